@@ -1,12 +1,16 @@
 #pragma once
 
 #include <boost/program_options.hpp>
+#include <boost/thread/mutex.hpp>
 #include <opencv2/opencv.hpp>
 
 #include "Argus/Argus.h"
 #include "EGLStream/EGLStream.h"
 
 #include "motordriver.hpp"
+#include "focus_curve.hpp"
+#include "focus_meter.hpp"
+#include "presets.hpp"
 #include "frame.hpp"
 
 namespace po = boost::program_options;
@@ -16,8 +20,20 @@ namespace BoulderAI
 
 struct ArgusReleaseData;
 
+// what the sensor and ISP did for the last frame, from its capture metadata
+struct ExposureStats
+{
+    bool valid;             // false until a frame with metadata arrived
+    float scene_lux;
+    float analog_gain;
+    float digital_gain;     // ISP
+    uint64_t exposure_ns;
+};
+
 // sample log handler using cout
 void cout_log_handler(std::string output);
+// log handler queueing to AsyncLog, so the capture and motor threads never wait on the console
+void async_log_handler(std::string output);
     
 class DNNCam
 {
@@ -91,7 +107,7 @@ public:
     static po::options_description GetOptions();
 
     // use the parameters set by boost program options
-    DNNCam(boost::function < void(std::string) > log_callback = cout_log_handler);
+    DNNCam(boost::function < void(std::string) > log_callback = async_log_handler);
 
     DNNCam(const uint32_t roi_x,
            const uint32_t roi_y,
@@ -99,7 +115,7 @@ public:
            const uint32_t roi_height = DEFAULT_ROI_H,
            const uint32_t output_width = DEFAULT_OUTPUT_W,  // NOTE: if the output resolution is different than the
            const uint32_t output_height = DEFAULT_OUTPUT_H, //       ROI resolution, Argus scales to the output res
-           boost::function < void(std::string) > log_callback = cout_log_handler,
+           boost::function < void(std::string) > log_callback = async_log_handler,
            const bool auto_exp_lock = DEFAULT_AUTO_EXP_LOCK,
            const double exp_time_min = DEFAULT_EXP_TIME_MIN,
            const double exp_time_max = DEFAULT_EXP_TIME_MAX,
@@ -136,6 +152,10 @@ public:
     FramePtr grab_y(); // Grabs just the 'Y' plane of a YUV image. This is equivalent to greyscale.
     FramePtr grab_u(); // Grabs just the 'U' plane of a YUV image. NOTE: this is half the size of the full frame
     FramePtr grab_v(); // Grabs just the 'V' plane of a YUV image. NOTE: this is half the size of the full frame
+    int get_yuv_fd(); // dmabuf fd of the YUV NvBuffer of the last grab, or -1. Valid as long as the grabbed RGB frame is alive.
+    uint64_t get_sensor_timestamp(); // Sensor timestamp of the last grab in ns (CLOCK_MONOTONIC domain), or 0 if unknown
+    uint64_t get_frame_number(); // libargus internal frame count of the last grab
+    ExposureStats get_exposure_stats(); // Safe to call from any thread
     
     void set_auto_exposure_lock(const bool enabled);
     bool get_auto_exposure_lock();
@@ -186,14 +206,54 @@ public:
     bool iris_absolute(const int pos);
     bool iris_home();
     int get_iris_location();
+    // false until the iris is homed; the location of an iris that is not homed means nothing
+    bool iris_homed();
+
+    // relative moves of all three axes at the same time
+    bool lens_move(const int zoom_steps, const int focus_steps, const int iris_steps);
 
     bool set_ir_cut(const bool enabled);
+
+    // while tracking, zoom moves take focus along the calibrated zoom->focus curve with them
+    void set_focus_tracking(const bool enabled);
+    bool get_focus_tracking();
+    std::vector < FocusCurve::Point > get_focus_curve();
+    // moves focus to the sharpest position within range steps of where it is
+    bool autofocus(const int range);
+    // finds the best focus at points zoom positions across the zoom travel and saves the curve;
+    // needs frames coming through grab()
+    bool calibrate_focus(const int points);
+
+    // named lens positions with optional exposure and gain, see PresetTable
+    std::vector < LensPreset > get_presets();
+    bool get_preset(const std::string &name, LensPreset &preset);
+    bool delete_preset(const std::string &name);
+    // fills in the current exposure and gain ranges, for a preset that keeps them
+    void get_preset_settings(LensPreset &preset);
+    // saves the preset with the current lens positions; run it as a lens job, so the
+    // positions are where the moves queued before it ended up
+    bool store_preset(LensPreset preset);
+    // applies the stored exposure and gain with a single request update
+    void apply_preset_settings(const LensPreset &preset);
+    // moves all three axes to the preset together, so it takes as long as the longest one
+    bool move_to_preset(const LensPreset &preset);
+
+    // stops the lens move in progress; safe to call from any thread
+    void cancel_lens_move();
+    // called before each move, so a cancel only affects the move it was meant for
+    void clear_lens_cancel();
     
     boost::function < void(std::string) > _log_callback;
 
 private:
     ArgusReleaseData *request_frame(bool &dropped_frame);
     bool check_bounds();
+    // the focus steps that go with a zoom move to zoom_target, false when not tracking
+    bool tracked_focus_steps(const int zoom_target, int &focus_steps);
+    bool tracked_zoom(const int zoom_steps, const int focus_steps);
+    bool measure_focus(double &sharpness);
+    // steps focus from from to to, then moves it to the sharpest position seen
+    bool focus_sweep(const int from, const int to, const int step, int &best);
 
     bool _initialized;
     cv::Mat cv_frame_rgb;
@@ -203,8 +263,17 @@ private:
     const uint32_t _sensor_width;
     const uint32_t _sensor_height;
     uint64_t _dropped_frames;
+    int _yuv_fd;
+    uint64_t _sensor_timestamp;
+    uint64_t _frame_number;
+    ExposureStats _exposure_stats;
+    boost::mutex _exposure_stats_mtex;
 
     MotorDriver _motor;
+    FocusCurve _focus_curve;
+    FocusMeter _focus_meter;
+    PresetTable _presets;
+    std::atomic < bool > _focus_tracking;
 
     Argus::UniqueObj<Argus::CameraProvider>    _camera_provider_object;
     Argus::UniqueObj<Argus::CaptureSession>    _capture_session_object;
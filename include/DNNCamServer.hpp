@@ -1,82 +1,175 @@
 #pragma once
 
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <set>
+#include <vector>
 #include <xmlrpc-c/base.hpp>
 #include <xmlrpc-c/registry.hpp>
 #include <xmlrpc-c/server_abyss.hpp>
+#include <boost/function.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "motordriver.hpp"
 #include "DNNCam.hpp"
 #include "configuration.hpp"
+#include "frame_processor.hpp"
+#include "lens_jobs.hpp"
+#include "exposure_controller.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
+#include "new_worker.hpp"
 
 namespace BoulderAI
 {
 
+typedef boost::function < void(void) > ChangeCallback;
+
+// calls the change callback of a DNNCamServer, from whichever thread made the change
+class ChangeNotifier
+{
+public:
+    void set_callback(const ChangeCallback &callback)
+    {
+        boost::mutex::scoped_lock lock(_mtex);
+        _callback = callback;
+    }
+
+    void notify()
+    {
+        ChangeCallback callback;
+        {
+            boost::mutex::scoped_lock lock(_mtex);
+            callback = _callback;
+        }
+        if (callback)
+        {
+            callback();
+        }
+    }
+
+protected:
+    boost::mutex _mtex;
+    ChangeCallback _callback;
+};
+
+/**
+ * Runs another method under the lock of the resource it uses, if any. Requests are served
+ * by several threads, but the camera methods were written for a single threaded server, so
+ * they serialize against each other; methods of other resources run alongside them.
+ *
+ * Methods that change something notify the change notifier once they are done.
+ */
+class SerializedMethod : public xmlrpc_c::method {
+public:
+    SerializedMethod(xmlrpc_c::methodPtr method, boost::mutex *resource, ChangeNotifier *notifier,
+                     MetricHistogram *latency) :
+        _method(method),
+        _resource(resource),
+        _notifier(notifier),
+        _latency(latency)
+    {
+        this->_signature = method->signature();
+        this->_help = method->help();
+    }
+
+    void execute(xmlrpc_c::paramList const &paramList, xmlrpc_c::value *const retvalP)
+    {
+        // includes the wait for the resource, which is what the caller sees
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (_resource)
+        {
+            boost::mutex::scoped_lock lock(*_resource);
+            _method->execute(paramList, retvalP);
+        }
+        else
+        {
+            _method->execute(paramList, retvalP);
+        }
+        struct timespec end;
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        _latency->observe_ns((end.tv_sec - start.tv_sec) * 1000000000LL + (end.tv_nsec - start.tv_nsec));
+
+        if (_notifier)
+        {
+            _notifier->notify();
+        }
+    }
+
+protected:
+    xmlrpc_c::methodPtr _method;
+    boost::mutex *_resource;
+    ChangeNotifier *_notifier;
+    MetricHistogram *_latency;
+};
+
 class FocusHome : public xmlrpc_c::method {
 public:
-    FocusHome(DNNCamPtr dnncam) : _dnncam(dnncam)
+    FocusHome(DNNCamPtr dnncam, LensJobsPtr jobs) : _dnncam(dnncam), _jobs(jobs)
     {
         this->_signature = "i:";
-        this->_help = "Sets the focus to the home location.";
+        this->_help = "Starts moving the focus to the home location. Returns the job id, see job_status.";
     }
 
     void execute(xmlrpc_c::paramList const &paramList, xmlrpc_c::value *const retvalP)
     {
-        int ret = 0;
         _dnncam->_log_callback("XMLRPC: FocusHome");
-        if (false == _dnncam->focus_home()) {
-            ret = -1;
-        }
-        *retvalP = xmlrpc_c::value_int(ret);
+        *retvalP = xmlrpc_c::value_int(_jobs->add("focus_home", boost::bind(&DNNCam::focus_home, _dnncam)));
     }
 
 protected:
     DNNCamPtr _dnncam;
+    LensJobsPtr _jobs;
 };
 
 class FocusAbsolute : public xmlrpc_c::method {
 public:
-    FocusAbsolute(DNNCamPtr dnncam) : _dnncam(dnncam)
+    FocusAbsolute(DNNCamPtr dnncam, LensJobsPtr jobs) : _dnncam(dnncam), _jobs(jobs)
     {
-        this->_signature = "i:i";
-        this->_help = "Sets focus to an absolute value.";
+        this->_signature = "i:i,i:ib";
+        this->_help = "Starts moving the focus to an absolute value. With preempt true, the running and queued lens jobs are cancelled first. Returns the job id, see job_status.";
     }
 
     void execute(xmlrpc_c::paramList const &paramList, xmlrpc_c::value *const retvalP)
     {
-        int ret = 0;
         const int value(paramList.getInt(0));
+        const bool preempt = paramList.size() > 1 && paramList.getBoolean(1);
         _dnncam->_log_callback("XMLRPC: FocusAbsolute");
-        if (false == _dnncam->focus_absolute(value)) {
-           ret = -1;
-        }
-        *retvalP = xmlrpc_c::value_int(ret);
+        std::ostringstream description;
+        description << "focus_absolute(" << value << ")";
+        *retvalP = xmlrpc_c::value_int(_jobs->add(description.str(), boost::bind(&DNNCam::focus_absolute, _dnncam, value), preempt));
     }
 
 protected:
     DNNCamPtr _dnncam;
+    LensJobsPtr _jobs;
 };
 
 class FocusRelative : public xmlrpc_c::method {
 public:
-    FocusRelative(DNNCamPtr dnncam) : _dnncam(dnncam)
+    FocusRelative(DNNCamPtr dnncam, LensJobsPtr jobs) : _dnncam(dnncam), _jobs(jobs)
     {
         this->_signature = "i:i";
-        this->_help = "Sets focus to a relative value.";
+        this->_help = "Starts moving the focus by a relative value. Joins a focus_relative move still queued right before it. Returns the job id, see job_status.";
     }
 
     void execute(xmlrpc_c::paramList const &paramList, xmlrpc_c::value *const retvalP)
     {
-        int ret = 0;
         const int value(paramList.getInt(0));
         _dnncam->_log_callback("XMLRPC: FocusRelative");
-        if (false == _dnncam->focus_relative(value)) {
-           ret = -1;
-        }
-        *retvalP = xmlrpc_c::value_int(ret);
+        *retvalP = xmlrpc_c::value_int(_jobs->add_relative("focus_relative", boost::bind(&DNNCam::focus_relative, _dnncam, _1), value));
     }
 
 protected:
     DNNCamPtr _dnncam;
+    LensJobsPtr _jobs;
 };
 
 class FocusGetLocation : public xmlrpc_c::method {
@@ -101,70 +194,64 @@ protected:
 
 class ZoomHome : public xmlrpc_c::method {
 public:
-    ZoomHome(DNNCamPtr dnncam) : _dnncam(dnncam)
+    ZoomHome(DNNCamPtr dnncam, LensJobsPtr jobs) : _dnncam(dnncam), _jobs(jobs)
     {
         this->_signature = "i:";
-        this->_help = "Sets the zoom to the home location.";
+        this->_help = "Starts moving the zoom to the home location. Returns the job id, see job_status.";
     }
 
     void execute(xmlrpc_c::paramList const &paramList, xmlrpc_c::value *const retvalP)
     {
-        int ret = 0;
         _dnncam->_log_callback("XMLRPC: ZoomHome");
-        if (false == _dnncam->zoom_home()) {
-            ret = -1;
-        }
-        *retvalP = xmlrpc_c::value_int(ret);
+        *retvalP = xmlrpc_c::value_int(_jobs->add("zoom_home", boost::bind(&DNNCam::zoom_home, _dnncam)));
     }
 
 protected:
     DNNCamPtr _dnncam;
+    LensJobsPtr _jobs;
 };
 
 class ZoomAbsolute : public xmlrpc_c::method {
 public:
-    ZoomAbsolute(DNNCamPtr dnncam) : _dnncam(dnncam)
+    ZoomAbsolute(DNNCamPtr dnncam, LensJobsPtr jobs) : _dnncam(dnncam), _jobs(jobs)
     {
-        this->_signature = "i:i";
-        this->_help = "Sets zoom to an absolute value.";
+        this->_signature = "i:i,i:ib";
+        this->_help = "Starts moving the zoom to an absolute value. With preempt true, the running and queued lens jobs are cancelled first. Returns the job id, see job_status.";
     }
 
     void execute(xmlrpc_c::paramList const &paramList, xmlrpc_c::value *const retvalP)
     {
-        int ret = 0;
         const int value(paramList.getInt(0));
+        const bool preempt = paramList.size() > 1 && paramList.getBoolean(1);
         _dnncam->_log_callback("XMLRPC: ZoomAbsolute");
-        if (false == _dnncam->zoom_absolute(value)) {
-           ret = -1;
-        }
-        *retvalP = xmlrpc_c::value_int(ret);
+        std::ostringstream description;
+        description << "zoom_absolute(" << value << ")";
+        *retvalP = xmlrpc_c::value_int(_jobs->add(description.str(), boost::bind(&DNNCam::zoom_absolute, _dnncam, value), preempt));
     }
 
 protected:
     DNNCamPtr _dnncam;
+    LensJobsPtr _jobs;
 };
 
 class ZoomRelative : public xmlrpc_c::method {
 public:
-    ZoomRelative(DNNCamPtr dnncam) : _dnncam(dnncam)
+    ZoomRelative(DNNCamPtr dnncam, LensJobsPtr jobs) : _dnncam(dnncam), _jobs(jobs)
     {
         this->_signature = "i:i";
-        this->_help = "Sets zoom to a relative value.";
+        this->_help = "Starts moving the zoom by a relative value. Joins a zoom_relative move still queued right before it. Returns the job id, see job_status.";
     }
 
     void execute(xmlrpc_c::paramList const &paramList, xmlrpc_c::value *const retvalP)
     {
-        int ret = 0;
         const int value(paramList.getInt(0));
         _dnncam->_log_callback("XMLRPC: ZoomRelative");
-        if (false == _dnncam->zoom_relative(value)) {
-           ret = -1;
-        }
-        *retvalP = xmlrpc_c::value_int(ret);
+        *retvalP = xmlrpc_c::value_int(_jobs->add_relative("zoom_relative", boost::bind(&DNNCam::zoom_relative, _dnncam, _1), value));
     }
 
 protected:
     DNNCamPtr _dnncam;
+    LensJobsPtr _jobs;
 };
 
 class ZoomGetLocation : public xmlrpc_c::method {
@@ -189,70 +276,64 @@ protected:
 
 class IrisHome : public xmlrpc_c::method {
 public:
-    IrisHome(DNNCamPtr dnncam) : _dnncam(dnncam)
+    IrisHome(DNNCamPtr dnncam, LensJobsPtr jobs) : _dnncam(dnncam), _jobs(jobs)
     {
         this->_signature = "i:";
-        this->_help = "Sets the iris to the home location.";
+        this->_help = "Starts moving the iris to the home location. Returns the job id, see job_status.";
     }
 
     void execute(xmlrpc_c::paramList const &paramList, xmlrpc_c::value *const retvalP)
     {
-        int ret = 0;
         _dnncam->_log_callback("XMLRPC: IrisHome");
-        if (false == _dnncam->iris_home()) {
-            ret = -1;
-        }
-        *retvalP = xmlrpc_c::value_int(ret);
+        *retvalP = xmlrpc_c::value_int(_jobs->add("iris_home", boost::bind(&DNNCam::iris_home, _dnncam)));
     }
 
 protected:
     DNNCamPtr _dnncam;
+    LensJobsPtr _jobs;
 };
 
 class IrisAbsolute : public xmlrpc_c::method {
 public:
-    IrisAbsolute(DNNCamPtr dnncam) : _dnncam(dnncam)
+    IrisAbsolute(DNNCamPtr dnncam, LensJobsPtr jobs) : _dnncam(dnncam), _jobs(jobs)
     {
-        this->_signature = "i:i";
-        this->_help = "Sets the iris to an absolute value.";
+        this->_signature = "i:i,i:ib";
+        this->_help = "Starts moving the iris to an absolute value. With preempt true, the running and queued lens jobs are cancelled first. Returns the job id, see job_status.";
     }
 
     void execute(xmlrpc_c::paramList const &paramList, xmlrpc_c::value *const retvalP)
     {
-        int ret = 0;
         const int value(paramList.getInt(0));
+        const bool preempt = paramList.size() > 1 && paramList.getBoolean(1);
         _dnncam->_log_callback("XMLRPC: IrisAbsolute");
-        if (false == _dnncam->iris_absolute(value)) {
-           ret = -1;
-        }
-        *retvalP = xmlrpc_c::value_int(ret);
+        std::ostringstream description;
+        description << "iris_absolute(" << value << ")";
+        *retvalP = xmlrpc_c::value_int(_jobs->add(description.str(), boost::bind(&DNNCam::iris_absolute, _dnncam, value), preempt));
     }
 
 protected:
     DNNCamPtr _dnncam;
+    LensJobsPtr _jobs;
 };
 
 class IrisRelative : public xmlrpc_c::method {
 public:
-    IrisRelative(DNNCamPtr dnncam) : _dnncam(dnncam)
+    IrisRelative(DNNCamPtr dnncam, LensJobsPtr jobs) : _dnncam(dnncam), _jobs(jobs)
     {
         this->_signature = "i:i";
-        this->_help = "Sets the iris to a relative value.";
+        this->_help = "Starts moving the iris by a relative value. Joins a iris_relative move still queued right before it. Returns the job id, see job_status.";
     }
 
     void execute(xmlrpc_c::paramList const &paramList, xmlrpc_c::value *const retvalP)
     {
-        int ret = 0;
         const int value(paramList.getInt(0));
         _dnncam->_log_callback("XMLRPC: IrisRelative");
-        if (false == _dnncam->iris_relative(value)) {
-           ret = -1;
-        }
-        *retvalP = xmlrpc_c::value_int(ret);
+        *retvalP = xmlrpc_c::value_int(_jobs->add_relative("iris_relative", boost::bind(&DNNCam::iris_relative, _dnncam, _1), value));
     }
 
 protected:
     DNNCamPtr _dnncam;
+    LensJobsPtr _jobs;
 };
 
 class IrisGetLocation : public xmlrpc_c::method {
@@ -275,25 +356,349 @@ protected:
     DNNCamPtr _dnncam;
 };
 
+class LensMove : public xmlrpc_c::method {
+public:
+    LensMove(DNNCamPtr dnncam, LensJobsPtr jobs) : _dnncam(dnncam), _jobs(jobs)
+    {
+        this->_signature = "i:iii";
+        this->_help = "Starts moving zoom, focus and iris by relative values at the same time. Returns the job id, see job_status.";
+    }
+
+    void execute(xmlrpc_c::paramList const &paramList, xmlrpc_c::value *const retvalP)
+    {
+        const int zoom(paramList.getInt(0));
+        const int focus(paramList.getInt(1));
+        const int iris(paramList.getInt(2));
+        _dnncam->_log_callback("XMLRPC: LensMove");
+        std::ostringstream description;
+        description << "lens_move(" << zoom << "," << focus << "," << iris << ")";
+        *retvalP = xmlrpc_c::value_int(_jobs->add(description.str(), boost::bind(&DNNCam::lens_move, _dnncam, zoom, focus, iris)));
+    }
+
+protected:
+    DNNCamPtr _dnncam;
+    LensJobsPtr _jobs;
+};
+
+class SetFocusTracking : public xmlrpc_c::method {
+public:
+    SetFocusTracking(DNNCamPtr dnncam) : _dnncam(dnncam)
+    {
+        this->_signature = "n:b";
+        this->_help = "Turns focus tracking on or off: while on, zoom moves take focus along the calibrated focus curve with them.";
+    }
+
+    void execute(xmlrpc_c::paramList const &paramList, xmlrpc_c::value *const retvalP)
+    {
+        const bool value(paramList.getBoolean(0));
+        _dnncam->_log_callback("XMLRPC: SetFocusTracking");
+        _dnncam->set_focus_tracking(value);
+        *retvalP = xmlrpc_c::value_nil();
+    }
+
+protected:
+    DNNCamPtr _dnncam;
+};
+
+class GetFocusTracking : public xmlrpc_c::method {
+public:
+    GetFocusTracking(DNNCamPtr dnncam) : _dnncam(dnncam)
+    {
+        this->_signature = "b:";
+        this->_help = "Gets whether focus follows zoom.";
+    }
+
+    void execute(xmlrpc_c::paramList const &paramList, xmlrpc_c::value *const retvalP)
+    {
+        *retvalP = xmlrpc_c::value_boolean(_dnncam->get_focus_tracking());
+    }
+
+protected:
+    DNNCamPtr _dnncam;
+};
+
+class GetFocusCurve : public xmlrpc_c::method {
+public:
+    GetFocusCurve(DNNCamPtr dnncam) : _dnncam(dnncam)
+    {
+        this->_signature = "A:";
+        this->_help = "Gets the calibrated focus curve, as zoom and focus positions.";
+    }
+
+    void execute(xmlrpc_c::paramList const &paramList, xmlrpc_c::value *const retvalP)
+    {
+        const std::vector < FocusCurve::Point > points = _dnncam->get_focus_curve();
+        std::vector < xmlrpc_c::value > ret_array;
+        for (size_t i = 0; i < points.size(); i++)
+        {
+            std::map < std::string, xmlrpc_c::value > point;
+            point["zoom"] = xmlrpc_c::value_int(points[i].zoom);
+            point["focus"] = xmlrpc_c::value_int(points[i].focus);
+            ret_array.push_back(xmlrpc_c::value_struct(point));
+        }
+        *retvalP = xmlrpc_c::value_array(ret_array);
+    }
+
+protected:
+    DNNCamPtr _dnncam;
+};
+
+class Autofocus : public xmlrpc_c::method {
+public:
+    Autofocus(DNNCamPtr dnncam, LensJobsPtr jobs) : _dnncam(dnncam), _jobs(jobs)
+    {
+        this->_signature = "i:,i:i";
+        this->_help = "Starts moving the focus to the sharpest position within the given number of steps (autofocus_range by default). Returns the job id, see job_status.";
+    }
+
+    void execute(xmlrpc_c::paramList const &paramList, xmlrpc_c::value *const retvalP)
+    {
+        const int range = paramList.size() > 0 ? paramList.getInt(0) : Configuration::autofocus_range();
+        _dnncam->_log_callback("XMLRPC: Autofocus");
+        std::ostringstream description;
+        description << "autofocus(" << range << ")";
+        *retvalP = xmlrpc_c::value_int(_jobs->add(description.str(), boost::bind(&DNNCam::autofocus, _dnncam, range)));
+    }
+
+protected:
+    DNNCamPtr _dnncam;
+    LensJobsPtr _jobs;
+};
+
+class FocusCalibrate : public xmlrpc_c::method {
+public:
+    FocusCalibrate(DNNCamPtr dnncam, LensJobsPtr jobs) : _dnncam(dnncam), _jobs(jobs)
+    {
+        this->_signature = "i:i";
+        this->_help = "Starts calibrating the focus curve: finds the best focus at the given number of zoom positions and saves the curve. Takes minutes; returns the job id, see job_status.";
+    }
+
+    void execute(xmlrpc_c::paramList const &paramList, xmlrpc_c::value *const retvalP)
+    {
+        const int points(paramList.getInt(0));
+        _dnncam->_log_callback("XMLRPC: FocusCalibrate");
+        std::ostringstream description;
+        description << "focus_calibrate(" << points << ")";
+        *retvalP = xmlrpc_c::value_int(_jobs->add(description.str(), boost::bind(&DNNCam::calibrate_focus, _dnncam, points)));
+    }
+
+protected:
+    DNNCamPtr _dnncam;
+    LensJobsPtr _jobs;
+};
+
 class IRCut : public xmlrpc_c::method {
 public:
-    IRCut(DNNCamPtr dnncam) : _dnncam(dnncam)
+    IRCut(DNNCamPtr dnncam, LensJobsPtr jobs) : _dnncam(dnncam), _jobs(jobs)
     {
         this->_signature = "i:b";
-        this->_help = "Sets the IR cut filter.";
+        this->_help = "Sets the IR cut filter, after any lens moves already queued. Returns the job id, see job_status.";
     }
 
     void execute(xmlrpc_c::paramList const &paramList, xmlrpc_c::value *const retvalP)
     {
-        int ret = 0;
         const bool value(paramList.getBoolean(0));
         _dnncam->_log_callback("XMLRPC: IRCut");
-        ret = _dnncam->set_ir_cut(value);
-        *retvalP = xmlrpc_c::value_int(ret);
+        *retvalP = xmlrpc_c::value_int(_jobs->add(value ? "ir_cut(true)" : "ir_cut(false)",
+                                                  boost::bind(&DNNCam::set_ir_cut, _dnncam, value)));
+    }
+
+protected:
+    DNNCamPtr _dnncam;
+    LensJobsPtr _jobs;
+};
+
+class StorePreset : public xmlrpc_c::method {
+public:
+    StorePreset(DNNCamPtr dnncam, LensJobsPtr jobs) : _dnncam(dnncam), _jobs(jobs)
+    {
+        this->_signature = "i:s,i:sb";
+        this->_help = "Stores the lens positions, once the moves already queued are done, as the named preset; with true also the current exposure and gain. Returns the job id, see job_status.";
+    }
+
+    void execute(xmlrpc_c::paramList const &paramList, xmlrpc_c::value *const retvalP)
+    {
+        LensPreset preset = LensPreset();
+        preset.name = paramList.getString(0);
+        const bool settings = paramList.size() > 1 && paramList.getBoolean(1);
+        if (!PresetTable::valid_name(preset.name))
+        {
+            throw xmlrpc_c::fault("Preset names are a single word");
+        }
+        _dnncam->_log_callback("XMLRPC: StorePreset");
+        if (settings)
+        {
+            _dnncam->get_preset_settings(preset);
+        }
+        *retvalP = xmlrpc_c::value_int(_jobs->add("store_preset(" + preset.name + ")",
+                                                  boost::bind(&DNNCam::store_preset, _dnncam, preset)));
+    }
+
+protected:
+    DNNCamPtr _dnncam;
+    LensJobsPtr _jobs;
+};
+
+class RecallPreset : public xmlrpc_c::method {
+public:
+    RecallPreset(DNNCamPtr dnncam, LensJobsPtr jobs) : _dnncam(dnncam), _jobs(jobs)
+    {
+        this->_signature = "i:s";
+        this->_help = "Moves zoom, focus and iris to the named preset together, replacing any lens moves running or queued, and applies its exposure and gain right away. Returns the job id, see job_status.";
+    }
+
+    void execute(xmlrpc_c::paramList const &paramList, xmlrpc_c::value *const retvalP)
+    {
+        const std::string name(paramList.getString(0));
+        LensPreset preset;
+        if (!_dnncam->get_preset(name, preset))
+        {
+            throw xmlrpc_c::fault("Unknown preset");
+        }
+        _dnncam->_log_callback("XMLRPC: RecallPreset");
+        _dnncam->apply_preset_settings(preset);
+        *retvalP = xmlrpc_c::value_int(_jobs->add("recall_preset(" + name + ")",
+                                                  boost::bind(&DNNCam::move_to_preset, _dnncam, preset), true));
     }
 
 protected:
     DNNCamPtr _dnncam;
+    LensJobsPtr _jobs;
+};
+
+class DeletePreset : public xmlrpc_c::method {
+public:
+    DeletePreset(DNNCamPtr dnncam) : _dnncam(dnncam)
+    {
+        this->_signature = "b:s";
+        this->_help = "Deletes the named preset, false if there is none.";
+    }
+
+    void execute(xmlrpc_c::paramList const &paramList, xmlrpc_c::value *const retvalP)
+    {
+        const std::string name(paramList.getString(0));
+        _dnncam->_log_callback("XMLRPC: DeletePreset");
+        *retvalP = xmlrpc_c::value_boolean(_dnncam->delete_preset(name));
+    }
+
+protected:
+    DNNCamPtr _dnncam;
+};
+
+class GetPresets : public xmlrpc_c::method {
+public:
+    GetPresets(DNNCamPtr dnncam) : _dnncam(dnncam)
+    {
+        this->_signature = "A:";
+        this->_help = "Gets the presets: name, zoom, focus, iris, and exposure_min/max (ns) and gain_min/max when stored.";
+    }
+
+    void execute(xmlrpc_c::paramList const &paramList, xmlrpc_c::value *const retvalP)
+    {
+        const std::vector < LensPreset > presets = _dnncam->get_presets();
+        std::vector < xmlrpc_c::value > ret_array;
+        for (size_t i = 0; i < presets.size(); i++)
+        {
+            std::map < std::string, xmlrpc_c::value > preset;
+            preset["name"] = xmlrpc_c::value_string(presets[i].name);
+            preset["zoom"] = xmlrpc_c::value_int(presets[i].zoom);
+            preset["focus"] = xmlrpc_c::value_int(presets[i].focus);
+            preset["iris"] = xmlrpc_c::value_int(presets[i].iris);
+            if (presets[i].has_exposure)
+            {
+                preset["exposure_min"] = xmlrpc_c::value_i8(presets[i].exposure_min);
+                preset["exposure_max"] = xmlrpc_c::value_i8(presets[i].exposure_max);
+            }
+            if (presets[i].has_gain)
+            {
+                preset["gain_min"] = xmlrpc_c::value_double(presets[i].gain_min);
+                preset["gain_max"] = xmlrpc_c::value_double(presets[i].gain_max);
+            }
+            ret_array.push_back(xmlrpc_c::value_struct(preset));
+        }
+        *retvalP = xmlrpc_c::value_array(ret_array);
+    }
+
+protected:
+    DNNCamPtr _dnncam;
+};
+
+class JobStatus : public xmlrpc_c::method {
+public:
+    JobStatus(LensJobsPtr jobs) : _jobs(jobs)
+    {
+        this->_signature = "S:i";
+        this->_help = "Returns the state of a lens job: id, description, state (queued, running, done, failed or cancelled), queued_unix_ms, duration_ms.";
+    }
+
+    void execute(xmlrpc_c::paramList const &paramList, xmlrpc_c::value *const retvalP)
+    {
+        const int id(paramList.getInt(0));
+        LensJobStatus status;
+        if (!_jobs->get_status(id, status))
+        {
+            throw xmlrpc_c::fault("Unknown job id");
+        }
+        std::map < std::string, xmlrpc_c::value > ret;
+        ret["id"] = xmlrpc_c::value_int(status.id);
+        ret["description"] = xmlrpc_c::value_string(status.description);
+        ret["state"] = xmlrpc_c::value_string(status.state);
+        ret["queued_unix_ms"] = xmlrpc_c::value_i8(status.queued_unix_ms);
+        ret["duration_ms"] = xmlrpc_c::value_i8(status.duration_ms);
+        *retvalP = xmlrpc_c::value_struct(ret);
+    }
+
+protected:
+    LensJobsPtr _jobs;
+};
+
+class JobCancel : public xmlrpc_c::method {
+public:
+    JobCancel(LensJobsPtr jobs) : _jobs(jobs)
+    {
+        this->_signature = "b:i";
+        this->_help = "Cancels a queued or running lens job. Returns false if it had already finished.";
+    }
+
+    void execute(xmlrpc_c::paramList const &paramList, xmlrpc_c::value *const retvalP)
+    {
+        const int id(paramList.getInt(0));
+        *retvalP = xmlrpc_c::value_boolean(_jobs->cancel(id));
+    }
+
+protected:
+    LensJobsPtr _jobs;
+};
+
+class SetTrace : public xmlrpc_c::method {
+public:
+    SetTrace()
+    {
+        this->_signature = "n:b";
+        this->_help = "Starts or stops recording per frame timing spans for get_trace.";
+    }
+
+    void execute(xmlrpc_c::paramList const &paramList, xmlrpc_c::value *const retvalP)
+    {
+        const bool value(paramList.getBoolean(0));
+        Trace::set_enabled(value);
+        *retvalP = xmlrpc_c::value_nil();
+    }
+};
+
+class GetTrace : public xmlrpc_c::method {
+public:
+    GetTrace()
+    {
+        this->_signature = "s:d";
+        this->_help = "Returns the spans of the last given seconds as Chrome trace_event JSON, for chrome://tracing or Perfetto.";
+    }
+
+    void execute(xmlrpc_c::paramList const &paramList, xmlrpc_c::value *const retvalP)
+    {
+        const double seconds(paramList.getDouble(0));
+        *retvalP = xmlrpc_c::value_string(Trace::get_chrome_json(seconds));
+    }
 };
 
 class SetAutoExposure : public xmlrpc_c::method {
@@ -830,141 +1235,546 @@ protected:
     DNNCamPtr _dnncam;
 };
     
+class SetAutoIris : public xmlrpc_c::method {
+public:
+    SetAutoIris(ExposureControllerPtr controller) : _controller(controller)
+    {
+        this->_signature = "n:b";
+        this->_help = "Turns the automatic iris on or off.";
+    }
+
+    void execute(xmlrpc_c::paramList const &paramList, xmlrpc_c::value *const retvalP)
+    {
+        const bool value(paramList.getBoolean(0));
+        _controller->set_auto_iris(value);
+        *retvalP = xmlrpc_c::value_nil();
+    }
+
+protected:
+    ExposureControllerPtr _controller;
+};
+
+class SetAutoIRCut : public xmlrpc_c::method {
+public:
+    SetAutoIRCut(ExposureControllerPtr controller) : _controller(controller)
+    {
+        this->_signature = "n:b";
+        this->_help = "Turns the automatic day/night switching of the IR cut filter on or off.";
+    }
+
+    void execute(xmlrpc_c::paramList const &paramList, xmlrpc_c::value *const retvalP)
+    {
+        const bool value(paramList.getBoolean(0));
+        _controller->set_auto_ir_cut(value);
+        *retvalP = xmlrpc_c::value_nil();
+    }
+
+protected:
+    ExposureControllerPtr _controller;
+};
+
+class GetAutoIrisStatus : public xmlrpc_c::method {
+public:
+    GetAutoIrisStatus(ExposureControllerPtr controller) : _controller(controller)
+    {
+        this->_signature = "S:";
+        this->_help = "Gets auto_iris, auto_ir_cut, night, scene_lux, gain, exposure_ms and iris.";
+    }
+
+    void execute(xmlrpc_c::paramList const &paramList, xmlrpc_c::value *const retvalP)
+    {
+        const ExposureControlStatus status = _controller->get_status();
+        std::map < std::string, xmlrpc_c::value > ret;
+        ret["auto_iris"] = xmlrpc_c::value_boolean(status.auto_iris);
+        ret["auto_ir_cut"] = xmlrpc_c::value_boolean(status.auto_ir_cut);
+        ret["night"] = xmlrpc_c::value_boolean(status.night);
+        ret["scene_lux"] = xmlrpc_c::value_double(status.scene_lux);
+        ret["gain"] = xmlrpc_c::value_double(status.gain);
+        ret["exposure_ms"] = xmlrpc_c::value_double(status.exposure_ms);
+        ret["iris"] = xmlrpc_c::value_int(status.iris);
+        *retvalP = xmlrpc_c::value_struct(ret);
+    }
+
+protected:
+    ExposureControllerPtr _controller;
+};
+
+class GetStreamStats : public xmlrpc_c::method {
+public:
+    GetStreamStats(FrameProcessorPtr frame_proc) : _frame_proc(frame_proc)
+    {
+        this->_signature = "A:";
+        this->_help = "Gets the queue depth and drop counters of every connected RTSP client.";
+    }
+
+    void execute(xmlrpc_c::paramList const &paramList, xmlrpc_c::value *const retvalP)
+    {
+        const std::vector < StreamClientStats > stats = _frame_proc->get_stream_client_stats();
+        std::vector < xmlrpc_c::value > ret_array;
+        for (size_t i = 0; i < stats.size(); i++)
+        {
+            std::map < std::string, xmlrpc_c::value > client;
+            client["mount"] = xmlrpc_c::value_string(stats[i].mount);
+            client["id"] = xmlrpc_c::value_int(stats[i].id);
+            client["queue_depth"] = xmlrpc_c::value_int(stats[i].queue_depth);
+            client["queue_bytes"] = xmlrpc_c::value_i8(stats[i].queue_bytes);
+            client["pushed_frames"] = xmlrpc_c::value_i8(stats[i].pushed_frames);
+            client["pushed_bytes"] = xmlrpc_c::value_i8(stats[i].pushed_bytes);
+            client["dropped_frames"] = xmlrpc_c::value_i8(stats[i].dropped_frames);
+            client["need_data"] = xmlrpc_c::value_boolean(stats[i].need_data);
+            ret_array.push_back(xmlrpc_c::value_struct(client));
+        }
+        *retvalP = xmlrpc_c::value_array(ret_array);
+    }
+
+protected:
+    FrameProcessorPtr _frame_proc;
+};
+
+class GetStreamClock : public xmlrpc_c::method {
+public:
+    GetStreamClock(FrameProcessorPtr frame_proc) : _frame_proc(frame_proc)
+    {
+        this->_signature = "S:";
+        this->_help = "Gets the sensor timestamp, pipeline clock time and wall clock time (ns) of the last streamed frame.";
+    }
+
+    void execute(xmlrpc_c::paramList const &paramList, xmlrpc_c::value *const retvalP)
+    {
+        const StreamClockInfo info = _frame_proc->get_stream_clock_info();
+        std::map < std::string, xmlrpc_c::value > ret;
+        ret["frame_number"] = xmlrpc_c::value_i8(info.frame_number);
+        ret["sensor_timestamp"] = xmlrpc_c::value_i8(info.sensor_timestamp);
+        ret["clock_time"] = xmlrpc_c::value_i8(info.clock_time);
+        ret["unix_time"] = xmlrpc_c::value_i8(info.unix_time);
+        *retvalP = xmlrpc_c::value_struct(ret);
+    }
+
+protected:
+    FrameProcessorPtr _frame_proc;
+};
+
+class RecordStart : public xmlrpc_c::method {
+public:
+    RecordStart(FrameProcessorPtr frame_proc) : _frame_proc(frame_proc)
+    {
+        this->_signature = "n:";
+        this->_help = "Starts recording an event, beginning with the prebuffered frames.";
+    }
+
+    void execute(xmlrpc_c::paramList const &paramList, xmlrpc_c::value *const retvalP)
+    {
+        _frame_proc->start_event();
+        *retvalP = xmlrpc_c::value_nil();
+    }
+
+protected:
+    FrameProcessorPtr _frame_proc;
+};
+
+class RecordStop : public xmlrpc_c::method {
+public:
+    RecordStop(FrameProcessorPtr frame_proc) : _frame_proc(frame_proc)
+    {
+        this->_signature = "n:";
+        this->_help = "Ends the recorded event after the post-roll frames.";
+    }
+
+    void execute(xmlrpc_c::paramList const &paramList, xmlrpc_c::value *const retvalP)
+    {
+        _frame_proc->stop_event();
+        *retvalP = xmlrpc_c::value_nil();
+    }
+
+protected:
+    FrameProcessorPtr _frame_proc;
+};
+
+class GetRecordStatus : public xmlrpc_c::method {
+public:
+    GetRecordStatus(FrameProcessorPtr frame_proc) : _frame_proc(frame_proc)
+    {
+        this->_signature = "S:";
+        this->_help = "Gets the recording state, segment and byte counters.";
+    }
+
+    void execute(xmlrpc_c::paramList const &paramList, xmlrpc_c::value *const retvalP)
+    {
+        const RecorderStats stats = _frame_proc->get_recorder_stats();
+        std::map < std::string, xmlrpc_c::value > ret;
+        ret["recording"] = xmlrpc_c::value_boolean(stats.recording);
+        ret["event_id"] = xmlrpc_c::value_i8(stats.event_id);
+        ret["segment"] = xmlrpc_c::value_string(stats.segment);
+        ret["segments"] = xmlrpc_c::value_i8(stats.segments);
+        ret["frames"] = xmlrpc_c::value_i8(stats.frames);
+        ret["dropped_frames"] = xmlrpc_c::value_i8(stats.dropped_frames);
+        ret["written_bytes"] = xmlrpc_c::value_i8(stats.written_bytes);
+        ret["dropped_bytes"] = xmlrpc_c::value_i8(stats.dropped_bytes);
+        ret["io_queue_bytes"] = xmlrpc_c::value_i8(stats.io_queue_bytes);
+        *retvalP = xmlrpc_c::value_struct(ret);
+    }
+
+protected:
+    FrameProcessorPtr _frame_proc;
+};
+
+class GetRecordedEvents : public xmlrpc_c::method {
+public:
+    GetRecordedEvents(FrameProcessorPtr frame_proc) : _frame_proc(frame_proc)
+    {
+        this->_signature = "A:";
+        this->_help = "Gets every recorded event still on disk: id, start and end (unix ms), size, segments and protection.";
+    }
+
+    void execute(xmlrpc_c::paramList const &paramList, xmlrpc_c::value *const retvalP)
+    {
+        const std::vector < RecordedEvent > events = _frame_proc->get_retention()->get_events();
+        std::vector < xmlrpc_c::value > ret_array;
+        for (size_t i = 0; i < events.size(); i++)
+        {
+            std::map < std::string, xmlrpc_c::value > event;
+            event["event_id"] = xmlrpc_c::value_i8(events[i].event_id);
+            event["start_unix_ms"] = xmlrpc_c::value_i8(events[i].start_unix_ms);
+            event["end_unix_ms"] = xmlrpc_c::value_i8(events[i].end_unix_ms);
+            event["bytes"] = xmlrpc_c::value_i8(events[i].bytes);
+            event["segments"] = xmlrpc_c::value_int(events[i].segments);
+            event["protected"] = xmlrpc_c::value_boolean(events[i].is_protected);
+            ret_array.push_back(xmlrpc_c::value_struct(event));
+        }
+        *retvalP = xmlrpc_c::value_array(ret_array);
+    }
+
+protected:
+    FrameProcessorPtr _frame_proc;
+};
+
+class RecordProtect : public xmlrpc_c::method {
+public:
+    RecordProtect(FrameProcessorPtr frame_proc) : _frame_proc(frame_proc)
+    {
+        this->_signature = "b:i8b";
+        this->_help = "Protects a recorded event from deletion by the retention limits, or releases it. False for an unknown event.";
+    }
+
+    void execute(xmlrpc_c::paramList const &paramList, xmlrpc_c::value *const retvalP)
+    {
+        const uint64_t event_id = paramList.getI8(0);
+        const bool is_protected = paramList.getBoolean(1);
+        *retvalP = xmlrpc_c::value_boolean(_frame_proc->get_retention()->set_protected(event_id, is_protected));
+    }
+
+protected:
+    FrameProcessorPtr _frame_proc;
+};
+
+class SetCaptureMode : public xmlrpc_c::method {
+public:
+    SetCaptureMode(FrameProcessorPtr frame_proc) : _frame_proc(frame_proc)
+    {
+        this->_signature = "n:s";
+        this->_help = "Sets the capture mode: on, off, or auto to record motion events.";
+    }
+
+    void execute(xmlrpc_c::paramList const &paramList, xmlrpc_c::value *const retvalP)
+    {
+        const std::string mode = paramList.getString(0);
+        if (!_frame_proc->set_capture_mode(mode))
+        {
+            throw xmlrpc_c::fault("Invalid capture mode, must be on, off or auto");
+        }
+        *retvalP = xmlrpc_c::value_nil();
+    }
+
+protected:
+    FrameProcessorPtr _frame_proc;
+};
+
+class GetCaptureState : public xmlrpc_c::method {
+public:
+    GetCaptureState(FrameProcessorPtr frame_proc) : _frame_proc(frame_proc)
+    {
+        this->_signature = "S:";
+        this->_help = "Gets the capture state (auto, off, auto_off, on, auto_on), the moving blocks of the last frame and the motion event count.";
+    }
+
+    void execute(xmlrpc_c::paramList const &paramList, xmlrpc_c::value *const retvalP)
+    {
+        const CaptureStatus status = _frame_proc->get_capture_status();
+        std::map < std::string, xmlrpc_c::value > ret;
+        ret["state"] = xmlrpc_c::value_string(FrameProcessor::capture_state_name(status.state));
+        ret["moving_blocks"] = xmlrpc_c::value_int(status.moving_blocks);
+        ret["blocks"] = xmlrpc_c::value_int(status.blocks);
+        ret["motion_events"] = xmlrpc_c::value_i8(status.motion_events);
+        *retvalP = xmlrpc_c::value_struct(ret);
+    }
+
+protected:
+    FrameProcessorPtr _frame_proc;
+};
+
+class GetRetentionStatus : public xmlrpc_c::method {
+public:
+    GetRetentionStatus(FrameProcessorPtr frame_proc) : _frame_proc(frame_proc)
+    {
+        this->_signature = "S:";
+        this->_help = "Gets the recording space used, the quota and the eviction counters.";
+    }
+
+    void execute(xmlrpc_c::paramList const &paramList, xmlrpc_c::value *const retvalP)
+    {
+        const RetentionStats stats = _frame_proc->get_retention()->get_stats();
+        std::map < std::string, xmlrpc_c::value > ret;
+        ret["segments"] = xmlrpc_c::value_i8(stats.segments);
+        ret["events"] = xmlrpc_c::value_i8(stats.events);
+        ret["bytes"] = xmlrpc_c::value_i8(stats.bytes);
+        ret["quota_bytes"] = xmlrpc_c::value_i8(stats.quota_bytes);
+        ret["oldest_unix_ms"] = xmlrpc_c::value_i8(stats.oldest_unix_ms);
+        ret["evicted_segments"] = xmlrpc_c::value_i8(stats.evicted_segments);
+        ret["evicted_bytes"] = xmlrpc_c::value_i8(stats.evicted_bytes);
+        *retvalP = xmlrpc_c::value_struct(ret);
+    }
+
+protected:
+    FrameProcessorPtr _frame_proc;
+};
+
 class DNNCamServer
 {
 public:
+    static const int XMLRPC_PORT = 7000;
+    // requests served at the same time; lens moves run as jobs and never hold a thread for long
+    static const int XMLRPC_THREADS = 4;
+    // connections beyond this are closed right away
+    static const size_t MAX_CONNECTIONS = 32;
+
     /**
      * @param md Smart pointer to the motordriver.
      */
     DNNCamServer(DNNCamPtr dnncam) :
+        _lens_jobs(new LensJobs(dnncam)),
+        _pool(XMLRPC_THREADS, "XMLRPC Worker"),
+        _listen_fd(-1),
         _done(false)
     {
-        // lens methods
-        xmlrpc_c::methodPtr const focusHome(new FocusHome(dnncam));
-        _registry.addMethod("focus_home", focusHome);
+        _lens_jobs->set_done_callback(boost::bind(&ChangeNotifier::notify, &_notifier));
+        _lens_jobs->start();
+
+        // lens methods; the moves are queued as lens jobs, which run one at a time
+        xmlrpc_c::methodPtr const focusHome(new FocusHome(dnncam, _lens_jobs));
+        add_method("focus_home", focusHome);
 
-        xmlrpc_c::methodPtr const focusAbsolute(new FocusAbsolute(dnncam));
-        _registry.addMethod("focus_absolute", focusAbsolute);
+        xmlrpc_c::methodPtr const focusAbsolute(new FocusAbsolute(dnncam, _lens_jobs));
+        add_method("focus_absolute", focusAbsolute);
 
-        xmlrpc_c::methodPtr const focusRelative(new FocusRelative(dnncam));
-        _registry.addMethod("focus_relative", focusRelative);
+        xmlrpc_c::methodPtr const focusRelative(new FocusRelative(dnncam, _lens_jobs));
+        add_method("focus_relative", focusRelative);
 
         xmlrpc_c::methodPtr const focusGetLocation(new FocusGetLocation(dnncam));
-        _registry.addMethod("focus_get_location", focusGetLocation);
+        add_method("focus_get_location", focusGetLocation);
 
-        xmlrpc_c::methodPtr const zoomHome(new ZoomHome(dnncam));
-        _registry.addMethod("zoom_home", zoomHome);
+        xmlrpc_c::methodPtr const zoomHome(new ZoomHome(dnncam, _lens_jobs));
+        add_method("zoom_home", zoomHome);
 
-        xmlrpc_c::methodPtr const zoomAbsolute(new ZoomAbsolute(dnncam));
-        _registry.addMethod("zoom_absolute", zoomAbsolute);
+        xmlrpc_c::methodPtr const zoomAbsolute(new ZoomAbsolute(dnncam, _lens_jobs));
+        add_method("zoom_absolute", zoomAbsolute);
 
-        xmlrpc_c::methodPtr const zoomRelative(new ZoomRelative(dnncam));
-        _registry.addMethod("zoom_relative", zoomRelative);
+        xmlrpc_c::methodPtr const zoomRelative(new ZoomRelative(dnncam, _lens_jobs));
+        add_method("zoom_relative", zoomRelative);
 
         xmlrpc_c::methodPtr const zoomGetLocation(new ZoomGetLocation(dnncam));
-        _registry.addMethod("zoom_get_location", zoomGetLocation);
+        add_method("zoom_get_location", zoomGetLocation);
 
-        xmlrpc_c::methodPtr const irisHome(new IrisHome(dnncam));
-        _registry.addMethod("iris_home", irisHome);
+        xmlrpc_c::methodPtr const irisHome(new IrisHome(dnncam, _lens_jobs));
+        add_method("iris_home", irisHome);
 
-        xmlrpc_c::methodPtr const irisAbsolute(new IrisAbsolute(dnncam));
-        _registry.addMethod("iris_absolute", irisAbsolute);
+        xmlrpc_c::methodPtr const irisAbsolute(new IrisAbsolute(dnncam, _lens_jobs));
+        add_method("iris_absolute", irisAbsolute);
 
-        xmlrpc_c::methodPtr const irisRelative(new IrisRelative(dnncam));
-        _registry.addMethod("iris_relative", irisRelative);
+        xmlrpc_c::methodPtr const irisRelative(new IrisRelative(dnncam, _lens_jobs));
+        add_method("iris_relative", irisRelative);
 
         xmlrpc_c::methodPtr const irisGetLocation(new IrisGetLocation(dnncam));
-        _registry.addMethod("iris_get_location", irisGetLocation);
+        add_method("iris_get_location", irisGetLocation);
+
+        xmlrpc_c::methodPtr const lensMove(new LensMove(dnncam, _lens_jobs));
+        add_method("lens_move", lensMove);
+
+        xmlrpc_c::methodPtr const setFocusTracking(new SetFocusTracking(dnncam));
+        add_method("set_focus_tracking", setFocusTracking);
+
+        xmlrpc_c::methodPtr const getFocusTracking(new GetFocusTracking(dnncam));
+        add_method("get_focus_tracking", getFocusTracking);
 
-        xmlrpc_c::methodPtr const irCut(new IRCut(dnncam));
-        _registry.addMethod("ir_cut", irCut);
+        xmlrpc_c::methodPtr const getFocusCurve(new GetFocusCurve(dnncam));
+        add_method("get_focus_curve", getFocusCurve);
 
-        // camera methods
+        xmlrpc_c::methodPtr const autofocus(new Autofocus(dnncam, _lens_jobs));
+        add_method("autofocus", autofocus);
+
+        xmlrpc_c::methodPtr const focusCalibrate(new FocusCalibrate(dnncam, _lens_jobs));
+        add_method("focus_calibrate", focusCalibrate);
+
+        xmlrpc_c::methodPtr const irCut(new IRCut(dnncam, _lens_jobs));
+        add_method("ir_cut", irCut);
+
+        // presets read and apply camera settings, so they take the camera lock as well
+        xmlrpc_c::methodPtr const storePreset(new StorePreset(dnncam, _lens_jobs));
+        add_method("store_preset", storePreset, &_camera_mtex);
+
+        xmlrpc_c::methodPtr const recallPreset(new RecallPreset(dnncam, _lens_jobs));
+        add_method("recall_preset", recallPreset, &_camera_mtex);
+
+        xmlrpc_c::methodPtr const deletePreset(new DeletePreset(dnncam));
+        add_method("delete_preset", deletePreset);
+
+        xmlrpc_c::methodPtr const getPresets(new GetPresets(dnncam));
+        add_method("get_presets", getPresets);
+
+        xmlrpc_c::methodPtr const jobStatus(new JobStatus(_lens_jobs));
+        add_method("job_status", jobStatus);
+
+        xmlrpc_c::methodPtr const jobCancel(new JobCancel(_lens_jobs));
+        add_method("job_cancel", jobCancel);
+
+        xmlrpc_c::methodPtr const setTrace(new SetTrace());
+        add_method("set_trace", setTrace);
+
+        xmlrpc_c::methodPtr const getTrace(new GetTrace());
+        add_method("get_trace", getTrace);
+
+        // camera methods, serialized on the camera
         xmlrpc_c::methodPtr const setAutoExposure(new SetAutoExposure(dnncam));
-        _registry.addMethod("set_auto_exposure", setAutoExposure);
+        add_method("set_auto_exposure", setAutoExposure, &_camera_mtex);
         
         xmlrpc_c::methodPtr const getAutoExposure(new GetAutoExposure(dnncam));
-        _registry.addMethod("get_auto_exposure", getAutoExposure);
+        add_method("get_auto_exposure", getAutoExposure, &_camera_mtex);
         
         xmlrpc_c::methodPtr const getExposureTime(new GetExposureTime(dnncam));
-        _registry.addMethod("get_exposure_time", getExposureTime);
+        add_method("get_exposure_time", getExposureTime, &_camera_mtex);
         
         xmlrpc_c::methodPtr const setExposureTime(new SetExposureTime(dnncam));
-        _registry.addMethod("set_exposure_time", setExposureTime);
+        add_method("set_exposure_time", setExposureTime, &_camera_mtex);
         
         xmlrpc_c::methodPtr const setExposureCompensation(new SetExposureCompensation(dnncam));
-        _registry.addMethod("set_exposure_compensation", setExposureCompensation);
+        add_method("set_exposure_compensation", setExposureCompensation, &_camera_mtex);
         
         xmlrpc_c::methodPtr const getExposureCompensation(new GetExposureCompensation(dnncam));
-        _registry.addMethod("get_exposure_compensation", getExposureCompensation);
+        add_method("get_exposure_compensation", getExposureCompensation, &_camera_mtex);
         
         xmlrpc_c::methodPtr const setFrameDuration(new SetFrameDuration(dnncam));
-        _registry.addMethod("set_frame_duration", setFrameDuration);
+        add_method("set_frame_duration", setFrameDuration, &_camera_mtex);
         
         xmlrpc_c::methodPtr const getFrameDuration(new GetFrameDuration(dnncam));
-        _registry.addMethod("get_frame_duration", getFrameDuration);
+        add_method("get_frame_duration", getFrameDuration, &_camera_mtex);
         
         xmlrpc_c::methodPtr const setGain(new SetGain(dnncam));
-        _registry.addMethod("set_gain", setGain);
+        add_method("set_gain", setGain, &_camera_mtex);
         
         xmlrpc_c::methodPtr const getGain(new GetGain(dnncam));
-        _registry.addMethod("get_gain", getGain);
+        add_method("get_gain", getGain, &_camera_mtex);
         
         xmlrpc_c::methodPtr const setAWB(new SetAWB(dnncam));
-        _registry.addMethod("set_awb", setAWB);
+        add_method("set_awb", setAWB, &_camera_mtex);
         
         xmlrpc_c::methodPtr const getAWB(new GetAWB(dnncam));
-        _registry.addMethod("get_awb", getAWB);
+        add_method("get_awb", getAWB, &_camera_mtex);
         
         xmlrpc_c::methodPtr const getAWBMode(new GetAWBMode(dnncam));
-        _registry.addMethod("get_awb_mode", getAWBMode);
+        add_method("get_awb_mode", getAWBMode, &_camera_mtex);
         
         xmlrpc_c::methodPtr const setAWBMode(new SetAWBMode(dnncam));
-        _registry.addMethod("set_awb_mode", setAWBMode);
+        add_method("set_awb_mode", setAWBMode, &_camera_mtex);
 
         // TODO: currently the numbers of gains is hardcoded so we don't have
         //       to expose Argus::BAYER_CHANNEL_COUNT through XMLRPC...
         xmlrpc_c::methodPtr const setAWBGains(new SetAWBGains(dnncam));
-        _registry.addMethod("set_awb_gains", setAWBGains);
+        add_method("set_awb_gains", setAWBGains, &_camera_mtex);
         
         xmlrpc_c::methodPtr const getAWBGains(new GetAWBGains(dnncam));
-        _registry.addMethod("get_awb_gains", getAWBGains);
+        add_method("get_awb_gains", getAWBGains, &_camera_mtex);
         
         xmlrpc_c::methodPtr const getDenoiseMode(new GetDenoiseMode(dnncam));
-        _registry.addMethod("get_denoise_mode", getDenoiseMode);
+        add_method("get_denoise_mode", getDenoiseMode, &_camera_mtex);
         
         xmlrpc_c::methodPtr const setDenoiseMode(new SetDenoiseMode(dnncam));
-        _registry.addMethod("set_denoise_mode", setDenoiseMode);
+        add_method("set_denoise_mode", setDenoiseMode, &_camera_mtex);
         
         xmlrpc_c::methodPtr const setDenoiseStrength(new SetDenoiseStrength(dnncam));
-        _registry.addMethod("set_denoise_strength", setDenoiseStrength);
+        add_method("set_denoise_strength", setDenoiseStrength, &_camera_mtex);
         
         xmlrpc_c::methodPtr const getDenoiseStrength(new GetDenoiseStrength(dnncam));
-        _registry.addMethod("get_denoise_strength", getDenoiseStrength);
+        add_method("get_denoise_strength", getDenoiseStrength, &_camera_mtex);
 
         xmlrpc_c::methodPtr const getConfig(new GetConfig(dnncam));
-        _registry.addMethod("get_config", getConfig);
+        add_method("get_config", getConfig, &_camera_mtex);
         
-        _server = new xmlrpc_c::serverAbyss(xmlrpc_c::serverAbyss::constrOpt()
-                        .registryP(&_registry)
-                        .portNumber(7000)
-                        .logFileName("/tmp/xmlrpc_log"));
+        /* Connections are accepted here and each one is handed to Abyss on a pool thread,
+         * instead of Abyss accepting and serving one request at a time. */
+        _listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        const int one = 1;
+        setsockopt(_listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons(XMLRPC_PORT);
+        if (_listen_fd < 0 || bind(_listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(_listen_fd, 16) < 0)
+        {
+            throw std::runtime_error(std::string("Unable to listen for XMLRPC requests: ") + strerror(errno));
+        }
 
+        /* Nothing says runConn() may be called on one Abyss server from several threads at
+         * once, so every pool thread gets a server of its own. They share the registry and
+         * the listening socket, which they never accept on. */
+        for (int i = 0; i < XMLRPC_THREADS; i++)
+        {
+            xmlrpc_c::serverAbyss *server = new xmlrpc_c::serverAbyss(xmlrpc_c::serverAbyss::constrOpt()
+                            .registryP(&_registry)
+                            .socketFd(_listen_fd)
+                            .logFileName("/tmp/xmlrpc_log"));
+            _servers.push_back(server);
+            _idle_servers.push_back(server);
+        }
     }
 
     virtual ~DNNCamServer()
     {
         stop();
-        delete _server;
+        _pool.stop();
+        for (size_t i = 0; i < _servers.size(); i++)
+        {
+            delete _servers[i];
+        }
+        close(_listen_fd);
     }
 
     void run()
     {
+        _pool.start();
         while (!_done)
         {
-            // Loop over runOnce to run serially. Note that this is a blocking call;
-            // it only returns once a request arrives or if _server->terminate() is called.
-            _server->runOnce();
+            // blocks until a client connects or stop() shuts the socket down
+            const int fd = accept(_listen_fd, NULL, NULL);
+            if (fd < 0)
+            {
+                if (!_done && errno != EINTR)
+                {
+                    std::cout << "XMLRPC accept failed: " << strerror(errno) << std::endl;
+                    usleep(100000);
+                }
+                continue;
+            }
+
+            {
+                boost::mutex::scoped_lock lock(_connections_mtex);
+                if (_connections.size() >= MAX_CONNECTIONS)
+                {
+                    close(fd);
+                    continue;
+                }
+                _connections.insert(fd);
+            }
+            _pool.add_job(boost::bind(&DNNCamServer::serve_connection, this, fd));
         }
     }
 
@@ -973,21 +1783,133 @@ public:
         // First, mark the flag so that the while-loop in run() will terminate.
         _done = true;
 
-        // Now tell the server to exit immediately, which will cause the server's
-        // runOnce() call (a blocking method) to return, which will allow our thread
-        // to exit and the program to exit cleanly.
-        _server->terminate();
+        // Now wake up accept() and end the connections being served, so run() and the
+        // pool threads return and the program can exit cleanly.
+        shutdown(_listen_fd, SHUT_RDWR);
+        {
+            boost::mutex::scoped_lock lock(_connections_mtex);
+            for (std::set < int >::const_iterator itr = _connections.begin(); itr != _connections.end(); ++itr)
+            {
+                shutdown(*itr, SHUT_RDWR);
+            }
+        }
+        _lens_jobs->stop();
     }
 
-    void add_method(const std::string &name, xmlrpc_c::methodPtr method)
+    /**
+     * Registers a method for XMLRPC and the HTTP API. Methods with a resource lock run one at
+     * a time with the other methods of that resource; without one they must be thread safe.
+     */
+    void add_method(const std::string &name, xmlrpc_c::methodPtr method, boost::mutex *resource = NULL)
     {
-        _registry.addMethod(name, method);
+        // all methods but the getters change settings, the lens or the recording state
+        const bool changes = name.find("get_") == std::string::npos && name != "job_status";
+        MetricHistogram *latency = Metrics::registry().histogram("dnncam_rpc_call_seconds",
+                                                                 "Duration of XMLRPC and /api method calls",
+                                                                 Metrics::label("method", name));
+        xmlrpc_c::methodPtr const serialized(new SerializedMethod(method, resource, changes ? &_notifier : NULL, latency));
+        _registry.addMethod(name, serialized);
+
+        boost::mutex::scoped_lock lock(_methods_mtex);
+        _methods.insert(std::make_pair(name, serialized));
+    }
+
+    // called after every method that changed something, e.g. to push the new state to clients
+    void set_change_callback(const ChangeCallback &callback)
+    {
+        _notifier.set_callback(callback);
+    }
+
+    /**
+     * Runs a method in-process, as if it had been called over XMLRPC. Returns false for an
+     * unknown method; faults raised by the method are thrown as xmlrpc_c::fault.
+     */
+    bool call(const std::string &name, xmlrpc_c::paramList const &params, xmlrpc_c::value *const result)
+    {
+        xmlrpc_c::method *method = find_method(name);
+        if (!method)
+        {
+            return false;
+        }
+        method->execute(params, result);
+        return true;
+    }
+
+    // signature and help of a method, false for an unknown method
+    bool describe(const std::string &name, std::string &signature, std::string &help)
+    {
+        xmlrpc_c::method *method = find_method(name);
+        if (!method)
+        {
+            return false;
+        }
+        signature = method->signature();
+        help = method->help();
+        return true;
+    }
+
+    LensJobsPtr get_lens_jobs()
+    {
+        return _lens_jobs;
+    }
+
+    std::vector < std::string > get_method_names()
+    {
+        boost::mutex::scoped_lock lock(_methods_mtex);
+        std::vector < std::string > ret;
+        for (std::map < std::string, xmlrpc_c::methodPtr >::const_iterator itr = _methods.begin(); itr != _methods.end(); ++itr)
+        {
+            ret.push_back(itr->first);
+        }
+        return ret;
     }
 
 protected:
+    void serve_connection(const int fd)
+    {
+        // there are as many servers as pool threads, so one is always idle
+        xmlrpc_c::serverAbyss *server;
+        {
+            boost::mutex::scoped_lock lock(_connections_mtex);
+            server = _idle_servers.back();
+            _idle_servers.pop_back();
+        }
+
+        try
+        {
+            server->runConn(fd);
+        }
+        catch (const std::exception &e)
+        {
+            std::cout << "XMLRPC connection failed: " << e.what() << std::endl;
+        }
+
+        boost::mutex::scoped_lock lock(_connections_mtex);
+        _idle_servers.push_back(server);
+        _connections.erase(fd);
+        close(fd);
+    }
+
+    xmlrpc_c::method *find_method(const std::string &name)
+    {
+        boost::mutex::scoped_lock lock(_methods_mtex);
+        std::map < std::string, xmlrpc_c::methodPtr >::const_iterator itr = _methods.find(name);
+        return itr == _methods.end() ? NULL : itr->second.get();
+    }
+
+    LensJobsPtr _lens_jobs;
+    bl::NewWorker < bl::Logexc_policy > _pool;
+    int _listen_fd;
+    std::set < int > _connections;
+    boost::mutex _connections_mtex;
+    boost::mutex _camera_mtex;
+    ChangeNotifier _notifier;
+    boost::mutex _methods_mtex;
+    std::map < std::string, xmlrpc_c::methodPtr > _methods;
     xmlrpc_c::registry _registry;
-    xmlrpc_c::serverAbyss* _server;
-    bool _done;
+    std::vector < xmlrpc_c::serverAbyss * > _servers;
+    std::vector < xmlrpc_c::serverAbyss * > _idle_servers;  // guarded by _connections_mtex
+    std::atomic < bool > _done;
 
 };
 
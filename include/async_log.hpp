@@ -0,0 +1,108 @@
+#pragma once
+
+#include <atomic>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <boost/program_options.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace po = boost::program_options;
+
+namespace BoulderAI
+{
+
+/**
+ * Logging that never blocks the caller on the console or the disk.
+ *
+ * write() copies the already formatted message into a fixed size record in a ring owned by
+ * the calling thread, without taking a lock; a background thread collects the records of all
+ * threads in time order, adds the time stamp, level and source, and writes them to stdout and
+ * the log file, which it also rotates. When a ring is full the record is dropped and counted
+ * instead of waiting. Check enabled() before formatting anything expensive.
+ *
+ * Until start() (and after stop()) records are written synchronously, so tools that never
+ * start the logger thread still see their output.
+ */
+class AsyncLog
+{
+public:
+    enum Level { LOG_DEBUG, LOG_INFO, LOG_WARN, LOG_ERROR };
+
+    // options names
+    static const char *OPT_LEVEL;
+    static const char *OPT_FILE;
+    static const char *OPT_FILE_MAX_KB;
+    static const char *OPT_FILE_COUNT;
+    static const char *OPT_BUFFER_RECORDS;
+
+    // option defaults
+    static const std::string DEFAULT_LEVEL;
+    static const std::string DEFAULT_FILE;
+    static const int DEFAULT_FILE_MAX_KB;
+    static const int DEFAULT_FILE_COUNT;
+    static const int DEFAULT_BUFFER_RECORDS;
+
+    // option variables
+    static std::string _level_name;
+    static std::string _file;
+    static int _file_max_kb;
+    static int _file_count;
+    static int _buffer_records;
+
+    static po::options_description GetOptions();
+
+    // applies the options and starts the logger thread
+    static void start();
+    // writes out everything still queued and stops the logger thread
+    static void stop();
+
+    static void set_level(const Level level);
+    static bool enabled(const Level level) { return level >= _level.load(std::memory_order_relaxed); }
+
+    // source must be a string literal; messages longer than a record are truncated
+    static void write(const Level level, const char *source, const std::string &message);
+
+    // records dropped because a ring was full
+    static uint64_t get_dropped();
+
+    // one queued message, defined in async_log.cpp
+    struct Record;
+
+protected:
+    typedef boost::mutex::scoped_lock ScopedLock;
+
+    struct Ring;
+    typedef boost::shared_ptr < Ring > RingPtr;
+
+    static Ring *get_ring();
+    static void release_ring(Ring *ring);
+
+    static void run();
+    // moves the queued records of every ring to the outputs, false if there were none
+    static bool drain();
+    static void output(const Record &record);
+    static void open_file();
+    static void rotate();
+
+    static bool parse_level(const std::string &name, Level &level);
+    static const char *level_name(const Level level);
+
+    static std::atomic < int > _level;
+    static std::atomic < bool > _running;
+    static std::atomic < uint64_t > _dropped;
+
+    static boost::mutex _rings_mtex;
+    static std::vector < RingPtr > _rings;
+
+    // only used by the logger thread, or under _output_mtex while it is not running
+    static boost::mutex _output_mtex;
+    static std::ofstream _output;
+    static uint64_t _reported_dropped;
+
+    static boost::shared_ptr < boost::thread > _thread_ptr;
+};
+
+} // namespace BoulderAI
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+namespace BoulderAI
+{
+
+/**
+ * Writes files on a dedicated I/O thread, so a slow SD card never blocks the caller.
+ *
+ * Writes are copied into a queue and coalesced into large batches before they reach the
+ * file system. Files are preallocated with fallocate() when opened and trimmed to their real
+ * size when closed. Data is written to "<path>.part" and renamed to the final name once it
+ * is complete. When the queue is over its byte limit new writes are dropped and counted,
+ * never waited for. A file that lost a write loses every later one too and is deleted when
+ * it is closed, so no file ever has data missing from its middle.
+ */
+class AsyncWriter
+{
+public:
+    // called on the I/O thread once a file is complete, with its final path and size
+    typedef boost::function < void(const std::string &, const uint64_t) > ClosedCallback;
+
+    AsyncWriter(const size_t batch_bytes, const size_t max_queue_bytes);
+    virtual ~AsyncWriter();
+
+    void start();
+    // writes out everything that is queued, then stops
+    void stop();
+
+    // All of these only queue the operation and return immediately.
+    int open(const std::string &path, const uint64_t preallocate_bytes);
+    // false when the data was dropped; the file is then discarded on close()
+    bool write(const int file, const uint8_t *data, const size_t size);
+    void close(const int file, ClosedCallback on_closed = ClosedCallback());
+
+    size_t get_queue_bytes();
+    uint64_t get_written_bytes();
+    uint64_t get_dropped_bytes();
+
+protected:
+    typedef boost::mutex::scoped_lock ScopedLock;
+
+    struct Op
+    {
+        enum Type { OPEN, WRITE, CLOSE } type;
+        int file;
+        std::string path;
+        uint64_t preallocate_bytes;
+        std::vector < uint8_t > data;
+        ClosedCallback on_closed;
+    };
+
+    struct OpenFile
+    {
+        int fd;
+        std::string path;
+        uint64_t size;
+        bool failed;
+        std::vector < uint8_t > batch;
+    };
+
+    void run();
+    void do_op(Op &op);
+    void flush(OpenFile &file);
+    void flush_all();
+
+    const size_t _batch_bytes;
+    const size_t _max_queue_bytes;
+
+    bool _running;
+    int _next_file;
+    std::deque < Op > _queue;
+    size_t _queue_bytes;
+    uint64_t _written_bytes;
+    uint64_t _dropped_bytes;
+    std::set < int > _dropped_files;    // files that lost a write, until they are closed
+
+    // only touched by the I/O thread
+    std::map < int, OpenFile > _files;
+
+    boost::mutex _mtex;
+    boost::condition_variable _condition;
+    boost::shared_ptr < boost::thread > _thread_ptr;
+};
+
+typedef boost::shared_ptr < AsyncWriter > AsyncWriterPtr;
+
+} // namespace BoulderAI
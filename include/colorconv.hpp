@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace BoulderAI
+{
+
+/**
+ * CPU colour conversion between the capture formats (RGBA, NV12, I420) and the formats the
+ * encoders and OpenCV want (I420, BGR). BT.601 limited range, 8 bit fixed point.
+ *
+ * Every kernel has a scalar reference (the _c variants) and NEON (aarch64) and SSE2 (x86)
+ * paths, plus AVX2 for RGBA->I420 when the CPU has it. The vectorized paths produce exactly
+ * the same output as the reference. Large frames are split into row bands that are
+ * converted on several threads, the caller's and a pool of helpers started once.
+ *
+ * Widths and heights must be even.
+ */
+class ColorConv
+{
+public:
+    // RGBA (R first in memory, alpha ignored) to I420. Chroma is taken from the 2x2 average.
+    static void rgba_to_i420(const uint8_t *rgba, const int rgba_stride,
+                             uint8_t *y, const int y_stride, uint8_t *u, const int u_stride,
+                             uint8_t *v, const int v_stride, const int width, const int height);
+    static void rgba_to_i420_c(const uint8_t *rgba, const int rgba_stride,
+                               uint8_t *y, const int y_stride, uint8_t *u, const int u_stride,
+                               uint8_t *v, const int v_stride, const int width, const int height);
+
+    // Packed 3 byte BGR (OpenCV order) to I420. Scalar only, split into bands.
+    static void bgr_to_i420(const uint8_t *bgr, const int bgr_stride,
+                            uint8_t *y, const int y_stride, uint8_t *u, const int u_stride,
+                            uint8_t *v, const int v_stride, const int width, const int height);
+
+    // I420 to packed 3 byte BGR
+    static void i420_to_bgr(const uint8_t *y, const int y_stride, const uint8_t *u, const int u_stride,
+                            const uint8_t *v, const int v_stride, uint8_t *bgr, const int bgr_stride,
+                            const int width, const int height);
+    static void i420_to_bgr_c(const uint8_t *y, const int y_stride, const uint8_t *u, const int u_stride,
+                              const uint8_t *v, const int v_stride, uint8_t *bgr, const int bgr_stride,
+                              const int width, const int height);
+
+    // NV12 (interleaved UV plane) to I420
+    static void nv12_to_i420(const uint8_t *y, const int y_stride, const uint8_t *uv, const int uv_stride,
+                             uint8_t *dst_y, const int dst_y_stride, uint8_t *u, const int u_stride,
+                             uint8_t *v, const int v_stride, const int width, const int height);
+    static void nv12_to_i420_c(const uint8_t *y, const int y_stride, const uint8_t *uv, const int uv_stride,
+                               uint8_t *dst_y, const int dst_y_stride, uint8_t *u, const int u_stride,
+                               uint8_t *v, const int v_stride, const int width, const int height);
+
+    // I420 to NV12
+    static void i420_to_nv12(const uint8_t *y, const int y_stride, const uint8_t *u, const int u_stride,
+                             const uint8_t *v, const int v_stride, uint8_t *dst_y, const int dst_y_stride,
+                             uint8_t *uv, const int uv_stride, const int width, const int height);
+    static void i420_to_nv12_c(const uint8_t *y, const int y_stride, const uint8_t *u, const int u_stride,
+                               const uint8_t *v, const int v_stride, uint8_t *dst_y, const int dst_y_stride,
+                               uint8_t *uv, const int uv_stride, const int width, const int height);
+
+    // Halves a plane (e.g. Y) with Scaler::half_plane(), split into bands
+    static void half_plane(const uint8_t *src, const int src_stride,
+                           uint8_t *dst, const int dst_stride, const int dst_w, const int dst_h);
+
+    // Number of threads used for large frames, defaults to the number of cores. The helper
+    // threads are started with the first large frame, set this before then.
+    static void set_threads(const int threads);
+    static int get_threads();
+
+    // Name of the vector extension in use, for logging
+    static const char *simd_name();
+
+protected:
+    static int _threads;
+};
+
+} // namespace BoulderAI
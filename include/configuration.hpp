@@ -18,6 +18,9 @@ public:
     static int zoom_home_max_steps() { init(); return _zoom_home_max_steps; }
     static int zoom_home_step_size() { init(); return _zoom_home_step_size; }
     static bool zoom_has_limit() { init(); return _zoom_has_limit; }
+    static double zoom_start_speed() { init(); return _zoom_start_speed; }
+    static double zoom_max_speed() { init(); return _zoom_max_speed; }
+    static double zoom_acceleration() { init(); return _zoom_acceleration; }
 
     static int focus_start() { init(); return _focus_start; }
     static int focus_up_direction() { init(); return _focus_up_direction; }
@@ -25,6 +28,9 @@ public:
     static int focus_home_max_steps() { init(); return _focus_home_max_steps; }
     static int focus_home_step_size() { init(); return _focus_home_step_size; }
     static bool focus_has_limit() { init(); return _focus_has_limit; }
+    static double focus_start_speed() { init(); return _focus_start_speed; }
+    static double focus_max_speed() { init(); return _focus_max_speed; }
+    static double focus_acceleration() { init(); return _focus_acceleration; }
 
     static int iris_start() { init(); return _iris_start; }
     static int iris_up_direction() { init(); return _iris_up_direction; }
@@ -32,6 +38,20 @@ public:
     static int iris_home_max_steps() { init(); return _iris_home_max_steps; }
     static int iris_home_step_size() { init(); return _iris_home_step_size; }
     static bool iris_has_limit() { init(); return _iris_has_limit; }
+    static double iris_start_speed() { init(); return _iris_start_speed; }
+    static double iris_max_speed() { init(); return _iris_max_speed; }
+    static double iris_acceleration() { init(); return _iris_acceleration; }
+
+    static std::string position_journal() { init(); return _position_journal; }
+
+    static int zoom_max() { init(); return _zoom_max; }
+    static int focus_max() { init(); return _focus_max; }
+    static std::string focus_curve() { init(); return _focus_curve; }
+    static bool focus_track() { init(); return _focus_track; }
+    static bool focus_track_autofocus() { init(); return _focus_track_autofocus; }
+    static int autofocus_range() { init(); return _autofocus_range; }
+    static int autofocus_step() { init(); return _autofocus_step; }
+    static std::string presets() { init(); return _presets; }
 
 protected:
     static void _load_config_file();
@@ -56,6 +76,9 @@ protected:
     static int _zoom_home_max_steps;
     static int _zoom_home_step_size;
     static bool _zoom_has_limit;
+    static double _zoom_start_speed;
+    static double _zoom_max_speed;
+    static double _zoom_acceleration;
 
     // Focus configuration
     static int _focus_start;
@@ -64,6 +87,9 @@ protected:
     static int _focus_home_max_steps;
     static int _focus_home_step_size;
     static bool _focus_has_limit;
+    static double _focus_start_speed;
+    static double _focus_max_speed;
+    static double _focus_acceleration;
 
     // Iris configuration
     static int _iris_start;
@@ -72,6 +98,23 @@ protected:
     static int _iris_home_max_steps;
     static int _iris_home_step_size;
     static bool _iris_has_limit;
+    static double _iris_start_speed;
+    static double _iris_max_speed;
+    static double _iris_acceleration;
+
+    // where the lens positions are kept across restarts, empty to always home
+    static std::string _position_journal;
+
+    // Focus tracking: zoom and focus travel from home, the zoom->focus curve, whether focus
+    // follows zoom from startup and ends every tracked zoom with an autofocus pass
+    static int _zoom_max;
+    static int _focus_max;
+    static std::string _focus_curve;
+    static bool _focus_track;
+    static bool _focus_track_autofocus;
+    static int _autofocus_range;
+    static int _autofocus_step;
+    static std::string _presets;
 
     static boost::function < void(std::string) > _log_callback;
 };
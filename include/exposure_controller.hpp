@@ -0,0 +1,129 @@
+#pragma once
+
+#include <atomic>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/program_options.hpp>
+
+#include "DNNCam.hpp"
+#include "lens_jobs.hpp"
+
+namespace po = boost::program_options;
+
+namespace BoulderAI
+{
+
+struct ExposureControlStatus
+{
+    bool auto_iris;
+    bool auto_ir_cut;
+    bool night;             // IR cut filter out
+    float scene_lux;        // smoothed
+    float gain;             // sensor analog gain times ISP digital gain
+    double exposure_ms;
+    int iris;               // location, -1 when unknown
+};
+
+/**
+ * Keeps the sensor gain low by opening and closing the iris, and switches the IR cut filter
+ * between day and night, from the capture metadata of the frames (see
+ * DNNCam::get_exposure_stats()). Runs on a thread of its own a few times a second, never on
+ * the frame path; the iris and IR cut moves are queued as lens jobs like any other.
+ *
+ * The iris opens a few steps at a time while the gain is above gain-high, before auto
+ * exposure has to raise it further, and closes while the exposure time is below
+ * exposure-low-ms, i.e. when there is light to spare. Each move waits for the previous
+ * one to finish and for auto exposure to settle.
+ *
+ * The IR cut filter comes out when the scene lux stays below night-lux for dwell-s and
+ * goes back in when it stays above day-lux for dwell-s; the gap between the two and the
+ * dwell keep it from flapping, as the lux changes with the filter itself.
+ */
+class ExposureController
+{
+public:
+    // options names
+    static const char *OPT_AUTO_IRIS;
+    static const char *OPT_AUTO_IR_CUT;
+    static const char *OPT_RATE;
+    static const char *OPT_GAIN_HIGH;
+    static const char *OPT_EXPOSURE_LOW_MS;
+    static const char *OPT_IRIS_STEP;
+    static const char *OPT_IRIS_MAX;
+    static const char *OPT_NIGHT_LUX;
+    static const char *OPT_DAY_LUX;
+    static const char *OPT_DWELL_S;
+
+    // option defaults
+    static const bool DEFAULT_AUTO_IRIS;
+    static const bool DEFAULT_AUTO_IR_CUT;
+    static const double DEFAULT_RATE;
+    static const float DEFAULT_GAIN_HIGH;
+    static const double DEFAULT_EXPOSURE_LOW_MS;
+    static const int DEFAULT_IRIS_STEP;
+    static const int DEFAULT_IRIS_MAX;
+    static const float DEFAULT_NIGHT_LUX;
+    static const float DEFAULT_DAY_LUX;
+    static const int DEFAULT_DWELL_S;
+
+    // option variables
+    static bool _auto_iris_option;
+    static bool _auto_ir_cut_option;
+    static double _rate;
+    static float _gain_high;
+    static double _exposure_low_ms;
+    static int _iris_step;
+    static int _iris_max;
+    static float _night_lux;
+    static float _day_lux;
+    static int _dwell_s;
+
+    static po::options_description GetOptions();
+
+    ExposureController(DNNCamPtr dnncam, LensJobsPtr jobs);
+    virtual ~ExposureController();
+
+    void start();
+    void stop();
+
+    void set_auto_iris(const bool enabled);
+    void set_auto_ir_cut(const bool enabled);
+    ExposureControlStatus get_status();
+
+protected:
+    typedef boost::mutex::scoped_lock ScopedLock;
+
+    void run();
+    void control(const ExposureStats &stats, const uint64_t now_ms);
+    void control_iris(const ExposureStats &stats, const uint64_t now_ms);
+    void control_ir_cut(const uint64_t now_ms);
+    // false while the job is queued or running
+    bool job_finished(const int id);
+
+    DNNCamPtr _dnncam;
+    LensJobsPtr _jobs;
+
+    std::atomic < bool > _auto_iris;
+    std::atomic < bool > _auto_ir_cut;
+
+    // on the controller thread only
+    int _iris_job;
+    uint64_t _iris_done_ms;     // when the last iris job was seen finished
+    int _ir_cut_job;
+    int _night;                 // -1 until the filter was first set
+    uint64_t _switched_ms;
+    uint64_t _crossed_ms;       // since when the lux is past the threshold of the other state, 0 if not
+    bool _have_lux;
+
+    bool _running;
+    ExposureControlStatus _status;
+    boost::mutex _mtex;
+    boost::condition_variable _condition;
+    boost::shared_ptr < boost::thread > _thread_ptr;
+};
+
+typedef boost::shared_ptr < ExposureController > ExposureControllerPtr;
+
+} // namespace BoulderAI
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <boost/thread/mutex.hpp>
+
+namespace BoulderAI
+{
+
+/**
+ * Calibrated focus position for each zoom position. The table holds the best focus found at a
+ * few zoom positions; in between, focus is interpolated linearly, and beyond the first and last
+ * point it is held at their value. Kept as a text file of "zoom focus" lines next to
+ * lensdriver.cfg, so it can be edited or copied between cameras with the same lens.
+ */
+class FocusCurve
+{
+public:
+    struct Point
+    {
+        int zoom;
+        int focus;
+    };
+
+    // false when the file is missing or has no valid points; the curve is then empty
+    bool load(const std::string &path);
+    bool save(const std::string &path);
+
+    void set_points(std::vector < Point > points);
+    std::vector < Point > get_points();
+
+    // false when the curve is empty
+    bool focus_for(const int zoom, int &focus);
+
+protected:
+    typedef boost::mutex::scoped_lock ScopedLock;
+
+    boost::mutex _mtex;
+    boost::mutex _save_mtex;    // held from the snapshot to the rename, so saves land in order
+    std::vector < Point > _points;  // sorted by zoom
+};
+
+} // namespace BoulderAI
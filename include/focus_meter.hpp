@@ -0,0 +1,45 @@
+#pragma once
+
+#include <atomic>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <opencv2/opencv.hpp>
+
+namespace BoulderAI
+{
+
+/**
+ * Measures how sharp the image is, for autofocus and focus calibration. The capture thread
+ * hands every frame to submit(), which returns at once unless a measure() is waiting; only
+ * then is the sharpness of the frame computed. One measure() at a time, from the lens thread.
+ */
+class FocusMeter
+{
+public:
+    FocusMeter();
+
+    // the Y plane of a frame just captured
+    void submit(const cv::Mat &y);
+
+    // mean sharpness of count frames, after skipping skip frames that may have been exposed
+    // while the lens was still moving; false when the frames do not come within timeout_ms
+    bool measure(double &sharpness, const int skip, const int count, const int timeout_ms);
+
+    // variance of the Laplacian over the middle of the frame, higher is sharper
+    static double sharpness(const cv::Mat &y);
+
+protected:
+    typedef boost::mutex::scoped_lock ScopedLock;
+
+    std::atomic < bool > _armed;
+    int _skip;
+    int _count;
+    int _taken;
+    double _sum;
+    uint64_t _generation;       // counts measure() calls, frames of an earlier one are not counted
+
+    boost::mutex _mtex;
+    boost::condition_variable _condition;
+};
+
+} // namespace BoulderAI
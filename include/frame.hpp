@@ -96,10 +96,15 @@ typedef boost::shared_ptr < Frame > FramePtr;
 
 struct FrameCollection
 {
+    FrameCollection() : yuv_fd(-1), sensor_timestamp(0), frame_number(0) {}
+
     FramePtr frame_rgb;
     FramePtr frame_y;
     FramePtr frame_u;
     FramePtr frame_v;
+    int yuv_fd; // dmabuf fd of the NvBuffer behind frame_y/u/v, or -1. Only valid while frame_rgb is alive.
+    uint64_t sensor_timestamp; // start of exposure in ns, CLOCK_MONOTONIC domain, or 0 if unknown
+    uint64_t frame_number; // libargus frame count, consecutive unless frames were lost
 };
 
 typedef std::deque < FrameCollection > FrameQueue;
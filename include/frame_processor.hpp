@@ -8,6 +8,12 @@
 #include "frame.hpp"
 #include "new_worker.hpp"
 #include "stream.hpp"
+#include "jpeg_source.hpp"
+#include "recorder.hpp"
+#include "retention.hpp"
+#include "telemetry.hpp"
+#include "metrics.hpp"
+#include "motion_detector.hpp"
 
 namespace BoulderAI
 {
@@ -147,6 +153,23 @@ private:
     static std::map<std::string, int> _frame_num; 
 } ; 
 
+struct CaptureStatus
+{
+    CaptureState::CaptureState state;
+    int moving_blocks;      // of the last frame checked for motion
+    int blocks;
+    uint64_t motion_events; // events started by motion
+};
+
+// moving averages over the last frames, in ms
+struct StageLatency
+{
+    double capture_ms;  // start of exposure until the frame reached the frame processor
+    double queue_ms;    // waiting for a worker
+    double stream_ms;   // in order hand-over to the RTSP clients
+    double total_ms;    // start of exposure until the frame was handed to all outputs
+};
+
 class FrameProcessor : public boost::enable_shared_from_this<FrameProcessor>
 {
 public:
@@ -162,19 +185,42 @@ public:
     void set_stream_state(const std::string &state);
     std::string get_stream_state(); 
 
-    boost::posix_time::time_duration get_mean_tracking_time()
-    {
-        return boost::posix_time::time_duration(0,0,0); // No longer used. so just return 0 to prevent division by zero errors.
-        //if (_frame_num == 0)
-        //return _tracking_time;  // Dan: Should make this return zero though.
-        //return _tracking_time/_frame_num;
-    }
+    // mean worker time per frame over the last seconds, from the trace; 0 while tracing is off
+    boost::posix_time::time_duration get_mean_tracking_time();
 
     int get_queue_size();
     int get_dropped_frames(void);
+    std::vector < StreamClientStats > get_stream_client_stats(void);
+    StreamClockInfo get_stream_clock_info(void);
+    JpegSourcePtr get_jpeg_source(void);
+
+    // Recording: start_event() writes out the prebuffered frames and records every frame
+    // until stop_event(), followed by PREBUFFER_POST_FRAMES more.
+    void start_event(void);
+    void stop_event(void);
+    RecorderStats get_recorder_stats(void);
+    RetentionManagerPtr get_retention(void);
+
+    // Capture mode: "on" records until set otherwise, "off" stops, "auto" records motion
+    // events (see MotionDetector); false for an unknown mode.
+    bool set_capture_mode(const std::string &mode);
+    CaptureStatus get_capture_status(void);
+    static std::string capture_state_name(const CaptureState::CaptureState state);
+
+    StageLatency get_stage_latency(void);
+
+    // telemetry source: queue depth, dropped frames, latency, clients and recording state
+    void sample_telemetry(TelemetryValues &values);
+    // the capture.* part of it
+    static void sample_capture_telemetry(const CaptureStatus &capture, TelemetryValues &values);
+
+    // adds collectors for the queue depths, drop counters and per RTSP client stats;
+    // call after start_workers()
+    void register_metrics(Metrics &metrics);
 
     void increment_dropped_frames(void);
     
+    // per span summary of the last seconds (see Trace), empty while tracing is off
     std::string get_timing_string(void);
 
     void DrawPoints3D(cv::Mat frame,
@@ -198,10 +244,18 @@ public:
 protected:
     typedef boost::mutex::scoped_lock ScopedLock;
 
-    void process_frame_task(FrameCollection frame_col, const int frame_num, const int n_dropped_before);
+    void process_frame_task(FrameCollection frame_col, const int frame_num, const int n_dropped_before,
+                            const uint64_t queued_ns);
 
     void do_stream(FrameCollection frame_col, const int frame_num, const int n_dropped_before);
 
+    // the auto capture states; runs on the capture thread, in frame order
+    void update_capture_state(const FrameCollection &frame_col);
+
+    void collect_queue_depths(std::vector < MetricSample > &samples);
+    void collect_recorder_io(std::vector < MetricSample > &samples);
+    void collect_dropped_frames(std::vector < MetricSample > &samples);
+
     bool _created_window;
     int _frame_width;
     int _frame_height;
@@ -210,12 +264,27 @@ protected:
     int _queue_size;
     int _dropped_frames;
     int _prebuffer_post_frames;
+    bool _event_active;
     StreamState _stream_state;
     StreamPtr _streamer;
+    JpegSourcePtr _jpeg_source;
+    RecorderPtr _recorder;
+    RetentionManagerPtr _retention;
     FrameQueue _prebuffer;
+    StageLatency _latency;
+
+    CaptureState::CaptureState _capture_state;
+    MotionDetector _motion_detector;
+    MotionStatus _motion_status;
+    int _motion_frames;         // consecutive frames with motion
+    uint64_t _last_motion_ns;
+    uint64_t _auto_event_start_ns;
+    uint64_t _motion_events;
 
     boost::mutex _mtex;
     boost::mutex _prebuffer_mtex;
+    boost::mutex _latency_mtex;
+    boost::mutex _capture_mtex;     // taken before _prebuffer_mtex
 
     BoundedWorker _worker;
     bl::NewWorker < bl::Logexc_policy > _gui_worker;
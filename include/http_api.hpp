@@ -0,0 +1,84 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <boost/program_options.hpp>
+
+#include "DNNCamServer.hpp"
+#include "http_server.hpp"
+#include "telemetry.hpp"
+
+namespace po = boost::program_options;
+
+namespace BoulderAI
+{
+
+/**
+ * The web UI and control API on the embedded HTTP server, without any CGI process:
+ *
+ *   /                  static files of the web UI
+ *   /export/<file>     recordings and exports
+ *   /api/              JSON list of every XMLRPC method with signature and help
+ *   /api/<method>      calls an XMLRPC method; parameters are a JSON array in the POST body
+ *                      or in ?params=, the result is {"result": ...} or {"error": "..."}
+ *   /cgi-bin/rpc       ?request=<method>+<type>/<value>..., the syntax of the xmlrpc command
+ *                      line tool that the old script ran
+ *   /cgi-bin/list, /cgi-bin/delete, /cgi-bin/setroi, /cgi-bin/temps
+ *                      the functions of the old CGI scripts
+ *
+ * Methods run in-process through DNNCamServer::call, with the same locking as when they
+ * are called over XMLRPC.
+ */
+class HttpApi
+{
+public:
+    // options names
+    static const char *OPT_ROOT;
+    static const char *OPT_ROI_CONFIG;
+
+    // option defaults
+    static const std::string DEFAULT_ROOT;
+    static const std::string DEFAULT_ROI_CONFIG;
+
+    // option variables
+    static std::string _root;
+    static std::string _roi_config;
+
+    static po::options_description GetOptions();
+
+    HttpApi(DNNCamServerPtr server, const std::string &export_dir);
+    virtual ~HttpApi();
+
+    void register_handlers(HttpServer &server);
+
+    // telemetry source publishing the results of parameterless getter methods as settings.<method>
+    void sample_methods(const std::vector < std::string > &methods, TelemetryValues &values);
+
+    // JSON text of an XMLRPC value
+    static std::string to_json(const xmlrpc_c::value &value);
+    // plain text of an XMLRPC value, as the old cgi-bin/rpc printed it; arrays and structs as JSON
+    static std::string to_text(const xmlrpc_c::value &value);
+
+protected:
+    bool serve_static(const HttpRequest &request, const int fd);
+    bool serve_export(const HttpRequest &request, const int fd);
+    bool serve_api(const HttpRequest &request, const int fd);
+    bool serve_rpc(const HttpRequest &request, const int fd);
+    bool serve_list(const HttpRequest &request, const int fd);
+    bool serve_delete(const HttpRequest &request, const int fd);
+    bool serve_setroi(const HttpRequest &request, const int fd);
+    bool serve_temps(const HttpRequest &request, const int fd);
+
+    bool send_json(const int fd, const int status, const std::string &json);
+    std::vector < char > param_types(const std::string &method);
+
+    static bool safe_name(const std::string &name);
+
+    DNNCamServerPtr _server;
+    const std::string _export_dir;
+};
+
+typedef boost::shared_ptr < HttpApi > HttpApiPtr;
+
+} // namespace BoulderAI
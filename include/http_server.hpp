@@ -0,0 +1,142 @@
+#pragma once
+
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/program_options.hpp>
+
+namespace po = boost::program_options;
+
+namespace BoulderAI
+{
+
+struct HttpRequest
+{
+    std::string method;
+    std::string path;       // without the query string
+    std::string query;      // raw query string, without the '?'
+    std::string version;
+    std::map < std::string, std::string > headers;  // names in lower case
+    std::string body;
+
+    // url decoded value of a query parameter, or "" if it is not present
+    std::string get_param(const std::string &name) const;
+    bool has_param(const std::string &name) const;
+
+    static std::string url_decode(const std::string &s);
+};
+
+/**
+ * Handles a request by writing the complete response to fd. Returns false if the
+ * connection must be closed afterwards, e.g. after a streaming response.
+ */
+typedef boost::function < bool(const HttpRequest &, int) > HttpHandler;
+
+/**
+ * Minimal embedded HTTP/1.1 server for the camera's own endpoints (web UI, control API,
+ * snapshots, MJPEG).
+ *
+ * One thread accepts connections and polls the idle keep-alive ones; requests are handled
+ * by a small pool of worker threads. Handlers registered as streaming (MJPEG, event streams)
+ * hold their connection for as long as they run, so they get a thread of their own instead
+ * of a pool thread.
+ *
+ * Handlers are matched by exact path, or by prefix when the registered path ends in '/';
+ * the longest match wins.
+ */
+class HttpServer
+{
+public:
+    // options names
+    static const char *OPT_PORT;
+    static const char *OPT_THREADS;
+
+    // option defaults
+    static const int DEFAULT_PORT;
+    static const int DEFAULT_THREADS;
+
+    // option variables
+    static int _port;
+    static int _threads;
+
+    static po::options_description GetOptions();
+
+    HttpServer(const int port, const int threads);
+    virtual ~HttpServer();
+
+    void add_handler(const std::string &path, HttpHandler handler, const bool streaming = false);
+
+    void start();
+    void stop();
+
+    // write helpers for handlers; all return false once the client is gone
+    static bool send_all(const int fd, const void *data, const size_t size);
+    static bool send_headers(const int fd, const int status, const std::string &content_type,
+                             const int64_t content_length, const std::string &extra_headers = "");
+    static bool send_response(const int fd, const int status, const std::string &content_type,
+                              const std::string &body, const std::string &extra_headers = "");
+    // GET/HEAD of a file, with its content type guessed from the extension
+    static bool send_file(const int fd, const HttpRequest &request, const std::string &path);
+    static std::string status_text(const int status);
+    static std::string content_type(const std::string &path);
+    // s as a quoted and escaped JSON string
+    static std::string json_string(const std::string &s);
+
+    // false once the peer closed the connection or the server is shutting down
+    static bool is_connected(const int fd);
+
+protected:
+    typedef boost::mutex::scoped_lock ScopedLock;
+
+    struct Connection
+    {
+        int fd;
+        std::string buffer;     // bytes received beyond the last request
+        time_t last_active;
+    };
+
+    struct Route
+    {
+        HttpHandler handler;
+        bool streaming;
+    };
+
+    void run();
+    void run_worker();
+    void handle_connection(Connection conn);
+    void run_streaming(Connection conn, HttpRequest request, HttpHandler handler);
+    bool find_route(const std::string &path, Route &route);
+    void return_connection(const Connection &conn);
+    void close_connection(const int fd);
+    bool read_request(const int fd, std::string &buffer, HttpRequest &request);
+
+    const int _listen_port;
+    const int _num_threads;
+    int _listen_fd;
+    int _wake_pipe[2];
+    bool _running;
+    std::set < int > _connections;
+
+    // connections with a request waiting for a worker
+    std::deque < Connection > _ready;
+    // keep-alive connections handed back by the workers, picked up by the poll thread
+    std::deque < Connection > _returned;
+
+    std::map < std::string, Route > _routes;
+
+    boost::mutex _mtex;
+    boost::condition_variable _condition;
+    boost::condition_variable _ready_condition;
+    boost::shared_ptr < boost::thread > _thread_ptr;
+    boost::thread_group _workers;
+};
+
+typedef boost::shared_ptr < HttpServer > HttpServerPtr;
+
+} // namespace BoulderAI
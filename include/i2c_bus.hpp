@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct i2c_msg;
+
+namespace BoulderAI
+{
+
+// one write of a transfer: len bytes to the device at addr, the first one being the register
+struct I2cWrite
+{
+    uint8_t addr;
+    const uint8_t *buf;
+    uint16_t len;
+};
+
+/**
+ * The I2C bus the lens expanders sit on. MotorDriver only talks to the hardware through
+ * this, so it can run against SimulatedI2cBus on a machine without the lens board.
+ */
+class I2cBus
+{
+public:
+    virtual ~I2cBus() {}
+
+    // all writes as one transfer where the adapter can, false if any of them failed
+    virtual bool write(const I2cWrite *writes, const int count) = 0;
+    virtual bool read_reg(const uint8_t addr, const uint8_t reg, uint8_t &value) = 0;
+};
+
+typedef std::shared_ptr < I2cBus > I2cBusPtr;
+
+/**
+ * An i2c-dev adapter such as /dev/i2c-6. Writes go out in a single I2C_RDWR transfer when the
+ * adapter supports plain I2C, otherwise one write() per message.
+ */
+class LinuxI2cBus : public I2cBus
+{
+public:
+    LinuxI2cBus(const std::string &device);
+    virtual ~LinuxI2cBus();
+
+    // false when the device cannot be opened or cannot do either kind of write
+    bool open(std::string &error);
+
+    virtual bool write(const I2cWrite *writes, const int count);
+    virtual bool read_reg(const uint8_t addr, const uint8_t reg, uint8_t &value);
+
+    bool supports_rdwr() const { return _use_rdwr; }
+
+protected:
+    bool select_slave(const uint8_t addr);
+
+    const std::string _device;
+    int _fd;
+    int _slave_addr;
+    bool _use_rdwr;
+    std::vector < struct i2c_msg > _msgs;   // reused for every transfer
+};
+
+} // namespace BoulderAI
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <boost/thread/mutex.hpp>
+
+#include "i2c_bus.hpp"
+
+namespace BoulderAI
+{
+
+struct I2cSimStats
+{
+    uint64_t transfers;     // write() and read_reg() calls
+    uint64_t messages;      // addressed messages within them
+    uint64_t bytes;         // data bytes, without the address bytes
+    uint64_t bus_ns;        // time the transfers would take on the wire
+    uint64_t missed_steps;  // phase jumps of two at once, which a real motor may follow either way
+};
+
+/**
+ * The lens board on a simulated bus: the three MCP23017 expanders at 0x20, 0x21 and 0x22 as
+ * wired in lens_pins.hpp, with a stepper model for zoom, focus and iris and the limit
+ * switches of zoom and focus. Lets MotorDriver and lensDriver run, be tested and be
+ * benchmarked on a machine without the hardware.
+ *
+ * Each motor follows its two phase outputs while both of its enables are set: the phase
+ * moving one step through the cycle moves the motor one step, in the direction MotorDriver
+ * counts steps, until the motor hits the end of its travel. A limit switch reads active from
+ * its position to the end of the travel. Bus time is counted at the given clock, 9 bits per
+ * byte plus start and stop conditions, without any time in the driver.
+ */
+class SimulatedI2cBus : public I2cBus
+{
+public:
+    SimulatedI2cBus(const double clock_hz = 400000);
+
+    virtual bool write(const I2cWrite *writes, const int count);
+    virtual bool read_reg(const uint8_t addr, const uint8_t reg, uint8_t &value);
+
+    // axes are "zoom", "focus" and "iris"; positions are in MotorDriver steps
+    int get_position(const std::string &axis);
+    void set_position(const std::string &axis, const int position);
+    // the travel of the axis and where its limit switch starts
+    void set_travel(const std::string &axis, const int min, const int max, const int limit);
+
+    bool get_ir_cut();
+
+    I2cSimStats get_stats();
+    void reset_stats();
+
+protected:
+    typedef boost::mutex::scoped_lock ScopedLock;
+
+    static const int REGISTERS = 0x16;
+
+    struct Expander
+    {
+        uint8_t regs[REGISTERS];
+    };
+
+    struct Motor
+    {
+        uint8_t addr;
+        int port;           // 0 for A, 1 for B
+        uint8_t aphase;
+        uint8_t bphase;
+        uint8_t enable;     // both enable pins
+        uint8_t limit;      // input pin of the limit switch, 0 if there is none
+        bool reverse;       // as MotorDriver::StepChannel::reverse
+        int phase;
+        int position;
+        int min;
+        int max;
+        int limit_from;
+    };
+
+    // with _mtex held
+    void write_reg(const uint8_t addr, Expander &expander, const uint8_t reg, const uint8_t value);
+    void update_motors(const uint8_t addr, const int port, const uint8_t outputs);
+    uint8_t read_port(const uint8_t addr, const int port);
+    void count_transfer(const int messages, const int bytes);
+    Motor &motor(const std::string &axis);
+
+    const double _clock_hz;
+    std::map < uint8_t, Expander > _expanders;
+    std::map < std::string, Motor > _motors;
+    I2cSimStats _stats;
+    boost::mutex _mtex;
+};
+
+typedef std::shared_ptr < SimulatedI2cBus > SimulatedI2cBusPtr;
+
+} // namespace BoulderAI
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/program_options.hpp>
+#include <opencv2/opencv.hpp>
+
+#include "frame.hpp"
+#include "http_server.hpp"
+
+namespace po = boost::program_options;
+
+class NvJPEGEncoder;
+
+namespace BoulderAI
+{
+
+struct JpegFrame
+{
+    uint64_t seq;               // increases by one per encoded frame
+    uint64_t sensor_timestamp;  // of the source frame, ns
+    std::vector < uint8_t > data;
+};
+
+typedef boost::shared_ptr < const JpegFrame > JpegFramePtr;
+
+/**
+ * Encodes frames to JPEG at a fixed size and rate on its own thread, and shares the latest
+ * encoded frame with every HTTP viewer: /snapshot.jpg returns it, and /mjpeg streams each new
+ * one as multipart/x-mixed-replace. Each frame is encoded at most once, whatever the number
+ * of viewers.
+ *
+ * Frames are scaled by the hardware converter and encoded by NvJPEGEncoder::encodeFromFd
+ * when the capture buffer's fd is available. Otherwise they are scaled with OpenCV and
+ * encoded with libjpeg.
+ */
+class JpegSource
+{
+public:
+    // options names
+    static const char *OPT_WIDTH;
+    static const char *OPT_HEIGHT;
+    static const char *OPT_FPS;
+    static const char *OPT_IDLE_FPS;
+    static const char *OPT_QUALITY;
+
+    // option defaults
+    static const int DEFAULT_WIDTH;
+    static const int DEFAULT_HEIGHT;
+    static const double DEFAULT_FPS;
+    static const double DEFAULT_IDLE_FPS;
+    static const int DEFAULT_QUALITY;
+
+    // option variables
+    static int _opt_width;
+    static int _opt_height;
+    static double _fps;
+    static double _idle_fps;
+    static int _quality;
+
+    static po::options_description GetOptions();
+
+    JpegSource();
+    virtual ~JpegSource();
+
+    void start();
+    void stop();
+
+    // Never blocks. Frames arriving faster than the configured rate are skipped, and only the
+    // newest frame waits for the encoder.
+    void push_frame(const FrameCollection &frame_col);
+
+    // latest encoded frame, or an empty pointer before the first one
+    JpegFramePtr get_latest();
+
+    // number of connected MJPEG viewers
+    int get_viewer_count();
+
+    // waits up to timeout_ms for a frame newer than seq
+    JpegFramePtr wait_for_frame(const uint64_t seq, const int timeout_ms);
+
+    // registers /snapshot.jpg and /mjpeg
+    void register_handlers(HttpServer &server);
+
+protected:
+    typedef boost::mutex::scoped_lock ScopedLock;
+
+    void run();
+    bool encode_hw(const FrameCollection &frame_col, std::vector < uint8_t > &out);
+    bool encode_sw(const FrameCollection &frame_col, std::vector < uint8_t > &out);
+
+    bool serve_snapshot(const HttpRequest &request, const int fd);
+    bool serve_mjpeg(const HttpRequest &request, const int fd);
+
+    const int _width;
+    const int _height;
+
+    bool _running;
+    bool _has_pending;
+    FrameCollection _pending;
+    uint64_t _last_accepted_ns;
+    uint64_t _last_frame_number;
+    int _viewers;
+    JpegFramePtr _latest;
+
+    // hardware path, disabled for good after the first failure
+    bool _use_hw;
+    NvJPEGEncoder *_encoder;
+    int _hw_fd;
+    std::vector < unsigned char > _hw_out;
+
+    // software path scratch planes
+    cv::Mat _y;
+    cv::Mat _u;
+    cv::Mat _v;
+
+    boost::mutex _mtex;
+    boost::condition_variable _condition;
+    boost::condition_variable _frame_condition;
+    boost::shared_ptr < boost::thread > _thread_ptr;
+};
+
+typedef boost::shared_ptr < JpegSource > JpegSourcePtr;
+
+} // namespace BoulderAI
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <deque>
+#include <map>
+#include <string>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#include "DNNCam.hpp"
+
+namespace BoulderAI
+{
+
+struct LensJobStatus
+{
+    int id;
+    std::string description;    // e.g. "focus_relative(500)"
+    std::string state;          // queued, running, done, failed or cancelled
+    int64_t queued_unix_ms;
+    int64_t duration_ms;        // run time so far, 0 while queued
+};
+
+/**
+ * Runs lens moves one at a time on a thread of its own, so a long move never holds up
+ * the thread that asked for it. Every move gets a job id that can be polled with
+ * get_status() and stopped with cancel(), whether it is still queued or already moving.
+ * The last MAX_FINISHED finished jobs are kept for get_status().
+ *
+ * Relative moves of the same kind queued one after the other (repeated arrow clicks) are
+ * merged into a single move, and a preempting move replaces whatever is running or queued.
+ */
+class LensJobs
+{
+public:
+    typedef boost::function < bool(void) > Move;
+    typedef boost::function < bool(int) > RelativeMove;
+    typedef boost::function < void(void) > DoneCallback;
+
+    static const size_t MAX_FINISHED;
+
+    LensJobs(DNNCamPtr dnncam);
+    virtual ~LensJobs();
+
+    void start();
+    void stop();
+
+    // called after every finished job, on the lens thread
+    void set_done_callback(const DoneCallback &callback);
+
+    // queues a move, returns its job id or -1 when stopped; a preempting move first
+    // cancels the running job and everything still queued
+    int add(const std::string &description, const Move &move, const bool preempt = false);
+
+    // queues move(steps) as name(steps); when the last queued job is a move of the same name
+    // the steps are added to it instead, and its id is returned
+    int add_relative(const std::string &name, const RelativeMove &move, const int steps);
+
+    // false for an unknown or forgotten job
+    bool get_status(const int id, LensJobStatus &status);
+
+    // false if the job is unknown or already finished
+    bool cancel(const int id);
+
+    // true while a job is running or queued
+    bool is_busy();
+
+protected:
+    typedef boost::mutex::scoped_lock ScopedLock;
+
+    enum State { QUEUED, RUNNING, DONE, FAILED, CANCELLED };
+
+    struct Job
+    {
+        std::string description;
+        Move move;
+        std::string relative_name;  // set for add_relative() jobs, which run relative(steps)
+        RelativeMove relative;
+        int steps;
+        State state;
+        bool cancel_requested;
+        int64_t queued_unix_ms;
+        uint64_t start_ms;      // monotonic
+        uint64_t end_ms;
+    };
+
+    // with _mtex held
+    int queue_job(const std::string &description, const Move &move);
+    void run();
+    void finish(const int id, const State state);
+
+    static const char *state_name(const State state);
+
+    DNNCamPtr _dnncam;
+    bool _running;
+    int _next_id;
+    int _running_id;            // 0 while idle
+    std::map < int, Job > _jobs;
+    std::deque < int > _queue;
+    std::deque < int > _finished;
+    DoneCallback _done_callback;
+
+    boost::mutex _mtex;
+    boost::condition_variable _condition;
+    boost::shared_ptr < boost::thread > _thread_ptr;
+};
+
+typedef boost::shared_ptr < LensJobs > LensJobsPtr;
+
+} // namespace BoulderAI
@@ -0,0 +1,91 @@
+#pragma once
+
+// Wiring of the lens board: the MCP23017 expanders, their registers and what each pin drives
+
+// Addresses of the chips on the I2C bus
+#define EXP0_ADDR 0x22  //U7 (Iris/Ircut)
+#define EXP1_ADDR 0x20  //U4 (Zoom, focus)
+#define EXP2_ADDR 0x21  //U5 (Power on mainboard)
+
+#define ZOOM_LIMIT      0x01 //pin U5.A.0
+#define ZOOM_DIR        0x02 //pin U5.A.1
+#define ZOOM_ENABLE     0x04 //pin U5.A.2
+#define ZOOM_STEP       0x08 //pin U5.A.3
+#define ZOOM_FAULT      0x10 //pin U5.A.4
+#define ZOOM_MS2        0X20 //pin U5.A.5
+#define ZOOM_MS1	0x40 //pin U5.A.6
+#define ZOOM_SLEEP	0x80 //pin U5.A.7
+#define ZOOM_AENBL 	ZOOM_ENABLE
+#define ZOOM_BENBL 	ZOOM_STEP
+#define ZOOM_APHASE 	ZOOM_MS1
+#define ZOOM_BPHASE	ZOOM_DIR
+#define ZOOM_EN1	ZOOM_MS2
+
+#define FOCUS_LIMIT     0x01 //pin U5.B.0
+#define FOCUS_DIR       0x02 //pin U5.B.1
+#define FOCUS_ENABLE    0x04 //pin U5.B.2
+#define FOCUS_STEP      0x08 //pin U5.B.3
+#define FOCUS_FAULT     0x10 //pin U5.B.4
+#define FOCUS_MS2       0X20 //pin U5.B.5
+#define FOCUS_MS1       0x40 //pin U5.B.6
+#define FOCUS_SLEEP     0x80 //pin U5.B.7
+#define FOCUS_AENBL      FOCUS_ENABLE
+#define FOCUS_BENBL      FOCUS_STEP
+#define FOCUS_APHASE     FOCUS_MS1
+#define FOCUS_BPHASE     FOCUS_DIR
+#define FOCUS_EN1        FOCUS_MS2
+
+#define PG		0x01 //pin U6.A.0
+#define IRIS_DIR        0x02 //pin U6.A.1
+#define IRIS_ENABLE     0x04 //pin U6.A.2
+#define IRIS_STEP       0x08 //pin U6.A.3
+#define IRIS_FAULT      0x10 //pin U6.A.4
+#define IRIS_MS2        0X20 //pin U6.A.5
+#define IRIS_MS1        0x40 //pin U6.A.6
+#define IRIS_SLEEP      0x80 //pin U6.A.7
+#define IRIS_AENBL      IRIS_ENABLE
+#define IRIS_BENBL      IRIS_STEP
+#define IRIS_APHASE     IRIS_MS1
+#define IRIS_BPHASE     IRIS_DIR
+#define IRIS_EN1        IRIS_MS2
+
+
+#define POWER_5V_EN_LDO    0x02 //pin U5.A.1
+#define PGOOD		   0x01 //pin U5.A.0
+#define POWER_4V_EN        0x80 //pin U5.B.7
+#define POWER_2_8V_EN      0x40 //pion U5.B.6
+#define POWER_1_8V_EN      0x20 //pin U5.B.5
+#define POWER_1_2V_EN      0x10 //pin U5.B.4
+#define POWER_5V_EN        0x08 //pin U5.B.3
+#define PG_4V		   0x04 //pin U5.B.2
+#define POWER_3_3V_EN      0x02 //pin U5.B.1
+#define PG_3_3V	           0x01 //pin U5.B.0
+
+
+#define IRCUT_A		   0x02 //pin U6.B.1
+#define IRCUT_B		   0x01 //pin U6.B.0
+
+#define REG_IOCON 0x0A
+#define REG_IODIRA 0x00
+#define REG_IODIRB 0x01
+#define REG_GPPUA 0x0C
+#define REG_GPPUB 0x0D
+#define REG_GPIOA 0x12
+#define REG_GPIOB 0x13
+
+#define REG_IOCON_VAL 0x00
+// Output direction is value 0
+#define REG_IODIRA_EXP1 0x11 //Fault, Pgood
+#define REG_IODIRB_EXP1 0x11 //Fault, Pgood
+#define REG_IODIRA_EXP0 0x00  
+#define REG_IODIRB_EXP0 0xE0 //Board ID
+#define REG_IODIRA_EXP2 0x01 //PGood, all others output
+#define REG_IODIRB_EXP2 (0x01 + 0x04) // U5.B.0,3 are input, all others output
+#define REG_GPPUA_VAL 0x00 // disable all pull-ups
+#define REG_GPPUB_VAL 0x00
+#define REG_GPIOA_EXP1 (ZOOM_SLEEP ) // wake up on init
+#define REG_GPIOB_EXP1 (FOCUS_SLEEP)
+#define REG_GPIOA_EXP2 0x00
+#define REG_GPIOB_EXP2 (POWER_1_8V_EN) //keep 1.8V on so level translator will work.
+#define REG_GPIOA_EXP0 (IRIS_SLEEP ) // wake up on init
+#define REG_GPIOB_EXP0 0x00
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <atomic>
+#include <list>
+#include <string>
+#include <vector>
+#include <boost/function.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "http_server.hpp"
+
+namespace BoulderAI
+{
+
+class MetricCounter
+{
+public:
+    MetricCounter() : _value(0) {}
+
+    void inc(const uint64_t n = 1) { _value.fetch_add(n, std::memory_order_relaxed); }
+    uint64_t get() const { return _value.load(std::memory_order_relaxed); }
+
+protected:
+    std::atomic < uint64_t > _value;
+};
+
+class MetricGauge
+{
+public:
+    MetricGauge() : _value(0) {}
+
+    void set(const int64_t value) { _value.store(value, std::memory_order_relaxed); }
+    void add(const int64_t n) { _value.fetch_add(n, std::memory_order_relaxed); }
+    int64_t get() const { return _value.load(std::memory_order_relaxed); }
+
+protected:
+    std::atomic < int64_t > _value;
+};
+
+/**
+ * Histogram of durations over fixed bucket bounds (in seconds). observe() only does a short
+ * scan of the bounds and two relaxed atomic adds, so it can be called on every frame.
+ */
+class MetricHistogram
+{
+public:
+    MetricHistogram(const std::vector < double > &bounds_s);
+
+    void observe_ns(const uint64_t ns);
+
+    const std::vector < double > &get_bounds() const { return _bounds_s; }
+    // per bucket (not cumulative) counts, the last one is +Inf
+    std::vector < uint64_t > get_counts() const;
+    uint64_t get_sum_ns() const { return _sum_ns.load(std::memory_order_relaxed); }
+
+protected:
+    std::vector < double > _bounds_s;
+    std::vector < uint64_t > _bounds_ns;
+    boost::scoped_array < std::atomic < uint64_t > > _counts;   // _bounds_ns.size() + 1
+    std::atomic < uint64_t > _sum_ns;
+};
+
+// a value filled in by a collector at scrape time, labels as for Metrics::counter()
+struct MetricSample
+{
+    std::string labels;
+    double value;
+};
+
+typedef boost::function < void(std::vector < MetricSample > &) > MetricCollector;
+
+/**
+ * Process wide registry of performance counters, served on /metrics in the Prometheus text
+ * exposition format (0.0.4).
+ *
+ * Metrics are created once, usually into a function local static, and then updated without
+ * any locking. Asking again for the same name and labels returns the same metric. Values that
+ * already live elsewhere (queue depths, per client stats) are read by collectors when
+ * /metrics is scraped instead of being copied on every change.
+ *
+ * labels is the inner part of a label set, e.g. label("method", "get_gain"), or "".
+ */
+class Metrics
+{
+public:
+    enum Type { COUNTER, GAUGE, HISTOGRAM };
+
+    static Metrics &registry();
+
+    // latency buckets from 100 us to 10 s
+    static const std::vector < double > &default_buckets();
+
+    // name="value", with the value escaped
+    static std::string label(const std::string &name, const std::string &value);
+
+    MetricCounter *counter(const std::string &name, const std::string &help, const std::string &labels = "");
+    MetricGauge *gauge(const std::string &name, const std::string &help, const std::string &labels = "");
+    MetricHistogram *histogram(const std::string &name, const std::string &help, const std::string &labels = "",
+                               const std::vector < double > &bounds_s = default_buckets());
+
+    // collectors are called on the HTTP thread serving /metrics
+    void add_collector(const std::string &name, const std::string &help, const Type type,
+                       const MetricCollector &collector);
+
+    // all metrics in text exposition format
+    std::string expose();
+
+    // registers /metrics
+    void register_handlers(HttpServer &server);
+
+protected:
+    typedef boost::mutex::scoped_lock ScopedLock;
+
+    struct Series
+    {
+        std::string labels;
+        boost::shared_ptr < MetricCounter > counter;
+        boost::shared_ptr < MetricGauge > gauge;
+        boost::shared_ptr < MetricHistogram > histogram;
+    };
+
+    struct Family
+    {
+        std::string name;
+        std::string help;
+        Type type;
+        std::list < Series > series;
+        std::vector < MetricCollector > collectors;
+    };
+
+    Metrics();
+
+    Family &get_family(const std::string &name, const std::string &help, const Type type);
+    Series &get_series(Family &family, const std::string &labels);
+
+    bool serve_metrics(const HttpRequest &request, const int fd);
+
+    // families in registration order; a list, so references stay valid
+    std::list < Family > _families;
+    boost::mutex _mtex;
+};
+
+} // namespace BoulderAI
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <map>
+#include <string>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <boost/program_options.hpp>
+
+#include "DNNCam.hpp"
+#include "DNNCamServer.hpp"
+#include "lens_jobs.hpp"
+#include "new_worker.hpp"
+
+namespace po = boost::program_options;
+
+namespace BoulderAI
+{
+
+/**
+ * Modbus TCP server for PLCs, on a single thread that polls every connection with epoll.
+ *
+ * Holding registers (input registers read the same values), 10 per axis as the old
+ * package/modbus.py had them:
+ *   0-3    focus home, absolute, relative (signed), location
+ *   10-13  zoom home, absolute, relative (signed), location
+ *   20-23  iris home, absolute, relative (signed), location
+ *   30     write n to recall the preset named "n"
+ *   31     write n to store the current lens positions, exposure and gain as preset "n"
+ *   32     1 while writes or lens jobs are running or queued
+ *   40     scene lux, 41 gain x100, 42 exposure time in us, from the last frame's metadata
+ * Writes go through the XMLRPC methods in-process, so they queue lens jobs and take the
+ * camera lock exactly as XMLRPC calls do. They are made in order by a worker thread and
+ * answered as soon as they are queued; a call that fails later (an unknown preset) is only
+ * logged. Reads only use values that are kept up to date anyway (live motor positions,
+ * capture metadata). The server thread therefore never waits for a lens move, the camera or
+ * a lock. Unknown and unused locations read as 0; -1 (not homed) reads as 65535.
+ */
+class ModbusServer
+{
+public:
+    // options names
+    static const char *OPT_PORT;
+
+    // option defaults
+    static const int DEFAULT_PORT;
+
+    // option variables
+    static int _port;
+
+    static po::options_description GetOptions();
+
+    // connections beyond this are closed right away
+    static const size_t MAX_CONNECTIONS = 16;
+    static const int MAX_ADDRESS = 42;
+    // writes beyond this, waiting for the worker, are refused as busy
+    static const int MAX_QUEUED_WRITES = 32;
+
+    ModbusServer(DNNCamServerPtr server, DNNCamPtr camera, const int port);
+    virtual ~ModbusServer();
+
+    void start();
+    void stop();
+
+protected:
+    struct Connection
+    {
+        std::string in;     // received bytes not yet making up a whole request
+        std::string out;    // responses the socket did not take yet
+    };
+
+    void run();
+    void accept_connection();
+    // false when the connection has to be closed
+    bool read_connection(const int fd, Connection &conn);
+    bool flush_connection(const int fd, Connection &conn);
+    void close_connection(const int fd);
+
+    // appends the response PDU to a request PDU
+    void handle_request(const uint8_t *pdu, const size_t size, std::string &response);
+    uint16_t read_register(const int address);
+    // the call a write of value to address makes, false for a register that cannot be written
+    bool write_call(const int address, const uint16_t value, std::string &method, xmlrpc_c::paramList &params);
+    // queues the calls of count written registers, values in request order; 0, or the
+    // Modbus exception code, in which case nothing was queued
+    uint8_t queue_writes(const int start, const int count, const uint8_t *values);
+    // on the write worker
+    void run_write(const std::string &method, xmlrpc_c::paramList const &params);
+    bool call(const std::string &method, xmlrpc_c::paramList const &params);
+
+    DNNCamServerPtr _server;
+    DNNCamPtr _camera;
+    LensJobsPtr _jobs;
+    const int _listen_port;
+    int _listen_fd;
+    int _epoll_fd;
+    int _wake_pipe[2];
+    std::atomic < bool > _running;
+    std::atomic < int > _pending_writes;    // queued or running on the write worker
+    bl::NewWorker < bl::Logexc_policy > _write_worker;
+    std::map < int, Connection > _connections;  // only used by the server thread
+    boost::shared_ptr < boost::thread > _thread_ptr;
+};
+
+typedef boost::shared_ptr < ModbusServer > ModbusServerPtr;
+
+} // namespace BoulderAI
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <boost/program_options.hpp>
+
+namespace po = boost::program_options;
+
+namespace BoulderAI
+{
+
+struct MotionStatus
+{
+    int moving_blocks;  // blocks that differ from the reference by more than the threshold
+    int blocks;
+    bool motion;        // moving_blocks reached motion-min-blocks
+};
+
+/**
+ * Motion detection on the Y plane, cheap enough for every frame of a 4K stream.
+ *
+ * The plane is downscaled by DECIMATION: every DECIMATION-th row is read and each run of
+ * DECIMATION pixels in it averaged, so only an eighth of the plane is touched. The small image
+ * is compared with a running average of the previous ones in BLOCK x BLOCK blocks by their sum
+ * of absolute differences; a block moves when its mean difference is above the threshold
+ * given by motion-sensitivity. When most of the image changes at once (exposure or IR cut
+ * switching, a lens move) that is not counted as motion and the reference starts over.
+ *
+ * The downscale and SAD kernels have NEON (aarch64) and SSE2 paths next to the scalar
+ * references (the _c variants), with identical results.
+ */
+class MotionDetector
+{
+public:
+    // options names
+    static const char *OPT_CAPTURE_MODE;
+    static const char *OPT_SENSITIVITY;
+    static const char *OPT_MIN_BLOCKS;
+    static const char *OPT_TRIGGER_FRAMES;
+    static const char *OPT_MIN_EVENT_S;
+    static const char *OPT_COOLDOWN_S;
+
+    // option defaults
+    static const std::string DEFAULT_CAPTURE_MODE;
+    static const int DEFAULT_SENSITIVITY;
+    static const int DEFAULT_MIN_BLOCKS;
+    static const int DEFAULT_TRIGGER_FRAMES;
+    static const double DEFAULT_MIN_EVENT_S;
+    static const double DEFAULT_COOLDOWN_S;
+
+    // option variables
+    static std::string _capture_mode;
+    static int _sensitivity;
+    static int _min_blocks;
+    static int _trigger_frames;
+    static double _min_event_s;
+    static double _cooldown_s;
+
+    static po::options_description GetOptions();
+
+    static const int DECIMATION = 8;    // source pixels per downscaled pixel, each way
+    static const int BLOCK = 16;        // downscaled pixels per block side
+
+    MotionDetector();
+
+    // 0 to 100; the higher, the smaller the change that counts
+    void set_sensitivity(const int sensitivity);
+    void set_min_blocks(const int min_blocks);
+
+    // compares the plane with the reference and updates it; false while there is no
+    // reference yet, e.g. for the first frame or after the frame size changed
+    bool process(const uint8_t *y, const int stride, const int width, const int height, MotionStatus &status);
+    void reset();
+
+    // dst[i] is the rounded mean of src[DECIMATION * i] to src[DECIMATION * i + DECIMATION - 1]
+    static void downscale_row(const uint8_t *src, uint8_t *dst, const int dst_w);
+    static void downscale_row_c(const uint8_t *src, uint8_t *dst, const int dst_w);
+
+    // sums[i] += SAD of the BLOCK bytes at a + BLOCK * i and b + BLOCK * i
+    static void block_sad_row(const uint8_t *a, const uint8_t *b, uint32_t *sums, const int blocks);
+    static void block_sad_row_c(const uint8_t *a, const uint8_t *b, uint32_t *sums, const int blocks);
+
+    // Name of the vector extension in use, for logging
+    static const char *simd_name();
+
+protected:
+    void update_reference();
+
+    int _threshold;     // SAD of a whole block
+    int _motion_blocks; // moving blocks that make a frame count as motion
+    int _width;         // downscaled size
+    int _height;
+    bool _have_reference;
+    std::vector < uint8_t > _small;
+    std::vector < uint16_t > _reference;    // running average, 8.8 fixed point
+    std::vector < uint8_t > _reference8;    // the same, rounded to 8 bits for the SAD
+    std::vector < uint32_t > _sums;
+};
+
+} // namespace BoulderAI
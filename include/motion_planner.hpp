@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+namespace BoulderAI
+{
+
+/**
+ * Speed limits of one lens axis, in full steps. A motor can start and stop at start_speed
+ * without losing steps; faster speeds have to be reached by accelerating.
+ */
+struct MotionProfile
+{
+    double start_speed;     // steps/s
+    double max_speed;       // steps/s
+    double acceleration;    // steps/s^2, 0 to always step at start_speed
+};
+
+/**
+ * Trapezoidal step schedule: the time in ns from each of the steps to the next one (and, for
+ * the last step, until the coils may be released). Accelerates from start_speed at the given
+ * acceleration, cruises at max_speed and decelerates to start_speed for the last step; short
+ * moves that never reach max_speed turn around half way.
+ */
+std::vector < uint32_t > plan_steps(const MotionProfile &profile, const int steps);
+
+} // namespace BoulderAI
@@ -1,17 +1,31 @@
 #pragma once
 
 #include <stdint.h>
+#include <atomic>
 #include <iostream>
 #include <memory>
 
 #include <boost/function.hpp>
 
+#include "i2c_bus.hpp"
+#include "motion_planner.hpp"
+#include "position_journal.hpp"
+
 namespace BoulderAI
 {
 
+// relative steps of each lens axis, moved together by MotorDriver::move()
+struct LensSteps
+{
+    int zoom;
+    int focus;
+    int iris;
+};
+
 class MotorDriver {
 public:
-    MotorDriver(bool doInit, boost::function < void(std::string) > log_callback);
+    // without a bus, init() opens /dev/i2c-6 and journals the lens positions
+    MotorDriver(bool doInit, boost::function < void(std::string) > log_callback, I2cBusPtr bus = I2cBusPtr());
     ~MotorDriver();
 
     bool init();
@@ -24,6 +38,9 @@ public:
     bool zoomAbsolute(int steps);
     bool zoomRelative(int steps);
     int  zoomAbsoluteLocation() { return zoom_abs_location; }
+    // whether the location is a position; an axis that is not homed still counts its steps
+    // from -1, so its location means nothing
+    bool zoomHomed() { return zoom_init; }
 
     bool focusUp(int steps);
     bool focusDown(int steps);
@@ -32,6 +49,7 @@ public:
     bool focusAbsolute(int steps);
     bool focusRelative(int steps);
     int  focusAbsoluteLocation() { return focus_abs_location; }
+    bool focusHomed() { return focus_init; }
 
     bool irisUp(int steps);
     bool irisDown(int steps);
@@ -40,6 +58,16 @@ public:
     bool irisAbsolute(int steps);
     bool irisRelative(int steps);
     int  irisAbsoluteLocation() { return iris_abs_location; }
+    bool irisHomed() { return iris_init; }
+
+    // moves the axes at the same time, each on its own speed profile, so the move takes as
+    // long as the longest axis; steps of zoom and focus that coincide are one register write
+    bool move(const LensSteps &steps);
+
+    // stops the move in progress, from any thread, and every later one until clearCancel()
+    void cancelMoves();
+    void clearCancel();
+    bool isCancelled() { return _cancel; }
 
     bool ircutOn();
     bool ircutOff();
@@ -51,34 +79,76 @@ public:
 
 private:
     enum class MotorDirection { UP, DOWN };
+
+    // the two phase outputs of one stepper on an expander port
+    struct StepChannel {
+        uint8_t addr;
+        uint8_t reg;
+        char *gpio;         // shadow of the port's output latch
+        uint8_t aphase;
+        uint8_t bphase;
+        bool reverse;       // positive steps run the phase cycle backwards
+        std::atomic < int > *location;
+        MotionProfile profile;
+    };
+
     bool initExpanders();
+    // takes the positions from the journal, unless a limit switch disagrees
+    void restorePositions();
+    // records the positions and which are known; the moving axes are recorded as unknown.
+    // Nothing is written when that is what the journal already holds, so steps of an axis
+    // that is journaled as unknown (homing) cost no disk writes.
+    void journalPositions(const unsigned moving, const bool sync);
+    // all writes as one transfer on the bus
+    bool writeMessages(const I2cWrite *writes, int count);
     bool writeReg(uint8_t addr, uint8_t regaddr, uint8_t data);
     bool readReg(uint8_t addr, uint8_t regaddr, uint8_t& res);
     bool printReg(uint8_t addr, uint8_t regaddr);
 
     bool enableZoom();
     bool disableZoom();
-    bool zoom(int steps);
+    // steps taken, fewer than requested when cancelled; the location follows every step
+    int zoom(int steps);
     bool zoomLimit();
 
     bool enableFocus();
     bool disableFocus();
-    bool focus(int steps);
+    // steps taken, fewer than requested when cancelled
+    int focus(int steps);
     bool focusLimit();
 
     bool enableIris();
     bool disableIris();
-    bool iris(int steps);
-
-    int fd_;
+    // steps taken, fewer than requested when cancelled
+    int iris(int steps);
+    StepChannel zoomChannel();
+    StepChannel focusChannel();
+    StepChannel irisChannel();
+    int axisOf(const StepChannel &channel);
+    // after lost steps: the axis has to be homed again
+    void forgetPosition(const int axis);
+    // steps taken, fewer than requested when cancelled or when a write fails
+    int step(const StepChannel &channel, int steps);
+    // steps the axes on merged schedules; taken gets the signed steps each one took, false
+    // when a write failed
+    bool stepAxes(const StepChannel *channels, const int *steps, int *taken, const int count);
+
+    I2cBusPtr _bus;
     static int addr0, addr1, addr2;
     char exp0_gpioa, exp0_gpiob, exp1_gpioa, exp1_gpiob, exp2_gpioa, exp2_gpiob;
-    bool zoom_init;
-    int zoom_abs_location;
-    bool focus_init;
-    int focus_abs_location;
-    bool iris_init;
-    int iris_abs_location;
+    std::atomic < bool > zoom_init;
+    std::atomic < int > zoom_abs_location;
+    std::atomic < bool > focus_init;
+    std::atomic < int > focus_abs_location;
+    std::atomic < bool > iris_init;
+    std::atomic < int > iris_abs_location;
+    std::atomic < bool > _cancel;
+    PositionJournal _journal;
+    // the last record written, and whether it is on disk
+    bool _journal_written;
+    bool _journal_synced;
+    unsigned _journal_known;
+    int _journal_positions[PositionJournal::AXES];
 
     boost::function < void(std::string) > _log_callback;
 };
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+namespace BoulderAI
+{
+
+/**
+ * Crash-safe record of where the lens axes are, so a restart does not have to home them.
+ *
+ * Every write() appends a small checksummed record of all axis positions and which of them
+ * are known; the newest intact record is the state. Before a move the moving axes are
+ * written as unknown and synced, and after the move their new positions are written without
+ * waiting for the disk: that record reaches the disk with the next synced write (or sync(),
+ * or close). A crash therefore never leaves a stale position behind, at worst an axis that
+ * has to be homed again. The file is rewritten with just the newest record once it grows
+ * past MAX_BYTES.
+ */
+class PositionJournal
+{
+public:
+    static const int AXES = 3;
+    static const size_t MAX_BYTES;
+
+    PositionJournal();
+    virtual ~PositionJournal();
+
+    // opens or creates the journal, false if it cannot be used
+    bool open(const std::string &path);
+    void close();
+    bool is_open() const { return _fd >= 0; }
+
+    // the newest state found by open(), false when there was none
+    bool restore(int positions[AXES], unsigned &known_mask) const;
+
+    // known_mask has bit i set when positions[i] is valid; with sync the record, and every
+    // record before it, is on disk when this returns
+    bool write(const int positions[AXES], const unsigned known_mask, const bool sync);
+    void sync();
+
+protected:
+    struct Record;
+
+    bool append(const Record &record);
+    bool compact(const Record &record);
+
+    std::string _path;
+    int _fd;
+    uint32_t _seq;
+    uint64_t _size;
+    bool _dirty;
+
+    bool _restored;
+    int _positions[AXES];
+    unsigned _known_mask;
+};
+
+} // namespace BoulderAI
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/thread/mutex.hpp>
+
+namespace BoulderAI
+{
+
+struct LensPreset
+{
+    std::string name;
+    int zoom;
+    int focus;
+    int iris;
+    // camera settings, only applied on recall when stored with the preset
+    bool has_exposure;
+    uint64_t exposure_min;  // ns
+    uint64_t exposure_max;
+    bool has_gain;
+    float gain_min;
+    float gain_max;
+};
+
+/**
+ * Named lens positions, e.g. "gate" or "wide", with optional exposure and gain. The table is
+ * read once at startup and kept in memory, so a recall never touches the disk; it is a text
+ * file of "name zoom focus iris exposure_min exposure_max gain_min gain_max" lines next to
+ * lensdriver.cfg, with "- -" for settings that are not stored.
+ */
+class PresetTable
+{
+public:
+    // false when the file is missing; the table is then empty
+    bool load(const std::string &path);
+    bool save(const std::string &path);
+
+    // names are a single word
+    static bool valid_name(const std::string &name);
+
+    // adds the preset, or replaces the one with the same name
+    void set(const LensPreset &preset);
+    bool remove(const std::string &name);
+    bool find(const std::string &name, LensPreset &preset);
+    std::vector < LensPreset > get_presets();
+
+protected:
+    typedef boost::mutex::scoped_lock ScopedLock;
+
+    boost::mutex _mtex;
+    boost::mutex _save_mtex;    // held from the snapshot to the rename, so saves land in order
+    std::map < std::string, LensPreset > _presets;
+};
+
+} // namespace BoulderAI
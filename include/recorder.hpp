@@ -0,0 +1,171 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <string>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/program_options.hpp>
+
+#include <gst/gst.h>
+
+#include "frame.hpp"
+#include "async_writer.hpp"
+
+namespace po = boost::program_options;
+
+namespace BoulderAI
+{
+
+struct RecordedSegment
+{
+    std::string name;           // file name, relative to the recording directory
+    int64_t start_unix_ms;
+    int64_t duration_ms;
+    uint64_t bytes;
+    uint64_t event_id;          // unix ms of the start of the event
+};
+
+// called on the recorder's I/O thread once a segment file is complete
+typedef boost::function < void(const RecordedSegment &) > SegmentCallback;
+
+struct RecorderStats
+{
+    bool recording;
+    uint64_t event_id;          // current or last event, 0 before the first
+    std::string segment;        // file name of the segment being written, or ""
+    uint64_t segments;          // completed segments since start
+    uint64_t frames;            // frames encoded since start
+    uint64_t dropped_frames;    // frames lost because the encoder or the disk fell behind
+    uint64_t written_bytes;
+    uint64_t dropped_bytes;     // encoded data of discarded segments
+    uint64_t io_queue_bytes;
+};
+
+/**
+ * Records events to fixed-duration segment files in the export directory.
+ *
+ * Frames of an event are encoded once to H.265 on the recorder's own thread. The encoded
+ * stream is cut at the first key frame after every segment-seconds and each piece is muxed
+ * into its own MKV or fragmented MP4 file. Nothing touches the disk on the caller's thread:
+ * the muxed data goes through an AsyncWriter, and every completed segment is reported to
+ * the segment callback.
+ *
+ * push_frame() never blocks. When the disk falls behind, whole frames are dropped before the
+ * encoder; should encoded data still be lost, the segment is discarded and a new one starts
+ * at the next key frame. The first frame after end_event() starts a new event.
+ */
+class Recorder
+{
+public:
+    // options names
+    static const char *OPT_DIR;
+    static const char *OPT_SEGMENT_SECONDS;
+    static const char *OPT_CONTAINER;
+    static const char *OPT_BITRATE;
+    static const char *OPT_KEYFRAME_INTERVAL;
+    static const char *OPT_WRITE_BATCH_KB;
+    static const char *OPT_IO_QUEUE_MB;
+
+    // option defaults
+    static const std::string DEFAULT_DIR;
+    static const uint32_t DEFAULT_SEGMENT_SECONDS;
+    static const std::string DEFAULT_CONTAINER;
+    static const uint32_t DEFAULT_BITRATE;
+    static const uint32_t DEFAULT_KEYFRAME_INTERVAL;
+    static const uint32_t DEFAULT_WRITE_BATCH_KB;
+    static const uint32_t DEFAULT_IO_QUEUE_MB;
+
+    // option variables
+    static std::string _dir;
+    static uint32_t _segment_seconds;
+    static std::string _container;
+    static uint32_t _bitrate;
+    static uint32_t _keyframe_interval;
+    static uint32_t _write_batch_kb;
+    static uint32_t _io_queue_mb;
+
+    static po::options_description GetOptions();
+
+    Recorder(const int width, const int height, const size_t max_queued_frames);
+    virtual ~Recorder();
+
+    // set before start()
+    void set_segment_callback(SegmentCallback callback);
+
+    void start();
+    void stop();
+
+    // queues a frame of the current event, frames must arrive in capture order
+    void push_frame(const FrameCollection &frame_col);
+    // finishes the current event once the frames queued so far are written
+    void end_event();
+
+    RecorderStats get_stats();
+
+protected:
+    typedef boost::mutex::scoped_lock ScopedLock;
+
+    struct QueueEntry
+    {
+        bool end_event;
+        uint64_t event_id;
+        FrameCollection frame_col;
+    };
+
+    void run();
+    bool start_encoder();
+    void stop_encoder();
+    void encode_frame(const FrameCollection &frame_col);
+
+    bool open_segment(GstSample *sample, const GstClockTime pts);
+    void close_segment();
+    void segment_closed(const std::string &path, const uint64_t bytes, const uint64_t event_id,
+                        const int64_t start_unix_ms, const int64_t duration_ms);
+
+    static GstFlowReturn on_encoded_sample(GstElement *sink, gpointer user_data);
+    static GstFlowReturn on_muxed_sample(GstElement *sink, gpointer user_data);
+
+    const int _width;
+    const int _height;
+    const size_t _max_queued_frames;
+    const size_t _shed_io_bytes;    // frames are dropped while this much waits for the disk
+
+    AsyncWriter _writer;
+    SegmentCallback _segment_callback;
+
+    bool _running;
+    bool _in_event;
+    std::deque < QueueEntry > _queue;
+    RecorderStats _stats;
+
+    // encoder, lives for one event; only touched by the recorder thread
+    GstElement *_encoder;
+    GstElement *_encoder_src;
+    uint64_t _event_id;
+    uint64_t _event_base_ns;
+    int64_t _event_unix_offset_ns;  // add to a sensor timestamp for the wall clock time
+    GstClockTime _last_pts;
+
+    // current segment, touched by the encoder's streaming thread and by the recorder thread
+    // once the encoder is drained
+    GstElement *_muxer;
+    GstElement *_muxer_src;
+    int _segment_file;
+    std::string _segment_path;
+    GstClockTime _segment_start;
+    GstClockTime _segment_end;
+    std::atomic < bool > _segment_failed;  // the writer dropped data of the current segment
+
+    boost::mutex _mtex;
+    boost::mutex _segment_mtex;
+    boost::condition_variable _condition;
+    boost::shared_ptr < boost::thread > _thread_ptr;
+};
+
+typedef boost::shared_ptr < Recorder > RecorderPtr;
+
+} // namespace BoulderAI
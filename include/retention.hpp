@@ -0,0 +1,135 @@
+#pragma once
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/program_options.hpp>
+
+#include "recorder.hpp"
+
+namespace po = boost::program_options;
+
+namespace BoulderAI
+{
+
+struct RecordedEvent
+{
+    uint64_t event_id;
+    int64_t start_unix_ms;
+    int64_t end_unix_ms;
+    uint64_t bytes;
+    int segments;
+    bool is_protected;
+};
+
+struct RetentionStats
+{
+    uint64_t segments;
+    uint64_t events;
+    uint64_t bytes;
+    uint64_t quota_bytes;
+    int64_t oldest_unix_ms;     // start of the oldest segment kept, 0 without segments
+    uint64_t evicted_segments;  // since start
+    uint64_t evicted_bytes;
+};
+
+/**
+ * Keeps the recording directory within a byte quota and a maximum age.
+ *
+ * Every recorded segment is kept in an in-memory index, ordered by start time, which is
+ * persisted to segments.idx in the recording directory. A background thread running at idle
+ * I/O priority evicts the oldest segments with unlinkat() whenever the quota or the age limit
+ * is exceeded. Segments of protected events are never evicted; the protected event ids are
+ * kept in protected.idx.
+ *
+ * At startup the index is rebuilt from segments.idx and a single pass over the directory
+ * entries. Only files missing from the index are stat()ed and no recording is ever opened,
+ * so this stays fast with many thousands of files.
+ */
+class RetentionManager
+{
+public:
+    // options names
+    static const char *OPT_QUOTA_MB;
+    static const char *OPT_MAX_AGE_HOURS;
+    static const char *OPT_INTERVAL_S;
+
+    // option defaults
+    static const uint32_t DEFAULT_QUOTA_MB;
+    static const uint32_t DEFAULT_MAX_AGE_HOURS;
+    static const uint32_t DEFAULT_INTERVAL_S;
+
+    // option variables
+    static uint32_t _quota_mb;
+    static uint32_t _max_age_hours;
+    static uint32_t _interval_s;
+
+    static const char *INDEX_FILE;
+    static const char *PROTECTED_FILE;
+
+    static po::options_description GetOptions();
+
+    RetentionManager(const std::string &dir);
+    virtual ~RetentionManager();
+
+    void start();
+    void stop();
+
+    // adds a completed segment to the index, the recorder's segment callback
+    void add_segment(const RecordedSegment &segment);
+
+    // protected events are kept regardless of quota and age; false for an unknown event
+    bool set_protected(const uint64_t event_id, const bool is_protected);
+
+    std::vector < RecordedEvent > get_events();
+    RetentionStats get_stats();
+
+protected:
+    typedef boost::mutex::scoped_lock ScopedLock;
+
+    // ordered by start time, then name
+    typedef std::pair < int64_t, std::string > SegmentKey;
+    typedef std::map < SegmentKey, RecordedSegment > SegmentMap;
+
+    void run();
+    void load_protected();
+    void load_index(SegmentMap &segments);
+    void scan_directory(SegmentMap &segments);
+    bool evict();
+    void write_index();
+    void write_protected();
+    void insert_segment(const RecordedSegment &segment);
+    uint64_t quota_bytes();
+
+    static std::string format_segment(const RecordedSegment &segment);
+    static bool parse_segment(const std::string &line, RecordedSegment &segment);
+    static bool parse_segment_name(const std::string &name, int64_t &start_unix_ms);
+
+    const std::string _dir;
+    const time_t _start_time;
+    int _dir_fd;
+
+    bool _running;
+    bool _loaded;
+    bool _index_dirty;
+    SegmentMap _segments;
+    std::set < uint64_t > _protected;
+    uint64_t _bytes;
+    uint64_t _evicted_segments;
+    uint64_t _evicted_bytes;
+
+    boost::mutex _mtex;
+    // serializes appends to segments.idx with rewrites of it
+    boost::mutex _index_mtex;
+    boost::condition_variable _condition;
+    boost::shared_ptr < boost::thread > _thread_ptr;
+};
+
+typedef boost::shared_ptr < RetentionManager > RetentionManagerPtr;
+
+} // namespace BoulderAI
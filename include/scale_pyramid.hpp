@@ -0,0 +1,46 @@
+#pragma once
+
+#include <vector>
+
+#include "frame.hpp"
+#include "scaler.hpp"
+
+namespace BoulderAI
+{
+
+/**
+ * Downscaled copies of the current frame, computed once per frame and shared by every
+ * stream that needs them. Level n is 1/2^n of the full frame; level 0 is not stored.
+ *
+ * When the frame carries the dmabuf fd of its YUV NvBuffer, each level is scaled by the
+ * hardware converter (NvBufferTransform). Otherwise, or if the converter fails, the levels
+ * are built on the CPU by repeatedly halving with the SIMD Scaler.
+ */
+class ScalePyramid
+{
+public:
+    static const int MAX_LEVELS = 4;
+
+    ScalePyramid(const int width, const int height);
+    virtual ~ScalePyramid();
+
+    // Computes the levels set in level_mask (bit n for level n) for this frame
+    void build(const FrameCollection &frame_col, const unsigned level_mask);
+
+    const I420Image &level(const int n) const { return _levels[n]; }
+
+    static int level_width(const int width, const int n);
+    static int level_height(const int height, const int n);
+
+protected:
+    bool hw_scale(const int src_fd, const int n);
+    void destroy_hw_buffers();
+
+    const int _width;
+    const int _height;
+    bool _use_hw;
+    std::vector < I420Image > _levels;
+    std::vector < int > _hw_fds;   // one NvBuffer per level, created on first use
+};
+
+} // namespace BoulderAI
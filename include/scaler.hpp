@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+namespace BoulderAI
+{
+
+/**
+ * Planar I420 image in one contiguous buffer: Y plane followed by the 2x2 subsampled
+ * U and V planes, the same layout the RTSP appsrc expects.
+ */
+struct I420Image
+{
+    I420Image() : width(0), height(0) {}
+
+    void resize(const int w, const int h)
+    {
+        width = w;
+        height = h;
+        data.resize(size());
+    }
+
+    size_t size() const { return width * height * 3 / 2; }
+
+    uint8_t *y() { return data.data(); }
+    uint8_t *u() { return data.data() + width * height; }
+    uint8_t *v() { return data.data() + width * height + (width / 2) * (height / 2); }
+    const uint8_t *y() const { return data.data(); }
+    const uint8_t *u() const { return data.data() + width * height; }
+    const uint8_t *v() const { return data.data() + width * height + (width / 2) * (height / 2); }
+
+    int width;
+    int height;
+    std::vector < uint8_t > data;
+};
+
+/**
+ * CPU plane scaling, used when the hardware converter is not available.
+ * The vectorized paths (NEON on aarch64, SSE2 on x86) produce exactly the same output
+ * as the scalar reference.
+ */
+class Scaler
+{
+public:
+    // Averages each 2x2 block of src (rounding to nearest) into one pixel of dst.
+    // Requires 2 * dst_w <= source width and 2 * dst_h <= source height.
+    static void half_plane(const uint8_t *src, const int src_stride,
+                           uint8_t *dst, const int dst_stride, const int dst_w, const int dst_h);
+
+    // Scalar reference for half_plane()
+    static void half_plane_c(const uint8_t *src, const int src_stride,
+                             uint8_t *dst, const int dst_stride, const int dst_w, const int dst_h);
+
+    // Halves all three planes of src into dst; dst is resized to the even half size of src.
+    static void half_i420(const I420Image &src, I420Image &dst);
+
+    // Even dimension of the next pyramid level, so the chroma planes stay exactly half size
+    static int half_dim(const int dim) { return (dim / 2) & ~1; }
+
+    // Name of the vector extension used by half_plane(), for logging
+    static const char *simd_name();
+};
+
+} // namespace BoulderAI
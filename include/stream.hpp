@@ -5,20 +5,60 @@
 #include <boost/thread.hpp>
 #include <boost/thread/mutex.hpp>
 #include <unordered_map>
+#include <vector>
+#include <boost/program_options.hpp>
 
 #include <gst/gst.h>
 #include <gst/rtsp-server/rtsp-server.h>
 
 #include "frame.hpp"
+#include "stream_client.hpp"
+#include "scale_pyramid.hpp"
 
 namespace pt = boost::posix_time;
+namespace po = boost::program_options;
 
 namespace BoulderAI
 {
 
+/**
+ * Relation between the sensor timestamps, the pipeline clock that every RTSP media runs on
+ * and the wall clock, sampled at the most recent streamed frame.
+ */
+struct StreamClockInfo
+{
+    uint64_t frame_number;
+    uint64_t sensor_timestamp;  // ns, CLOCK_MONOTONIC domain
+    uint64_t clock_time;        // capture time on the pipeline clock, ns
+    int64_t unix_time;          // capture time on the wall clock, ns since 1970
+};
+
 class Stream
 {
 public:
+    // options names
+    static const char *OPT_CLIENT_QUEUE_FRAMES;
+    static const char *OPT_CLIENT_MAX_BYTES;
+    static const char *OPT_BITRATE;
+    static const char *OPT_MOUNTS;
+    static const char *OPT_LATENCY_MS;
+
+    // option defaults
+    static const uint32_t DEFAULT_CLIENT_QUEUE_FRAMES;
+    static const uint64_t DEFAULT_CLIENT_MAX_BYTES;
+    static const uint32_t DEFAULT_BITRATE;
+    static const std::vector < std::string > DEFAULT_MOUNTS;
+    static const uint32_t DEFAULT_LATENCY_MS;
+
+    // option variables
+    static uint32_t _client_queue_frames;
+    static uint64_t _client_max_bytes;
+    static uint32_t _bitrate;
+    static std::vector < std::string > _mounts;
+    static uint32_t _latency_ms;
+
+    static po::options_description GetOptions();
+
     Stream(const int width, const int height, const std::string host = "0.0.0.0", const int port = 9090);
     virtual ~Stream();
 
@@ -26,24 +66,64 @@ public:
     void stop(); 
     void push_frame(const FrameCollection frame_col);
 
+    // per-client queue depth and drop counters, one entry per connected client
+    std::vector < StreamClientStats > get_client_stats();
+
+    // sensor/pipeline/wall clock mapping of the last streamed frame
+    StreamClockInfo get_clock_info();
+
 protected:
 
-    using ElementMap = std::unordered_map<GstElement*, GstElement*>;
+    struct MountConfig {
+        std::string path;
+        int level;          // pyramid level, the mount is 1/2^level of the full frame
+        int decimation;     // only every n-th frame is sent
+        uint32_t bitrate;   // encoder bitrate, 0 for the encoder default
+        bool gray;          // send only the Y plane, with neutral chroma
+    };
+    static bool parse_mount(const std::string &spec, MountConfig &mount);
+
+    using ClientMap = std::unordered_map<GstElement*, StreamClientPtr>;
     struct streamContext {
+        MountConfig mount;
         int width;
         int height;
-        ElementMap elementMap;
-    } _streamContext;
-    // Protect the streamContext
+        size_t max_frames;
+        size_t max_bytes;
+        int next_client_id;
+        uint64_t last_frame_number;     // frame number of the last frame sent, for gap detection
+        GstClockTime last_capture_time; // for the buffer duration
+        ClientMap clients;
+    };
+    typedef boost::shared_ptr < streamContext > StreamContextPtr;
+    // One context per mount point, the first one is the full resolution /stream
+    std::vector < StreamContextPtr > _contexts;
+    // Protect the streamContexts
     static std::mutex _context_mutex;
 
+    void add_mount(GstRTSPMountPoints *mounts, const MountConfig &mount);
+    GstBuffer *make_buffer(const FrameCollection &frame_col, const streamContext &sc);
+    GstClockTime capture_time(const FrameCollection &frame_col);
+
     static void media_configure(GstRTSPMediaFactory * factory, GstRTSPMedia * media, gpointer user_data);
+    static void element_added(GstBin * bin, GstElement * element, gpointer user_data);
     static void rgb_to_i420(unsigned char *rgb, unsigned char *yuv420, int width, int height); 
     static void rgba_to_i420(unsigned char *rgb, unsigned char *yuv420, int width, int height); 
     static inline void rgb_to_yuv(unsigned char b, unsigned char g, unsigned char r, unsigned char & y, unsigned char & u, unsigned char & v);
 
     const std::string _host;
     const int _port;
+    const int _width;
+    const int _height;
+
+    ScalePyramid _pyramid;
+    uint64_t _frame_count;
+
+    // All media run on this clock, sensor timestamps are mapped onto it once
+    GstClock *_clock;
+    bool _clock_mapped;
+    GstClockTimeDiff _clock_offset;
+    StreamClockInfo _clock_info;
 
     boost::shared_ptr<boost::thread> _thread_ptr;
 
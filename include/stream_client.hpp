@@ -0,0 +1,93 @@
+#pragma once
+
+#include <deque>
+#include <string>
+#include <vector>
+#include <boost/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <gst/gst.h>
+
+namespace BoulderAI
+{
+
+struct StreamClientStats
+{
+    std::string mount;      // RTSP mount point the client is watching
+    int id;
+    size_t queue_depth;     // frames currently waiting for this client
+    size_t queue_bytes;     // bytes currently waiting for this client
+    uint64_t pushed_frames;
+    uint64_t pushed_bytes;
+    uint64_t dropped_frames;
+    bool need_data;         // false while the appsrc has signalled enough-data
+};
+
+/**
+ * Feeds the appsrc of a single RTSP client from its own bounded queue on its own thread.
+ *
+ * Stream::push_frame() only hands a reference to the frame buffer to every client, so a
+ * congested client can never hold up the other clients or the frame pipeline. When the
+ * queue is full (by frame count or bytes) the oldest frame is dropped. The client stops
+ * pushing while the appsrc reports enough-data and resumes on need-data.
+ *
+ * Buffers are expected to carry the capture time on the pipeline clock as PTS; the client
+ * converts it to the running time of its own pipeline and flags the buffer following any
+ * dropped frames as a discontinuity.
+ */
+class StreamClient
+{
+public:
+    StreamClient(GstElement *appsrc, GstElement *media_element, const int id,
+                 const size_t max_frames, const size_t max_bytes);
+    virtual ~StreamClient();
+
+    void start();
+    void stop();
+
+    // takes its own reference on the buffer; never blocks
+    void enqueue(GstBuffer *buffer);
+
+    // false once a push failed, which most likely means the client disconnected
+    bool is_alive();
+
+    StreamClientStats get_stats();
+
+protected:
+    typedef boost::mutex::scoped_lock ScopedLock;
+
+    void run();
+    void clear_queue();
+
+    static void need_data(GstElement *appsrc, guint length, gpointer user_data);
+    static void enough_data(GstElement *appsrc, gpointer user_data);
+
+    GstElement *_appsrc;
+    GstElement *_media_element;
+    const int _id;
+    const size_t _max_frames;
+    const size_t _max_bytes;
+
+    gulong _need_data_handler;
+    gulong _enough_data_handler;
+
+    std::deque < GstBuffer * > _queue;
+    size_t _queue_bytes;
+    uint64_t _pushed_frames;
+    uint64_t _pushed_bytes;
+    uint64_t _dropped_frames;
+    bool _need_data;
+    bool _discont;          // frames were dropped since the last push
+    bool _alive;
+    bool _running;
+
+    boost::mutex _mtex;
+    boost::condition_variable _condition;
+    boost::shared_ptr < boost::thread > _thread_ptr;
+};
+
+typedef boost::shared_ptr < StreamClient > StreamClientPtr;
+
+} // namespace BoulderAI
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/program_options.hpp>
+
+#include "http_server.hpp"
+
+namespace po = boost::program_options;
+
+namespace BoulderAI
+{
+
+// telemetry values by name, each already formatted as JSON
+typedef std::map < std::string, std::string > TelemetryValues;
+typedef boost::function < void(TelemetryValues &) > TelemetrySource;
+
+/**
+ * Pushes live telemetry to browsers as Server-Sent Events on /events.
+ *
+ * The sources are sampled on the telemetry thread every interval, or sooner after notify(),
+ * but never more often than max-rate. Every client receives only the values that changed
+ * since its last event, as one JSON object per event; its first event holds everything.
+ * A slow client simply gets the accumulated changes in its next event. Event ids are
+ * change versions, so a reconnecting EventSource resumes with the changes it missed.
+ *
+ * Without clients the sources are not sampled at all, and connected clients sleep until
+ * something changed, apart from a comment every 15 s that detects dead connections.
+ */
+class Telemetry
+{
+public:
+    // options names
+    static const char *OPT_MAX_RATE;
+    static const char *OPT_INTERVAL_MS;
+
+    // option defaults
+    static const double DEFAULT_MAX_RATE;
+    static const int DEFAULT_INTERVAL_MS;
+
+    // option variables
+    static double _max_rate;
+    static int _interval_ms;
+
+    static po::options_description GetOptions();
+
+    Telemetry(const double max_rate, const int interval_ms);
+    virtual ~Telemetry();
+
+    // sources are called on the telemetry thread; add them before start()
+    void add_source(const TelemetrySource &source);
+
+    void start();
+    void stop();
+
+    // something changed, sample soon
+    void notify();
+
+    // registers /events
+    void register_handlers(HttpServer &server);
+
+    int get_client_count();
+
+protected:
+    typedef boost::mutex::scoped_lock ScopedLock;
+
+    struct Entry
+    {
+        std::string value;
+        uint64_t version;   // version of the sample that last changed it
+    };
+
+    void run();
+    void sample();
+    // JSON object of the values changed after version since
+    std::string get_changes(const uint64_t since);
+
+    bool serve_events(const HttpRequest &request, const int fd);
+
+    const double _rate;
+    const int _interval;
+
+    bool _running;
+    bool _notified;
+    int _clients;
+    uint64_t _version;
+    std::map < std::string, Entry > _values;
+    std::vector < TelemetrySource > _sources;
+
+    boost::mutex _mtex;
+    // wakes the telemetry thread
+    boost::condition_variable _condition;
+    // wakes the clients
+    boost::condition_variable _changed;
+    boost::shared_ptr < boost::thread > _thread_ptr;
+};
+
+typedef boost::shared_ptr < Telemetry > TelemetryPtr;
+
+// thermal zones of the board as (name, degrees C)
+std::vector < std::pair < std::string, double > > read_temperatures();
+
+// telemetry source publishing the thermal zones as temps.<zone>
+void sample_temperatures(TelemetryValues &values);
+
+} // namespace BoulderAI
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <boost/program_options.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace po = boost::program_options;
+
+namespace BoulderAI
+{
+
+// one finished span; name must be a string literal
+struct TraceEvent
+{
+    const char *name;
+    uint64_t start_ns;      // CLOCK_MONOTONIC
+    uint64_t duration_ns;
+    uint64_t frame;         // sensor frame number, 0 if unknown
+};
+
+/**
+ * Per frame span recording, exported as Chrome trace_event JSON (chrome://tracing, Perfetto).
+ *
+ * Every thread writes its spans into a ring of its own, without locks, and the rings are only
+ * read when a trace is requested, so a span costs two clock reads while tracing is enabled
+ * and a single relaxed load while it is disabled. Rings of threads that exited are handed to
+ * the next new thread, so per client threads don't add up.
+ */
+class Trace
+{
+public:
+    // options names
+    static const char *OPT_ENABLE;
+    static const char *OPT_BUFFER_EVENTS;
+
+    // option defaults
+    static const bool DEFAULT_ENABLE;
+    static const int DEFAULT_BUFFER_EVENTS;
+
+    // option variables
+    static bool _enable;
+    static int _buffer_events;
+
+    static po::options_description GetOptions();
+
+    static void set_enabled(const bool enabled);
+    static bool is_enabled() { return _enabled.load(std::memory_order_relaxed); }
+
+    static uint64_t now_ns();
+    static void record(const char *name, const uint64_t start_ns, const uint64_t end_ns, const uint64_t frame);
+
+    // spans of the last seconds as a Chrome trace_event JSON object
+    static std::string get_chrome_json(const double seconds);
+    // one line per span name: count, mean and max duration over the last seconds
+    static std::string get_summary(const double seconds);
+    // mean duration of the named spans over the last seconds, 0 if there were none
+    static uint64_t get_mean_ns(const std::string &name, const double seconds);
+
+protected:
+    typedef boost::mutex::scoped_lock ScopedLock;
+
+    struct Ring;
+    typedef boost::shared_ptr < Ring > RingPtr;
+
+    struct ThreadEvents
+    {
+        int tid;
+        std::vector < TraceEvent > events;
+    };
+
+    static Ring *get_ring();
+    static void release_ring(Ring *ring);
+    static std::vector < ThreadEvents > collect(const double seconds);
+
+    static std::atomic < bool > _enabled;
+    static boost::mutex _rings_mtex;
+    static std::vector < RingPtr > _rings;
+};
+
+/**
+ * Records the time from construction until destruction (or end()) as a span on the calling
+ * thread's ring. Does nothing unless tracing was enabled when it was constructed.
+ */
+class TraceSpan
+{
+public:
+    TraceSpan(const char *name, const uint64_t frame = 0) :
+        _name(name),
+        _frame(frame),
+        _start_ns(Trace::is_enabled() ? Trace::now_ns() : 0)
+    {
+    }
+
+    ~TraceSpan()
+    {
+        end();
+    }
+
+    // for spans that only learn their frame number on the way
+    void set_frame(const uint64_t frame) { _frame = frame; }
+
+    void end()
+    {
+        if (_start_ns)
+        {
+            Trace::record(_name, _start_ns, Trace::now_ns(), _frame);
+            _start_ns = 0;
+        }
+    }
+
+protected:
+    const char *_name;
+    uint64_t _frame;
+    uint64_t _start_ns;
+};
+
+} // namespace BoulderAI
@@ -26,6 +26,12 @@ ADDRESSES = { 0 : 'Focus Home',
         21 : 'Iris Absolute',
         22 : 'Iris Relative',
         23 : 'Irirs Location',
+        30 : 'Preset Recall',
+        31 : 'Preset Store',
+        32 : 'Lens Busy',
+        40 : 'Scene Lux',
+        41 : 'Gain x100',
+        42 : 'Exposure Time us',
         }
 
 def print_app_state():
@@ -1,6 +1,11 @@
+#include <algorithm>
 #include <sstream>
 
 #include "DNNCam.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
+#include "async_log.hpp"
+#include "configuration.hpp"
 
 #include "EGLStream/NV/ImageNativeBuffer.h"
 #include "Argus/Ext/InternalFrameCount.h"
@@ -95,11 +100,20 @@ struct ArgusReleaseData
     void *_v;
 };
 
+// NvBuffers handed out with frames and not yet released, two per frame
+static MetricGauge *nvbuffers_in_use()
+{
+    static MetricGauge *const gauge = Metrics::registry().gauge(
+        "dnncam_nvbuffers_in_use", "NvBuffers held by frames in the pipeline (prebuffer, queues, encoders)");
+    return gauge;
+}
+
 static void argus_release_helper(void *opaque)
 {
     ArgusReleaseData *data = (ArgusReleaseData *)opaque;
     if(data)
     {
+        nvbuffers_in_use()->add(-2);
         NvBufferMemUnMap(data->_rgb_fd, 0, &data->_rgb);
         NvBufferDestroy(data->_rgb_fd);
 
@@ -115,6 +129,11 @@ void cout_log_handler(string output)
 {
     cout << output << endl;
 }
+
+void async_log_handler(string output)
+{
+    AsyncLog::write(AsyncLog::LOG_INFO, "dnncam", output);
+}
     
 po::options_description DNNCam::GetOptions()
 {
@@ -168,8 +187,16 @@ DNNCam::DNNCam(boost::function < void(std::string) > log_callback)
     _sensor_height(2196),
     _log_callback(log_callback),
     _dropped_frames(0),
-    _motor(true, log_callback)
+    _yuv_fd(-1),
+    _sensor_timestamp(0),
+    _frame_number(0),
+    _exposure_stats(),
+    _motor(true, log_callback),
+    _focus_tracking(Configuration::focus_track())
 {
+    _focus_curve.load(Configuration::focus_curve());
+    _presets.load(Configuration::presets());
+
     if(!check_bounds())
     {
         ostringstream oss;
@@ -211,8 +238,16 @@ DNNCam::DNNCam(const uint32_t roi_x, const uint32_t roi_y,
     _sensor_height(2196),
     _log_callback(log_callback),
     _dropped_frames(0),
-    _motor(true, log_callback)
+    _yuv_fd(-1),
+    _sensor_timestamp(0),
+    _frame_number(0),
+    _exposure_stats(),
+    _motor(true, log_callback),
+    _focus_tracking(Configuration::focus_track())
 {
+    _focus_curve.load(Configuration::focus_curve());
+    _presets.load(Configuration::presets());
+
     _roi_x = roi_x;
     _roi_y = roi_y;
     _roi_width = roi_width;
@@ -1313,6 +1348,8 @@ ArgusReleaseData *DNNCam::request_frame(bool &dropped_frame)
         return NULL;
     }
 
+    _yuv_fd = -1;
+
     // Acquire frame from frame consumer
     Argus::Status status;
     uint64_t timeout = Argus::TIMEOUT_INFINITE;
@@ -1320,6 +1357,7 @@ ArgusReleaseData *DNNCam::request_frame(bool &dropped_frame)
         timeout = static_cast<uint64_t>( _timeout * pow( 10, 9 ) );
     }
 
+    TraceSpan acquire_span("acquire");
     Argus::UniqueObj<EGLStream::Frame> frame_object( frame_consumer->acquireFrame(timeout, &status));
     if ( status != Argus::STATUS_OK ) {
         ostringstream oss;
@@ -1344,6 +1382,16 @@ ArgusReleaseData *DNNCam::request_frame(bool &dropped_frame)
     }
     Argus::CaptureMetadata *metadata = iArgusCaptureMetadata->getMetadata();
     Argus::ICaptureMetadata *iMetadata = Argus::interface_cast<Argus::ICaptureMetadata>(metadata);
+    _sensor_timestamp = iMetadata ? iMetadata->getSensorTimestamp() : 0;
+    if (iMetadata)
+    {
+        boost::mutex::scoped_lock lock(_exposure_stats_mtex);
+        _exposure_stats.valid = true;
+        _exposure_stats.scene_lux = iMetadata->getSceneLux();
+        _exposure_stats.analog_gain = iMetadata->getSensorAnalogGain();
+        _exposure_stats.digital_gain = iMetadata->getIspDigitalGain();
+        _exposure_stats.exposure_ns = iMetadata->getSensorExposureTime();
+    }
     
     auto *frame_count = Argus::interface_cast < Argus::Ext::IInternalFrameCount >(metadata);
     if(frame_count == nullptr)
@@ -1358,11 +1406,17 @@ ArgusReleaseData *DNNCam::request_frame(bool &dropped_frame)
     {
         ostringstream oss;
         _dropped_frames += this_frame_num - last_frame_num - 1;
+        static MetricCounter *const sensor_dropped = Metrics::registry().counter(
+            "dnncam_dropped_frames_total", "Frames dropped in the pipeline, by stage", Metrics::label("stage", "sensor"));
+        sensor_dropped->inc(this_frame_num - last_frame_num - 1);
         oss << "Missed frame! last " << last_frame_num << " this " << this_frame_num << " dropped " << _dropped_frames;
         _log_callback(oss.str());
         dropped_frame = true;
     }
     last_frame_num = this_frame_num;
+    _frame_number = this_frame_num;
+    acquire_span.set_frame(this_frame_num);
+    acquire_span.end();
   
     // Get image from frame
     EGLStream::Image *image_object = frame->getImage();
@@ -1376,6 +1430,7 @@ ArgusReleaseData *DNNCam::request_frame(bool &dropped_frame)
     }
 
     Argus::Size2D<uint32_t> image_size( _output_width, _output_height );
+    TraceSpan create_span("create_nvbuffer", this_frame_num);
     int fd_yuv = image_native_buffer->createNvBuffer( image_size,
                                                       NvBufferColorFormat_YUV420,
                                                       NvBufferLayout_Pitch,
@@ -1398,6 +1453,8 @@ ArgusReleaseData *DNNCam::request_frame(bool &dropped_frame)
         return NULL;
     }
 
+    create_span.end();
+
     NvBufferParams params_yuv;
     NvBufferGetParams( fd_yuv, &params_yuv );
     NvBufferParams params_rgb;
@@ -1416,6 +1473,7 @@ ArgusReleaseData *DNNCam::request_frame(bool &dropped_frame)
         return NULL;
     }
   
+    TraceSpan map_span("map_sync", this_frame_num);
     void *plane_buffer_y;
     void *plane_buffer_u;
     void *plane_buffer_v;
@@ -1437,6 +1495,7 @@ ArgusReleaseData *DNNCam::request_frame(bool &dropped_frame)
     NvBufferMemSyncForCpu(fd_rgb, 0, &plane_buffer_rgb);
     cv_frame_rgb = cv::Mat(params_rgb.height[0], params_rgb.width[0],
                            CV_8UC4, plane_buffer_rgb, params_rgb.pitch[0]);
+    map_span.end();
 
     // NOTE:
     // In order to avoid copying all the data here, the calls to NvBufferMemUnMap()
@@ -1444,6 +1503,9 @@ ArgusReleaseData *DNNCam::request_frame(bool &dropped_frame)
     // The provided 'Frame' class will call these as part of it's dtor through the
     // release_callback.
 
+    _yuv_fd = fd_yuv;
+    nvbuffers_in_use()->add(2);
+
     return new ArgusReleaseData(fd_rgb, plane_buffer_rgb, fd_yuv, plane_buffer_y, plane_buffer_u, plane_buffer_v);
 }
 
@@ -1455,6 +1517,10 @@ uint64_t DNNCam::get_dropped_frames()
 FramePtr DNNCam::grab(bool &dropped_frame)
 {
     ArgusReleaseData *data = request_frame(dropped_frame);
+    if (data)
+    {
+        _focus_meter.submit(cv_frame_y);
+    }
     return FramePtr(new Frame(cv_frame_rgb, data, argus_release_helper));
 }
 
@@ -1473,13 +1539,44 @@ FramePtr DNNCam::grab_v()
     return FramePtr(new Frame(cv_frame_v, NULL, argus_release_helper));
 }
 
+int DNNCam::get_yuv_fd()
+{
+    return _yuv_fd;
+}
+
+uint64_t DNNCam::get_sensor_timestamp()
+{
+    return _sensor_timestamp;
+}
+
+uint64_t DNNCam::get_frame_number()
+{
+    return _frame_number;
+}
+
+ExposureStats DNNCam::get_exposure_stats()
+{
+    boost::mutex::scoped_lock lock(_exposure_stats_mtex);
+    return _exposure_stats;
+}
+
 bool DNNCam::zoom_relative(const int steps)
 {
+    int focus_steps;
+    if (tracked_focus_steps(_motor.zoomAbsoluteLocation() + steps, focus_steps))
+    {
+        return tracked_zoom(steps, focus_steps);
+    }
     return _motor.zoomRelative(steps);
 }
     
 bool DNNCam::zoom_absolute(const int pos)
 {
+    int focus_steps;
+    if (tracked_focus_steps(pos, focus_steps))
+    {
+        return tracked_zoom(pos - _motor.zoomAbsoluteLocation(), focus_steps);
+    }
     return _motor.zoomAbsolute(pos);
 }
 
@@ -1533,6 +1630,17 @@ int DNNCam::get_iris_location()
     return _motor.irisAbsoluteLocation();
 }
 
+bool DNNCam::iris_homed()
+{
+    return _motor.irisHomed();
+}
+
+bool DNNCam::lens_move(const int zoom_steps, const int focus_steps, const int iris_steps)
+{
+    const LensSteps steps = { zoom_steps, focus_steps, iris_steps };
+    return _motor.move(steps);
+}
+
 bool DNNCam::set_ir_cut(const bool enabled)
 {
     if(enabled)
@@ -1540,5 +1648,294 @@ bool DNNCam::set_ir_cut(const bool enabled)
     else
         return _motor.ircutOff();
 }
+
+// frames skipped after a focus move, in case they were exposed while the lens moved,
+// and frames averaged per measurement
+static const int FOCUS_SETTLE_FRAMES = 2;
+static const int FOCUS_MEASURE_FRAMES = 2;
+static const int FOCUS_MEASURE_TIMEOUT_MS = 2000;
+
+void DNNCam::set_focus_tracking(const bool enabled)
+{
+    _focus_tracking = enabled;
+}
+
+bool DNNCam::get_focus_tracking()
+{
+    return _focus_tracking;
+}
+
+std::vector < FocusCurve::Point > DNNCam::get_focus_curve()
+{
+    return _focus_curve.get_points();
+}
+
+bool DNNCam::tracked_focus_steps(const int zoom_target, int &focus_steps)
+{
+    int focus_target;
+    if (!_focus_tracking || !_motor.zoomHomed() || !_motor.focusHomed() || zoom_target < 0 ||
+        !_focus_curve.focus_for(zoom_target, focus_target))
+    {
+        return false;
+    }
+    focus_steps = focus_target - _motor.focusAbsoluteLocation();
+    return true;
+}
+
+bool DNNCam::tracked_zoom(const int zoom_steps, const int focus_steps)
+{
+    const LensSteps steps = { zoom_steps, focus_steps, 0 };
+    if (!_motor.move(steps))
+    {
+        return false;
+    }
+    // the zoom itself succeeded, a failed fine pass only leaves focus on the curve
+    if (Configuration::focus_track_autofocus() && zoom_steps != 0 && !_motor.isCancelled())
+    {
+        autofocus(Configuration::autofocus_range());
+    }
+    return true;
+}
+
+bool DNNCam::measure_focus(double &sharpness)
+{
+    if (!_focus_meter.measure(sharpness, FOCUS_SETTLE_FRAMES, FOCUS_MEASURE_FRAMES, FOCUS_MEASURE_TIMEOUT_MS))
+    {
+        _log_callback("No frames to measure the focus on");
+        return false;
+    }
+    return true;
+}
+
+bool DNNCam::autofocus(const int range)
+{
+    const int start = _motor.focusAbsoluteLocation();
+    const int step = std::max(Configuration::autofocus_step(), 1);
+    double best_sharpness;
+    if (!_motor.focusHomed() || !measure_focus(best_sharpness))
+    {
+        return false;
+    }
+
+    // hill climb: up while it gets sharper, and down instead if the first step up did not
+    int best = start;
+    for (int dir = 1; dir >= -1 && best == start; dir -= 2)
+    {
+        for (int pos = start + dir * step; abs(pos - start) <= range && pos >= 0 && pos <= Configuration::focus_max(); pos += dir * step)
+        {
+            double sharpness;
+            if (!_motor.focusAbsolute(pos) || _motor.isCancelled() || !measure_focus(sharpness))
+            {
+                return false;
+            }
+            if (sharpness <= best_sharpness)
+            {
+                break;
+            }
+            best = pos;
+            best_sharpness = sharpness;
+        }
+    }
+
+    ostringstream oss;
+    oss << "Autofocus moved focus from " << start << " to " << best;
+    _log_callback(oss.str());
+    return _motor.focusAbsolute(best);
+}
+
+bool DNNCam::focus_sweep(const int from, const int to, const int step, int &best)
+{
+    double best_sharpness = -1;
+    for (int pos = std::max(from, 0); pos <= std::min(to, Configuration::focus_max()); pos += step)
+    {
+        double sharpness;
+        if (!_motor.focusAbsolute(pos) || _motor.isCancelled() || !measure_focus(sharpness))
+        {
+            return false;
+        }
+        if (sharpness > best_sharpness)
+        {
+            best = pos;
+            best_sharpness = sharpness;
+        }
+    }
+    return best_sharpness >= 0 && _motor.focusAbsolute(best);
+}
+
+bool DNNCam::calibrate_focus(const int points)
+{
+    if (points < 2)
+    {
+        _log_callback("Focus calibration needs at least 2 zoom positions");
+        return false;
+    }
+    if (!_motor.zoomHomed() && !_motor.zoomHome())
+    {
+        return false;
+    }
+    if (!_motor.focusHomed() && !_motor.focusHome())
+    {
+        return false;
+    }
+    if (!_motor.zoomHomed() || !_motor.focusHomed())
+    {
+        _log_callback("Focus calibration needs zoom and focus homed");
+        return false;
+    }
+
+    // a coarse sweep of the whole focus travel at each zoom position, then a fine pass
+    const int coarse = std::max(Configuration::focus_max() / 32, 1);
+    std::vector < FocusCurve::Point > curve;
+    for (int i = 0; i < points; i++)
+    {
+        FocusCurve::Point point;
+        point.zoom = (int)((int64_t)Configuration::zoom_max() * i / (points - 1));
+        if (!_motor.zoomAbsolute(point.zoom) || _motor.isCancelled() ||
+            !focus_sweep(0, Configuration::focus_max(), coarse, point.focus) ||
+            !autofocus(coarse))
+        {
+            _log_callback("Focus calibration stopped, the curve was not changed");
+            return false;
+        }
+        point.focus = _motor.focusAbsoluteLocation();
+        curve.push_back(point);
+
+        ostringstream oss;
+        oss << "Focus calibration: zoom " << point.zoom << " focus " << point.focus;
+        _log_callback(oss.str());
+    }
+
+    _focus_curve.set_points(curve);
+    if (!_focus_curve.save(Configuration::focus_curve()))
+    {
+        _log_callback("Unable to save the focus curve to " + Configuration::focus_curve());
+        return false;
+    }
+    return true;
+}
+
+std::vector < LensPreset > DNNCam::get_presets()
+{
+    return _presets.get_presets();
+}
+
+bool DNNCam::get_preset(const std::string &name, LensPreset &preset)
+{
+    return _presets.find(name, preset);
+}
+
+bool DNNCam::delete_preset(const std::string &name)
+{
+    if (!_presets.remove(name))
+    {
+        return false;
+    }
+    if (!_presets.save(Configuration::presets()))
+    {
+        _log_callback("Unable to save the presets to " + Configuration::presets());
+        return false;
+    }
+    return true;
+}
+
+void DNNCam::get_preset_settings(LensPreset &preset)
+{
+    const Argus::Range < uint64_t > exposure = get_exposure_time();
+    const Argus::Range < float > gain = get_gain();
+    preset.has_exposure = true;
+    preset.exposure_min = exposure.min();
+    preset.exposure_max = exposure.max();
+    preset.has_gain = true;
+    preset.gain_min = gain.min();
+    preset.gain_max = gain.max();
+}
+
+bool DNNCam::store_preset(LensPreset preset)
+{
+    if (!_motor.zoomHomed() || !_motor.focusHomed() || !_motor.irisHomed())
+    {
+        _log_callback("Unable to store preset " + preset.name + ", the lens is not homed");
+        return false;
+    }
+    preset.zoom = _motor.zoomAbsoluteLocation();
+    preset.focus = _motor.focusAbsoluteLocation();
+    preset.iris = _motor.irisAbsoluteLocation();
+
+    _presets.set(preset);
+    if (!_presets.save(Configuration::presets()))
+    {
+        _log_callback("Unable to save the presets to " + Configuration::presets());
+        return false;
+    }
+    ostringstream oss;
+    oss << "Stored preset " << preset.name << ": zoom " << preset.zoom << " focus " << preset.focus << " iris " << preset.iris;
+    _log_callback(oss.str());
+    return true;
+}
+
+void DNNCam::apply_preset_settings(const LensPreset &preset)
+{
+    if (!preset.has_exposure && !preset.has_gain)
+    {
+        return;
+    }
+
+    auto *request = Argus::interface_cast<Argus::IRequest>( _request_object );
+    if ( request == nullptr ) {
+        ostringstream oss;
+        oss << "Interface cast to IRequest failed.";
+        _log_callback(oss.str());
+        return;
+    }
+    
+    auto source_settings = Argus::interface_cast<Argus::ISourceSettings>(request->getSourceSettings());
+    if ( source_settings == nullptr ) {
+        ostringstream oss;
+        oss << "Interface cast to ISourceSettings failed.";
+        _log_callback(oss.str());
+        return;
+    }
+
+    auto *capture_session = Argus::interface_cast<Argus::ICaptureSession>(_capture_session_object);
+    if ( capture_session == nullptr ) {
+        ostringstream oss;
+        oss << "Interface cast to ICaptureSession failed.";
+        _log_callback(oss.str());
+        return;
+    }
+
+    // both go into the same request, so no frame is captured with only one of them changed
+    if (preset.has_exposure) {
+        source_settings->setExposureTimeRange(Argus::Range < uint64_t >(preset.exposure_min, preset.exposure_max));
+    }
+    if (preset.has_gain) {
+        source_settings->setGainRange(Argus::Range < float >(preset.gain_min, preset.gain_max));
+    }
+    capture_session->repeat(_request_object.get());
+}
+
+bool DNNCam::move_to_preset(const LensPreset &preset)
+{
+    if (!_motor.zoomHomed() || !_motor.focusHomed() || !_motor.irisHomed())
+    {
+        _log_callback("Unable to recall preset " + preset.name + ", the lens is not homed");
+        return false;
+    }
+    const int zoom = _motor.zoomAbsoluteLocation();
+    const int focus = _motor.focusAbsoluteLocation();
+    const int iris = _motor.irisAbsoluteLocation();
+    const LensSteps steps = { preset.zoom - zoom, preset.focus - focus, preset.iris - iris };
+    return _motor.move(steps);
+}
+
+void DNNCam::cancel_lens_move()
+{
+    _motor.cancelMoves();
+}
+
+void DNNCam::clear_lens_cancel()
+{
+    _motor.clearCancel();
+}
     
 } // namespace BoulderAI
@@ -0,0 +1,382 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <time.h>
+#include <boost/scoped_array.hpp>
+#include <boost/thread/tss.hpp>
+
+#include "async_log.hpp"
+
+namespace BoulderAI
+{
+
+const char *AsyncLog::OPT_LEVEL = "log-level";
+const char *AsyncLog::OPT_FILE = "log-file";
+const char *AsyncLog::OPT_FILE_MAX_KB = "log-file-max-kb";
+const char *AsyncLog::OPT_FILE_COUNT = "log-file-count";
+const char *AsyncLog::OPT_BUFFER_RECORDS = "log-buffer-records";
+
+const std::string AsyncLog::DEFAULT_LEVEL = "info";
+const std::string AsyncLog::DEFAULT_FILE = "";
+const int AsyncLog::DEFAULT_FILE_MAX_KB = 1000;
+const int AsyncLog::DEFAULT_FILE_COUNT = 10;
+const int AsyncLog::DEFAULT_BUFFER_RECORDS = 1024;
+
+std::string AsyncLog::_level_name = DEFAULT_LEVEL;
+std::string AsyncLog::_file = DEFAULT_FILE;
+int AsyncLog::_file_max_kb = DEFAULT_FILE_MAX_KB;
+int AsyncLog::_file_count = DEFAULT_FILE_COUNT;
+int AsyncLog::_buffer_records = DEFAULT_BUFFER_RECORDS;
+
+std::atomic < int > AsyncLog::_level(AsyncLog::LOG_INFO);
+std::atomic < bool > AsyncLog::_running(false);
+std::atomic < uint64_t > AsyncLog::_dropped(0);
+
+boost::mutex AsyncLog::_rings_mtex;
+std::vector < AsyncLog::RingPtr > AsyncLog::_rings;
+
+boost::mutex AsyncLog::_output_mtex;
+std::ofstream AsyncLog::_output;
+uint64_t AsyncLog::_reported_dropped = 0;
+
+boost::shared_ptr < boost::thread > AsyncLog::_thread_ptr;
+
+// how long the logger thread sleeps when there is nothing to write
+static const int IDLE_MS = 10;
+
+struct AsyncLog::Record
+{
+    static const size_t TEXT_SIZE = 232;
+
+    int64_t unix_ns;
+    Level level;
+    const char *source;
+    uint32_t length;
+    char text[TEXT_SIZE];
+};
+
+// single producer (the owning thread), single consumer (the logger thread)
+struct AsyncLog::Ring
+{
+    bool in_use;
+    size_t mask;                    // capacity - 1, the capacity is a power of two
+    boost::scoped_array < Record > records;
+    std::atomic < uint64_t > head;  // records written
+    std::atomic < uint64_t > tail;  // records taken by the logger thread
+};
+
+static void fill_record(AsyncLog::Record &record, const struct timespec &ts, const AsyncLog::Level level,
+                        const char *source, const std::string &message)
+{
+    record.unix_ns = (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    record.level = level;
+    record.source = source;
+    record.length = std::min(message.size(), AsyncLog::Record::TEXT_SIZE);
+    memcpy(record.text, message.data(), record.length);
+}
+
+static bool record_before(const AsyncLog::Record &a, const AsyncLog::Record &b)
+{
+    return a.unix_ns < b.unix_ns;
+}
+
+po::options_description AsyncLog::GetOptions()
+{
+    po::options_description desc( "Log Options" );
+    desc.add_options()
+        ( OPT_LEVEL, po::value<std::string>(&_level_name)->default_value(DEFAULT_LEVEL),
+          "Lowest level logged: debug, info, warn or error." )
+        ( OPT_FILE, po::value<std::string>(&_file)->default_value(DEFAULT_FILE),
+          "Also write the log to this file (rotated as file.1, file.2, ...). Empty for stdout only." )
+        ( OPT_FILE_MAX_KB, po::value<int>(&_file_max_kb)->default_value(DEFAULT_FILE_MAX_KB),
+          "Size in kB at which the log file is rotated." )
+        ( OPT_FILE_COUNT, po::value<int>(&_file_count)->default_value(DEFAULT_FILE_COUNT),
+          "Number of log files kept, including the current one." )
+        ( OPT_BUFFER_RECORDS, po::value<int>(&_buffer_records)->default_value(DEFAULT_BUFFER_RECORDS),
+          "Log records buffered per thread; further records are dropped until the logger catches up." )
+        ;
+    return desc;
+}
+
+void AsyncLog::start()
+{
+    Level level;
+    if (!parse_level(_level_name, level))
+    {
+        write(LOG_WARN, "log", "Unknown log level " + _level_name + ", using info");
+        level = LOG_INFO;
+    }
+    set_level(level);
+
+    ScopedLock lock(_output_mtex);
+    if (_thread_ptr.get())
+    {
+        return;
+    }
+    open_file();
+    _running = true;
+    _thread_ptr.reset(new boost::thread(&AsyncLog::run));
+}
+
+void AsyncLog::stop()
+{
+    _running = false;
+    if (!_thread_ptr.get())
+    {
+        return;
+    }
+    _thread_ptr->join();
+    _thread_ptr.reset();
+    // whatever was queued while the thread finished
+    drain();
+}
+
+void AsyncLog::set_level(const Level level)
+{
+    _level.store(level, std::memory_order_relaxed);
+}
+
+void AsyncLog::write(const Level level, const char *source, const std::string &message)
+{
+    if (!enabled(level))
+    {
+        return;
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    if (!_running.load(std::memory_order_acquire))
+    {
+        Record record;
+        fill_record(record, ts, level, source, message);
+
+        ScopedLock lock(_output_mtex);
+        output(record);
+        std::cout.flush();
+        return;
+    }
+
+    Ring *ring = get_ring();
+    const uint64_t head = ring->head.load(std::memory_order_relaxed);
+    if (head - ring->tail.load(std::memory_order_acquire) > ring->mask)
+    {
+        _dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    fill_record(ring->records[head & ring->mask], ts, level, source, message);
+    // publishes the record to drain()
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+uint64_t AsyncLog::get_dropped()
+{
+    return _dropped.load(std::memory_order_relaxed);
+}
+
+AsyncLog::Ring *AsyncLog::get_ring()
+{
+    // plain thread_local for the fast path; the thread_specific_ptr only hands the ring
+    // back when its thread exits
+    static thread_local Ring *cached_ring = NULL;
+    static boost::thread_specific_ptr < Ring > thread_ring(&AsyncLog::release_ring);
+
+    if (cached_ring)
+    {
+        return cached_ring;
+    }
+
+    Ring *ring = NULL;
+    ScopedLock lock(_rings_mtex);
+    for (size_t i = 0; i < _rings.size() && !ring; i++)
+    {
+        // a released ring is only handed out again once the logger has emptied it
+        if (!_rings[i]->in_use && _rings[i]->tail.load(std::memory_order_acquire) == _rings[i]->head.load(std::memory_order_relaxed))
+        {
+            ring = _rings[i].get();
+        }
+    }
+    if (!ring)
+    {
+        size_t capacity = 16;
+        while (capacity < (size_t)_buffer_records)
+        {
+            capacity *= 2;
+        }
+        RingPtr new_ring(new Ring());
+        new_ring->mask = capacity - 1;
+        new_ring->records.reset(new Record[capacity]);
+        new_ring->head.store(0);
+        new_ring->tail.store(0);
+        _rings.push_back(new_ring);
+        ring = new_ring.get();
+    }
+    ring->in_use = true;
+    thread_ring.reset(ring);
+    cached_ring = ring;
+    return ring;
+}
+
+void AsyncLog::release_ring(Ring *ring)
+{
+    ScopedLock lock(_rings_mtex);
+    ring->in_use = false;
+}
+
+void AsyncLog::run()
+{
+    while (_running.load(std::memory_order_acquire))
+    {
+        if (!drain())
+        {
+            boost::this_thread::sleep(boost::posix_time::milliseconds(IDLE_MS));
+        }
+    }
+    drain();
+}
+
+bool AsyncLog::drain()
+{
+    std::vector < Record > records;
+    {
+        ScopedLock lock(_rings_mtex);
+        for (size_t i = 0; i < _rings.size(); i++)
+        {
+            Ring &ring = *_rings[i];
+            const uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+            const uint64_t head = ring.head.load(std::memory_order_acquire);
+            for (uint64_t r = tail; r < head; r++)
+            {
+                records.push_back(ring.records[r & ring.mask]);
+            }
+            ring.tail.store(head, std::memory_order_release);
+        }
+    }
+
+    const uint64_t dropped = get_dropped();
+    if (records.empty() && dropped == _reported_dropped)
+    {
+        return false;
+    }
+
+    // every thread's records are in order already, interleave them by time
+    std::stable_sort(records.begin(), records.end(), &record_before);
+
+    ScopedLock lock(_output_mtex);
+    for (size_t i = 0; i < records.size(); i++)
+    {
+        output(records[i]);
+    }
+    if (dropped != _reported_dropped)
+    {
+        std::ostringstream oss;
+        oss << dropped - _reported_dropped << " log records dropped, the log buffers were full";
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        Record record;
+        fill_record(record, ts, LOG_WARN, "log", oss.str());
+        output(record);
+        _reported_dropped = dropped;
+    }
+    std::cout.flush();
+    if (_output.is_open())
+    {
+        _output.flush();
+    }
+    return true;
+}
+
+void AsyncLog::output(const Record &record)
+{
+    const time_t seconds = record.unix_ns / 1000000000LL;
+    struct tm tm;
+    localtime_r(&seconds, &tm);
+    char stamp[32];
+    const size_t n = strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &tm);
+    snprintf(stamp + n, sizeof(stamp) - n, ".%03d", (int)(record.unix_ns / 1000000 % 1000));
+
+    std::ostringstream line;
+    line << stamp << " " << level_name(record.level) << " " << record.source << ": ";
+    line.write(record.text, record.length);
+    line << "\n";
+    const std::string text = line.str();
+
+    std::cout << text;
+    if (_output.is_open())
+    {
+        if ((int64_t)_output.tellp() >= (int64_t)_file_max_kb * 1024)
+        {
+            rotate();
+        }
+        _output << text;
+    }
+}
+
+void AsyncLog::open_file()
+{
+    if (_file.empty())
+    {
+        return;
+    }
+    _output.open(_file.c_str(), std::ios::app);
+    if (!_output)
+    {
+        std::cout << "Unable to open log file " << _file << std::endl;
+    }
+}
+
+void AsyncLog::rotate()
+{
+    _output.close();
+    // file.(n-1) falls off the end, the others move up by one
+    for (int i = _file_count - 1; i > 0; i--)
+    {
+        std::ostringstream from, to;
+        from << _file;
+        if (i > 1)
+        {
+            from << "." << i - 1;
+        }
+        to << _file << "." << i;
+        ::rename(from.str().c_str(), to.str().c_str());
+    }
+    if (_file_count <= 1)
+    {
+        ::remove(_file.c_str());
+    }
+    _output.clear();
+    _output.open(_file.c_str(), std::ios::app);
+}
+
+bool AsyncLog::parse_level(const std::string &name, Level &level)
+{
+    static const Level levels[] = { LOG_DEBUG, LOG_INFO, LOG_WARN, LOG_ERROR };
+    for (size_t i = 0; i < sizeof(levels) / sizeof(levels[0]); i++)
+    {
+        std::string lower = level_name(levels[i]);
+        std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+        if (name == lower)
+        {
+            level = levels[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *AsyncLog::level_name(const Level level)
+{
+    switch (level)
+    {
+        case LOG_DEBUG: return "DEBUG";
+        case LOG_INFO: return "INFO";
+        case LOG_WARN: return "WARN";
+        case LOG_ERROR: return "ERROR";
+    }
+    return "UNKNOWN";
+}
+
+} // namespace BoulderAI
@@ -0,0 +1,287 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <boost/bind.hpp>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "async_writer.hpp"
+
+namespace BoulderAI
+{
+
+// batches are flushed after this long without new data, so an idle file is never far behind
+static const int IDLE_FLUSH_MS = 500;
+
+AsyncWriter::AsyncWriter(const size_t batch_bytes, const size_t max_queue_bytes) :
+    _batch_bytes(batch_bytes),
+    _max_queue_bytes(max_queue_bytes),
+    _running(false),
+    _next_file(0),
+    _queue_bytes(0),
+    _written_bytes(0),
+    _dropped_bytes(0)
+{
+}
+
+AsyncWriter::~AsyncWriter()
+{
+    stop();
+}
+
+void AsyncWriter::start()
+{
+    ScopedLock lock(_mtex);
+    if (_thread_ptr.get())
+    {
+        return;
+    }
+
+    _running = true;
+    _thread_ptr.reset(new boost::thread(boost::bind(&AsyncWriter::run, this)));
+}
+
+void AsyncWriter::stop()
+{
+    {
+        ScopedLock lock(_mtex);
+        _running = false;
+        _condition.notify_all();
+    }
+
+    if (!_thread_ptr.get())
+    {
+        return;
+    }
+    _thread_ptr->join();
+    _thread_ptr.reset();
+}
+
+int AsyncWriter::open(const std::string &path, const uint64_t preallocate_bytes)
+{
+    ScopedLock lock(_mtex);
+    Op op;
+    op.type = Op::OPEN;
+    op.file = _next_file++;
+    op.path = path;
+    op.preallocate_bytes = preallocate_bytes;
+    _queue.push_back(op);
+    _condition.notify_one();
+    return op.file;
+}
+
+bool AsyncWriter::write(const int file, const uint8_t *data, const size_t size)
+{
+    ScopedLock lock(_mtex);
+    if (_dropped_files.count(file) || _queue_bytes + size > _max_queue_bytes)
+    {
+        // never resume after a gap, the file would be missing data in its middle
+        _dropped_files.insert(file);
+        _dropped_bytes += size;
+        return false;
+    }
+
+    // consecutive small writes to the same file share one queue entry
+    if (!_queue.empty() && _queue.back().type == Op::WRITE && _queue.back().file == file &&
+        _queue.back().data.size() < _batch_bytes)
+    {
+        _queue.back().data.insert(_queue.back().data.end(), data, data + size);
+    }
+    else
+    {
+        Op op;
+        op.type = Op::WRITE;
+        op.file = file;
+        op.data.assign(data, data + size);
+        _queue.push_back(op);
+    }
+    _queue_bytes += size;
+    _condition.notify_one();
+    return true;
+}
+
+void AsyncWriter::close(const int file, ClosedCallback on_closed)
+{
+    ScopedLock lock(_mtex);
+    Op op;
+    op.type = Op::CLOSE;
+    op.file = file;
+    op.on_closed = on_closed;
+    _queue.push_back(op);
+    _condition.notify_one();
+}
+
+size_t AsyncWriter::get_queue_bytes()
+{
+    ScopedLock lock(_mtex);
+    return _queue_bytes;
+}
+
+uint64_t AsyncWriter::get_written_bytes()
+{
+    ScopedLock lock(_mtex);
+    return _written_bytes;
+}
+
+uint64_t AsyncWriter::get_dropped_bytes()
+{
+    ScopedLock lock(_mtex);
+    return _dropped_bytes;
+}
+
+void AsyncWriter::run()
+{
+    while (true)
+    {
+        Op op;
+        {
+            ScopedLock lock(_mtex);
+            while (_queue.empty() && _running)
+            {
+                if (!_condition.timed_wait(lock, boost::posix_time::milliseconds(IDLE_FLUSH_MS)))
+                {
+                    lock.unlock();
+                    flush_all();
+                    lock.lock();
+                }
+            }
+            if (_queue.empty())
+            {
+                break;
+            }
+            op = _queue.front();
+            _queue.pop_front();
+            _queue_bytes -= op.data.size();
+        }
+        do_op(op);
+    }
+
+    // close whatever the caller left open
+    for (std::map < int, OpenFile >::iterator itr = _files.begin(); itr != _files.end(); itr = _files.begin())
+    {
+        Op op;
+        op.type = Op::CLOSE;
+        op.file = itr->first;
+        do_op(op);
+    }
+}
+
+void AsyncWriter::do_op(Op &op)
+{
+    if (op.type == Op::OPEN)
+    {
+        OpenFile &file = _files[op.file];
+        file.path = op.path;
+        file.size = 0;
+        file.failed = false;
+        file.batch.reserve(_batch_bytes);
+        file.fd = ::open((op.path + ".part").c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (file.fd < 0)
+        {
+            std::cout << "Unable to create " << op.path << ": " << strerror(errno) << std::endl;
+            file.failed = true;
+        }
+        else if (op.preallocate_bytes > 0)
+        {
+            // reserve the blocks up front, so the file does not fragment as it grows
+            fallocate(file.fd, FALLOC_FL_KEEP_SIZE, 0, op.preallocate_bytes);
+        }
+        return;
+    }
+
+    std::map < int, OpenFile >::iterator itr = _files.find(op.file);
+    if (itr == _files.end())
+    {
+        return;
+    }
+    OpenFile &file = itr->second;
+
+    if (op.type == Op::WRITE)
+    {
+        if (file.failed)
+        {
+            return;
+        }
+        file.batch.insert(file.batch.end(), op.data.begin(), op.data.end());
+        if (file.batch.size() >= _batch_bytes)
+        {
+            flush(file);
+        }
+        return;
+    }
+
+    // CLOSE
+    {
+        ScopedLock lock(_mtex);
+        if (_dropped_files.erase(op.file) && !file.failed)
+        {
+            std::cout << "Data for " << file.path << " was dropped, discarding it" << std::endl;
+            file.failed = true;
+            file.batch.clear();
+            if (file.fd >= 0)
+            {
+                unlink((file.path + ".part").c_str());
+            }
+        }
+    }
+    flush(file);
+    if (file.fd >= 0)
+    {
+        // give back the preallocated blocks we did not use
+        ftruncate(file.fd, file.size);
+        fdatasync(file.fd);
+        posix_fadvise(file.fd, 0, 0, POSIX_FADV_DONTNEED);
+        ::close(file.fd);
+        if (!file.failed && rename((file.path + ".part").c_str(), file.path.c_str()) != 0)
+        {
+            std::cout << "Unable to rename " << file.path << ".part: " << strerror(errno) << std::endl;
+            file.failed = true;
+        }
+    }
+    if (!file.failed && op.on_closed)
+    {
+        op.on_closed(file.path, file.size);
+    }
+    _files.erase(itr);
+}
+
+void AsyncWriter::flush(OpenFile &file)
+{
+    size_t done = 0;
+    while (!file.failed && done < file.batch.size())
+    {
+        const ssize_t n = ::write(file.fd, file.batch.data() + done, file.batch.size() - done);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            std::cout << "Write to " << file.path << " failed: " << strerror(errno) << std::endl;
+            file.failed = true;
+            break;
+        }
+        done += n;
+    }
+    file.size += done;
+    file.batch.clear();
+
+    ScopedLock lock(_mtex);
+    _written_bytes += done;
+}
+
+void AsyncWriter::flush_all()
+{
+    for (std::map < int, OpenFile >::iterator itr = _files.begin(); itr != _files.end(); ++itr)
+    {
+        if (!itr->second.batch.empty())
+        {
+            flush(itr->second);
+        }
+    }
+}
+
+} // namespace BoulderAI
@@ -14,6 +14,14 @@
 #include "DNNCamServer.hpp"
 
 #include "frame_processor.hpp"
+#include "http_server.hpp"
+#include "http_api.hpp"
+#include "telemetry.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
+#include "async_log.hpp"
+#include "exposure_controller.hpp"
+#include "modbus_server.hpp"
 
 using namespace std;
 using namespace BoulderAI;
@@ -39,6 +47,33 @@ static int parse_arguments(int argc, char *argv[])
         ;
 
     visible_options.add(DNNCam::GetOptions());
+    visible_options.add(Stream::GetOptions());
+    visible_options.add(HttpServer::GetOptions());
+    visible_options.add(JpegSource::GetOptions());
+    visible_options.add(Recorder::GetOptions());
+    visible_options.add(RetentionManager::GetOptions());
+    visible_options.add(HttpApi::GetOptions());
+    visible_options.add(Telemetry::GetOptions());
+    visible_options.add(Trace::GetOptions());
+    visible_options.add(AsyncLog::GetOptions());
+    visible_options.add(ExposureController::GetOptions());
+    visible_options.add(ModbusServer::GetOptions());
+    visible_options.add(MotionDetector::GetOptions());
+
+    po::options_description config_options;
+    config_options.add(DNNCam::GetOptions());
+    config_options.add(Stream::GetOptions());
+    config_options.add(HttpServer::GetOptions());
+    config_options.add(JpegSource::GetOptions());
+    config_options.add(Recorder::GetOptions());
+    config_options.add(RetentionManager::GetOptions());
+    config_options.add(HttpApi::GetOptions());
+    config_options.add(Telemetry::GetOptions());
+    config_options.add(Trace::GetOptions());
+    config_options.add(AsyncLog::GetOptions());
+    config_options.add(ExposureController::GetOptions());
+    config_options.add(ModbusServer::GetOptions());
+    config_options.add(MotionDetector::GetOptions());
     
     /* Process them */
     try {
@@ -54,9 +89,14 @@ static int parse_arguments(int argc, char *argv[])
         
         po::variables_map vm;        
         po::store(po::command_line_parser(argc, argv).options(visible_options).run(), vm);
-        po::store(po::parse_config_file(ifs, DNNCam::GetOptions()), vm);
+        po::store(po::parse_config_file(ifs, config_options), vm);
         po::notify(vm);    
 
+        if (MotionDetector::_capture_mode != "off" && MotionDetector::_capture_mode != "on" && MotionDetector::_capture_mode != "auto")
+        {
+            throw po::validation_error(po::validation_error::invalid_option_value, MotionDetector::OPT_CAPTURE_MODE);
+        }
+
         if (vm.count("help")) 
         {
             std::cerr << visible_options << std::endl;
@@ -95,6 +135,8 @@ int run(int argc, char** argv)
     {
         return ret;
     }
+    Trace::set_enabled(Trace::_enable);
+    AsyncLog::start();
 
     camera->init();
     
@@ -107,6 +149,71 @@ int run(int argc, char** argv)
     FrameProcessorPtr frame_proc;
     frame_proc.reset(new FrameProcessor(camera->get_output_width(), camera->get_output_height()));
     frame_proc->start_workers();
+
+    xmlrpc_c::methodPtr const getStreamStats(new GetStreamStats(frame_proc));
+    server->add_method("get_stream_stats", getStreamStats);
+    xmlrpc_c::methodPtr const getStreamClock(new GetStreamClock(frame_proc));
+    server->add_method("get_stream_clock", getStreamClock);
+    xmlrpc_c::methodPtr const recordStart(new RecordStart(frame_proc));
+    server->add_method("record_start", recordStart);
+    xmlrpc_c::methodPtr const recordStop(new RecordStop(frame_proc));
+    server->add_method("record_stop", recordStop);
+    xmlrpc_c::methodPtr const getRecordStatus(new GetRecordStatus(frame_proc));
+    server->add_method("get_record_status", getRecordStatus);
+    xmlrpc_c::methodPtr const getRecordedEvents(new GetRecordedEvents(frame_proc));
+    server->add_method("get_recorded_events", getRecordedEvents);
+    xmlrpc_c::methodPtr const recordProtect(new RecordProtect(frame_proc));
+    server->add_method("record_protect", recordProtect);
+    xmlrpc_c::methodPtr const getRetentionStatus(new GetRetentionStatus(frame_proc));
+    server->add_method("get_retention_status", getRetentionStatus);
+    xmlrpc_c::methodPtr const setCaptureMode(new SetCaptureMode(frame_proc));
+    server->add_method("set_capture_mode", setCaptureMode);
+    xmlrpc_c::methodPtr const getCaptureState(new GetCaptureState(frame_proc));
+    server->add_method("get_capture_state", getCaptureState);
+
+    frame_proc->set_capture_mode(MotionDetector::_capture_mode);
+    std::cout << "Capture mode " << MotionDetector::_capture_mode << ", motion detection uses " << MotionDetector::simd_name() << std::endl;
+
+    // iris and IR cut filter follow the light, off the frame path
+    ExposureControllerPtr exposure_controller(new ExposureController(camera, server->get_lens_jobs()));
+    xmlrpc_c::methodPtr const setAutoIris(new SetAutoIris(exposure_controller));
+    server->add_method("set_auto_iris", setAutoIris);
+    xmlrpc_c::methodPtr const setAutoIRCut(new SetAutoIRCut(exposure_controller));
+    server->add_method("set_auto_ir_cut", setAutoIRCut);
+    xmlrpc_c::methodPtr const getAutoIrisStatus(new GetAutoIrisStatus(exposure_controller));
+    server->add_method("get_auto_iris_status", getAutoIrisStatus);
+    exposure_controller->start();
+
+    // PLC registers on the Modbus TCP port, read and written in-process
+    ModbusServerPtr modbus_server(new ModbusServer(server, camera, ModbusServer::_port));
+    modbus_server->start();
+
+    HttpServerPtr http_server(new HttpServer(HttpServer::_port, HttpServer::_threads));
+    HttpApiPtr http_api(new HttpApi(server, Recorder::_dir));
+    http_api->register_handlers(*http_server);
+    frame_proc->get_jpeg_source()->register_handlers(*http_server);
+
+    // live settings and status for the web UI, pushed on /events
+    static const char *telemetry_methods[] = {
+        "get_auto_exposure", "get_exposure_time", "get_exposure_compensation", "get_frame_duration",
+        "get_gain", "get_awb", "get_awb_mode", "get_awb_gains", "get_denoise_mode", "get_denoise_strength",
+        "get_dropped_frames", "focus_get_location", "zoom_get_location", "iris_get_location"
+    };
+    const std::vector < std::string > telemetry_getters(telemetry_methods,
+                                                        telemetry_methods + sizeof(telemetry_methods) / sizeof(telemetry_methods[0]));
+    TelemetryPtr telemetry(new Telemetry(Telemetry::_max_rate, Telemetry::_interval_ms));
+    telemetry->add_source(boost::bind(&HttpApi::sample_methods, http_api, telemetry_getters, _1));
+    telemetry->add_source(boost::bind(&FrameProcessor::sample_telemetry, frame_proc, _1));
+    telemetry->add_source(sample_temperatures);
+    telemetry->register_handlers(*http_server);
+    server->set_change_callback(boost::bind(&Telemetry::notify, telemetry));
+    telemetry->start();
+
+    // performance counters for fleet monitoring, on /metrics
+    frame_proc->register_metrics(Metrics::registry());
+    Metrics::registry().register_handlers(*http_server);
+
+    http_server->start();
     
     while(running)
     {
@@ -119,10 +226,18 @@ int run(int argc, char** argv)
         col.frame_y = camera->grab_y();
         col.frame_u = camera->grab_u();
         col.frame_v = camera->grab_v();
+        col.yuv_fd = camera->get_yuv_fd();
+        col.sensor_timestamp = camera->get_sensor_timestamp();
+        col.frame_number = camera->get_frame_number();
 
         frame_proc->process_frame(col);
     }
 
+    server->set_change_callback(ChangeCallback());
+    exposure_controller->stop();
+    modbus_server->stop();
+    telemetry->stop();
+    http_server->stop();
     frame_proc->wait_for_queued_images();
     
     server->stop();
@@ -147,5 +262,6 @@ int main(int argc, char** argv)
     {
         std::cout << "Caught an unknown type of unhandled exception." << std::endl;
     }
+    AsyncLog::stop();
     return ret;
 }
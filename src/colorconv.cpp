@@ -0,0 +1,750 @@
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#include "colorconv.hpp"
+#include "scaler.hpp"
+#include "new_worker.hpp"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define COLORCONV_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define COLORCONV_SSE2 1
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define COLORCONV_AVX2 1
+#endif
+#endif
+
+namespace BoulderAI
+{
+
+int ColorConv::_threads = std::max(1u, boost::thread::hardware_concurrency());
+
+namespace
+{
+
+// Frames smaller than this are converted on the calling thread
+const size_t MIN_BAND_BYTES = 256 * 1024;
+
+typedef bl::NewWorker < bl::Logexc_policy > BandWorker;
+
+/**
+ * Helpers for the calling thread, started with the first frame that is split, so a
+ * set_threads() before that sizes them. Never stopped, they live as long as the process.
+ */
+BandWorker *start_band_worker()
+{
+    BandWorker *worker = new BandWorker(std::max(ColorConv::get_threads() - 1, 1), "Colour Conversion");
+    worker->start();
+    return worker;
+}
+
+BandWorker &band_worker()
+{
+    static BandWorker *worker = start_band_worker();
+    return *worker;
+}
+
+// Counts the bands of one frame still being converted by the band worker
+struct BandLatch
+{
+    boost::mutex mtex;
+    boost::condition_variable done;
+    int remaining;
+    std::exception_ptr error;   // of the first band that threw, rethrown to the caller
+};
+
+// counts down even when fn throws, or the caller would wait forever
+void run_band(const boost::function < void(int, int) > &fn, const int begin, const int end, BandLatch &latch)
+{
+    std::exception_ptr error;
+    try
+    {
+        fn(begin, end);
+    }
+    catch (...)
+    {
+        error = std::current_exception();
+    }
+    boost::mutex::scoped_lock lock(latch.mtex);
+    if (error && !latch.error)
+    {
+        latch.error = error;
+    }
+    if (--latch.remaining == 0)
+    {
+        latch.done.notify_one();
+    }
+}
+
+/**
+ * Calls fn(begin, end) for bands of [0, rows), on up to ColorConv::get_threads() threads.
+ * The calling thread converts the last band itself, the others go to the band worker, so
+ * several callers can share it without waiting for each other's bands.
+ */
+void run_bands(const int rows, const size_t total_bytes, const boost::function < void(int, int) > &fn)
+{
+    const int bands = std::min < int >(std::min < int >(ColorConv::get_threads(), rows),
+                                       std::max < size_t >(total_bytes / MIN_BAND_BYTES, 1));
+    if (bands <= 1)
+    {
+        fn(0, rows);
+        return;
+    }
+
+    BandLatch latch;
+    latch.remaining = bands;
+    BandWorker &worker = band_worker();
+    for (int b = 0; b < bands - 1; b++)
+    {
+        worker.add_job(boost::bind(&run_band, boost::cref(fn), rows * b / bands, rows * (b + 1) / bands,
+                                   boost::ref(latch)));
+    }
+    // the latch lives on this stack, so even a throwing band waits for the others first
+    run_band(fn, rows * (bands - 1) / bands, rows, latch);
+
+    boost::mutex::scoped_lock lock(latch.mtex);
+    while (latch.remaining > 0)
+    {
+        latch.done.wait(lock);
+    }
+    if (latch.error)
+    {
+        std::rethrow_exception(latch.error);
+    }
+}
+
+inline uint8_t clamp255(const int x)
+{
+    return x < 0 ? 0 : (x > 255 ? 255 : x);
+}
+
+inline uint8_t rgb_y(const int r, const int g, const int b)
+{
+    return ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+}
+
+inline uint8_t rgb_u(const int r, const int g, const int b)
+{
+    return ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+}
+
+inline uint8_t rgb_v(const int r, const int g, const int b)
+{
+    return ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+}
+
+// Converts two RGB(A) rows from pixel x on; R, G and B are at byte offsets ri, 1 and bi
+void rgb_rows_c(const uint8_t *row0, const uint8_t *row1, const int bpp, const int ri, const int bi,
+                uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v, int x, const int width)
+{
+    for (; x < width; x += 2)
+    {
+        const uint8_t *p[4] = { row0 + x * bpp, row0 + (x + 1) * bpp, row1 + x * bpp, row1 + (x + 1) * bpp };
+        y0[x] = rgb_y(p[0][ri], p[0][1], p[0][bi]);
+        y0[x + 1] = rgb_y(p[1][ri], p[1][1], p[1][bi]);
+        y1[x] = rgb_y(p[2][ri], p[2][1], p[2][bi]);
+        y1[x + 1] = rgb_y(p[3][ri], p[3][1], p[3][bi]);
+        const int r = (p[0][ri] + p[1][ri] + p[2][ri] + p[3][ri] + 2) >> 2;
+        const int g = (p[0][1] + p[1][1] + p[2][1] + p[3][1] + 2) >> 2;
+        const int b = (p[0][bi] + p[1][bi] + p[2][bi] + p[3][bi] + 2) >> 2;
+        u[x / 2] = rgb_u(r, g, b);
+        v[x / 2] = rgb_v(r, g, b);
+    }
+}
+
+// Converts one I420 row from pixel x on
+void bgr_row_c(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *bgr, int x, const int width)
+{
+    for (; x < width; x++)
+    {
+        const int c = y[x] - 16;
+        const int d = u[x / 2] - 128;
+        const int e = v[x / 2] - 128;
+        bgr[3 * x] = clamp255((298 * c + 516 * d + 128) >> 8);
+        bgr[3 * x + 1] = clamp255((298 * c - 100 * d - 208 * e + 128) >> 8);
+        bgr[3 * x + 2] = clamp255((298 * c + 409 * e + 128) >> 8);
+    }
+}
+
+#if defined(COLORCONV_NEON)
+
+int rgba_rows_simd(const uint8_t *row0, const uint8_t *row1,
+                   uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v, const int width)
+{
+    int x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        const uint8x16x4_t p0 = vld4q_u8(row0 + 4 * x);
+        const uint8x16x4_t p1 = vld4q_u8(row1 + 4 * x);
+
+        const uint8x16x4_t *rows[2] = { &p0, &p1 };
+        uint8_t *ys[2] = { y0, y1 };
+        for (int k = 0; k < 2; k++)
+        {
+            const uint8x16x4_t &p = *rows[k];
+            uint16x8_t lo = vmull_u8(vget_low_u8(p.val[0]), vdup_n_u8(66));
+            lo = vmlal_u8(lo, vget_low_u8(p.val[1]), vdup_n_u8(129));
+            lo = vmlal_u8(lo, vget_low_u8(p.val[2]), vdup_n_u8(25));
+            uint16x8_t hi = vmull_u8(vget_high_u8(p.val[0]), vdup_n_u8(66));
+            hi = vmlal_u8(hi, vget_high_u8(p.val[1]), vdup_n_u8(129));
+            hi = vmlal_u8(hi, vget_high_u8(p.val[2]), vdup_n_u8(25));
+            const uint8x8_t ylo = vadd_u8(vshrn_n_u16(vaddq_u16(lo, vdupq_n_u16(128)), 8), vdup_n_u8(16));
+            const uint8x8_t yhi = vadd_u8(vshrn_n_u16(vaddq_u16(hi, vdupq_n_u16(128)), 8), vdup_n_u8(16));
+            vst1q_u8(ys[k] + x, vcombine_u8(ylo, yhi));
+        }
+
+        // 2x2 sums, then (sum + 2) >> 2
+        const int16x8_t r = vreinterpretq_s16_u16(vrshrq_n_u16(vpadalq_u8(vpaddlq_u8(p0.val[0]), p1.val[0]), 2));
+        const int16x8_t g = vreinterpretq_s16_u16(vrshrq_n_u16(vpadalq_u8(vpaddlq_u8(p0.val[1]), p1.val[1]), 2));
+        const int16x8_t b = vreinterpretq_s16_u16(vrshrq_n_u16(vpadalq_u8(vpaddlq_u8(p0.val[2]), p1.val[2]), 2));
+        int16x8_t cu = vmlaq_n_s16(vmlaq_n_s16(vmlaq_n_s16(vdupq_n_s16(128), r, -38), g, -74), b, 112);
+        int16x8_t cv = vmlaq_n_s16(vmlaq_n_s16(vmlaq_n_s16(vdupq_n_s16(128), r, 112), g, -94), b, -18);
+        cu = vaddq_s16(vshrq_n_s16(cu, 8), vdupq_n_s16(128));
+        cv = vaddq_s16(vshrq_n_s16(cv, 8), vdupq_n_s16(128));
+        vst1_u8(u + x / 2, vqmovun_s16(cu));
+        vst1_u8(v + x / 2, vqmovun_s16(cv));
+    }
+    return x;
+}
+
+inline uint8x8_t neon_bgr_channel(const int32x4_t lo, const int32x4_t hi)
+{
+    return vqmovun_s16(vcombine_s16(vqmovn_s32(vshrq_n_s32(lo, 8)), vqmovn_s32(vshrq_n_s32(hi, 8))));
+}
+
+// 8 pixels of one row, each chroma sample is already duplicated for the two pixels sharing it
+void neon_bgr8(const uint8x8_t yy, const uint8x8_t uu, const uint8x8_t vv, uint8_t *bgr)
+{
+    const int16x8_t c = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(yy)), vdupq_n_s16(16));
+    const int16x8_t d = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(uu)), vdupq_n_s16(128));
+    const int16x8_t e = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vv)), vdupq_n_s16(128));
+
+    const int32x4_t round = vdupq_n_s32(128);
+    const int32x4_t c_lo = vmlal_n_s16(round, vget_low_s16(c), 298);
+    const int32x4_t c_hi = vmlal_n_s16(round, vget_high_s16(c), 298);
+
+    uint8x8x3_t out;
+    out.val[0] = neon_bgr_channel(vmlal_n_s16(c_lo, vget_low_s16(d), 516), vmlal_n_s16(c_hi, vget_high_s16(d), 516));
+    out.val[1] = neon_bgr_channel(
+        vmlal_n_s16(vmlal_n_s16(c_lo, vget_low_s16(d), -100), vget_low_s16(e), -208),
+        vmlal_n_s16(vmlal_n_s16(c_hi, vget_high_s16(d), -100), vget_high_s16(e), -208));
+    out.val[2] = neon_bgr_channel(vmlal_n_s16(c_lo, vget_low_s16(e), 409), vmlal_n_s16(c_hi, vget_high_s16(e), 409));
+    vst3_u8(bgr, out);
+}
+
+int bgr_row_simd(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *bgr, const int width)
+{
+    int x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        const uint8x16_t yy = vld1q_u8(y + x);
+        const uint8x8_t u8 = vld1_u8(u + x / 2);
+        const uint8x8_t v8 = vld1_u8(v + x / 2);
+        const uint8x8x2_t uu = vzip_u8(u8, u8);
+        const uint8x8x2_t vv = vzip_u8(v8, v8);
+        neon_bgr8(vget_low_u8(yy), uu.val[0], vv.val[0], bgr + 3 * x);
+        neon_bgr8(vget_high_u8(yy), uu.val[1], vv.val[1], bgr + 3 * x + 24);
+    }
+    return x;
+}
+
+int deinterleave_simd(const uint8_t *uv, uint8_t *u, uint8_t *v, const int n)
+{
+    int i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        const uint8x16x2_t p = vld2q_u8(uv + 2 * i);
+        vst1q_u8(u + i, p.val[0]);
+        vst1q_u8(v + i, p.val[1]);
+    }
+    return i;
+}
+
+int interleave_simd(const uint8_t *u, const uint8_t *v, uint8_t *uv, const int n)
+{
+    int i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        uint8x16x2_t p;
+        p.val[0] = vld1q_u8(u + i);
+        p.val[1] = vld1q_u8(v + i);
+        vst2q_u8(uv + 2 * i, p);
+    }
+    return i;
+}
+
+#elif defined(COLORCONV_SSE2)
+
+// 8 RGBA pixels to 8x16 bit R, G and B
+inline void sse2_unpack_rgba(const uint8_t *p, __m128i &r, __m128i &g, __m128i &b)
+{
+    const __m128i mask = _mm_set1_epi32(0xff);
+    const __m128i a = _mm_loadu_si128((const __m128i *)p);
+    const __m128i c = _mm_loadu_si128((const __m128i *)(p + 16));
+    r = _mm_packs_epi32(_mm_and_si128(a, mask), _mm_and_si128(c, mask));
+    g = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(a, 8), mask), _mm_and_si128(_mm_srli_epi32(c, 8), mask));
+    b = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(a, 16), mask), _mm_and_si128(_mm_srli_epi32(c, 16), mask));
+}
+
+// the sum fits in 16 unsigned bits, so wrapping multiplies and a logical shift are exact
+inline __m128i sse2_y(const __m128i r, const __m128i g, const __m128i b)
+{
+    __m128i y = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(66)), _mm_mullo_epi16(g, _mm_set1_epi16(129)));
+    y = _mm_add_epi16(y, _mm_add_epi16(_mm_mullo_epi16(b, _mm_set1_epi16(25)), _mm_set1_epi16(128)));
+    return _mm_add_epi16(_mm_srli_epi16(y, 8), _mm_set1_epi16(16));
+}
+
+inline __m128i sse2_chroma(const __m128i r, const __m128i g, const __m128i b, const short cr, const short cg, const short cb)
+{
+    __m128i c = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(cr)), _mm_mullo_epi16(g, _mm_set1_epi16(cg)));
+    c = _mm_add_epi16(c, _mm_add_epi16(_mm_mullo_epi16(b, _mm_set1_epi16(cb)), _mm_set1_epi16(128)));
+    return _mm_add_epi16(_mm_srai_epi16(c, 8), _mm_set1_epi16(128));
+}
+
+// 2x2 sums of two rows of 16 pixels (two groups of 8 per row), rounded to the average
+inline __m128i sse2_average(const __m128i a0, const __m128i a1, const __m128i b0, const __m128i b1)
+{
+    const __m128i ones = _mm_set1_epi16(1);
+    const __m128i s0 = _mm_madd_epi16(_mm_add_epi16(a0, b0), ones);
+    const __m128i s1 = _mm_madd_epi16(_mm_add_epi16(a1, b1), ones);
+    return _mm_srli_epi16(_mm_add_epi16(_mm_packs_epi32(s0, s1), _mm_set1_epi16(2)), 2);
+}
+
+int rgba_rows_sse2(const uint8_t *row0, const uint8_t *row1,
+                   uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v, const int width)
+{
+    int x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        __m128i r[4], g[4], b[4];   // row0 px 0-7, row0 px 8-15, row1 px 0-7, row1 px 8-15
+        sse2_unpack_rgba(row0 + 4 * x, r[0], g[0], b[0]);
+        sse2_unpack_rgba(row0 + 4 * x + 32, r[1], g[1], b[1]);
+        sse2_unpack_rgba(row1 + 4 * x, r[2], g[2], b[2]);
+        sse2_unpack_rgba(row1 + 4 * x + 32, r[3], g[3], b[3]);
+
+        _mm_storeu_si128((__m128i *)(y0 + x), _mm_packus_epi16(sse2_y(r[0], g[0], b[0]), sse2_y(r[1], g[1], b[1])));
+        _mm_storeu_si128((__m128i *)(y1 + x), _mm_packus_epi16(sse2_y(r[2], g[2], b[2]), sse2_y(r[3], g[3], b[3])));
+
+        const __m128i ra = sse2_average(r[0], r[1], r[2], r[3]);
+        const __m128i ga = sse2_average(g[0], g[1], g[2], g[3]);
+        const __m128i ba = sse2_average(b[0], b[1], b[2], b[3]);
+        const __m128i zero = _mm_setzero_si128();
+        _mm_storel_epi64((__m128i *)(u + x / 2), _mm_packus_epi16(sse2_chroma(ra, ga, ba, -38, -74, 112), zero));
+        _mm_storel_epi64((__m128i *)(v + x / 2), _mm_packus_epi16(sse2_chroma(ra, ga, ba, 112, -94, -18), zero));
+    }
+    return x;
+}
+
+#if defined(COLORCONV_AVX2)
+
+// 256 bit packs work per 128 bit lane, this puts the 64 bit quarters back in order
+#define AVX2_FIX_ORDER(x) _mm256_permute4x64_epi64(x, 0xD8)
+
+__attribute__((target("avx2")))
+inline void avx2_unpack_rgba(const uint8_t *p, __m256i &r, __m256i &g, __m256i &b)
+{
+    const __m256i mask = _mm256_set1_epi32(0xff);
+    const __m256i a = _mm256_loadu_si256((const __m256i *)p);
+    const __m256i c = _mm256_loadu_si256((const __m256i *)(p + 32));
+    r = AVX2_FIX_ORDER(_mm256_packs_epi32(_mm256_and_si256(a, mask), _mm256_and_si256(c, mask)));
+    g = AVX2_FIX_ORDER(_mm256_packs_epi32(_mm256_and_si256(_mm256_srli_epi32(a, 8), mask),
+                                          _mm256_and_si256(_mm256_srli_epi32(c, 8), mask)));
+    b = AVX2_FIX_ORDER(_mm256_packs_epi32(_mm256_and_si256(_mm256_srli_epi32(a, 16), mask),
+                                          _mm256_and_si256(_mm256_srli_epi32(c, 16), mask)));
+}
+
+__attribute__((target("avx2")))
+inline __m256i avx2_y(const __m256i r, const __m256i g, const __m256i b)
+{
+    __m256i y = _mm256_add_epi16(_mm256_mullo_epi16(r, _mm256_set1_epi16(66)), _mm256_mullo_epi16(g, _mm256_set1_epi16(129)));
+    y = _mm256_add_epi16(y, _mm256_add_epi16(_mm256_mullo_epi16(b, _mm256_set1_epi16(25)), _mm256_set1_epi16(128)));
+    return _mm256_add_epi16(_mm256_srli_epi16(y, 8), _mm256_set1_epi16(16));
+}
+
+__attribute__((target("avx2")))
+inline __m256i avx2_chroma(const __m256i r, const __m256i g, const __m256i b, const short cr, const short cg, const short cb)
+{
+    __m256i c = _mm256_add_epi16(_mm256_mullo_epi16(r, _mm256_set1_epi16(cr)), _mm256_mullo_epi16(g, _mm256_set1_epi16(cg)));
+    c = _mm256_add_epi16(c, _mm256_add_epi16(_mm256_mullo_epi16(b, _mm256_set1_epi16(cb)), _mm256_set1_epi16(128)));
+    return _mm256_add_epi16(_mm256_srai_epi16(c, 8), _mm256_set1_epi16(128));
+}
+
+__attribute__((target("avx2")))
+inline __m256i avx2_average(const __m256i a0, const __m256i a1, const __m256i b0, const __m256i b1)
+{
+    const __m256i ones = _mm256_set1_epi16(1);
+    const __m256i s0 = _mm256_madd_epi16(_mm256_add_epi16(a0, b0), ones);
+    const __m256i s1 = _mm256_madd_epi16(_mm256_add_epi16(a1, b1), ones);
+    const __m256i s = AVX2_FIX_ORDER(_mm256_packs_epi32(s0, s1));
+    return _mm256_srli_epi16(_mm256_add_epi16(s, _mm256_set1_epi16(2)), 2);
+}
+
+__attribute__((target("avx2")))
+int rgba_rows_avx2(const uint8_t *row0, const uint8_t *row1,
+                   uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v, const int width)
+{
+    int x = 0;
+    for (; x + 32 <= width; x += 32)
+    {
+        __m256i r[4], g[4], b[4];   // row0 px 0-15, row0 px 16-31, row1 px 0-15, row1 px 16-31
+        avx2_unpack_rgba(row0 + 4 * x, r[0], g[0], b[0]);
+        avx2_unpack_rgba(row0 + 4 * x + 64, r[1], g[1], b[1]);
+        avx2_unpack_rgba(row1 + 4 * x, r[2], g[2], b[2]);
+        avx2_unpack_rgba(row1 + 4 * x + 64, r[3], g[3], b[3]);
+
+        _mm256_storeu_si256((__m256i *)(y0 + x),
+                            AVX2_FIX_ORDER(_mm256_packus_epi16(avx2_y(r[0], g[0], b[0]), avx2_y(r[1], g[1], b[1]))));
+        _mm256_storeu_si256((__m256i *)(y1 + x),
+                            AVX2_FIX_ORDER(_mm256_packus_epi16(avx2_y(r[2], g[2], b[2]), avx2_y(r[3], g[3], b[3]))));
+
+        const __m256i ra = avx2_average(r[0], r[1], r[2], r[3]);
+        const __m256i ga = avx2_average(g[0], g[1], g[2], g[3]);
+        const __m256i ba = avx2_average(b[0], b[1], b[2], b[3]);
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i cu = AVX2_FIX_ORDER(_mm256_packus_epi16(avx2_chroma(ra, ga, ba, -38, -74, 112), zero));
+        const __m256i cv = AVX2_FIX_ORDER(_mm256_packus_epi16(avx2_chroma(ra, ga, ba, 112, -94, -18), zero));
+        _mm_storeu_si128((__m128i *)(u + x / 2), _mm256_castsi256_si128(cu));
+        _mm_storeu_si128((__m128i *)(v + x / 2), _mm256_castsi256_si128(cv));
+    }
+    return x;
+}
+
+bool have_avx2()
+{
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    return avx2;
+}
+
+#endif
+
+int rgba_rows_simd(const uint8_t *row0, const uint8_t *row1,
+                   uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v, const int width)
+{
+#if defined(COLORCONV_AVX2)
+    if (have_avx2())
+    {
+        return rgba_rows_avx2(row0, row1, y0, y1, u, v, width);
+    }
+#endif
+    return rgba_rows_sse2(row0, row1, y0, y1, u, v, width);
+}
+
+// one BGR channel of 8 pixels from the 32 bit sums of pixels 0-3 and 4-7
+inline __m128i sse2_bgr_channel(const __m128i lo, const __m128i hi)
+{
+    return _mm_packs_epi32(_mm_srai_epi32(lo, 8), _mm_srai_epi32(hi, 8));
+}
+
+int bgr_row_simd(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *bgr, const int width)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i round = _mm_set1_epi32(128);
+    const __m128i coef_r = _mm_set_epi16(409, 298, 409, 298, 409, 298, 409, 298);         // (c, e)
+    const __m128i coef_b = _mm_set_epi16(516, 298, 516, 298, 516, 298, 516, 298);         // (c, d)
+    const __m128i coef_g_cd = _mm_set_epi16(-100, 298, -100, 298, -100, 298, -100, 298);  // (c, d)
+    const __m128i coef_g_e = _mm_set_epi16(128, -208, 128, -208, 128, -208, 128, -208);   // (e, 1), adds the rounding
+    const __m128i ones = _mm_set1_epi16(1);
+
+    int x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        const __m128i yy = _mm_loadu_si128((const __m128i *)(y + x));
+        __m128i uu = _mm_loadl_epi64((const __m128i *)(u + x / 2));
+        __m128i vv = _mm_loadl_epi64((const __m128i *)(v + x / 2));
+        uu = _mm_unpacklo_epi8(uu, uu);
+        vv = _mm_unpacklo_epi8(vv, vv);
+
+        __m128i channels[3][2];
+        for (int k = 0; k < 2; k++)
+        {
+            const __m128i c = _mm_sub_epi16(k ? _mm_unpackhi_epi8(yy, zero) : _mm_unpacklo_epi8(yy, zero), _mm_set1_epi16(16));
+            const __m128i d = _mm_sub_epi16(k ? _mm_unpackhi_epi8(uu, zero) : _mm_unpacklo_epi8(uu, zero), _mm_set1_epi16(128));
+            const __m128i e = _mm_sub_epi16(k ? _mm_unpackhi_epi8(vv, zero) : _mm_unpacklo_epi8(vv, zero), _mm_set1_epi16(128));
+
+            const __m128i ce_lo = _mm_unpacklo_epi16(c, e), ce_hi = _mm_unpackhi_epi16(c, e);
+            const __m128i cd_lo = _mm_unpacklo_epi16(c, d), cd_hi = _mm_unpackhi_epi16(c, d);
+            const __m128i e1_lo = _mm_unpacklo_epi16(e, ones), e1_hi = _mm_unpackhi_epi16(e, ones);
+
+            channels[0][k] = sse2_bgr_channel(_mm_add_epi32(_mm_madd_epi16(cd_lo, coef_b), round),
+                                              _mm_add_epi32(_mm_madd_epi16(cd_hi, coef_b), round));
+            channels[1][k] = sse2_bgr_channel(_mm_add_epi32(_mm_madd_epi16(cd_lo, coef_g_cd), _mm_madd_epi16(e1_lo, coef_g_e)),
+                                              _mm_add_epi32(_mm_madd_epi16(cd_hi, coef_g_cd), _mm_madd_epi16(e1_hi, coef_g_e)));
+            channels[2][k] = sse2_bgr_channel(_mm_add_epi32(_mm_madd_epi16(ce_lo, coef_r), round),
+                                              _mm_add_epi32(_mm_madd_epi16(ce_hi, coef_r), round));
+        }
+
+        // SSE2 has no byte shuffle, so interleave the saturated channels through the stack
+        uint8_t planar[3][16];
+        for (int ch = 0; ch < 3; ch++)
+        {
+            _mm_storeu_si128((__m128i *)planar[ch], _mm_packus_epi16(channels[ch][0], channels[ch][1]));
+        }
+        uint8_t *out = bgr + 3 * x;
+        for (int i = 0; i < 16; i++)
+        {
+            out[3 * i] = planar[0][i];
+            out[3 * i + 1] = planar[1][i];
+            out[3 * i + 2] = planar[2][i];
+        }
+    }
+    return x;
+}
+
+int deinterleave_simd(const uint8_t *uv, uint8_t *u, uint8_t *v, const int n)
+{
+    const __m128i mask = _mm_set1_epi16(0x00ff);
+    int i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        const __m128i a = _mm_loadu_si128((const __m128i *)(uv + 2 * i));
+        const __m128i b = _mm_loadu_si128((const __m128i *)(uv + 2 * i + 16));
+        _mm_storeu_si128((__m128i *)(u + i), _mm_packus_epi16(_mm_and_si128(a, mask), _mm_and_si128(b, mask)));
+        _mm_storeu_si128((__m128i *)(v + i), _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8)));
+    }
+    return i;
+}
+
+int interleave_simd(const uint8_t *u, const uint8_t *v, uint8_t *uv, const int n)
+{
+    int i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        const __m128i a = _mm_loadu_si128((const __m128i *)(u + i));
+        const __m128i b = _mm_loadu_si128((const __m128i *)(v + i));
+        _mm_storeu_si128((__m128i *)(uv + 2 * i), _mm_unpacklo_epi8(a, b));
+        _mm_storeu_si128((__m128i *)(uv + 2 * i + 16), _mm_unpackhi_epi8(a, b));
+    }
+    return i;
+}
+
+#else
+
+int rgba_rows_simd(const uint8_t *, const uint8_t *, uint8_t *, uint8_t *, uint8_t *, uint8_t *, const int)
+{
+    return 0;
+}
+
+int bgr_row_simd(const uint8_t *, const uint8_t *, const uint8_t *, uint8_t *, const int)
+{
+    return 0;
+}
+
+int deinterleave_simd(const uint8_t *, uint8_t *, uint8_t *, const int)
+{
+    return 0;
+}
+
+int interleave_simd(const uint8_t *, const uint8_t *, uint8_t *, const int)
+{
+    return 0;
+}
+
+#endif
+
+void rgba_band(const uint8_t *rgba, const int rgba_stride, uint8_t *y, const int y_stride,
+               uint8_t *u, const int u_stride, uint8_t *v, const int v_stride, const int width,
+               const bool simd, const int begin, const int end)
+{
+    for (int j = begin; j < end; j++)
+    {
+        const uint8_t *row0 = rgba + (2 * j) * rgba_stride;
+        const uint8_t *row1 = row0 + rgba_stride;
+        uint8_t *y0 = y + (2 * j) * y_stride;
+        uint8_t *y1 = y0 + y_stride;
+        const int x = simd ? rgba_rows_simd(row0, row1, y0, y1, u + j * u_stride, v + j * v_stride, width) : 0;
+        rgb_rows_c(row0, row1, 4, 0, 2, y0, y1, u + j * u_stride, v + j * v_stride, x, width);
+    }
+}
+
+void bgr_band(const uint8_t *bgr, const int bgr_stride, uint8_t *y, const int y_stride,
+              uint8_t *u, const int u_stride, uint8_t *v, const int v_stride, const int width,
+              const int begin, const int end)
+{
+    for (int j = begin; j < end; j++)
+    {
+        const uint8_t *row0 = bgr + (2 * j) * bgr_stride;
+        uint8_t *y0 = y + (2 * j) * y_stride;
+        rgb_rows_c(row0, row0 + bgr_stride, 3, 2, 0, y0, y0 + y_stride, u + j * u_stride, v + j * v_stride, 0, width);
+    }
+}
+
+void i420_bgr_band(const uint8_t *y, const int y_stride, const uint8_t *u, const int u_stride,
+                   const uint8_t *v, const int v_stride, uint8_t *bgr, const int bgr_stride, const int width,
+                   const bool simd, const int begin, const int end)
+{
+    for (int j = begin; j < end; j++)
+    {
+        const uint8_t *yr = y + j * y_stride;
+        const uint8_t *ur = u + (j / 2) * u_stride;
+        const uint8_t *vr = v + (j / 2) * v_stride;
+        uint8_t *out = bgr + j * bgr_stride;
+        const int x = simd ? bgr_row_simd(yr, ur, vr, out, width) : 0;
+        bgr_row_c(yr, ur, vr, out, x, width);
+    }
+}
+
+void copy_plane(const uint8_t *src, const int src_stride, uint8_t *dst, const int dst_stride,
+                const int width, const int height)
+{
+    for (int j = 0; j < height; j++)
+    {
+        memcpy(dst + j * dst_stride, src + j * src_stride, width);
+    }
+}
+
+void nv12_i420(const uint8_t *y, const int y_stride, const uint8_t *uv, const int uv_stride,
+               uint8_t *dst_y, const int dst_y_stride, uint8_t *u, const int u_stride,
+               uint8_t *v, const int v_stride, const int width, const int height, const bool simd)
+{
+    copy_plane(y, y_stride, dst_y, dst_y_stride, width, height);
+    const int n = width / 2;
+    for (int j = 0; j < height / 2; j++)
+    {
+        const uint8_t *src = uv + j * uv_stride;
+        uint8_t *ur = u + j * u_stride;
+        uint8_t *vr = v + j * v_stride;
+        for (int i = simd ? deinterleave_simd(src, ur, vr, n) : 0; i < n; i++)
+        {
+            ur[i] = src[2 * i];
+            vr[i] = src[2 * i + 1];
+        }
+    }
+}
+
+void i420_nv12(const uint8_t *y, const int y_stride, const uint8_t *u, const int u_stride,
+               const uint8_t *v, const int v_stride, uint8_t *dst_y, const int dst_y_stride,
+               uint8_t *uv, const int uv_stride, const int width, const int height, const bool simd)
+{
+    copy_plane(y, y_stride, dst_y, dst_y_stride, width, height);
+    const int n = width / 2;
+    for (int j = 0; j < height / 2; j++)
+    {
+        const uint8_t *ur = u + j * u_stride;
+        const uint8_t *vr = v + j * v_stride;
+        uint8_t *dst = uv + j * uv_stride;
+        for (int i = simd ? interleave_simd(ur, vr, dst, n) : 0; i < n; i++)
+        {
+            dst[2 * i] = ur[i];
+            dst[2 * i + 1] = vr[i];
+        }
+    }
+}
+
+void half_plane_band(const uint8_t *src, const int src_stride, uint8_t *dst, const int dst_stride,
+                     const int dst_w, const int begin, const int end)
+{
+    Scaler::half_plane(src + (2 * begin) * src_stride, src_stride, dst + begin * dst_stride, dst_stride,
+                       dst_w, end - begin);
+}
+
+} // anonymous namespace
+
+void ColorConv::rgba_to_i420(const uint8_t *rgba, const int rgba_stride,
+                             uint8_t *y, const int y_stride, uint8_t *u, const int u_stride,
+                             uint8_t *v, const int v_stride, const int width, const int height)
+{
+    run_bands(height / 2, (size_t)width * height * 4,
+              [=](int begin, int end) { rgba_band(rgba, rgba_stride, y, y_stride, u, u_stride, v, v_stride, width, true, begin, end); });
+}
+
+void ColorConv::rgba_to_i420_c(const uint8_t *rgba, const int rgba_stride,
+                               uint8_t *y, const int y_stride, uint8_t *u, const int u_stride,
+                               uint8_t *v, const int v_stride, const int width, const int height)
+{
+    rgba_band(rgba, rgba_stride, y, y_stride, u, u_stride, v, v_stride, width, false, 0, height / 2);
+}
+
+void ColorConv::bgr_to_i420(const uint8_t *bgr, const int bgr_stride,
+                            uint8_t *y, const int y_stride, uint8_t *u, const int u_stride,
+                            uint8_t *v, const int v_stride, const int width, const int height)
+{
+    run_bands(height / 2, (size_t)width * height * 3,
+              [=](int begin, int end) { bgr_band(bgr, bgr_stride, y, y_stride, u, u_stride, v, v_stride, width, begin, end); });
+}
+
+void ColorConv::i420_to_bgr(const uint8_t *y, const int y_stride, const uint8_t *u, const int u_stride,
+                            const uint8_t *v, const int v_stride, uint8_t *bgr, const int bgr_stride,
+                            const int width, const int height)
+{
+    run_bands(height, (size_t)width * height * 3,
+              [=](int begin, int end) { i420_bgr_band(y, y_stride, u, u_stride, v, v_stride, bgr, bgr_stride, width, true, begin, end); });
+}
+
+void ColorConv::i420_to_bgr_c(const uint8_t *y, const int y_stride, const uint8_t *u, const int u_stride,
+                              const uint8_t *v, const int v_stride, uint8_t *bgr, const int bgr_stride,
+                              const int width, const int height)
+{
+    i420_bgr_band(y, y_stride, u, u_stride, v, v_stride, bgr, bgr_stride, width, false, 0, height);
+}
+
+void ColorConv::nv12_to_i420(const uint8_t *y, const int y_stride, const uint8_t *uv, const int uv_stride,
+                             uint8_t *dst_y, const int dst_y_stride, uint8_t *u, const int u_stride,
+                             uint8_t *v, const int v_stride, const int width, const int height)
+{
+    // memory bound, more threads do not help
+    nv12_i420(y, y_stride, uv, uv_stride, dst_y, dst_y_stride, u, u_stride, v, v_stride, width, height, true);
+}
+
+void ColorConv::nv12_to_i420_c(const uint8_t *y, const int y_stride, const uint8_t *uv, const int uv_stride,
+                               uint8_t *dst_y, const int dst_y_stride, uint8_t *u, const int u_stride,
+                               uint8_t *v, const int v_stride, const int width, const int height)
+{
+    nv12_i420(y, y_stride, uv, uv_stride, dst_y, dst_y_stride, u, u_stride, v, v_stride, width, height, false);
+}
+
+void ColorConv::i420_to_nv12(const uint8_t *y, const int y_stride, const uint8_t *u, const int u_stride,
+                             const uint8_t *v, const int v_stride, uint8_t *dst_y, const int dst_y_stride,
+                             uint8_t *uv, const int uv_stride, const int width, const int height)
+{
+    i420_nv12(y, y_stride, u, u_stride, v, v_stride, dst_y, dst_y_stride, uv, uv_stride, width, height, true);
+}
+
+void ColorConv::i420_to_nv12_c(const uint8_t *y, const int y_stride, const uint8_t *u, const int u_stride,
+                               const uint8_t *v, const int v_stride, uint8_t *dst_y, const int dst_y_stride,
+                               uint8_t *uv, const int uv_stride, const int width, const int height)
+{
+    i420_nv12(y, y_stride, u, u_stride, v, v_stride, dst_y, dst_y_stride, uv, uv_stride, width, height, false);
+}
+
+void ColorConv::half_plane(const uint8_t *src, const int src_stride,
+                           uint8_t *dst, const int dst_stride, const int dst_w, const int dst_h)
+{
+    run_bands(dst_h, (size_t)dst_w * dst_h * 4,
+              [=](int begin, int end) { half_plane_band(src, src_stride, dst, dst_stride, dst_w, begin, end); });
+}
+
+void ColorConv::set_threads(const int threads)
+{
+    _threads = std::max(1, threads);
+}
+
+int ColorConv::get_threads()
+{
+    return _threads;
+}
+
+const char *ColorConv::simd_name()
+{
+#if defined(COLORCONV_NEON)
+    return "NEON";
+#elif defined(COLORCONV_AVX2)
+    return have_avx2() ? "AVX2" : "SSE2";
+#elif defined(COLORCONV_SSE2)
+    return "SSE2";
+#else
+    return "none";
+#endif
+}
+
+} // namespace BoulderAI
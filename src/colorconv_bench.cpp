@@ -0,0 +1,119 @@
+/**
+ * Benchmarks the ColorConv kernels against their scalar reference and checks that both
+ * produce exactly the same output.
+ *
+ * usage: colorconv_bench [width] [height] [iterations] [threads]
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/function.hpp>
+
+#include "colorconv.hpp"
+#include "scaler.hpp"
+
+using namespace BoulderAI;
+
+namespace pt = boost::posix_time;
+
+typedef std::vector < uint8_t > Buffer;
+
+static double run_mbps(const boost::function < void() > &fn, const int iterations, const size_t bytes)
+{
+    fn(); // warm up
+    const pt::ptime start = pt::microsec_clock::universal_time();
+    for (int i = 0; i < iterations; i++)
+    {
+        fn();
+    }
+    const double seconds = (pt::microsec_clock::universal_time() - start).total_microseconds() / 1e6;
+    return bytes * (double)iterations / seconds / 1e6;
+}
+
+static bool report(const std::string &name, const boost::function < void() > &ref, const boost::function < void() > &opt,
+                   const Buffer &ref_out, const Buffer &opt_out, const int iterations, const size_t bytes)
+{
+    ref();
+    opt();
+    const bool exact = (ref_out == opt_out);
+    const double ref_mbps = run_mbps(ref, iterations, bytes);
+    const double opt_mbps = run_mbps(opt, iterations, bytes);
+    std::cout << std::left << std::setw(14) << name << std::right << std::fixed << std::setprecision(1)
+              << std::setw(10) << ref_mbps << " MB/s" << std::setw(10) << opt_mbps << " MB/s"
+              << std::setw(8) << opt_mbps / ref_mbps << "x  " << (exact ? "exact" : "MISMATCH") << std::endl;
+    return exact;
+}
+
+int main(int argc, char **argv)
+{
+    const int width = argc > 1 ? atoi(argv[1]) & ~1 : 3840;
+    const int height = argc > 2 ? atoi(argv[2]) & ~1 : 2160;
+    const int iterations = argc > 3 ? atoi(argv[3]) : 20;
+    if (argc > 4)
+    {
+        ColorConv::set_threads(atoi(argv[4]));
+    }
+
+    std::cout << width << "x" << height << ", " << iterations << " iterations, " << ColorConv::simd_name()
+              << ", " << ColorConv::get_threads() << " threads" << std::endl;
+    std::cout << std::left << std::setw(14) << "kernel" << std::right << std::setw(15) << "reference"
+              << std::setw(15) << "optimized" << std::endl;
+
+    const int cw = width / 2;
+    const int ch = height / 2;
+    const size_t y_size = (size_t)width * height;
+    const size_t c_size = (size_t)cw * ch;
+
+    Buffer rgba(y_size * 4);
+    srand(1);
+    for (size_t i = 0; i < rgba.size(); i++)
+    {
+        rgba[i] = rand() & 0xff;
+    }
+
+    Buffer i420_ref(y_size + 2 * c_size), i420_opt(y_size + 2 * c_size);
+    Buffer bgr_ref(y_size * 3), bgr_opt(y_size * 3);
+    Buffer nv12_ref(y_size + 2 * c_size), nv12_opt(y_size + 2 * c_size);
+    Buffer half_ref(c_size), half_opt(c_size);
+    bool ok = true;
+
+#define I420_PLANES(b) &b[0], width, &b[y_size], cw, &b[y_size + c_size], cw
+#define NV12_PLANES(b) &b[0], width, &b[y_size], width
+
+    ok &= report("rgba_to_i420",
+                 [&]() { ColorConv::rgba_to_i420_c(&rgba[0], width * 4, I420_PLANES(i420_ref), width, height); },
+                 [&]() { ColorConv::rgba_to_i420(&rgba[0], width * 4, I420_PLANES(i420_opt), width, height); },
+                 i420_ref, i420_opt, iterations, rgba.size());
+
+    // the other kernels start from the I420 reference, which is a realistic image
+    ok &= report("i420_to_bgr",
+                 [&]() { ColorConv::i420_to_bgr_c(I420_PLANES(i420_ref), &bgr_ref[0], width * 3, width, height); },
+                 [&]() { ColorConv::i420_to_bgr(I420_PLANES(i420_ref), &bgr_opt[0], width * 3, width, height); },
+                 bgr_ref, bgr_opt, iterations, i420_ref.size());
+
+    ok &= report("i420_to_nv12",
+                 [&]() { ColorConv::i420_to_nv12_c(I420_PLANES(i420_ref), NV12_PLANES(nv12_ref), width, height); },
+                 [&]() { ColorConv::i420_to_nv12(I420_PLANES(i420_ref), NV12_PLANES(nv12_opt), width, height); },
+                 nv12_ref, nv12_opt, iterations, i420_ref.size());
+
+    ok &= report("nv12_to_i420",
+                 [&]() { ColorConv::nv12_to_i420_c(NV12_PLANES(nv12_ref), I420_PLANES(i420_ref), width, height); },
+                 [&]() { ColorConv::nv12_to_i420(NV12_PLANES(nv12_ref), I420_PLANES(i420_opt), width, height); },
+                 i420_ref, i420_opt, iterations, nv12_ref.size());
+
+    ok &= report("half_y",
+                 [&]() { Scaler::half_plane_c(&i420_ref[0], width, &half_ref[0], cw, cw, ch); },
+                 [&]() { ColorConv::half_plane(&i420_ref[0], width, &half_opt[0], cw, cw, ch); },
+                 half_ref, half_opt, iterations, y_size);
+
+    if (!ok)
+    {
+        std::cout << "Optimized output differs from the reference." << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -17,6 +17,9 @@ int Configuration::_zoom_home_direction;
 int Configuration::_zoom_home_max_steps;
 int Configuration::_zoom_home_step_size;
 bool Configuration::_zoom_has_limit;
+double Configuration::_zoom_start_speed;
+double Configuration::_zoom_max_speed;
+double Configuration::_zoom_acceleration;
 
 int Configuration::_focus_start;
 int Configuration::_focus_up_direction;
@@ -24,6 +27,9 @@ int Configuration::_focus_home_direction;
 int Configuration::_focus_home_max_steps;
 int Configuration::_focus_home_step_size;
 bool Configuration::_focus_has_limit;
+double Configuration::_focus_start_speed;
+double Configuration::_focus_max_speed;
+double Configuration::_focus_acceleration;
 
 int Configuration::_iris_start;
 int Configuration::_iris_up_direction;
@@ -31,6 +37,20 @@ int Configuration::_iris_home_direction;
 int Configuration::_iris_home_max_steps;
 int Configuration::_iris_home_step_size;
 bool Configuration::_iris_has_limit;
+double Configuration::_iris_start_speed;
+double Configuration::_iris_max_speed;
+double Configuration::_iris_acceleration;
+
+std::string Configuration::_position_journal;
+
+int Configuration::_zoom_max;
+int Configuration::_focus_max;
+std::string Configuration::_focus_curve;
+bool Configuration::_focus_track;
+bool Configuration::_focus_track_autofocus;
+int Configuration::_autofocus_range;
+int Configuration::_autofocus_step;
+std::string Configuration::_presets;
 
 static void cout_log_handler(std::string output)
 {
@@ -58,18 +78,36 @@ void Configuration::_load_config_file(void)
         ("zoom_home_max_steps", po::value<int>(&_zoom_home_max_steps)->default_value(100), "maximum steps to take while homing")
         ("zoom_home_step_size", po::value<int>(&_zoom_home_step_size)->default_value(5), "number of steps to take while homing")
         ("zoom_has_limit", po::value<bool>(&_zoom_has_limit)->default_value(true), "zoom has limit")
+        ("zoom_start_speed", po::value<double>(&_zoom_start_speed)->default_value(500), "steps/s the zoom motor starts and stops at")
+        ("zoom_max_speed", po::value<double>(&_zoom_max_speed)->default_value(4000), "fastest zoom steps/s")
+        ("zoom_acceleration", po::value<double>(&_zoom_acceleration)->default_value(10000), "zoom acceleration in steps/s^2, 0 for constant speed")
         ("focus_start", po::value<int>(&_focus_start)->default_value(0), "absolute focus start offset")
         ("focus_up_direction", po::value<int>(&_focus_up_direction)->default_value(0), "0 or 1 for direction")
         ("focus_home_direction", po::value<int>(&_focus_home_direction)->default_value(0), "0 or 1 for direction")
         ("focus_home_max_steps", po::value<int>(&_focus_home_max_steps)->default_value(100), "maximum steps to take while homing")
         ("focus_home_step_size", po::value<int>(&_focus_home_step_size)->default_value(5), "number of steps to take while homing")
         ("focus_has_limit", po::value<bool>(&_focus_has_limit)->default_value(true), "focus has limit")
+        ("focus_start_speed", po::value<double>(&_focus_start_speed)->default_value(500), "steps/s the focus motor starts and stops at")
+        ("focus_max_speed", po::value<double>(&_focus_max_speed)->default_value(4000), "fastest focus steps/s")
+        ("focus_acceleration", po::value<double>(&_focus_acceleration)->default_value(10000), "focus acceleration in steps/s^2, 0 for constant speed")
         ("iris_start", po::value<int>(&_iris_start)->default_value(0), "absolute iris start offset")
         ("iris_up_direction", po::value<int>(&_iris_up_direction)->default_value(0), "0 or 1 for direction")
         ("iris_home_direction", po::value<int>(&_iris_home_direction)->default_value(0), "0 or 1 for direction")
         ("iris_home_max_steps", po::value<int>(&_iris_home_max_steps)->default_value(1000), "maximum steps to take while homing")
         ("iris_home_step_size", po::value<int>(&_iris_home_step_size)->default_value(5), "number of steps to take while homing")
         ("iris_has_limit", po::value<bool>(&_iris_has_limit)->default_value(false), "iris has limit")
+        ("iris_start_speed", po::value<double>(&_iris_start_speed)->default_value(250), "steps/s the iris motor starts and stops at")
+        ("iris_max_speed", po::value<double>(&_iris_max_speed)->default_value(250), "fastest iris steps/s")
+        ("iris_acceleration", po::value<double>(&_iris_acceleration)->default_value(0), "iris acceleration in steps/s^2, 0 for constant speed")
+        ("position_journal", po::value<std::string>(&_position_journal)->default_value("/var/lib/dnncam/lens_position.journal"), "file keeping the lens positions across restarts, empty to disable")
+        ("zoom_max", po::value<int>(&_zoom_max)->default_value(7000), "zoom travel from home, in steps")
+        ("focus_max", po::value<int>(&_focus_max)->default_value(7000), "focus travel from home, in steps")
+        ("focus_curve", po::value<std::string>(&_focus_curve)->default_value("/etc/lensdriver.focus"), "zoom to focus curve written by focus calibration")
+        ("focus_track", po::value<bool>(&_focus_track)->default_value(false), "focus follows zoom along the focus curve from startup")
+        ("focus_track_autofocus", po::value<bool>(&_focus_track_autofocus)->default_value(false), "autofocus after every zoom move while tracking")
+        ("autofocus_range", po::value<int>(&_autofocus_range)->default_value(100), "steps autofocus searches either way of the focus position")
+        ("autofocus_step", po::value<int>(&_autofocus_step)->default_value(10), "focus steps between autofocus measurements")
+        ("presets", po::value<std::string>(&_presets)->default_value("/etc/lensdriver.presets"), "named lens positions and camera settings")
     ;
     std::ifstream ifs;
     ifs.open(_config_filename);
@@ -0,0 +1,586 @@
+/**
+ * Benchmarks the hot paths of the frame pipeline on synthetic frames: NewWorker job
+ * throughput, SequentialSection ordering, the Stream copy per resolution, FrameCollection
+ * copies, motion detection per resolution and the frame rate of the worker/stream path with
+ * 1..threads workers. Also checks that the /events telemetry snapshot is valid JSON for every
+ * capture state, and exits with 1 when it is not.
+ *
+ * Results are written as JSON to stdout, or to output.json, so runs of different builds can
+ * be compared; progress goes to stderr.
+ *
+ * usage: dnncam_bench [width] [height] [frames] [threads] [output.json]
+ */
+
+#include <atomic>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <time.h>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include "frame_processor.hpp"
+#include "colorconv.hpp"
+#include "motion_detector.hpp"
+
+using namespace BoulderAI;
+
+// the streaming part of FrameProcessor::process_frame_task() as if every mount had a client
+class BenchStream : public Stream
+{
+public:
+    BenchStream(const int width, const int height, const int port) :
+        Stream(width, height, "127.0.0.1", port)
+    {
+    }
+
+    size_t get_mount_count() const { return _contexts.size(); }
+    std::string get_mount_path(const size_t i) const { return _contexts[i]->mount.path; }
+
+    void build_levels(const FrameCollection &frame_col)
+    {
+        unsigned level_mask = 0;
+        for (size_t i = 0; i < _contexts.size(); i++)
+        {
+            level_mask |= 1u << _contexts[i]->mount.level;
+        }
+        _pyramid.build(frame_col, level_mask);
+    }
+
+    void copy_mount(const FrameCollection &frame_col, const size_t i)
+    {
+        GstBuffer *buffer = make_buffer(frame_col, *_contexts[i]);
+        if (buffer)
+        {
+            gst_buffer_unref(buffer);
+        }
+    }
+
+    void copy_frame(const FrameCollection &frame_col)
+    {
+        build_levels(frame_col);
+        for (size_t i = 0; i < _contexts.size(); i++)
+        {
+            copy_mount(frame_col, i);
+        }
+    }
+};
+
+// the snapshot a new /events client gets first
+class BenchTelemetry : public Telemetry
+{
+public:
+    BenchTelemetry() :
+        Telemetry(DEFAULT_MAX_RATE, DEFAULT_INTERVAL_MS)
+    {
+    }
+
+    std::string snapshot()
+    {
+        sample();
+        ScopedLock lock(_mtex);
+        return get_changes(0);
+    }
+};
+
+// keeps the RTSP servers of the streams apart from a running camerastreamer
+static int next_port = 19090;
+
+static uint64_t monotonic_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// a plane with a row pitch larger than its width, like the ones libargus hands out
+static FramePtr make_plane(const int width, const int height, const int type)
+{
+    const int pitch = (width + 255) & ~255;
+    cv::Mat buffer(height, pitch, type);
+    cv::randu(buffer, cv::Scalar::all(0), cv::Scalar::all(255));
+    return FramePtr(new Frame(buffer.colRange(0, width)));
+}
+
+static FrameCollection make_frame(const int width, const int height)
+{
+    FrameCollection frame_col;
+    frame_col.frame_rgb = make_plane(width, height, CV_8UC4);
+    frame_col.frame_y = make_plane(width, height, CV_8U);
+    frame_col.frame_u = make_plane(width / 2, height / 2, CV_8U);
+    frame_col.frame_v = make_plane(width / 2, height / 2, CV_8U);
+    return frame_col;
+}
+
+static void empty_job()
+{
+}
+
+static void bench_worker(std::ostream &json, const int threads, const int jobs)
+{
+    std::cerr << "worker: " << jobs << " jobs on " << threads << " threads" << std::endl;
+    bl::NewWorker < bl::Logexc_policy > worker(threads, "Bench Worker");
+    worker.start();
+    const uint64_t start = monotonic_ns();
+    for (int i = 0; i < jobs; i++)
+    {
+        worker.add_job(empty_job);
+    }
+    worker.wait();
+    const double seconds = (monotonic_ns() - start) / 1e9;
+    json << "{\"threads\":" << threads << ",\"jobs\":" << jobs
+         << ",\"jobs_per_s\":" << jobs / seconds << ",\"ns_per_job\":" << seconds * 1e9 / jobs << "}";
+}
+
+static void sequential_job(const bool ordered, const int frame_num, std::atomic < uint64_t > *count)
+{
+    if (!ordered)
+    {
+        count->fetch_add(1);
+        return;
+    }
+    SequentialSection ss("bench", frame_num, 0);
+    count->fetch_add(1);
+}
+
+// the same jobs with and without passing through the section in frame order
+static void bench_sequential_section(std::ostream &json, const int threads, const int frames)
+{
+    std::cerr << "sequential_section: " << frames << " frames on " << threads << " threads" << std::endl;
+    {
+        SequentialSection init("bench");
+    }
+
+    double ns[2];
+    for (int ordered = 0; ordered < 2; ordered++)
+    {
+        SequentialSection::set_next_frame("bench", 0);
+        std::atomic < uint64_t > count(0);
+        bl::NewWorker < bl::Logexc_policy > worker(threads, "Bench Sequential");
+        worker.start();
+        const uint64_t start = monotonic_ns();
+        for (int i = 0; i < frames; i++)
+        {
+            worker.add_job(boost::bind(&sequential_job, ordered != 0, i, &count));
+        }
+        worker.wait();
+        ns[ordered] = (double)(monotonic_ns() - start) / frames;
+    }
+    json << "{\"threads\":" << threads << ",\"frames\":" << frames << ",\"ns_per_frame_unordered\":" << ns[0]
+         << ",\"ns_per_frame_ordered\":" << ns[1] << ",\"overhead_ns_per_frame\":" << ns[1] - ns[0] << "}";
+}
+
+static void bench_stream_copy(std::ostream &json, const int width, const int height, const int frames)
+{
+    std::cerr << "stream_copy: " << width << "x" << height << std::endl;
+    BenchStream stream(width, height, next_port++);
+    const FrameCollection frame_col = make_frame(width, height);
+    stream.copy_frame(frame_col);   // warm up
+
+    uint64_t start = monotonic_ns();
+    for (int i = 0; i < frames; i++)
+    {
+        stream.build_levels(frame_col);
+    }
+    const double levels_ms = (monotonic_ns() - start) / 1e6 / frames;
+
+    json << "{\"width\":" << width << ",\"height\":" << height << ",\"scale_ms\":" << levels_ms << ",\"mounts\":[";
+    double total_ms = levels_ms;
+    for (size_t m = 0; m < stream.get_mount_count(); m++)
+    {
+        start = monotonic_ns();
+        for (int i = 0; i < frames; i++)
+        {
+            stream.copy_mount(frame_col, m);
+        }
+        const double copy_ms = (monotonic_ns() - start) / 1e6 / frames;
+        total_ms += copy_ms;
+        json << (m ? "," : "") << "{\"mount\":\"" << stream.get_mount_path(m) << "\",\"copy_ms\":" << copy_ms << "}";
+    }
+    json << "],\"total_ms\":" << total_ms << "}";
+}
+
+// the auto capture check on every frame; a patch of a sixteenth of the frame appears and
+// disappears, so the blocks are compared and some of them move
+static void bench_motion_detect(std::ostream &json, const int width, const int height, const int frames)
+{
+    std::cerr << "motion_detect: " << width << "x" << height << std::endl;
+    cv::Mat planes[2];
+    planes[0] = make_plane(width, height, CV_8U)->to_mat();
+    planes[1] = planes[0].clone();
+    planes[1](cv::Rect(width / 4, height / 4, width / 4, height / 4)).setTo(cv::Scalar::all(0));
+    MotionDetector detector;
+    MotionStatus status;
+    detector.process(planes[0].data, planes[0].step, width, height, status);   // reference
+
+    int moving_blocks = 0;
+    const uint64_t start = monotonic_ns();
+    for (int i = 0; i < frames; i++)
+    {
+        const cv::Mat &y = planes[i % 2];
+        detector.process(y.data, y.step, width, height, status);
+        moving_blocks = std::max(moving_blocks, status.moving_blocks);
+    }
+    const double ms = (monotonic_ns() - start) / 1e6 / frames;
+    json << "{\"width\":" << width << ",\"height\":" << height << ",\"blocks\":" << status.blocks
+         << ",\"moving_blocks\":" << moving_blocks << ",\"ms_per_frame\":" << ms << "}";
+}
+
+static void copy_collections(const FrameCollection *frame_col, const int copies)
+{
+    for (int i = 0; i < copies; i++)
+    {
+        FrameCollection copy = *frame_col;
+        (void)copy;
+    }
+}
+
+// copying a FrameCollection takes four shared_ptr references; contended when threads share frames
+static void bench_frame_collection(std::ostream &json, const int threads, const int copies)
+{
+    std::cerr << "frame_collection: " << copies << " copies on 1 and " << threads << " threads" << std::endl;
+    const FrameCollection frame_col = make_frame(64, 64);
+
+    uint64_t start = monotonic_ns();
+    copy_collections(&frame_col, copies);
+    const double single_ns = (double)(monotonic_ns() - start) / copies;
+
+    boost::thread_group group;
+    start = monotonic_ns();
+    for (int t = 0; t < threads; t++)
+    {
+        group.create_thread(boost::bind(&copy_collections, &frame_col, copies));
+    }
+    group.join_all();
+    const double shared_ns = (double)(monotonic_ns() - start) / copies;
+
+    json << "{\"copies\":" << copies << ",\"ns_per_copy\":" << single_ns << ",\"threads\":" << threads
+         << ",\"ns_per_copy_contended\":" << shared_ns << "}";
+}
+
+static void pipeline_task(BenchStream *stream, FrameCollection frame_col, const int frame_num)
+{
+    SequentialSection ss("bench_pipeline", frame_num, 0);
+    stream->copy_frame(frame_col);
+}
+
+// frames through a BoundedWorker into the ordered stream copy, as FrameProcessor does
+static void bench_pipeline(std::ostream &json, BenchStream &stream, const FrameCollection &source,
+                           const int threads, const int frames)
+{
+    std::cerr << "pipeline: " << frames << " frames on " << threads << " threads" << std::endl;
+    SequentialSection::set_next_frame("bench_pipeline", 0);
+    BoundedWorker worker(threads, 512, "Bench Pipeline");
+    worker.start();
+
+    const uint64_t start = monotonic_ns();
+    for (int i = 0; i < frames; i++)
+    {
+        FrameCollection frame_col = source;
+        frame_col.frame_number = i + 1;
+        while (worker.add_job(boost::bind(&pipeline_task, &stream, frame_col, i)) == -1)
+        {
+            boost::this_thread::yield();
+        }
+    }
+    worker.wait();
+    const double seconds = (monotonic_ns() - start) / 1e9;
+    json << "{\"threads\":" << threads << ",\"frames\":" << frames << ",\"fps\":" << frames / seconds << "}";
+}
+
+// Strict JSON syntax check, enough to tell whether JSON.parse() in the browser would accept
+// a telemetry event. Advances pos past the value.
+static bool json_value(const std::string &s, size_t &pos);
+
+static void json_space(const std::string &s, size_t &pos)
+{
+    while (pos < s.size() && (s[pos] == ' ' || s[pos] == '\t' || s[pos] == '\n' || s[pos] == '\r'))
+    {
+        pos++;
+    }
+}
+
+static bool json_string(const std::string &s, size_t &pos)
+{
+    if (pos >= s.size() || s[pos] != '"')
+    {
+        return false;
+    }
+    for (pos++; pos < s.size(); pos++)
+    {
+        const unsigned char c = s[pos];
+        if (c == '"')
+        {
+            pos++;
+            return true;
+        }
+        if (c < 0x20)
+        {
+            return false;
+        }
+        if (c == '\\')
+        {
+            pos++;
+            if (pos >= s.size() || std::string("\"\\/bfnrtu").find(s[pos]) == std::string::npos)
+            {
+                return false;
+            }
+            if (s[pos] == 'u')
+            {
+                for (int i = 0; i < 4; i++)
+                {
+                    if (++pos >= s.size() || !isxdigit((unsigned char)s[pos]))
+                    {
+                        return false;
+                    }
+                }
+            }
+        }
+    }
+    return false;
+}
+
+static bool json_number(const std::string &s, size_t &pos)
+{
+    const size_t start = pos;
+    if (pos < s.size() && s[pos] == '-')
+    {
+        pos++;
+    }
+    if (pos >= s.size() || !isdigit((unsigned char)s[pos]))
+    {
+        return false;
+    }
+    if (s[pos] == '0')
+    {
+        // no leading zeros
+        pos++;
+    }
+    else
+    {
+        while (pos < s.size() && isdigit((unsigned char)s[pos]))
+        {
+            pos++;
+        }
+    }
+    if (pos < s.size() && s[pos] == '.')
+    {
+        if (++pos >= s.size() || !isdigit((unsigned char)s[pos]))
+        {
+            return false;
+        }
+        while (pos < s.size() && isdigit((unsigned char)s[pos]))
+        {
+            pos++;
+        }
+    }
+    if (pos < s.size() && (s[pos] == 'e' || s[pos] == 'E'))
+    {
+        pos++;
+        if (pos < s.size() && (s[pos] == '+' || s[pos] == '-'))
+        {
+            pos++;
+        }
+        if (pos >= s.size() || !isdigit((unsigned char)s[pos]))
+        {
+            return false;
+        }
+        while (pos < s.size() && isdigit((unsigned char)s[pos]))
+        {
+            pos++;
+        }
+    }
+    return pos > start;
+}
+
+static bool json_container(const std::string &s, size_t &pos, const char close, const bool object)
+{
+    pos++;
+    json_space(s, pos);
+    if (pos < s.size() && s[pos] == close)
+    {
+        pos++;
+        return true;
+    }
+    while (true)
+    {
+        if (object)
+        {
+            if (!json_string(s, pos))
+            {
+                return false;
+            }
+            json_space(s, pos);
+            if (pos >= s.size() || s[pos] != ':')
+            {
+                return false;
+            }
+            pos++;
+        }
+        if (!json_value(s, pos))
+        {
+            return false;
+        }
+        json_space(s, pos);
+        if (pos < s.size() && s[pos] == ',')
+        {
+            pos++;
+            json_space(s, pos);
+            continue;
+        }
+        if (pos < s.size() && s[pos] == close)
+        {
+            pos++;
+            return true;
+        }
+        return false;
+    }
+}
+
+static bool json_value(const std::string &s, size_t &pos)
+{
+    json_space(s, pos);
+    if (pos >= s.size())
+    {
+        return false;
+    }
+    static const char *literals[] = { "true", "false", "null" };
+    for (size_t i = 0; i < sizeof(literals) / sizeof(literals[0]); i++)
+    {
+        if (s.compare(pos, strlen(literals[i]), literals[i]) == 0)
+        {
+            pos += strlen(literals[i]);
+            return true;
+        }
+    }
+    switch (s[pos])
+    {
+    case '{':
+        return json_container(s, pos, '}', true);
+    case '[':
+        return json_container(s, pos, ']', false);
+    case '"':
+        return json_string(s, pos);
+    default:
+        return json_number(s, pos);
+    }
+}
+
+static bool json_valid(const std::string &s)
+{
+    size_t pos = 0;
+    if (!json_value(s, pos))
+    {
+        return false;
+    }
+    json_space(s, pos);
+    return pos == s.size();
+}
+
+// every capture state, as the frame processor reports it, next to the thermal zones
+static bool check_telemetry(std::ostream &json)
+{
+    static const CaptureState::CaptureState states[] = {
+        CaptureState::AUTO, CaptureState::OFF, CaptureState::AUTO_OFF, CaptureState::ON, CaptureState::AUTO_ON
+    };
+    bool valid = true;
+    for (size_t i = 0; i < sizeof(states) / sizeof(states[0]); i++)
+    {
+        CaptureStatus capture = CaptureStatus();
+        capture.state = states[i];
+        capture.moving_blocks = 12;
+        capture.blocks = 8160;
+
+        BenchTelemetry telemetry;
+        telemetry.add_source(boost::bind(&FrameProcessor::sample_capture_telemetry, capture, _1));
+        telemetry.add_source(&sample_temperatures);
+        const std::string snapshot = telemetry.snapshot();
+        if (!json_valid(snapshot))
+        {
+            std::cerr << "telemetry: invalid JSON for capture state "
+                      << FrameProcessor::capture_state_name(states[i]) << ": " << snapshot << std::endl;
+            valid = false;
+        }
+    }
+    std::cerr << "telemetry: " << (valid ? "valid JSON" : "INVALID JSON") << std::endl;
+    json << (valid ? "true" : "false");
+    return valid;
+}
+
+int main(int argc, char **argv)
+{
+    const int width = argc > 1 ? atoi(argv[1]) & ~1 : 1920;
+    const int height = argc > 2 ? atoi(argv[2]) & ~1 : 1080;
+    const int frames = argc > 3 ? atoi(argv[3]) : 300;
+    const int threads = argc > 4 ? atoi(argv[4]) : std::max(1u, boost::thread::hardware_concurrency());
+
+    std::ostringstream json;
+    json << std::fixed << std::setprecision(3);
+    json << "{\"width\":" << width << ",\"height\":" << height << ",\"frames\":" << frames
+         << ",\"threads\":" << threads << ",\"simd\":\"" << ColorConv::simd_name() << "\"";
+
+    json << ",\"telemetry_valid\":";
+    const bool telemetry_valid = check_telemetry(json);
+
+    json << ",\"worker\":[";
+    bench_worker(json, 1, frames * 1000);
+    json << ",";
+    bench_worker(json, threads, frames * 1000);
+    json << "]";
+
+    json << ",\"sequential_section\":";
+    bench_sequential_section(json, threads, frames * 100);
+
+    static const int sizes[][2] = { { 1280, 720 }, { 1920, 1080 }, { 3840, 2160 } };
+    json << ",\"stream_copy\":[";
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        json << (i ? "," : "");
+        bench_stream_copy(json, sizes[i][0], sizes[i][1], std::max(frames / 10, 1));
+    }
+    json << "]";
+
+    json << ",\"motion_detect\":[";
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        json << (i ? "," : "");
+        bench_motion_detect(json, sizes[i][0], sizes[i][1], frames);
+    }
+    json << "]";
+
+    json << ",\"frame_collection\":";
+    bench_frame_collection(json, threads, frames * 10000);
+
+    {
+        SequentialSection init("bench_pipeline");
+    }
+    BenchStream stream(width, height, next_port++);
+    const FrameCollection source = make_frame(width, height);
+    json << ",\"pipeline\":[";
+    for (int t = 1; t <= threads; t++)
+    {
+        json << (t > 1 ? "," : "");
+        bench_pipeline(json, stream, source, t, frames);
+    }
+    json << "]}" << std::endl;
+
+    if (argc > 5)
+    {
+        std::ofstream out(argv[5]);
+        out << json.str();
+        if (!out)
+        {
+            std::cerr << "Unable to write " << argv[5] << std::endl;
+            return 1;
+        }
+    }
+    else
+    {
+        std::cout << json.str();
+    }
+    return telemetry_valid ? 0 : 1;
+}
@@ -0,0 +1,322 @@
+#include <algorithm>
+#include <sstream>
+#include <time.h>
+#include <boost/bind.hpp>
+
+#include "exposure_controller.hpp"
+
+namespace BoulderAI
+{
+
+const char *ExposureController::OPT_AUTO_IRIS = "auto-iris";
+const char *ExposureController::OPT_AUTO_IR_CUT = "auto-ir-cut";
+const char *ExposureController::OPT_RATE = "auto-iris-rate";
+const char *ExposureController::OPT_GAIN_HIGH = "auto-iris-gain-high";
+const char *ExposureController::OPT_EXPOSURE_LOW_MS = "auto-iris-exposure-low-ms";
+const char *ExposureController::OPT_IRIS_STEP = "auto-iris-step";
+const char *ExposureController::OPT_IRIS_MAX = "auto-iris-max";
+const char *ExposureController::OPT_NIGHT_LUX = "ir-cut-night-lux";
+const char *ExposureController::OPT_DAY_LUX = "ir-cut-day-lux";
+const char *ExposureController::OPT_DWELL_S = "ir-cut-dwell-s";
+
+const bool ExposureController::DEFAULT_AUTO_IRIS = false;
+const bool ExposureController::DEFAULT_AUTO_IR_CUT = false;
+const double ExposureController::DEFAULT_RATE = 4.0;
+const float ExposureController::DEFAULT_GAIN_HIGH = 2.0;
+const double ExposureController::DEFAULT_EXPOSURE_LOW_MS = 2.0;
+const int ExposureController::DEFAULT_IRIS_STEP = 4;
+const int ExposureController::DEFAULT_IRIS_MAX = 120;
+const float ExposureController::DEFAULT_NIGHT_LUX = 5.0;
+const float ExposureController::DEFAULT_DAY_LUX = 20.0;
+const int ExposureController::DEFAULT_DWELL_S = 30;
+
+bool ExposureController::_auto_iris_option = DEFAULT_AUTO_IRIS;
+bool ExposureController::_auto_ir_cut_option = DEFAULT_AUTO_IR_CUT;
+double ExposureController::_rate = DEFAULT_RATE;
+float ExposureController::_gain_high = DEFAULT_GAIN_HIGH;
+double ExposureController::_exposure_low_ms = DEFAULT_EXPOSURE_LOW_MS;
+int ExposureController::_iris_step = DEFAULT_IRIS_STEP;
+int ExposureController::_iris_max = DEFAULT_IRIS_MAX;
+float ExposureController::_night_lux = DEFAULT_NIGHT_LUX;
+float ExposureController::_day_lux = DEFAULT_DAY_LUX;
+int ExposureController::_dwell_s = DEFAULT_DWELL_S;
+
+// time given to auto exposure to follow an iris move before the next one
+static const uint64_t IRIS_SETTLE_MS = 1000;
+// weight of a new lux sample in the smoothed scene lux
+static const float LUX_SMOOTHING = 0.25f;
+
+po::options_description ExposureController::GetOptions()
+{
+    po::options_description desc( "Auto Iris Options" );
+    desc.add_options()
+        ( OPT_AUTO_IRIS, po::value<bool>(&_auto_iris_option)->default_value(DEFAULT_AUTO_IRIS),
+          "Open and close the iris to keep the sensor gain low." )
+        ( OPT_AUTO_IR_CUT, po::value<bool>(&_auto_ir_cut_option)->default_value(DEFAULT_AUTO_IR_CUT),
+          "Switch the IR cut filter between day and night by the scene lux." )
+        ( OPT_RATE, po::value<double>(&_rate)->default_value(DEFAULT_RATE),
+          "Times per second the iris and IR cut filter are reconsidered." )
+        ( OPT_GAIN_HIGH, po::value<float>(&_gain_high)->default_value(DEFAULT_GAIN_HIGH),
+          "The iris opens while the sensor times ISP gain is above this." )
+        ( OPT_EXPOSURE_LOW_MS, po::value<double>(&_exposure_low_ms)->default_value(DEFAULT_EXPOSURE_LOW_MS),
+          "The iris closes while the exposure time is below this, in ms." )
+        ( OPT_IRIS_STEP, po::value<int>(&_iris_step)->default_value(DEFAULT_IRIS_STEP),
+          "Iris steps per move." )
+        ( OPT_IRIS_MAX, po::value<int>(&_iris_max)->default_value(DEFAULT_IRIS_MAX),
+          "Iris location when fully open, once the iris is homed." )
+        ( OPT_NIGHT_LUX, po::value<float>(&_night_lux)->default_value(DEFAULT_NIGHT_LUX),
+          "The IR cut filter comes out below this scene lux." )
+        ( OPT_DAY_LUX, po::value<float>(&_day_lux)->default_value(DEFAULT_DAY_LUX),
+          "The IR cut filter goes back in above this scene lux." )
+        ( OPT_DWELL_S, po::value<int>(&_dwell_s)->default_value(DEFAULT_DWELL_S),
+          "Seconds the lux has to stay past a threshold, and the least time between two switches of the IR cut filter." )
+        ;
+    return desc;
+}
+
+namespace
+{
+
+uint64_t monotonic_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+} // anonymous namespace
+
+ExposureController::ExposureController(DNNCamPtr dnncam, LensJobsPtr jobs) :
+    _dnncam(dnncam),
+    _jobs(jobs),
+    _auto_iris(_auto_iris_option),
+    _auto_ir_cut(_auto_ir_cut_option),
+    _iris_job(0),
+    _iris_done_ms(0),
+    _ir_cut_job(0),
+    _night(-1),
+    _switched_ms(0),
+    _crossed_ms(0),
+    _have_lux(false),
+    _running(false),
+    _status()
+{
+    _status.iris = -1;
+}
+
+ExposureController::~ExposureController()
+{
+    stop();
+}
+
+void ExposureController::start()
+{
+    ScopedLock lock(_mtex);
+    if (_thread_ptr.get())
+    {
+        return;
+    }
+
+    _running = true;
+    _thread_ptr.reset(new boost::thread(boost::bind(&ExposureController::run, this)));
+}
+
+void ExposureController::stop()
+{
+    {
+        ScopedLock lock(_mtex);
+        _running = false;
+        _condition.notify_all();
+    }
+
+    if (!_thread_ptr.get())
+    {
+        return;
+    }
+    _thread_ptr->join();
+    _thread_ptr.reset();
+}
+
+void ExposureController::set_auto_iris(const bool enabled)
+{
+    _auto_iris = enabled;
+}
+
+void ExposureController::set_auto_ir_cut(const bool enabled)
+{
+    _auto_ir_cut = enabled;
+    if (!enabled)
+    {
+        // the next time it is turned on, the filter is set by the lux at once
+        ScopedLock lock(_mtex);
+        _night = -1;
+    }
+}
+
+ExposureControlStatus ExposureController::get_status()
+{
+    ScopedLock lock(_mtex);
+    ExposureControlStatus status = _status;
+    status.auto_iris = _auto_iris;
+    status.auto_ir_cut = _auto_ir_cut;
+    return status;
+}
+
+void ExposureController::run()
+{
+    const boost::posix_time::milliseconds period((int64_t)(1000.0 / std::max(_rate, 0.1)));
+
+    ScopedLock lock(_mtex);
+    while (_running)
+    {
+        _condition.timed_wait(lock, period);
+        if (!_running)
+        {
+            break;
+        }
+
+        lock.unlock();
+        control(_dnncam->get_exposure_stats(), monotonic_ms());
+        lock.lock();
+    }
+}
+
+void ExposureController::control(const ExposureStats &stats, const uint64_t now_ms)
+{
+    if (!stats.valid)
+    {
+        return;
+    }
+
+    {
+        ScopedLock lock(_mtex);
+        _status.scene_lux = _have_lux ? _status.scene_lux + LUX_SMOOTHING * (stats.scene_lux - _status.scene_lux)
+                                      : stats.scene_lux;
+        _have_lux = true;
+        _status.gain = stats.analog_gain * stats.digital_gain;
+        _status.exposure_ms = stats.exposure_ns / 1e6;
+        // steps of an iris that was never homed count from nowhere
+        _status.iris = _dnncam->iris_homed() ? _dnncam->get_iris_location() : -1;
+    }
+
+    if (_auto_ir_cut)
+    {
+        control_ir_cut(now_ms);
+    }
+    if (_auto_iris)
+    {
+        control_iris(stats, now_ms);
+    }
+}
+
+void ExposureController::control_iris(const ExposureStats &stats, const uint64_t now_ms)
+{
+    if (_iris_job != 0)
+    {
+        if (!job_finished(_iris_job))
+        {
+            return;
+        }
+        _iris_job = 0;
+        _iris_done_ms = now_ms;
+    }
+    if (now_ms - _iris_done_ms < IRIS_SETTLE_MS)
+    {
+        return;
+    }
+
+    int steps = 0;
+    if (_status.gain > _gain_high)
+    {
+        steps = _iris_step;
+    }
+    else if (stats.exposure_ns < _exposure_low_ms * 1e6)
+    {
+        steps = -_iris_step;
+    }
+
+    // without a home position the iris just runs into its stops
+    const int iris = _status.iris;
+    if (iris >= 0)
+    {
+        steps = std::max(std::min(steps, _iris_max - iris), -iris);
+    }
+    if (steps == 0)
+    {
+        return;
+    }
+
+    std::ostringstream description;
+    description << "auto_iris(" << steps << ")";
+    const int id = _jobs->add(description.str(), boost::bind(&DNNCam::iris_relative, _dnncam, steps));
+    if (id > 0)
+    {
+        _iris_job = id;
+    }
+}
+
+void ExposureController::control_ir_cut(const uint64_t now_ms)
+{
+    const float lux = _status.scene_lux;
+    bool night;
+    {
+        ScopedLock lock(_mtex);
+        if (_night < 0)
+        {
+            night = lux < _night_lux;
+        }
+        else
+        {
+            const bool crossed = _night ? lux > _day_lux : lux < _night_lux;
+            if (!crossed)
+            {
+                _crossed_ms = 0;
+                return;
+            }
+            if (_crossed_ms == 0)
+            {
+                _crossed_ms = now_ms;
+            }
+            const uint64_t dwell_ms = (uint64_t)std::max(_dwell_s, 0) * 1000;
+            if (now_ms - _crossed_ms < dwell_ms || now_ms - _switched_ms < dwell_ms)
+            {
+                return;
+            }
+            night = !_night;
+        }
+    }
+    if (!job_finished(_ir_cut_job))
+    {
+        return;
+    }
+
+    const int id = _jobs->add(night ? "auto_ir_cut(false)" : "auto_ir_cut(true)",
+                              boost::bind(&DNNCam::set_ir_cut, _dnncam, !night));
+    if (id < 0)
+    {
+        return;
+    }
+
+    std::ostringstream oss;
+    oss << "Scene at " << lux << " lux, switching to " << (night ? "night" : "day");
+    _dnncam->_log_callback(oss.str());
+
+    ScopedLock lock(_mtex);
+    _ir_cut_job = id;
+    _night = night;
+    _status.night = night;
+    _switched_ms = now_ms;
+    _crossed_ms = 0;
+}
+
+bool ExposureController::job_finished(const int id)
+{
+    LensJobStatus status;
+    if (id <= 0 || !_jobs->get_status(id, status))
+    {
+        return true;
+    }
+    return status.state != "queued" && status.state != "running";
+}
+
+} // namespace BoulderAI
@@ -0,0 +1,101 @@
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include "focus_curve.hpp"
+
+namespace BoulderAI
+{
+
+static bool zoom_before(const FocusCurve::Point &a, const FocusCurve::Point &b)
+{
+    return a.zoom < b.zoom;
+}
+
+bool FocusCurve::load(const std::string &path)
+{
+    std::vector < Point > points;
+    std::ifstream ifs(path.c_str());
+    std::string line;
+    while (std::getline(ifs, line))
+    {
+        if (line.empty() || line[0] == '#')
+        {
+            continue;
+        }
+        std::istringstream iss(line);
+        Point point;
+        if (iss >> point.zoom >> point.focus)
+        {
+            points.push_back(point);
+        }
+    }
+    set_points(points);
+    return !points.empty();
+}
+
+bool FocusCurve::save(const std::string &path)
+{
+    // one save at a time, so each writes a newer snapshot than the last and none of them
+    // shares the tmp file
+    ScopedLock save_lock(_save_mtex);
+    const std::vector < Point > points = get_points();
+
+    // written aside and renamed, so a crash never leaves half a curve
+    const std::string tmp = path + ".tmp";
+    {
+        std::ofstream ofs(tmp.c_str());
+        ofs << "# zoom focus, written by focus calibration" << std::endl;
+        for (size_t i = 0; i < points.size(); i++)
+        {
+            ofs << points[i].zoom << " " << points[i].focus << std::endl;
+        }
+        if (!ofs.good())
+        {
+            return false;
+        }
+    }
+    return rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+void FocusCurve::set_points(std::vector < Point > points)
+{
+    std::stable_sort(points.begin(), points.end(), zoom_before);
+    ScopedLock lock(_mtex);
+    _points.swap(points);
+}
+
+std::vector < FocusCurve::Point > FocusCurve::get_points()
+{
+    ScopedLock lock(_mtex);
+    return _points;
+}
+
+bool FocusCurve::focus_for(const int zoom, int &focus)
+{
+    ScopedLock lock(_mtex);
+    if (_points.empty())
+    {
+        return false;
+    }
+    if (zoom <= _points.front().zoom)
+    {
+        focus = _points.front().focus;
+        return true;
+    }
+    if (zoom >= _points.back().zoom)
+    {
+        focus = _points.back().focus;
+        return true;
+    }
+
+    const Point key = { zoom, 0 };
+    std::vector < Point >::const_iterator upper = std::upper_bound(_points.begin(), _points.end(), key, zoom_before);
+    std::vector < Point >::const_iterator lower = upper - 1;
+    const double t = (double)(zoom - lower->zoom) / (upper->zoom - lower->zoom);
+    focus = lower->focus + (int)(t * (upper->focus - lower->focus) + (upper->focus >= lower->focus ? 0.5 : -0.5));
+    return true;
+}
+
+} // namespace BoulderAI
@@ -0,0 +1,95 @@
+#include <algorithm>
+
+#include "focus_meter.hpp"
+
+namespace BoulderAI
+{
+
+FocusMeter::FocusMeter() :
+    _armed(false),
+    _skip(0),
+    _count(0),
+    _taken(0),
+    _sum(0),
+    _generation(0)
+{
+}
+
+void FocusMeter::submit(const cv::Mat &y)
+{
+    // cheap check for the common case, nobody is measuring
+    if (!_armed || y.empty())
+    {
+        return;
+    }
+
+    uint64_t generation;
+    {
+        ScopedLock lock(_mtex);
+        if (!_armed)
+        {
+            return;
+        }
+        if (_skip > 0)
+        {
+            _skip--;
+            return;
+        }
+        generation = _generation;
+    }
+    // outside the lock, the capture thread is the only one computing
+    const double value = sharpness(y);
+
+    ScopedLock lock(_mtex);
+    if (!_armed || _generation != generation)
+    {
+        // the measurement this frame was taken for has ended, the next one skips its own frames
+        return;
+    }
+    _sum += value;
+    if (++_taken >= _count)
+    {
+        _armed = false;
+        _condition.notify_all();
+    }
+}
+
+bool FocusMeter::measure(double &sharpness, const int skip, const int count, const int timeout_ms)
+{
+    ScopedLock lock(_mtex);
+    _skip = skip;
+    _count = std::max(count, 1);
+    _taken = 0;
+    _sum = 0;
+    _generation++;
+    _armed = true;
+
+    const boost::system_time deadline = boost::get_system_time() + boost::posix_time::milliseconds(timeout_ms);
+    while (_taken < _count)
+    {
+        if (!_condition.timed_wait(lock, deadline))
+        {
+            _armed = false;
+            return false;
+        }
+    }
+    sharpness = _sum / _taken;
+    return true;
+}
+
+double FocusMeter::sharpness(const cv::Mat &y)
+{
+    // the middle half of the frame, where the subject usually is, at half resolution
+    const cv::Rect middle(y.cols / 4, y.rows / 4, y.cols / 2, y.rows / 2);
+    cv::Mat small;
+    cv::resize(y(middle), small, cv::Size(), 0.5, 0.5, cv::INTER_AREA);
+
+    cv::Mat laplacian;
+    cv::Laplacian(small, laplacian, CV_16S);
+    cv::Scalar mean;
+    cv::Scalar stddev;
+    cv::meanStdDev(laplacian, mean, stddev);
+    return stddev[0] * stddev[0];
+}
+
+} // namespace BoulderAI
@@ -1,9 +1,15 @@
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <time.h>
 #include <boost/bind.hpp>
 
 #include <opencv2/core/core.hpp>
 #include <opencv2/highgui/highgui.hpp>
 
 #include "frame_processor.hpp"
+#include "trace.hpp"
+#include "async_log.hpp"
 
 #include <sys/stat.h>
 #include <sys/time.h>
@@ -25,6 +31,52 @@ static const size_t PREBUFFER_POST_FRAMES = 20;
 
 static const int NUM_COLORS = 6;
 
+// span of the timing summaries, in seconds
+static const double TIMING_SECONDS = 10.0;
+
+// weight of the newest frame in the latency averages
+static const double LATENCY_ALPHA = 1.0 / 32;
+
+template < typename T >
+static std::string telemetry_value(const T &value)
+{
+    std::ostringstream oss;
+    oss << std::fixed << std::setprecision(1) << value;
+    return oss.str();
+}
+
+static uint64_t monotonic_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// one sample per RTSP client of a StreamClientStats field
+template < typename T >
+static void collect_client_stat(FrameProcessorPtr frame_proc, T StreamClientStats::*field,
+                                std::vector < MetricSample > &samples)
+{
+    const std::vector < StreamClientStats > clients = frame_proc->get_stream_client_stats();
+    for (size_t i = 0; i < clients.size(); i++)
+    {
+        std::ostringstream id;
+        id << clients[i].id;
+        MetricSample sample;
+        sample.labels = Metrics::label("mount", clients[i].mount) + "," + Metrics::label("client", id.str());
+        sample.value = clients[i].*field;
+        samples.push_back(sample);
+    }
+}
+
+static MetricSample metric_sample(const std::string &labels, const double value)
+{
+    MetricSample sample;
+    sample.labels = labels;
+    sample.value = value;
+    return sample;
+}
+
 std::map<std::string, boost::shared_ptr<boost::mutex> > SequentialSection::_mutex;
 std::map<std::string, boost::shared_ptr<boost::condition_variable> > SequentialSection::_condition;
 std::map<std::string, int> SequentialSection::_frame_num;
@@ -40,6 +92,14 @@ FrameProcessor::FrameProcessor(const int w, const int h)
     _queue_size(0),
     _dropped_frames(0),
     _prebuffer_post_frames(0),
+    _event_active(false),
+    _latency(),
+    _capture_state(CaptureState::OFF),
+    _motion_status(),
+    _motion_frames(0),
+    _last_motion_ns(0),
+    _auto_event_start_ns(0),
+    _motion_events(0),
     _worker(3, 512, "Frame Processor Worker"),
     _gui_worker(1, "GUI Worker")
 {
@@ -51,12 +111,26 @@ FrameProcessor::FrameProcessor(const int w, const int h)
 
     _streamer.reset(new Stream(_frame_width, _frame_height));
     _streamer->start();
+
+    _jpeg_source.reset(new JpegSource());
+    _jpeg_source->start();
+
+    _retention.reset(new RetentionManager(Recorder::_dir));
+    _retention->start();
+
+    // room for a full prebuffer flush plus some encoder slack
+    _recorder.reset(new Recorder(_frame_width, _frame_height, PREBUFFERED_FRAMES + 10));
+    _recorder->set_segment_callback(boost::bind(&RetentionManager::add_segment, _retention, _1));
+    _recorder->start();
 }
 
 FrameProcessor::~FrameProcessor()
 {
     _worker.wait();
     _gui_worker.wait();
+    _jpeg_source->stop();
+    _recorder->stop();
+    _retention->stop();
 }
 
 // Creates the ObjectFinder and starts the workers.
@@ -114,13 +188,35 @@ void FrameProcessor::process_frame(FrameCollection frame_col, const bool block)
         }
         /* store a copy in the prebuffer, for when we turn on capture */
         _prebuffer.push_front(frame_col);
+
+        /* frames of an event and its post-roll go to the recorder in capture order;
+         * the recorder only queues them, encoding and disk writes happen on its threads */
+        if (_event_active)
+        {
+            _recorder->push_frame(frame_col);
+        }
+        else if (_prebuffer_post_frames > 0)
+        {
+            _recorder->push_frame(frame_col);
+            if (--_prebuffer_post_frames == 0)
+            {
+                _recorder->end_event();
+            }
+        }
     }
 
+    update_capture_state(frame_col);
+
+    static MetricCounter *const frames = Metrics::registry().counter(
+        "dnncam_frames_captured_total", "Frames handed to the frame processor, rate() gives the capture fps");
+    frames->inc();
+
     {
+        TraceSpan span("enqueue", frame_col.frame_number);
         ScopedLock lock(_mtex);
-        if ( (_queue_size = _worker.add_job( boost::bind(&FrameProcessor::process_frame_task, this, frame_col, _frame_num, _frame_num-_previous_frame_num-1)) ) == -1 )
+        if ( (_queue_size = _worker.add_job( boost::bind(&FrameProcessor::process_frame_task, this, frame_col, _frame_num, _frame_num-_previous_frame_num-1, monotonic_ns())) ) == -1 )
         {
-            std::cout << "The _worker queue is full!" << std::endl;
+            AsyncLog::write(AsyncLog::LOG_WARN, "frame_processor", "The _worker queue is full!");
             increment_dropped_frames();
         }
         else
@@ -209,10 +305,14 @@ void FrameProcessor::DrawPoints3D(cv::Mat frame, const float* points,
 }
 
 
+boost::posix_time::time_duration FrameProcessor::get_mean_tracking_time()
+{
+    return pt::microseconds(Trace::get_mean_ns("frame_task", TIMING_SECONDS) / 1000);
+}
+
 std::string FrameProcessor::get_timing_string(void)
 {
-    std::ostringstream ret;
-    return ret.str();
+    return Trace::get_summary(TIMING_SECONDS);
 }
 
 void FrameProcessor::do_stream(FrameCollection frame_col, const int frame_num, const int n_dropped_before)
@@ -239,24 +339,151 @@ void FrameProcessor::do_stream(FrameCollection frame_col, const int frame_num, c
 
     if (!SequentialSection::too_late("stream", frame_num, n_dropped_before))
     {
+        TraceSpan wait_span("sequential_wait", frame_col.frame_number);
         SequentialSection ss("stream", frame_num, n_dropped_before);
+        wait_span.end();
         //if (frame_num % 2 == 0)
         {
+           TraceSpan span("stream_push", frame_col.frame_number);
            _streamer->push_frame(frame_col);
         }
     }
 }
 
-void FrameProcessor::process_frame_task(FrameCollection frame_col, const int frame_num, const int n_dropped_before)
+void FrameProcessor::process_frame_task(FrameCollection frame_col, const int frame_num, const int n_dropped_before,
+                                        const uint64_t queued_ns)
 {
+    static MetricHistogram *const queue_wait = Metrics::registry().histogram(
+        "dnncam_frame_queue_wait_seconds", "Time frames waited for a frame processor worker");
+    static MetricHistogram *const busy = Metrics::registry().histogram(
+        "dnncam_frame_worker_busy_seconds", "Time a frame processor worker spent on a frame; _sum is the busy time");
+    static MetricHistogram *const capture_to_push = Metrics::registry().histogram(
+        "dnncam_capture_to_push_seconds", "Start of exposure until the frame was handed to the RTSP clients and the JPEG encoder");
+
+    TraceSpan span("frame_task", frame_col.frame_number);
+    const uint64_t start_ns = monotonic_ns();
     const int queue_size = get_queue_size();
     const bool skip_processing = (queue_size > 350) && frame_num % 2 == 1;
-    if (skip_processing)
+    if (skip_processing && AsyncLog::enabled(AsyncLog::LOG_WARN))
     {
-        std::cout << "Skipping frame " << frame_num << " because frame queue contains " << queue_size << " frames." << std::endl;
+        std::ostringstream oss;
+        oss << "Skipping frame " << frame_num << " because frame queue contains " << queue_size << " frames.";
+        AsyncLog::write(AsyncLog::LOG_WARN, "frame_processor", oss.str());
     }
 
     do_stream(frame_col, frame_num, n_dropped_before);
+    const uint64_t streamed_ns = monotonic_ns();
+
+    // only hands the frame over, encoding happens on the JPEG thread at its own rate
+    _jpeg_source->push_frame(frame_col);
+    const uint64_t done_ns = monotonic_ns();
+
+    queue_wait->observe_ns(start_ns - queued_ns);
+    busy->observe_ns(done_ns - start_ns);
+    if (frame_col.sensor_timestamp && frame_col.sensor_timestamp < queued_ns)
+    {
+        capture_to_push->observe_ns(done_ns - frame_col.sensor_timestamp);
+    }
+
+    {
+        ScopedLock lock(_latency_mtex);
+        if (frame_col.sensor_timestamp && frame_col.sensor_timestamp < queued_ns)
+        {
+            _latency.capture_ms += LATENCY_ALPHA * ((queued_ns - frame_col.sensor_timestamp) / 1e6 - _latency.capture_ms);
+            _latency.total_ms += LATENCY_ALPHA * ((done_ns - frame_col.sensor_timestamp) / 1e6 - _latency.total_ms);
+        }
+        _latency.queue_ms += LATENCY_ALPHA * ((start_ns - queued_ns) / 1e6 - _latency.queue_ms);
+        _latency.stream_ms += LATENCY_ALPHA * ((streamed_ns - start_ns) / 1e6 - _latency.stream_ms);
+    }
+}
+
+StageLatency FrameProcessor::get_stage_latency(void)
+{
+    ScopedLock lock(_latency_mtex);
+    return _latency;
+}
+
+void FrameProcessor::sample_telemetry(TelemetryValues &values)
+{
+    values["pipeline.queue_depth"] = telemetry_value(get_queue_size());
+    values["pipeline.dropped_frames"] = telemetry_value(get_dropped_frames());
+
+    const StageLatency latency = get_stage_latency();
+    values["latency.capture_ms"] = telemetry_value(latency.capture_ms);
+    values["latency.queue_ms"] = telemetry_value(latency.queue_ms);
+    values["latency.stream_ms"] = telemetry_value(latency.stream_ms);
+    values["latency.total_ms"] = telemetry_value(latency.total_ms);
+
+    const std::vector < StreamClientStats > clients = get_stream_client_stats();
+    uint64_t client_dropped = 0;
+    size_t client_queued = 0;
+    for (size_t i = 0; i < clients.size(); i++)
+    {
+        client_dropped += clients[i].dropped_frames;
+        client_queued += clients[i].queue_depth;
+    }
+    values["clients.rtsp"] = telemetry_value(clients.size());
+    values["clients.mjpeg"] = telemetry_value(_jpeg_source->get_viewer_count());
+    values["pipeline.rtsp_queue_depth"] = telemetry_value(client_queued);
+    values["pipeline.rtsp_dropped_frames"] = telemetry_value(client_dropped);
+
+    const RecorderStats recorder = get_recorder_stats();
+    values["recorder.recording"] = telemetry_value(recorder.recording ? "true" : "false");
+    values["recorder.segments"] = telemetry_value(recorder.segments);
+    values["recorder.dropped_frames"] = telemetry_value(recorder.dropped_frames);
+    values["recorder.io_queue_bytes"] = telemetry_value(recorder.io_queue_bytes);
+
+    sample_capture_telemetry(get_capture_status(), values);
+}
+
+void FrameProcessor::sample_capture_telemetry(const CaptureStatus &capture, TelemetryValues &values)
+{
+    values["capture.state"] = HttpServer::json_string(capture_state_name(capture.state));
+    values["capture.moving_blocks"] = telemetry_value(capture.moving_blocks);
+}
+
+void FrameProcessor::register_metrics(Metrics &metrics)
+{
+    FrameProcessorPtr self = shared_from_this();
+    metrics.add_collector("dnncam_queue_depth", "Frames waiting in the pipeline queues", Metrics::GAUGE,
+                          boost::bind(&FrameProcessor::collect_queue_depths, self, _1));
+    metrics.add_collector("dnncam_recorder_io_queue_bytes", "Recorded data waiting to be written to disk", Metrics::GAUGE,
+                          boost::bind(&FrameProcessor::collect_recorder_io, self, _1));
+    metrics.add_collector("dnncam_dropped_frames_total", "Frames dropped in the pipeline, by stage", Metrics::COUNTER,
+                          boost::bind(&FrameProcessor::collect_dropped_frames, self, _1));
+    metrics.add_collector("dnncam_rtsp_client_bytes_total", "Bytes pushed to each RTSP client", Metrics::COUNTER,
+                          boost::bind(&collect_client_stat < uint64_t >, self, &StreamClientStats::pushed_bytes, _1));
+    metrics.add_collector("dnncam_rtsp_client_frames_total", "Frames pushed to each RTSP client", Metrics::COUNTER,
+                          boost::bind(&collect_client_stat < uint64_t >, self, &StreamClientStats::pushed_frames, _1));
+    metrics.add_collector("dnncam_rtsp_client_dropped_frames_total", "Frames dropped from each RTSP client's queue", Metrics::COUNTER,
+                          boost::bind(&collect_client_stat < uint64_t >, self, &StreamClientStats::dropped_frames, _1));
+    metrics.add_collector("dnncam_rtsp_client_queue_depth", "Frames waiting for each RTSP client", Metrics::GAUGE,
+                          boost::bind(&collect_client_stat < size_t >, self, &StreamClientStats::queue_depth, _1));
+    metrics.add_collector("dnncam_rtsp_client_queue_bytes", "Bytes waiting for each RTSP client", Metrics::GAUGE,
+                          boost::bind(&collect_client_stat < size_t >, self, &StreamClientStats::queue_bytes, _1));
+}
+
+void FrameProcessor::collect_queue_depths(std::vector < MetricSample > &samples)
+{
+    size_t prebuffered;
+    {
+        ScopedLock lock(_prebuffer_mtex);
+        prebuffered = _prebuffer.size();
+    }
+    samples.push_back(metric_sample(Metrics::label("queue", "frame_processor"), get_queue_size()));
+    samples.push_back(metric_sample(Metrics::label("queue", "prebuffer"), prebuffered));
+}
+
+void FrameProcessor::collect_recorder_io(std::vector < MetricSample > &samples)
+{
+    samples.push_back(metric_sample("", get_recorder_stats().io_queue_bytes));
+}
+
+void FrameProcessor::collect_dropped_frames(std::vector < MetricSample > &samples)
+{
+    const RecorderStats recorder = get_recorder_stats();
+    samples.push_back(metric_sample(Metrics::label("stage", "frame_processor"), get_dropped_frames()));
+    samples.push_back(metric_sample(Metrics::label("stage", "recorder"), recorder.dropped_frames));
 }
 
 void touch(const std::string& pathname)
@@ -283,6 +510,185 @@ int FrameProcessor::get_dropped_frames(void)
     return _dropped_frames;
 }
 
+std::vector < StreamClientStats > FrameProcessor::get_stream_client_stats(void)
+{
+    return _streamer->get_client_stats();
+}
+
+StreamClockInfo FrameProcessor::get_stream_clock_info(void)
+{
+    return _streamer->get_clock_info();
+}
+
+JpegSourcePtr FrameProcessor::get_jpeg_source(void)
+{
+    return _jpeg_source;
+}
+
+void FrameProcessor::start_event(void)
+{
+    ScopedLock lock(_prebuffer_mtex);
+    if (_event_active)
+    {
+        return;
+    }
+
+    /* During the post-roll of the previous event the prebuffer has already been recorded
+     * and the event simply continues. Otherwise the prebuffer (newest first) is written
+     * out oldest first, so the recording starts before whatever triggered it. */
+    if (_prebuffer_post_frames == 0)
+    {
+        for (FrameQueueRIter itr = _prebuffer.rbegin(); itr != _prebuffer.rend(); ++itr)
+        {
+            _recorder->push_frame(*itr);
+        }
+    }
+    _prebuffer_post_frames = 0;
+    _event_active = true;
+}
+
+void FrameProcessor::stop_event(void)
+{
+    ScopedLock lock(_prebuffer_mtex);
+    if (!_event_active)
+    {
+        return;
+    }
+    _event_active = false;
+    _prebuffer_post_frames = PREBUFFER_POST_FRAMES;
+}
+
+bool FrameProcessor::set_capture_mode(const std::string &mode)
+{
+    CaptureState::CaptureState state;
+    if (mode == "off")
+    {
+        state = CaptureState::OFF;
+    }
+    else if (mode == "on")
+    {
+        state = CaptureState::ON;
+    }
+    else if (mode == "auto")
+    {
+        state = CaptureState::AUTO;
+    }
+    else
+    {
+        return false;
+    }
+
+    ScopedLock lock(_capture_mtex);
+    const bool recording = _capture_state == CaptureState::ON || _capture_state == CaptureState::AUTO_ON;
+    _capture_state = state;
+    _motion_frames = 0;
+    if (state == CaptureState::ON)
+    {
+        // continues an event motion already started
+        start_event();
+    }
+    else if (recording)
+    {
+        stop_event();
+    }
+    if (state == CaptureState::AUTO)
+    {
+        _motion_detector.set_sensitivity(MotionDetector::_sensitivity);
+        _motion_detector.set_min_blocks(MotionDetector::_min_blocks);
+        _motion_detector.reset();
+    }
+    return true;
+}
+
+CaptureStatus FrameProcessor::get_capture_status(void)
+{
+    ScopedLock lock(_capture_mtex);
+    CaptureStatus status;
+    status.state = _capture_state;
+    status.moving_blocks = _motion_status.moving_blocks;
+    status.blocks = _motion_status.blocks;
+    status.motion_events = _motion_events;
+    return status;
+}
+
+std::string FrameProcessor::capture_state_name(const CaptureState::CaptureState state)
+{
+    switch (state)
+    {
+        case CaptureState::AUTO: return "auto";
+        case CaptureState::OFF: return "off";
+        case CaptureState::AUTO_OFF: return "auto_off";
+        case CaptureState::ON: return "on";
+        case CaptureState::AUTO_ON: return "auto_on";
+    }
+    return "unknown";
+}
+
+void FrameProcessor::update_capture_state(const FrameCollection &frame_col)
+{
+    ScopedLock lock(_capture_mtex);
+    if (_capture_state == CaptureState::OFF || _capture_state == CaptureState::ON || !frame_col.frame_y.get())
+    {
+        return;
+    }
+
+    bool checked;
+    {
+        TraceSpan span("motion_detect", frame_col.frame_number);
+        const cv::Mat y = frame_col.frame_y->to_mat();
+        checked = _motion_detector.process(y.data, y.step, y.cols, y.rows, _motion_status);
+    }
+    const uint64_t now_ns = monotonic_ns();
+    if (_motion_status.motion)
+    {
+        _motion_frames++;
+        _last_motion_ns = now_ns;
+    }
+    else
+    {
+        _motion_frames = 0;
+    }
+
+    if (_capture_state == CaptureState::AUTO_ON)
+    {
+        // an event lasts motion-min-event-s at least, and until motion-cooldown-s without motion
+        if (now_ns - _last_motion_ns >= MotionDetector::_cooldown_s * 1e9 &&
+            now_ns - _auto_event_start_ns >= MotionDetector::_min_event_s * 1e9)
+        {
+            _capture_state = CaptureState::AUTO_OFF;
+            stop_event();
+            AsyncLog::write(AsyncLog::LOG_INFO, "frame_processor", "Motion event ended");
+        }
+    }
+    else if (_motion_frames >= std::max(MotionDetector::_trigger_frames, 1))
+    {
+        _capture_state = CaptureState::AUTO_ON;
+        _auto_event_start_ns = now_ns;
+        _motion_events++;
+        start_event();
+        if (AsyncLog::enabled(AsyncLog::LOG_INFO))
+        {
+            std::ostringstream oss;
+            oss << "Motion event started: " << _motion_status.moving_blocks << " of " << _motion_status.blocks << " blocks moving";
+            AsyncLog::write(AsyncLog::LOG_INFO, "frame_processor", oss.str());
+        }
+    }
+    else if (checked)
+    {
+        _capture_state = CaptureState::AUTO_OFF;
+    }
+}
+
+RecorderStats FrameProcessor::get_recorder_stats(void)
+{
+    return _recorder->get_stats();
+}
+
+RetentionManagerPtr FrameProcessor::get_retention(void)
+{
+    return _retention;
+}
+
 void FrameProcessor::increment_dropped_frames(void)
 {
     _dropped_frames++;
@@ -0,0 +1,732 @@
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <boost/bind.hpp>
+
+#include <dirent.h>
+#include <unistd.h>
+
+#include "http_api.hpp"
+
+namespace BoulderAI
+{
+
+const char *HttpApi::OPT_ROOT = "http-root";
+const char *HttpApi::OPT_ROI_CONFIG = "roi-config";
+
+const std::string HttpApi::DEFAULT_ROOT = "/var/www/html";
+const std::string HttpApi::DEFAULT_ROI_CONFIG = "/etc/smeltcam.cfg";
+
+std::string HttpApi::_root = DEFAULT_ROOT;
+std::string HttpApi::_roi_config = DEFAULT_ROI_CONFIG;
+
+po::options_description HttpApi::GetOptions()
+{
+    po::options_description desc( "Web UI Options" );
+    desc.add_options()
+        ( OPT_ROOT, po::value<std::string>(&_root)->default_value(DEFAULT_ROOT),
+          "Directory the web UI is served from." )
+        ( OPT_ROI_CONFIG, po::value<std::string>(&_roi_config)->default_value(DEFAULT_ROI_CONFIG),
+          "Configuration file updated by /cgi-bin/setroi." )
+        ;
+    return desc;
+}
+
+namespace
+{
+
+/**
+ * Reads JSON into XMLRPC values. A type code from the method signature (i, I, b, d, s)
+ * decides how a top level number or string is converted, since JSON cannot tell an int
+ * from an i8 or a double.
+ */
+class JsonReader
+{
+public:
+    JsonReader(const std::string &text) : _text(text), _pos(0) {}
+
+    xmlrpc_c::value parse(const char hint = 0)
+    {
+        skip_space();
+        if (_pos >= _text.size())
+        {
+            fail("unexpected end");
+        }
+
+        const char c = _text[_pos];
+        if (c == '[')
+        {
+            _pos++;
+            xmlrpc_c::carray items;
+            skip_space();
+            if (peek(']'))
+            {
+                return xmlrpc_c::value_array(items);
+            }
+            do
+            {
+                items.push_back(parse());
+            } while (peek(','));
+            expect(']');
+            return xmlrpc_c::value_array(items);
+        }
+        if (c == '{')
+        {
+            _pos++;
+            std::map < std::string, xmlrpc_c::value > members;
+            skip_space();
+            if (peek('}'))
+            {
+                return xmlrpc_c::value_struct(members);
+            }
+            do
+            {
+                skip_space();
+                const std::string name = parse_string();
+                expect(':');
+                members[name] = parse();
+            } while (peek(','));
+            expect('}');
+            return xmlrpc_c::value_struct(members);
+        }
+        if (c == '"')
+        {
+            return convert(parse_string(), hint);
+        }
+        if (_text.compare(_pos, 4, "true") == 0)
+        {
+            _pos += 4;
+            return xmlrpc_c::value_boolean(true);
+        }
+        if (_text.compare(_pos, 5, "false") == 0)
+        {
+            _pos += 5;
+            return xmlrpc_c::value_boolean(false);
+        }
+        if (_text.compare(_pos, 4, "null") == 0)
+        {
+            _pos += 4;
+            return xmlrpc_c::value_nil();
+        }
+
+        const size_t start = _pos;
+        while (_pos < _text.size() && strchr("+-0123456789.eE", _text[_pos]))
+        {
+            _pos++;
+        }
+        if (start == _pos)
+        {
+            fail("unexpected character");
+        }
+        return convert(_text.substr(start, _pos - start), hint ? hint : 'N');
+    }
+
+    void finish()
+    {
+        skip_space();
+        if (_pos != _text.size())
+        {
+            fail("trailing characters");
+        }
+    }
+
+    // a bare value in the given type, as found in a query string or a number literal
+    static xmlrpc_c::value convert(const std::string &s, const char hint)
+    {
+        char *end = NULL;
+        switch (hint)
+        {
+            case 'i':
+            {
+                const long v = strtol(s.c_str(), &end, 10);
+                if (*end || s.empty() || v < INT_MIN || v > INT_MAX)
+                {
+                    throw std::runtime_error("expected an int, got " + s);
+                }
+                return xmlrpc_c::value_int((int)v);
+            }
+            case 'I':
+            {
+                const long long v = strtoll(s.c_str(), &end, 10);
+                if (*end || s.empty())
+                {
+                    throw std::runtime_error("expected an i8, got " + s);
+                }
+                return xmlrpc_c::value_i8(v);
+            }
+            case 'd':
+            {
+                const double v = strtod(s.c_str(), &end);
+                if (*end || s.empty())
+                {
+                    throw std::runtime_error("expected a double, got " + s);
+                }
+                return xmlrpc_c::value_double(v);
+            }
+            case 'b':
+                if (s == "true" || s == "1" || s == "t")
+                {
+                    return xmlrpc_c::value_boolean(true);
+                }
+                if (s == "false" || s == "0" || s == "f")
+                {
+                    return xmlrpc_c::value_boolean(false);
+                }
+                throw std::runtime_error("expected a boolean, got " + s);
+            case 'N':
+            {
+                // a JSON number without a known type: int if it fits, else i8, else double
+                const long long v = strtoll(s.c_str(), &end, 10);
+                if (!*end && !s.empty())
+                {
+                    return (v >= INT_MIN && v <= INT_MAX) ? xmlrpc_c::value(xmlrpc_c::value_int((int)v))
+                                                          : xmlrpc_c::value(xmlrpc_c::value_i8(v));
+                }
+                return convert(s, 'd');
+            }
+            default:
+                return xmlrpc_c::value_string(s);
+        }
+    }
+
+protected:
+    void skip_space()
+    {
+        while (_pos < _text.size() && isspace((unsigned char)_text[_pos]))
+        {
+            _pos++;
+        }
+    }
+
+    bool peek(const char c)
+    {
+        skip_space();
+        if (_pos < _text.size() && _text[_pos] == c)
+        {
+            _pos++;
+            return true;
+        }
+        return false;
+    }
+
+    void expect(const char c)
+    {
+        if (!peek(c))
+        {
+            fail(std::string("expected '") + c + "'");
+        }
+    }
+
+    std::string parse_string()
+    {
+        if (_pos >= _text.size() || _text[_pos] != '"')
+        {
+            fail("expected a string");
+        }
+        _pos++;
+        std::string ret;
+        while (_pos < _text.size() && _text[_pos] != '"')
+        {
+            char c = _text[_pos++];
+            if (c != '\\')
+            {
+                ret += c;
+                continue;
+            }
+            if (_pos >= _text.size())
+            {
+                break;
+            }
+            c = _text[_pos++];
+            switch (c)
+            {
+                case 'n': ret += '\n'; break;
+                case 't': ret += '\t'; break;
+                case 'r': ret += '\r'; break;
+                case 'b': ret += '\b'; break;
+                case 'f': ret += '\f'; break;
+                case 'u':
+                {
+                    if (_pos + 4 > _text.size())
+                    {
+                        fail("bad \\u escape");
+                    }
+                    const unsigned cp = strtoul(_text.substr(_pos, 4).c_str(), NULL, 16);
+                    _pos += 4;
+                    // BMP only, which is all the UI ever sends
+                    if (cp < 0x80)
+                    {
+                        ret += (char)cp;
+                    }
+                    else if (cp < 0x800)
+                    {
+                        ret += (char)(0xc0 | (cp >> 6));
+                        ret += (char)(0x80 | (cp & 0x3f));
+                    }
+                    else
+                    {
+                        ret += (char)(0xe0 | (cp >> 12));
+                        ret += (char)(0x80 | ((cp >> 6) & 0x3f));
+                        ret += (char)(0x80 | (cp & 0x3f));
+                    }
+                    break;
+                }
+                default: ret += c; break;
+            }
+        }
+        if (_pos >= _text.size())
+        {
+            fail("unterminated string");
+        }
+        _pos++;
+        return ret;
+    }
+
+    void fail(const std::string &what)
+    {
+        std::ostringstream oss;
+        oss << "Invalid JSON at offset " << _pos << ": " << what;
+        throw std::runtime_error(oss.str());
+    }
+
+    const std::string &_text;
+    size_t _pos;
+};
+
+std::string fault_text(const xmlrpc_c::fault &f)
+{
+    return f.getDescription();
+}
+
+} // namespace
+
+HttpApi::HttpApi(DNNCamServerPtr server, const std::string &export_dir) :
+    _server(server),
+    _export_dir(export_dir)
+{
+}
+
+HttpApi::~HttpApi()
+{
+}
+
+void HttpApi::register_handlers(HttpServer &server)
+{
+    server.add_handler("/", boost::bind(&HttpApi::serve_static, this, _1, _2));
+    server.add_handler("/export/", boost::bind(&HttpApi::serve_export, this, _1, _2));
+    server.add_handler("/api/", boost::bind(&HttpApi::serve_api, this, _1, _2));
+    server.add_handler("/cgi-bin/rpc", boost::bind(&HttpApi::serve_rpc, this, _1, _2));
+    server.add_handler("/cgi-bin/list", boost::bind(&HttpApi::serve_list, this, _1, _2));
+    server.add_handler("/cgi-bin/delete", boost::bind(&HttpApi::serve_delete, this, _1, _2));
+    server.add_handler("/cgi-bin/setroi", boost::bind(&HttpApi::serve_setroi, this, _1, _2));
+    server.add_handler("/cgi-bin/temps", boost::bind(&HttpApi::serve_temps, this, _1, _2));
+}
+
+std::string HttpApi::to_json(const xmlrpc_c::value &value)
+{
+    std::ostringstream oss;
+    switch (value.type())
+    {
+        case xmlrpc_c::value::TYPE_INT:
+            oss << xmlrpc_c::value_int(value).cvalue();
+            break;
+        case xmlrpc_c::value::TYPE_I8:
+            oss << xmlrpc_c::value_i8(value).cvalue();
+            break;
+        case xmlrpc_c::value::TYPE_BOOLEAN:
+            oss << (xmlrpc_c::value_boolean(value).cvalue() ? "true" : "false");
+            break;
+        case xmlrpc_c::value::TYPE_DOUBLE:
+        {
+            const double d = xmlrpc_c::value_double(value).cvalue();
+            if (std::isfinite(d))
+            {
+                oss << std::setprecision(15) << d;
+            }
+            else
+            {
+                oss << "null";
+            }
+            break;
+        }
+        case xmlrpc_c::value::TYPE_STRING:
+            oss << HttpServer::json_string(xmlrpc_c::value_string(value).cvalue());
+            break;
+        case xmlrpc_c::value::TYPE_ARRAY:
+        {
+            const xmlrpc_c::carray items = xmlrpc_c::value_array(value).vectorValueValue();
+            oss << "[";
+            for (size_t i = 0; i < items.size(); i++)
+            {
+                oss << (i ? "," : "") << to_json(items[i]);
+            }
+            oss << "]";
+            break;
+        }
+        case xmlrpc_c::value::TYPE_STRUCT:
+        {
+            const std::map < std::string, xmlrpc_c::value > members = xmlrpc_c::value_struct(value);
+            oss << "{";
+            for (std::map < std::string, xmlrpc_c::value >::const_iterator itr = members.begin(); itr != members.end(); ++itr)
+            {
+                oss << (itr == members.begin() ? "" : ",") << HttpServer::json_string(itr->first) << ":" << to_json(itr->second);
+            }
+            oss << "}";
+            break;
+        }
+        default:
+            oss << "null";
+            break;
+    }
+    return oss.str();
+}
+
+std::string HttpApi::to_text(const xmlrpc_c::value &value)
+{
+    switch (value.type())
+    {
+        case xmlrpc_c::value::TYPE_STRING:
+            return xmlrpc_c::value_string(value).cvalue();
+        case xmlrpc_c::value::TYPE_BOOLEAN:
+            return xmlrpc_c::value_boolean(value).cvalue() ? "TRUE" : "FALSE";
+        case xmlrpc_c::value::TYPE_NIL:
+            return "Nil";
+        default:
+            return to_json(value);
+    }
+}
+
+bool HttpApi::send_json(const int fd, const int status, const std::string &json)
+{
+    return HttpServer::send_response(fd, status, "application/json", json + "\n", "Cache-Control: no-store\r\n");
+}
+
+std::vector < char > HttpApi::param_types(const std::string &method)
+{
+    /* First signature only, e.g. "n:i8i8" or "n:I". The methods here write i8 both as
+     * "I" and as "i8". */
+    std::vector < char > ret;
+    std::string signature, help;
+    if (!_server->describe(method, signature, help))
+    {
+        return ret;
+    }
+    signature = signature.substr(0, signature.find(','));
+    const size_t colon = signature.find(':');
+    if (colon == std::string::npos)
+    {
+        return ret;
+    }
+    for (size_t i = colon + 1; i < signature.size(); i++)
+    {
+        if (signature[i] == 'i' && i + 1 < signature.size() && signature[i + 1] == '8')
+        {
+            ret.push_back('I');
+            i++;
+        }
+        else
+        {
+            ret.push_back(signature[i]);
+        }
+    }
+    return ret;
+}
+
+bool HttpApi::serve_static(const HttpRequest &request, const int fd)
+{
+    std::string path = request.path;
+    if (path.find("..") != std::string::npos)
+    {
+        return HttpServer::send_response(fd, 403, "text/plain", "Forbidden\n");
+    }
+    if (path[path.size() - 1] == '/')
+    {
+        path += "index.html";
+    }
+    return HttpServer::send_file(fd, request, _root + path);
+}
+
+bool HttpApi::serve_export(const HttpRequest &request, const int fd)
+{
+    const std::string name = request.path.substr(strlen("/export/"));
+    if (!safe_name(name))
+    {
+        return HttpServer::send_response(fd, 403, "text/plain", "Forbidden\n");
+    }
+    return HttpServer::send_file(fd, request, _export_dir + "/" + name);
+}
+
+bool HttpApi::serve_api(const HttpRequest &request, const int fd)
+{
+    const std::string name = request.path.substr(strlen("/api/"));
+    if (name.empty())
+    {
+        const std::vector < std::string > names = _server->get_method_names();
+        std::ostringstream oss;
+        oss << "{\"methods\":[";
+        for (size_t i = 0; i < names.size(); i++)
+        {
+            std::string signature, help;
+            _server->describe(names[i], signature, help);
+            oss << (i ? "," : "") << "{\"name\":" << HttpServer::json_string(names[i]) << ",\"signature\":" << HttpServer::json_string(signature)
+                << ",\"help\":" << HttpServer::json_string(help) << "}";
+        }
+        oss << "]}";
+        return send_json(fd, 200, oss.str());
+    }
+
+    std::string signature, help;
+    if (!_server->describe(name, signature, help))
+    {
+        return send_json(fd, 404, "{\"error\":" + HttpServer::json_string("Unknown method " + name) + "}");
+    }
+
+    const std::string params_json = request.method == "POST" ? request.body : request.get_param("params");
+    const std::vector < char > types = param_types(name);
+    xmlrpc_c::paramList params;
+    try
+    {
+        if (!params_json.empty())
+        {
+            JsonReader reader(params_json);
+            const xmlrpc_c::value value = reader.parse();
+            reader.finish();
+            if (value.type() != xmlrpc_c::value::TYPE_ARRAY)
+            {
+                throw std::runtime_error("parameters must be a JSON array");
+            }
+            // scalars are converted again to the types of the signature
+            const xmlrpc_c::carray items = xmlrpc_c::value_array(value).vectorValueValue();
+            for (size_t i = 0; i < items.size(); i++)
+            {
+                const char hint = i < types.size() ? types[i] : 0;
+                if (hint && strchr("iIbds", hint) &&
+                    (items[i].type() == xmlrpc_c::value::TYPE_INT || items[i].type() == xmlrpc_c::value::TYPE_I8 ||
+                             items[i].type() == xmlrpc_c::value::TYPE_DOUBLE || items[i].type() == xmlrpc_c::value::TYPE_STRING))
+                {
+                    params.add(JsonReader::convert(to_text(items[i]), hint));
+                }
+                else
+                {
+                    params.add(items[i]);
+                }
+            }
+        }
+    }
+    catch (const std::exception &e)
+    {
+        return send_json(fd, 400, "{\"error\":" + HttpServer::json_string(e.what()) + "}");
+    }
+
+    xmlrpc_c::value result;
+    try
+    {
+        _server->call(name, params, &result);
+    }
+    catch (const xmlrpc_c::fault &f)
+    {
+        return send_json(fd, 500, "{\"error\":" + HttpServer::json_string(fault_text(f)) + "}");
+    }
+    catch (const std::exception &e)
+    {
+        return send_json(fd, 500, "{\"error\":" + HttpServer::json_string(e.what()) + "}");
+    }
+    return send_json(fd, 200, "{\"result\":" + to_json(result) + "}");
+}
+
+bool HttpApi::serve_rpc(const HttpRequest &request, const int fd)
+{
+    /* request=<method> <type>/<value> ..., with the '+'s of the query already turned into
+     * spaces. Types as for the xmlrpc tool: i int, I i8, b boolean, d double, s string,
+     * n nil; a value without a type is a string. */
+    std::istringstream iss(request.get_param("request"));
+    std::string name;
+    iss >> name;
+
+    xmlrpc_c::paramList params;
+    xmlrpc_c::value result;
+    std::string text;
+    try
+    {
+        std::string arg;
+        while (iss >> arg)
+        {
+            if (arg.size() >= 2 && arg[1] == '/' && strchr("iIbdsn", arg[0]))
+            {
+                if (arg[0] == 'n')
+                {
+                    params.add(xmlrpc_c::value_nil());
+                }
+                else
+                {
+                    params.add(JsonReader::convert(arg.substr(2), arg[0]));
+                }
+            }
+            else
+            {
+                params.add(xmlrpc_c::value_string(arg));
+            }
+        }
+
+        text = _server->call(name, params, &result) ? to_text(result) : "Unknown method " + name;
+    }
+    catch (const xmlrpc_c::fault &f)
+    {
+        text = fault_text(f);
+    }
+    catch (const std::exception &e)
+    {
+        text = e.what();
+    }
+    return HttpServer::send_response(fd, 200, "text/plain", text + "\n", "Cache-Control: no-store\r\n");
+}
+
+bool HttpApi::serve_list(const HttpRequest &request, const int fd)
+{
+    std::vector < std::string > names;
+    DIR *dir = opendir(_export_dir.c_str());
+    if (dir)
+    {
+        struct dirent *ent;
+        while ((ent = readdir(dir)) != NULL)
+        {
+            const std::string name = ent->d_name;
+            const size_t dot = name.rfind('.');
+            const std::string ext = dot == std::string::npos ? "" : name.substr(dot);
+            if (ext == ".tar" || ext == ".mkv" || ext == ".mp4")
+            {
+                names.push_back(name);
+            }
+        }
+        closedir(dir);
+    }
+    std::sort(names.begin(), names.end());
+
+    std::ostringstream oss;
+    for (size_t i = 0; i < names.size(); i++)
+    {
+        oss << names[i] << "\n";
+    }
+    return HttpServer::send_response(fd, 200, "text/plain", oss.str(), "Cache-Control: no-store\r\n");
+}
+
+bool HttpApi::serve_delete(const HttpRequest &request, const int fd)
+{
+    const std::string name = request.get_param("file");
+    const bool ok = safe_name(name) && unlink((_export_dir + "/" + name).c_str()) == 0;
+    return HttpServer::send_response(fd, 200, "text/plain", ok ? "Delete succeeded\n" : "Delete failed\n");
+}
+
+bool HttpApi::serve_setroi(const HttpRequest &request, const int fd)
+{
+    static const char *params[] = { "width", "height", "offsetx", "offsety" };
+    static const char *keys[] = { "frame-width", "frame-height", "frame-offset-x", "frame-offset-y" };
+
+    int values[4];
+    for (int i = 0; i < 4; i++)
+    {
+        const std::string s = request.get_param(params[i]);
+        char *end = NULL;
+        values[i] = strtol(s.c_str(), &end, 10);
+        if (s.empty() || *end || values[i] < 0)
+        {
+            return HttpServer::send_response(fd, 200, "text/plain", "Invalid configuration\n");
+        }
+    }
+
+    std::ifstream in(_roi_config.c_str());
+    if (!in)
+    {
+        return HttpServer::send_response(fd, 200, "text/plain", "Unable to read " + _roi_config + "\n");
+    }
+    std::ostringstream out;
+    std::string line;
+    while (std::getline(in, line))
+    {
+        const size_t start = line.find_first_not_of(" \t");
+        const size_t eq = line.find('=');
+        if (start != std::string::npos && eq != std::string::npos)
+        {
+            std::string key = line.substr(start, eq - start);
+            key.erase(key.find_last_not_of(" \t") + 1);
+            for (int i = 0; i < 4; i++)
+            {
+                if (key == keys[i])
+                {
+                    std::ostringstream oss;
+                    oss << keys[i] << "=" << values[i];
+                    line = oss.str();
+                }
+            }
+        }
+        out << line << "\n";
+    }
+    in.close();
+
+    // keep the previous file, as the old script did
+    const std::string tmp = _roi_config + ".new";
+    std::ofstream file(tmp.c_str());
+    file << out.str();
+    file.close();
+    if (!file || rename(_roi_config.c_str(), (_roi_config + ".orig").c_str()) != 0 ||
+        rename(tmp.c_str(), _roi_config.c_str()) != 0)
+    {
+        return HttpServer::send_response(fd, 200, "text/plain", "Unable to update " + _roi_config + "\n");
+    }
+    return HttpServer::send_response(fd, 200, "text/plain", "");
+}
+
+bool HttpApi::serve_temps(const HttpRequest &request, const int fd)
+{
+    std::ostringstream oss;
+    char now[16];
+    const time_t t = time(NULL);
+    struct tm tm;
+    localtime_r(&t, &tm);
+    strftime(now, sizeof(now), "%H:%M:%S", &tm);
+    oss << "<table>\n<tr><th>Time</th><td>" << now << "</td></tr>\n";
+
+    const std::vector < std::pair < std::string, double > > temps = read_temperatures();
+    for (size_t i = 0; i < temps.size(); i++)
+    {
+        oss << "<tr><th>" << temps[i].first << "</th><td>" << std::fixed << std::setprecision(1) << temps[i].second
+            << "&deg;C</td></tr>\n";
+    }
+    oss << "</table>\n";
+    return HttpServer::send_response(fd, 200, "text/plain", oss.str(), "Cache-Control: no-store\r\n");
+}
+
+void HttpApi::sample_methods(const std::vector < std::string > &methods, TelemetryValues &values)
+{
+    const xmlrpc_c::paramList params;
+    for (size_t i = 0; i < methods.size(); i++)
+    {
+        xmlrpc_c::value result;
+        try
+        {
+            if (_server->call(methods[i], params, &result))
+            {
+                values["settings." + methods[i]] = to_json(result);
+            }
+        }
+        catch (const xmlrpc_c::fault &f)
+        {
+            // e.g. no capture session yet; the value is sent once it can be read
+        }
+    }
+}
+
+bool HttpApi::safe_name(const std::string &name)
+{
+    return !name.empty() && name.find('/') == std::string::npos && name != "." && name != "..";
+}
+
+} // namespace BoulderAI
@@ -0,0 +1,718 @@
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <boost/bind.hpp>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "http_server.hpp"
+
+namespace BoulderAI
+{
+
+const char *HttpServer::OPT_PORT = "http-port";
+const char *HttpServer::OPT_THREADS = "http-threads";
+
+const int HttpServer::DEFAULT_PORT = 8080;
+const int HttpServer::DEFAULT_THREADS = 4;
+
+int HttpServer::_port = DEFAULT_PORT;
+int HttpServer::_threads = DEFAULT_THREADS;
+
+static const size_t MAX_HEADER_BYTES = 16 * 1024;
+static const size_t MAX_BODY_BYTES = 1024 * 1024;
+static const int RECV_TIMEOUT_S = 10;
+static const int SEND_TIMEOUT_S = 5;
+static const int KEEPALIVE_TIMEOUT_S = 10;
+
+po::options_description HttpServer::GetOptions()
+{
+    po::options_description desc( "HTTP Options" );
+    desc.add_options()
+        ( OPT_PORT, po::value<int>(&_port)->default_value(DEFAULT_PORT),
+          "Port of the embedded HTTP server (web UI, control API, snapshots and MJPEG). 0 disables it." )
+        ( OPT_THREADS, po::value<int>(&_threads)->default_value(DEFAULT_THREADS),
+          "Worker threads of the embedded HTTP server. Streaming responses do not count against these." )
+        ;
+    return desc;
+}
+
+std::string HttpRequest::url_decode(const std::string &s)
+{
+    std::string ret;
+    ret.reserve(s.size());
+    for (size_t i = 0; i < s.size(); i++)
+    {
+        if (s[i] == '+')
+        {
+            ret += ' ';
+        }
+        else if (s[i] == '%' && i + 2 < s.size() && isxdigit(s[i + 1]) && isxdigit(s[i + 2]))
+        {
+            ret += (char)strtol(s.substr(i + 1, 2).c_str(), NULL, 16);
+            i += 2;
+        }
+        else
+        {
+            ret += s[i];
+        }
+    }
+    return ret;
+}
+
+bool HttpRequest::has_param(const std::string &name) const
+{
+    std::istringstream iss(query);
+    std::string pair;
+    while (std::getline(iss, pair, '&'))
+    {
+        if (url_decode(pair.substr(0, pair.find('='))) == name)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string HttpRequest::get_param(const std::string &name) const
+{
+    std::istringstream iss(query);
+    std::string pair;
+    while (std::getline(iss, pair, '&'))
+    {
+        const size_t eq = pair.find('=');
+        if (eq != std::string::npos && url_decode(pair.substr(0, eq)) == name)
+        {
+            return url_decode(pair.substr(eq + 1));
+        }
+    }
+    return "";
+}
+
+HttpServer::HttpServer(const int port, const int threads) :
+    _listen_port(port),
+    _num_threads(std::max(threads, 1)),
+    _listen_fd(-1),
+    _running(false)
+{
+    _wake_pipe[0] = _wake_pipe[1] = -1;
+}
+
+HttpServer::~HttpServer()
+{
+    stop();
+}
+
+void HttpServer::add_handler(const std::string &path, HttpHandler handler, const bool streaming)
+{
+    ScopedLock lock(_mtex);
+    Route route;
+    route.handler = handler;
+    route.streaming = streaming;
+    _routes[path] = route;
+}
+
+void HttpServer::start()
+{
+    if (_thread_ptr.get() || _listen_port <= 0)
+    {
+        return;
+    }
+
+    _listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (_listen_fd < 0)
+    {
+        throw std::runtime_error("Unable to create the HTTP server socket.");
+    }
+    const int one = 1;
+    setsockopt(_listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(_listen_port);
+    if (bind(_listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(_listen_fd, 64) != 0)
+    {
+        close(_listen_fd);
+        _listen_fd = -1;
+        std::ostringstream oss;
+        oss << "Unable to listen on HTTP port " << _listen_port << ": " << strerror(errno);
+        throw std::runtime_error(oss.str());
+    }
+    if (pipe2(_wake_pipe, O_CLOEXEC | O_NONBLOCK) != 0)
+    {
+        throw std::runtime_error("Unable to create the HTTP server wake-up pipe.");
+    }
+
+    std::cout << "HTTP server listening on port " << _listen_port << " with " << _num_threads << " threads" << std::endl;
+    _running = true;
+    for (int i = 0; i < _num_threads; i++)
+    {
+        _workers.create_thread(boost::bind(&HttpServer::run_worker, this));
+    }
+    _thread_ptr.reset(new boost::thread(boost::bind(&HttpServer::run, this)));
+}
+
+void HttpServer::stop()
+{
+    {
+        ScopedLock lock(_mtex);
+        _running = false;
+        _ready_condition.notify_all();
+    }
+
+    if (!_thread_ptr.get())
+    {
+        return;
+    }
+    const char c = 0;
+    if (write(_wake_pipe[1], &c, 1) < 0)
+    {
+        // the poll timeout wakes the thread as well
+    }
+    _thread_ptr->join();
+    _thread_ptr.reset();
+    close(_listen_fd);
+    _listen_fd = -1;
+
+    // wake up handlers blocked in recv(), streaming handlers fail their next write
+    {
+        ScopedLock lock(_mtex);
+        for (std::set < int >::iterator itr = _connections.begin(); itr != _connections.end(); ++itr)
+        {
+            shutdown(*itr, SHUT_RDWR);
+        }
+    }
+    _workers.join_all();
+
+    ScopedLock lock(_mtex);
+    while (!_connections.empty())
+    {
+        _condition.wait(lock);
+    }
+    close(_wake_pipe[0]);
+    close(_wake_pipe[1]);
+    _wake_pipe[0] = _wake_pipe[1] = -1;
+}
+
+void HttpServer::run()
+{
+    std::map < int, Connection > idle;
+    std::vector < struct pollfd > pfds;
+    while (true)
+    {
+        {
+            ScopedLock lock(_mtex);
+            if (!_running)
+            {
+                break;
+            }
+            while (!_returned.empty())
+            {
+                idle[_returned.front().fd] = _returned.front();
+                _returned.pop_front();
+            }
+        }
+
+        pfds.resize(2);
+        pfds[0].fd = _listen_fd;
+        pfds[0].events = POLLIN;
+        pfds[1].fd = _wake_pipe[0];
+        pfds[1].events = POLLIN;
+        for (std::map < int, Connection >::iterator itr = idle.begin(); itr != idle.end(); ++itr)
+        {
+            struct pollfd pfd;
+            pfd.fd = itr->first;
+            pfd.events = POLLIN;
+            pfds.push_back(pfd);
+        }
+        for (size_t i = 0; i < pfds.size(); i++)
+        {
+            pfds[i].revents = 0;
+        }
+        if (poll(pfds.data(), pfds.size(), 500) < 0)
+        {
+            continue;
+        }
+
+        if (pfds[1].revents & POLLIN)
+        {
+            char drain[64];
+            while (read(_wake_pipe[0], drain, sizeof(drain)) > 0)
+            {
+            }
+        }
+
+        const time_t now = time(NULL);
+        std::vector < Connection > ready;
+        for (size_t i = 2; i < pfds.size(); i++)
+        {
+            std::map < int, Connection >::iterator itr = idle.find(pfds[i].fd);
+            if (pfds[i].revents)
+            {
+                ready.push_back(itr->second);
+                idle.erase(itr);
+            }
+            else if (now - itr->second.last_active > KEEPALIVE_TIMEOUT_S)
+            {
+                idle.erase(itr);
+                close_connection(pfds[i].fd);
+            }
+        }
+
+        if (pfds[0].revents & POLLIN)
+        {
+            const int fd = accept4(_listen_fd, NULL, NULL, SOCK_CLOEXEC);
+            if (fd >= 0)
+            {
+                struct timeval recv_timeout = { RECV_TIMEOUT_S, 0 };
+                struct timeval send_timeout = { SEND_TIMEOUT_S, 0 };
+                setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &recv_timeout, sizeof(recv_timeout));
+                setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &send_timeout, sizeof(send_timeout));
+                const int one = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+                // a worker only gets the connection once its first request arrives
+                Connection conn;
+                conn.fd = fd;
+                conn.last_active = now;
+                idle[fd] = conn;
+                ScopedLock lock(_mtex);
+                _connections.insert(fd);
+            }
+        }
+
+        if (!ready.empty())
+        {
+            ScopedLock lock(_mtex);
+            _ready.insert(_ready.end(), ready.begin(), ready.end());
+            _ready_condition.notify_all();
+        }
+    }
+
+    std::deque < Connection > returned;
+    {
+        ScopedLock lock(_mtex);
+        returned.swap(_returned);
+    }
+    for (size_t i = 0; i < returned.size(); i++)
+    {
+        idle[returned[i].fd] = returned[i];
+    }
+    for (std::map < int, Connection >::iterator itr = idle.begin(); itr != idle.end(); ++itr)
+    {
+        close_connection(itr->first);
+    }
+}
+
+void HttpServer::run_worker()
+{
+    while (true)
+    {
+        Connection conn;
+        {
+            ScopedLock lock(_mtex);
+            while (_ready.empty() && _running)
+            {
+                _ready_condition.wait(lock);
+            }
+            if (!_running)
+            {
+                break;
+            }
+            conn = _ready.front();
+            _ready.pop_front();
+        }
+        handle_connection(conn);
+    }
+
+    // connections nobody will serve any more
+    ScopedLock lock(_mtex);
+    while (!_ready.empty())
+    {
+        const int fd = _ready.front().fd;
+        _ready.pop_front();
+        close(fd);
+        _connections.erase(fd);
+    }
+    _condition.notify_all();
+}
+
+void HttpServer::handle_connection(Connection conn)
+{
+    // serve every request that has arrived, then go back to waiting in the poll thread
+    do
+    {
+        HttpRequest request;
+        if (!read_request(conn.fd, conn.buffer, request))
+        {
+            close_connection(conn.fd);
+            return;
+        }
+
+        Route route;
+        bool keep_alive = (request.version == "HTTP/1.1" && request.headers["connection"] != "close");
+        if (!find_route(request.path, route))
+        {
+            keep_alive = send_response(conn.fd, 404, "text/plain", "Not found\n") && keep_alive;
+        }
+        else if (route.streaming)
+        {
+            boost::thread(boost::bind(&HttpServer::run_streaming, this, conn, request, route.handler)).detach();
+            return;
+        }
+        else
+        {
+            try
+            {
+                keep_alive = route.handler(request, conn.fd) && keep_alive;
+            }
+            catch (const std::exception &e)
+            {
+                std::cout << "HTTP handler for " << request.path << " failed: " << e.what() << std::endl;
+                send_response(conn.fd, 500, "text/plain", std::string(e.what()) + "\n");
+                keep_alive = false;
+            }
+        }
+
+        if (!keep_alive)
+        {
+            close_connection(conn.fd);
+            return;
+        }
+    } while (conn.buffer.find("\r\n\r\n") != std::string::npos);
+
+    conn.last_active = time(NULL);
+    return_connection(conn);
+}
+
+void HttpServer::run_streaming(Connection conn, HttpRequest request, HttpHandler handler)
+{
+    try
+    {
+        handler(request, conn.fd);
+    }
+    catch (const std::exception &e)
+    {
+        std::cout << "HTTP handler for " << request.path << " failed: " << e.what() << std::endl;
+    }
+    close_connection(conn.fd);
+}
+
+bool HttpServer::find_route(const std::string &path, Route &route)
+{
+    ScopedLock lock(_mtex);
+    std::map < std::string, Route >::iterator itr = _routes.find(path);
+    if (itr != _routes.end())
+    {
+        route = itr->second;
+        return true;
+    }
+
+    // longest registered prefix ending in '/'
+    size_t slash = path.size();
+    while (slash != std::string::npos && slash > 0)
+    {
+        slash = path.rfind('/', slash - 1);
+        if (slash == std::string::npos)
+        {
+            break;
+        }
+        itr = _routes.find(path.substr(0, slash + 1));
+        if (itr != _routes.end())
+        {
+            route = itr->second;
+            return true;
+        }
+    }
+    return false;
+}
+
+void HttpServer::return_connection(const Connection &conn)
+{
+    {
+        ScopedLock lock(_mtex);
+        if (_running)
+        {
+            _returned.push_back(conn);
+            const char c = 0;
+            if (write(_wake_pipe[1], &c, 1) < 0)
+            {
+                // the pipe is full, the poll thread is awake anyway
+            }
+            return;
+        }
+    }
+    close_connection(conn.fd);
+}
+
+void HttpServer::close_connection(const int fd)
+{
+    ScopedLock lock(_mtex);
+    close(fd);
+    _connections.erase(fd);
+    _condition.notify_all();
+}
+
+bool HttpServer::read_request(const int fd, std::string &buffer, HttpRequest &request)
+{
+    size_t header_end;
+    while ((header_end = buffer.find("\r\n\r\n")) == std::string::npos)
+    {
+        if (buffer.size() > MAX_HEADER_BYTES)
+        {
+            send_response(fd, 431, "text/plain", "Request header too large\n");
+            return false;
+        }
+        char chunk[4096];
+        const ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n <= 0)
+        {
+            return false;
+        }
+        buffer.append(chunk, n);
+    }
+
+    request = HttpRequest();
+    std::istringstream iss(buffer.substr(0, header_end));
+    std::string line;
+    std::getline(iss, line);
+    std::istringstream request_line(line);
+    std::string target;
+    request_line >> request.method >> target >> request.version;
+    if (request.method.empty() || target.empty())
+    {
+        send_response(fd, 400, "text/plain", "Bad request\n");
+        return false;
+    }
+    const size_t question = target.find('?');
+    request.path = HttpRequest::url_decode(target.substr(0, question));
+    if (question != std::string::npos)
+    {
+        request.query = target.substr(question + 1);
+    }
+
+    while (std::getline(iss, line))
+    {
+        if (!line.empty() && line[line.size() - 1] == '\r')
+        {
+            line.erase(line.size() - 1);
+        }
+        const size_t colon = line.find(':');
+        if (colon == std::string::npos)
+        {
+            continue;
+        }
+        std::string name = line.substr(0, colon);
+        std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+        const size_t value_start = line.find_first_not_of(" \t", colon + 1);
+        request.headers[name] = (value_start == std::string::npos) ? "" : line.substr(value_start);
+    }
+    buffer.erase(0, header_end + 4);
+
+    const size_t content_length = strtoul(request.headers["content-length"].c_str(), NULL, 10);
+    if (content_length > MAX_BODY_BYTES)
+    {
+        send_response(fd, 413, "text/plain", "Request body too large\n");
+        return false;
+    }
+    while (buffer.size() < content_length)
+    {
+        char chunk[4096];
+        const ssize_t n = recv(fd, chunk, std::min(sizeof(chunk), content_length - buffer.size()), 0);
+        if (n <= 0)
+        {
+            return false;
+        }
+        buffer.append(chunk, n);
+    }
+    request.body = buffer.substr(0, content_length);
+    buffer.erase(0, content_length);
+    return true;
+}
+
+bool HttpServer::send_all(const int fd, const void *data, const size_t size)
+{
+    const char *p = (const char *)data;
+    size_t sent = 0;
+    while (sent < size)
+    {
+        const ssize_t n = send(fd, p + sent, size - sent, MSG_NOSIGNAL);
+        if (n <= 0)
+        {
+            return false;
+        }
+        sent += n;
+    }
+    return true;
+}
+
+std::string HttpServer::json_string(const std::string &s)
+{
+    std::ostringstream oss;
+    oss << '"';
+    for (size_t i = 0; i < s.size(); i++)
+    {
+        const unsigned char c = s[i];
+        switch (c)
+        {
+            case '"': oss << "\\\""; break;
+            case '\\': oss << "\\\\"; break;
+            case '\n': oss << "\\n"; break;
+            case '\r': oss << "\\r"; break;
+            case '\t': oss << "\\t"; break;
+            default:
+                if (c < 0x20)
+                {
+                    oss << "\\u" << std::hex << std::setw(4) << std::setfill('0') << (int)c << std::dec;
+                }
+                else
+                {
+                    oss << c;
+                }
+        }
+    }
+    oss << '"';
+    return oss.str();
+}
+
+bool HttpServer::is_connected(const int fd)
+{
+    char c;
+    const ssize_t n = recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    return n > 0 || (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+}
+
+std::string HttpServer::status_text(const int status)
+{
+    switch (status)
+    {
+        case 200: return "OK";
+        case 204: return "No Content";
+        case 304: return "Not Modified";
+        case 403: return "Forbidden";
+        case 400: return "Bad Request";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 413: return "Payload Too Large";
+        case 431: return "Request Header Fields Too Large";
+        case 500: return "Internal Server Error";
+        case 503: return "Service Unavailable";
+        default: return "Unknown";
+    }
+}
+
+bool HttpServer::send_headers(const int fd, const int status, const std::string &content_type,
+                              const int64_t content_length, const std::string &extra_headers)
+{
+    std::ostringstream oss;
+    oss << "HTTP/1.1 " << status << " " << status_text(status) << "\r\n"
+        << "Content-Type: " << content_type << "\r\n";
+    if (content_length >= 0)
+    {
+        oss << "Content-Length: " << content_length << "\r\n";
+    }
+    oss << extra_headers << "\r\n";
+    const std::string headers = oss.str();
+    return send_all(fd, headers.data(), headers.size());
+}
+
+bool HttpServer::send_response(const int fd, const int status, const std::string &content_type,
+                               const std::string &body, const std::string &extra_headers)
+{
+    return send_headers(fd, status, content_type, body.size(), extra_headers) &&
+           send_all(fd, body.data(), body.size());
+}
+
+std::string HttpServer::content_type(const std::string &path)
+{
+    static const char *types[][2] = {
+        { ".html", "text/html; charset=utf-8" },
+        { ".htm", "text/html; charset=utf-8" },
+        { ".js", "application/javascript" },
+        { ".css", "text/css" },
+        { ".json", "application/json" },
+        { ".png", "image/png" },
+        { ".jpg", "image/jpeg" },
+        { ".jpeg", "image/jpeg" },
+        { ".gif", "image/gif" },
+        { ".svg", "image/svg+xml" },
+        { ".ico", "image/x-icon" },
+        { ".txt", "text/plain" },
+        { ".mkv", "video/x-matroska" },
+        { ".mp4", "video/mp4" },
+    };
+    const size_t dot = path.rfind('.');
+    if (dot != std::string::npos)
+    {
+        std::string ext = path.substr(dot);
+        std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+        for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++)
+        {
+            if (ext == types[i][0])
+            {
+                return types[i][1];
+            }
+        }
+    }
+    return "application/octet-stream";
+}
+
+bool HttpServer::send_file(const int fd, const HttpRequest &request, const std::string &path)
+{
+    if (request.method != "GET" && request.method != "HEAD")
+    {
+        return send_response(fd, 405, "text/plain", "Method not allowed\n", "Allow: GET, HEAD\r\n");
+    }
+
+    const int file = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (file < 0 || fstat(file, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        if (file >= 0)
+        {
+            close(file);
+        }
+        return send_response(fd, 404, "text/plain", "Not found\n");
+    }
+
+    // the files only change with a new install, the browser revalidates with the mtime
+    char modified[64];
+    struct tm tm;
+    gmtime_r(&st.st_mtime, &tm);
+    strftime(modified, sizeof(modified), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    std::map < std::string, std::string >::const_iterator since = request.headers.find("if-modified-since");
+    const std::string extra = std::string("Last-Modified: ") + modified + "\r\nCache-Control: no-cache\r\n";
+    if (since != request.headers.end() && since->second == modified)
+    {
+        close(file);
+        return send_headers(fd, 304, content_type(path), -1, extra);
+    }
+
+    bool ok = send_headers(fd, 200, content_type(path), st.st_size, extra);
+    off_t offset = 0;
+    while (ok && request.method == "GET" && offset < st.st_size)
+    {
+        const ssize_t n = sendfile(fd, file, &offset, st.st_size - offset);
+        ok = (n > 0);
+    }
+    close(file);
+    return ok;
+}
+
+} // namespace BoulderAI
@@ -0,0 +1,120 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/i2c-dev.h>
+// The kernel's i2c-dev.h leaves struct i2c_msg, I2C_M_RD and the SMBus types to i2c.h; the
+// one i2c-tools 3 installs defines them itself and clashes with i2c.h.
+#ifndef LIB_I2CDEV_H
+#include <linux/i2c.h>
+#endif
+#include <sstream>
+
+#include "i2c_bus.hpp"
+
+namespace BoulderAI
+{
+
+LinuxI2cBus::LinuxI2cBus(const std::string &device) :
+    _device(device),
+    _fd(-1),
+    _slave_addr(-1),
+    _use_rdwr(false)
+{
+}
+
+LinuxI2cBus::~LinuxI2cBus()
+{
+    if (_fd >= 0)
+    {
+        close(_fd);
+    }
+}
+
+bool LinuxI2cBus::open(std::string &error)
+{
+    if ((_fd = ::open(_device.c_str(), O_RDWR)) < 0)
+    {
+        error = "Unable to open device: " + _device;
+        return false;
+    }
+    uint64_t funcs;
+    if (ioctl(_fd, I2C_FUNCS, &funcs) < 0)
+    {
+        error = "Unable to get I2C_FUNCS";
+        return false;
+    }
+    _use_rdwr = (funcs & I2C_FUNC_I2C) != 0;
+    if (!_use_rdwr && !(funcs & I2C_FUNC_SMBUS_WORD_DATA))
+    {
+        error = "Unable to get valid FUNC";
+        return false;
+    }
+    return true;
+}
+
+bool LinuxI2cBus::select_slave(const uint8_t addr)
+{
+    // the kernel keeps the address, only change it when talking to another device
+    if (addr == _slave_addr)
+    {
+        return true;
+    }
+    if (ioctl(_fd, I2C_SLAVE, addr) < 0)
+    {
+        _slave_addr = -1;
+        return false;
+    }
+    _slave_addr = addr;
+    return true;
+}
+
+bool LinuxI2cBus::write(const I2cWrite *writes, const int count)
+{
+    if (_use_rdwr)
+    {
+        _msgs.resize(count);
+        for (int i = 0; i < count; i++)
+        {
+            _msgs[i].addr = writes[i].addr;
+            _msgs[i].flags = 0;
+            _msgs[i].len = writes[i].len;
+            // char * or __u8 * depending on the i2c-dev.h; the kernel only reads it for a write
+            _msgs[i].buf = reinterpret_cast < decltype(_msgs[i].buf) > (const_cast < uint8_t * > (writes[i].buf));
+        }
+        struct i2c_rdwr_ioctl_data data;
+        data.msgs = &_msgs[0];
+        data.nmsgs = count;
+        return ioctl(_fd, I2C_RDWR, &data) == count;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        if (!select_slave(writes[i].addr) || ::write(_fd, writes[i].buf, writes[i].len) != writes[i].len)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool LinuxI2cBus::read_reg(const uint8_t addr, const uint8_t reg, uint8_t &value)
+{
+    if (!select_slave(addr))
+    {
+        return false;
+    }
+    // what i2c_smbus_read_byte_data() does, without needing libi2c's header or library
+    union i2c_smbus_data data;
+    struct i2c_smbus_ioctl_data args;
+    args.read_write = I2C_SMBUS_READ;
+    args.command = reg;
+    args.size = I2C_SMBUS_BYTE_DATA;
+    args.data = &data;
+    if (ioctl(_fd, I2C_SMBUS, &args) < 0)
+    {
+        return false;
+    }
+    value = data.byte;
+    return true;
+}
+
+} // namespace BoulderAI
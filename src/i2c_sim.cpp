@@ -0,0 +1,227 @@
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "i2c_sim.hpp"
+#include "lens_pins.hpp"
+
+namespace BoulderAI
+{
+
+// MCP23017 registers with IOCON.BANK = 0, besides those in lens_pins.hpp
+#define REG_OLATA 0x14
+#define REG_OLATB 0x15
+#define IOCON_SEQOP 0x20
+
+// the phase of the two outputs in the cycle MotorDriver steps through
+static int phase_of(const bool a, const bool b)
+{
+    if (a)
+    {
+        return b ? 1 : 0;
+    }
+    return b ? 2 : 3;
+}
+
+SimulatedI2cBus::SimulatedI2cBus(const double clock_hz) :
+    _clock_hz(clock_hz)
+{
+    const uint8_t addrs[] = { EXP0_ADDR, EXP1_ADDR, EXP2_ADDR };
+    for (size_t i = 0; i < sizeof(addrs); i++)
+    {
+        Expander &expander = _expanders[addrs[i]];
+        memset(expander.regs, 0, sizeof(expander.regs));
+        // all pins are inputs after power up
+        expander.regs[REG_IODIRA] = 0xff;
+        expander.regs[REG_IODIRB] = 0xff;
+    }
+
+    const Motor zoom = { EXP1_ADDR, 0, ZOOM_APHASE, ZOOM_BPHASE, ZOOM_AENBL | ZOOM_BENBL, ZOOM_LIMIT, true,
+                         3, 0, -10000, 10000, 3000 };
+    const Motor focus = { EXP1_ADDR, 1, FOCUS_APHASE, FOCUS_BPHASE, FOCUS_AENBL | FOCUS_BENBL, FOCUS_LIMIT, false,
+                          3, 0, -10000, 10000, 3000 };
+    const Motor iris = { EXP0_ADDR, 0, IRIS_APHASE, IRIS_BPHASE, IRIS_AENBL | IRIS_BENBL, 0, true,
+                         3, 0, -200, 200, 0 };
+    _motors["zoom"] = zoom;
+    _motors["focus"] = focus;
+    _motors["iris"] = iris;
+
+    reset_stats();
+}
+
+bool SimulatedI2cBus::write(const I2cWrite *writes, const int count)
+{
+    ScopedLock lock(_mtex);
+    int bytes = 0;
+    for (int i = 0; i < count; i++)
+    {
+        bytes += writes[i].len;
+    }
+    count_transfer(count, bytes);
+
+    for (int i = 0; i < count; i++)
+    {
+        std::map < uint8_t, Expander >::iterator itr = _expanders.find(writes[i].addr);
+        if (itr == _expanders.end())
+        {
+            // nobody acknowledges the address
+            return false;
+        }
+        if (writes[i].len < 1)
+        {
+            continue;
+        }
+        Expander &expander = itr->second;
+        uint8_t reg = writes[i].buf[0];
+        for (int b = 1; b < writes[i].len; b++)
+        {
+            write_reg(writes[i].addr, expander, reg, writes[i].buf[b]);
+            if (!(expander.regs[REG_IOCON] & IOCON_SEQOP))
+            {
+                reg = (reg + 1) % REGISTERS;
+            }
+        }
+    }
+    return true;
+}
+
+bool SimulatedI2cBus::read_reg(const uint8_t addr, const uint8_t reg, uint8_t &value)
+{
+    ScopedLock lock(_mtex);
+    // the register address is written, then one byte read after a repeated start
+    count_transfer(2, 2);
+
+    std::map < uint8_t, Expander >::const_iterator itr = _expanders.find(addr);
+    if (itr == _expanders.end() || reg >= REGISTERS)
+    {
+        return false;
+    }
+    if (reg == REG_GPIOA || reg == REG_GPIOB)
+    {
+        value = read_port(addr, reg - REG_GPIOA);
+    }
+    else
+    {
+        value = itr->second.regs[reg];
+    }
+    return true;
+}
+
+void SimulatedI2cBus::write_reg(const uint8_t addr, Expander &expander, const uint8_t reg, const uint8_t value)
+{
+    if (reg >= REGISTERS)
+    {
+        return;
+    }
+    // writing the port writes its output latch
+    const uint8_t target = (reg == REG_GPIOA || reg == REG_GPIOB) ? reg + (REG_OLATA - REG_GPIOA) : reg;
+    expander.regs[target] = value;
+    if (target == REG_OLATA || target == REG_OLATB)
+    {
+        update_motors(addr, target - REG_OLATA, value);
+    }
+}
+
+void SimulatedI2cBus::update_motors(const uint8_t addr, const int port, const uint8_t outputs)
+{
+    for (std::map < std::string, Motor >::iterator itr = _motors.begin(); itr != _motors.end(); ++itr)
+    {
+        Motor &m = itr->second;
+        if (m.addr != addr || m.port != port)
+        {
+            continue;
+        }
+        const int phase = phase_of(outputs & m.aphase, outputs & m.bphase);
+        const int delta = (phase - m.phase + 4) % 4;
+        m.phase = phase;
+        if ((outputs & m.enable) != m.enable || delta == 0)
+        {
+            continue;
+        }
+        if (delta == 2)
+        {
+            _stats.missed_steps++;
+            continue;
+        }
+        const int dir = (delta == 1) != m.reverse ? 1 : -1;
+        m.position = std::max(m.min, std::min(m.max, m.position + dir));
+    }
+}
+
+uint8_t SimulatedI2cBus::read_port(const uint8_t addr, const int port)
+{
+    const Expander &expander = _expanders[addr];
+    const uint8_t iodir = expander.regs[REG_IODIRA + port];
+    uint8_t inputs = 0;
+    for (std::map < std::string, Motor >::const_iterator itr = _motors.begin(); itr != _motors.end(); ++itr)
+    {
+        const Motor &m = itr->second;
+        if (m.addr == addr && m.port == port && m.limit && m.position >= m.limit_from)
+        {
+            inputs |= m.limit;
+        }
+    }
+    return (expander.regs[REG_OLATA + port] & ~iodir) | (inputs & iodir);
+}
+
+void SimulatedI2cBus::count_transfer(const int messages, const int bytes)
+{
+    // a start (or repeated start) and an address byte per message, a stop at the end
+    const uint64_t bits = messages * (1 + 9) + bytes * 9 + 1;
+    _stats.transfers++;
+    _stats.messages += messages;
+    _stats.bytes += bytes;
+    _stats.bus_ns += (uint64_t)(bits * 1e9 / _clock_hz);
+}
+
+SimulatedI2cBus::Motor &SimulatedI2cBus::motor(const std::string &axis)
+{
+    std::map < std::string, Motor >::iterator itr = _motors.find(axis);
+    if (itr == _motors.end())
+    {
+        throw std::invalid_argument("Unknown simulated axis: " + axis);
+    }
+    return itr->second;
+}
+
+int SimulatedI2cBus::get_position(const std::string &axis)
+{
+    ScopedLock lock(_mtex);
+    return motor(axis).position;
+}
+
+void SimulatedI2cBus::set_position(const std::string &axis, const int position)
+{
+    ScopedLock lock(_mtex);
+    motor(axis).position = position;
+}
+
+void SimulatedI2cBus::set_travel(const std::string &axis, const int min, const int max, const int limit)
+{
+    ScopedLock lock(_mtex);
+    Motor &m = motor(axis);
+    m.min = min;
+    m.max = max;
+    m.limit_from = limit;
+    m.position = std::max(min, std::min(max, m.position));
+}
+
+bool SimulatedI2cBus::get_ir_cut()
+{
+    ScopedLock lock(_mtex);
+    return (_expanders[EXP0_ADDR].regs[REG_OLATB] & IRCUT_A) != 0;
+}
+
+I2cSimStats SimulatedI2cBus::get_stats()
+{
+    ScopedLock lock(_mtex);
+    return _stats;
+}
+
+void SimulatedI2cBus::reset_stats()
+{
+    ScopedLock lock(_mtex);
+    memset(&_stats, 0, sizeof(_stats));
+}
+
+} // namespace BoulderAI
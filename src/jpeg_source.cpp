@@ -0,0 +1,435 @@
+#include <csetjmp>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <time.h>
+#include <boost/bind.hpp>
+
+#include "NvJpegEncoder.h"
+#include "nvbuf_utils.h"
+
+#include "jpeg_source.hpp"
+
+namespace BoulderAI
+{
+
+const char *JpegSource::OPT_WIDTH = "jpeg-width";
+const char *JpegSource::OPT_HEIGHT = "jpeg-height";
+const char *JpegSource::OPT_FPS = "jpeg-fps";
+const char *JpegSource::OPT_IDLE_FPS = "jpeg-idle-fps";
+const char *JpegSource::OPT_QUALITY = "jpeg-quality";
+
+const int JpegSource::DEFAULT_WIDTH = 960;
+const int JpegSource::DEFAULT_HEIGHT = 540;
+const double JpegSource::DEFAULT_FPS = 10.0;
+const double JpegSource::DEFAULT_IDLE_FPS = 1.0;
+const int JpegSource::DEFAULT_QUALITY = 75;
+
+int JpegSource::_opt_width = DEFAULT_WIDTH;
+int JpegSource::_opt_height = DEFAULT_HEIGHT;
+double JpegSource::_fps = DEFAULT_FPS;
+double JpegSource::_idle_fps = DEFAULT_IDLE_FPS;
+int JpegSource::_quality = DEFAULT_QUALITY;
+
+static const char *MJPEG_BOUNDARY = "dnncamframe";
+static const int FRAME_WAIT_MS = 2000;
+
+po::options_description JpegSource::GetOptions()
+{
+    po::options_description desc( "JPEG Options" );
+    desc.add_options()
+        ( OPT_WIDTH, po::value<int>(&_opt_width)->default_value(DEFAULT_WIDTH),
+          "Width of the /snapshot.jpg and /mjpeg images." )
+        ( OPT_HEIGHT, po::value<int>(&_opt_height)->default_value(DEFAULT_HEIGHT),
+          "Height of the /snapshot.jpg and /mjpeg images." )
+        ( OPT_FPS, po::value<double>(&_fps)->default_value(DEFAULT_FPS),
+          "JPEG encoding rate while at least one MJPEG viewer is connected." )
+        ( OPT_IDLE_FPS, po::value<double>(&_idle_fps)->default_value(DEFAULT_IDLE_FPS),
+          "JPEG encoding rate without MJPEG viewers, which keeps /snapshot.jpg current. 0 disables it." )
+        ( OPT_QUALITY, po::value<int>(&_quality)->default_value(DEFAULT_QUALITY),
+          "JPEG quality, 1 to 100." )
+        ;
+    return desc;
+}
+
+namespace
+{
+
+struct JpegErrorManager
+{
+    struct jpeg_error_mgr mgr;
+    jmp_buf jump;
+};
+
+// the default libjpeg error handler exits the process
+void jpeg_error_exit(j_common_ptr cinfo)
+{
+    JpegErrorManager *err = (JpegErrorManager *)cinfo->err;
+    char message[JMSG_LENGTH_MAX];
+    (*cinfo->err->format_message)(cinfo, message);
+    std::cout << "JPEG encoding failed: " << message << std::endl;
+    longjmp(err->jump, 1);
+}
+
+uint64_t monotonic_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+} // anonymous namespace
+
+JpegSource::JpegSource() :
+    _width(_opt_width & ~1),
+    _height(_opt_height & ~1),
+    _running(false),
+    _has_pending(false),
+    _last_accepted_ns(0),
+    _last_frame_number(0),
+    _viewers(0),
+    _use_hw(true),
+    _encoder(NULL),
+    _hw_fd(-1),
+    _hw_out(_width * _height * 3 / 2)
+{
+    std::cout << "JPEG images: " << _width << "x" << _height << " at " << _fps << " fps" << std::endl;
+}
+
+JpegSource::~JpegSource()
+{
+    stop();
+    delete _encoder;
+    if (_hw_fd >= 0)
+    {
+        NvBufferDestroy(_hw_fd);
+    }
+}
+
+void JpegSource::start()
+{
+    ScopedLock lock(_mtex);
+    if (_thread_ptr.get())
+    {
+        return;
+    }
+
+    _running = true;
+    _thread_ptr.reset(new boost::thread(boost::bind(&JpegSource::run, this)));
+}
+
+void JpegSource::stop()
+{
+    {
+        ScopedLock lock(_mtex);
+        _running = false;
+        _has_pending = false;
+        _pending = FrameCollection();
+        _condition.notify_all();
+        _frame_condition.notify_all();
+    }
+
+    if (!_thread_ptr.get())
+    {
+        return;
+    }
+    _thread_ptr->join();
+    _thread_ptr.reset();
+}
+
+void JpegSource::push_frame(const FrameCollection &frame_col)
+{
+    const uint64_t now = frame_col.sensor_timestamp ? frame_col.sensor_timestamp : monotonic_ns();
+
+    ScopedLock lock(_mtex);
+    const double fps = (_viewers > 0) ? _fps : _idle_fps;
+    if (!_running || fps <= 0)
+    {
+        return;
+    }
+    // the frame processor workers may finish frames slightly out of order
+    if (frame_col.frame_number != 0 && frame_col.frame_number <= _last_frame_number)
+    {
+        return;
+    }
+
+    const uint64_t interval = 1e9 / fps;
+    if (_last_accepted_ns != 0 && now - _last_accepted_ns < interval)
+    {
+        return;
+    }
+    // keep the average rate when the capture rate is not a multiple of fps
+    _last_accepted_ns = (now - _last_accepted_ns < 2 * interval) ? _last_accepted_ns + interval : now;
+    _last_frame_number = frame_col.frame_number;
+
+    _pending = frame_col;
+    _has_pending = true;
+    _condition.notify_one();
+}
+
+JpegFramePtr JpegSource::get_latest()
+{
+    ScopedLock lock(_mtex);
+    return _latest;
+}
+
+int JpegSource::get_viewer_count()
+{
+    ScopedLock lock(_mtex);
+    return _viewers;
+}
+
+JpegFramePtr JpegSource::wait_for_frame(const uint64_t seq, const int timeout_ms)
+{
+    const boost::system_time deadline = boost::get_system_time() + boost::posix_time::milliseconds(timeout_ms);
+    ScopedLock lock(_mtex);
+    while (_running && (!_latest.get() || _latest->seq <= seq))
+    {
+        if (!_frame_condition.timed_wait(lock, deadline))
+        {
+            break;
+        }
+    }
+    if (_latest.get() && _latest->seq > seq)
+    {
+        return _latest;
+    }
+    return JpegFramePtr();
+}
+
+void JpegSource::run()
+{
+    uint64_t seq = 0;
+    while (true)
+    {
+        FrameCollection frame_col;
+        {
+            ScopedLock lock(_mtex);
+            while (_running && !_has_pending)
+            {
+                _condition.wait(lock);
+            }
+            if (!_running)
+            {
+                break;
+            }
+            frame_col = _pending;
+            _pending = FrameCollection();
+            _has_pending = false;
+        }
+
+        boost::shared_ptr < JpegFrame > frame(new JpegFrame());
+        bool ok = false;
+        if (_use_hw && frame_col.yuv_fd >= 0)
+        {
+            ok = encode_hw(frame_col, frame->data);
+            if (!ok)
+            {
+                std::cout << "Hardware JPEG encoding failed, falling back to libjpeg." << std::endl;
+                _use_hw = false;
+            }
+        }
+        if (!ok)
+        {
+            ok = encode_sw(frame_col, frame->data);
+        }
+        frame->seq = ++seq;
+        frame->sensor_timestamp = frame_col.sensor_timestamp;
+
+        // release the capture buffer before waiting for the next frame
+        frame_col = FrameCollection();
+
+        if (ok)
+        {
+            ScopedLock lock(_mtex);
+            _latest = frame;
+            _frame_condition.notify_all();
+        }
+    }
+}
+
+bool JpegSource::encode_hw(const FrameCollection &frame_col, std::vector < uint8_t > &out)
+{
+    if (!_encoder)
+    {
+        _encoder = NvJPEGEncoder::createJPEGEncoder("jpenenc");
+        if (!_encoder)
+        {
+            return false;
+        }
+    }
+    if (_hw_fd < 0)
+    {
+        if (NvBufferCreate(&_hw_fd, _width, _height, NvBufferLayout_Pitch, NvBufferColorFormat_YUV420) != 0)
+        {
+            _hw_fd = -1;
+            return false;
+        }
+    }
+
+    NvBufferTransformParams transform_params;
+    memset(&transform_params, 0, sizeof(transform_params));
+    transform_params.transform_flag = NVBUFFER_TRANSFORM_FILTER;
+    transform_params.transform_filter = NvBufferTransform_Filter_Smart;
+    if (NvBufferTransform(frame_col.yuv_fd, _hw_fd, &transform_params) != 0)
+    {
+        return false;
+    }
+
+    unsigned char *buf = _hw_out.data();
+    unsigned long size = _hw_out.size();
+    if (_encoder->encodeFromFd(_hw_fd, JCS_YCbCr, &buf, size, _quality) < 0)
+    {
+        return false;
+    }
+    out.assign(buf, buf + size);
+    if (buf != _hw_out.data())
+    {
+        // libjpeg had to grow the output buffer
+        free(buf);
+    }
+    return true;
+}
+
+bool JpegSource::encode_sw(const FrameCollection &frame_col, std::vector < uint8_t > &out)
+{
+    if (!frame_col.frame_y.get() || !frame_col.frame_u.get() || !frame_col.frame_v.get())
+    {
+        return false;
+    }
+    cv::resize(frame_col.frame_y->to_mat(), _y, cv::Size(_width, _height), 0, 0, cv::INTER_AREA);
+    cv::resize(frame_col.frame_u->to_mat(), _u, cv::Size(_width / 2, _height / 2), 0, 0, cv::INTER_AREA);
+    cv::resize(frame_col.frame_v->to_mat(), _v, cv::Size(_width / 2, _height / 2), 0, 0, cv::INTER_AREA);
+
+    struct jpeg_compress_struct cinfo;
+    JpegErrorManager err;
+    cinfo.err = jpeg_std_error(&err.mgr);
+    err.mgr.error_exit = jpeg_error_exit;
+    unsigned char *buf = NULL;
+    unsigned long size = 0;
+    if (setjmp(err.jump))
+    {
+        jpeg_destroy_compress(&cinfo);
+        free(buf);
+        return false;
+    }
+
+    jpeg_create_compress(&cinfo);
+    jpeg_mem_dest(&cinfo, &buf, &size);
+    cinfo.image_width = _width;
+    cinfo.image_height = _height;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_YCbCr;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_colorspace(&cinfo, JCS_YCbCr);
+    jpeg_set_quality(&cinfo, _quality, TRUE);
+
+    // feed the I420 planes directly, without colour conversion or resampling
+    cinfo.raw_data_in = TRUE;
+#if JPEG_LIB_VERSION >= 70
+    cinfo.do_fancy_downsampling = FALSE;
+#endif
+    cinfo.comp_info[0].h_samp_factor = 2;
+    cinfo.comp_info[0].v_samp_factor = 2;
+    cinfo.comp_info[1].h_samp_factor = 1;
+    cinfo.comp_info[1].v_samp_factor = 1;
+    cinfo.comp_info[2].h_samp_factor = 1;
+    cinfo.comp_info[2].v_samp_factor = 1;
+    jpeg_start_compress(&cinfo, TRUE);
+
+    JSAMPROW y_rows[16];
+    JSAMPROW u_rows[8];
+    JSAMPROW v_rows[8];
+    JSAMPARRAY planes[3] = { y_rows, u_rows, v_rows };
+    while (cinfo.next_scanline < cinfo.image_height)
+    {
+        // the last MCU row repeats the bottom image row
+        for (int i = 0; i < 16; i++)
+        {
+            y_rows[i] = _y.ptr(std::min < int >(cinfo.next_scanline + i, _height - 1));
+        }
+        for (int i = 0; i < 8; i++)
+        {
+            const int row = std::min < int >(cinfo.next_scanline / 2 + i, _height / 2 - 1);
+            u_rows[i] = _u.ptr(row);
+            v_rows[i] = _v.ptr(row);
+        }
+        jpeg_write_raw_data(&cinfo, planes, 16);
+    }
+
+    jpeg_finish_compress(&cinfo);
+    out.assign(buf, buf + size);
+    jpeg_destroy_compress(&cinfo);
+    free(buf);
+    return true;
+}
+
+void JpegSource::register_handlers(HttpServer &server)
+{
+    server.add_handler("/snapshot.jpg", boost::bind(&JpegSource::serve_snapshot, this, _1, _2));
+    server.add_handler("/mjpeg", boost::bind(&JpegSource::serve_mjpeg, this, _1, _2), true);
+}
+
+bool JpegSource::serve_snapshot(const HttpRequest &request, const int fd)
+{
+    // never encode on request, serve what the encoder produced last
+    JpegFramePtr frame = get_latest();
+    if (!frame.get())
+    {
+        frame = wait_for_frame(0, FRAME_WAIT_MS);
+    }
+    if (!frame.get())
+    {
+        return HttpServer::send_response(fd, 503, "text/plain", "No frame available\n");
+    }
+
+    // read-only, so other pages (dashboards, a VMS) may embed it
+    return HttpServer::send_headers(fd, 200, "image/jpeg", frame->data.size(),
+                                    "Cache-Control: no-cache\r\nAccess-Control-Allow-Origin: *\r\n") &&
+           HttpServer::send_all(fd, frame->data.data(), frame->data.size());
+}
+
+bool JpegSource::serve_mjpeg(const HttpRequest &request, const int fd)
+{
+    {
+        ScopedLock lock(_mtex);
+        _viewers++;
+    }
+
+    std::ostringstream content_type;
+    content_type << "multipart/x-mixed-replace; boundary=" << MJPEG_BOUNDARY;
+    bool ok = HttpServer::send_headers(fd, 200, content_type.str(), -1,
+                                       "Cache-Control: no-cache\r\nConnection: close\r\n"
+                                       "Access-Control-Allow-Origin: *\r\n");
+    uint64_t seq = 0;
+    while (ok)
+    {
+        JpegFramePtr frame = wait_for_frame(seq, FRAME_WAIT_MS);
+        if (!frame.get())
+        {
+            // no frames for a while: stop if we are shutting down or the viewer went away
+            ScopedLock lock(_mtex);
+            ok = _running && HttpServer::is_connected(fd);
+            continue;
+        }
+        seq = frame->seq;
+
+        std::ostringstream part;
+        part << "--" << MJPEG_BOUNDARY << "\r\n"
+             << "Content-Type: image/jpeg\r\n"
+             << "Content-Length: " << frame->data.size() << "\r\n\r\n";
+        const std::string header = part.str();
+        ok = HttpServer::send_all(fd, header.data(), header.size()) &&
+             HttpServer::send_all(fd, frame->data.data(), frame->data.size()) &&
+             HttpServer::send_all(fd, "\r\n", 2);
+    }
+
+    {
+        ScopedLock lock(_mtex);
+        _viewers--;
+    }
+    return false;
+}
+
+} // namespace BoulderAI
@@ -6,7 +6,9 @@
 #include <readline/history.h>
 
 #include "motordriver.hpp"
+#include "i2c_sim.hpp"
 #include "DNNCamServer.hpp"
+#include "async_log.hpp"
 
 using namespace std;
 using namespace boost;
@@ -28,10 +30,10 @@ const char *convert_to_cstr(const std::string & s)
         {if (false == cmd) { std::cout << "FAILED" << std::endl; } else { std::cout << "OK" << std::endl; } continue;}
 
 
-void interactive(MotorDriverPtr m) {
+void interactive(MotorDriverPtr m, I2cBusPtr bus) {
     char c;
     int num_steps = 1;
-    m.reset(new MotorDriver(true, lens_cout_log_handler));
+    m.reset(new MotorDriver(true, lens_cout_log_handler, bus));
     std::cout << "Verson 1.1.6: Type help for commands." << std::endl;
     po::options_description desc("Options");
     desc.add_options()
@@ -195,9 +197,12 @@ void interactive(MotorDriverPtr m) {
 int main(int argc, const char* argv[])
 {
     MotorDriverPtr m;
+    // show every register write, as this tool always has
+    AsyncLog::set_level(AsyncLog::LOG_DEBUG);
     po::options_description desc{"Options"};
     desc.add_options()
-        ("help,h", "Help screen");
+        ("help,h", "Help screen")
+        ("simulate", "Drive simulated expanders instead of /dev/i2c-6");
     //("xmlrpc", "Run as xmlrpc client");
     try
     {
@@ -210,7 +215,11 @@ int main(int argc, const char* argv[])
         }/* else if (vm.count("xmlrpc")) {
             rpcmode(m);
             }*/ else {
-            interactive(m);
+            I2cBusPtr bus;
+            if (vm.count("simulate")) {
+                bus.reset(new SimulatedI2cBus());
+            }
+            interactive(m, bus);
         }
     } catch (const std::exception &e) {
         std::cout << "Error: " << e.what() << std::endl;
@@ -0,0 +1,327 @@
+#include <iostream>
+#include <sstream>
+#include <time.h>
+#include <boost/bind.hpp>
+
+#include "lens_jobs.hpp"
+#include "metrics.hpp"
+
+namespace BoulderAI
+{
+
+const size_t LensJobs::MAX_FINISHED = 64;
+
+namespace
+{
+
+uint64_t monotonic_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+int64_t realtime_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+} // anonymous namespace
+
+LensJobs::LensJobs(DNNCamPtr dnncam) :
+    _dnncam(dnncam),
+    _running(false),
+    _next_id(1),
+    _running_id(0)
+{
+}
+
+LensJobs::~LensJobs()
+{
+    stop();
+}
+
+void LensJobs::start()
+{
+    ScopedLock lock(_mtex);
+    if (_thread_ptr.get())
+    {
+        return;
+    }
+
+    _running = true;
+    _thread_ptr.reset(new boost::thread(boost::bind(&LensJobs::run, this)));
+}
+
+void LensJobs::stop()
+{
+    {
+        ScopedLock lock(_mtex);
+        _running = false;
+        _condition.notify_all();
+    }
+    // don't wait for the rest of a long move
+    _dnncam->cancel_lens_move();
+
+    if (!_thread_ptr.get())
+    {
+        return;
+    }
+    _thread_ptr->join();
+    _thread_ptr.reset();
+}
+
+void LensJobs::set_done_callback(const DoneCallback &callback)
+{
+    ScopedLock lock(_mtex);
+    _done_callback = callback;
+}
+
+int LensJobs::add(const std::string &description, const Move &move, const bool preempt)
+{
+    std::deque < int > dropped;
+    int id;
+    {
+        ScopedLock lock(_mtex);
+        if (!_running)
+        {
+            return -1;
+        }
+
+        if (preempt)
+        {
+            dropped.swap(_queue);
+            if (_running_id != 0)
+            {
+                _jobs[_running_id].cancel_requested = true;
+                _dnncam->cancel_lens_move();
+            }
+        }
+        id = queue_job(description, move);
+    }
+
+    for (size_t i = 0; i < dropped.size(); i++)
+    {
+        finish(dropped[i], CANCELLED);
+    }
+    return id;
+}
+
+int LensJobs::add_relative(const std::string &name, const RelativeMove &move, const int steps)
+{
+    ScopedLock lock(_mtex);
+    if (!_running)
+    {
+        return -1;
+    }
+
+    std::ostringstream description;
+    if (!_queue.empty())
+    {
+        Job &last = _jobs[_queue.back()];
+        if (last.relative && last.relative_name == name)
+        {
+            last.steps += steps;
+            description << name << "(" << last.steps << ")";
+            last.description = description.str();
+            return _queue.back();
+        }
+    }
+
+    description << name << "(" << steps << ")";
+    const int id = queue_job(description.str(), Move());
+    Job &job = _jobs[id];
+    job.relative_name = name;
+    job.relative = move;
+    job.steps = steps;
+    return id;
+}
+
+int LensJobs::queue_job(const std::string &description, const Move &move)
+{
+    const int id = _next_id++;
+    Job job;
+    job.description = description;
+    job.move = move;
+    job.steps = 0;
+    job.state = QUEUED;
+    job.cancel_requested = false;
+    job.queued_unix_ms = realtime_ms();
+    job.start_ms = 0;
+    job.end_ms = 0;
+    _jobs[id] = job;
+    _queue.push_back(id);
+    _condition.notify_all();
+    return id;
+}
+
+bool LensJobs::get_status(const int id, LensJobStatus &status)
+{
+    ScopedLock lock(_mtex);
+    std::map < int, Job >::const_iterator itr = _jobs.find(id);
+    if (itr == _jobs.end())
+    {
+        return false;
+    }
+
+    const Job &job = itr->second;
+    status.id = id;
+    status.description = job.description;
+    status.state = state_name(job.state);
+    status.queued_unix_ms = job.queued_unix_ms;
+    if (job.state == QUEUED || job.start_ms == 0)
+    {
+        status.duration_ms = 0;
+    }
+    else
+    {
+        status.duration_ms = (job.end_ms ? job.end_ms : monotonic_ms()) - job.start_ms;
+    }
+    return true;
+}
+
+bool LensJobs::is_busy()
+{
+    ScopedLock lock(_mtex);
+    return _running_id != 0 || !_queue.empty();
+}
+
+bool LensJobs::cancel(const int id)
+{
+    ScopedLock lock(_mtex);
+    std::map < int, Job >::iterator itr = _jobs.find(id);
+    if (itr == _jobs.end())
+    {
+        return false;
+    }
+
+    Job &job = itr->second;
+    if (job.state == QUEUED)
+    {
+        for (std::deque < int >::iterator q = _queue.begin(); q != _queue.end(); ++q)
+        {
+            if (*q == id)
+            {
+                _queue.erase(q);
+                break;
+            }
+        }
+        lock.unlock();
+        finish(id, CANCELLED);
+        return true;
+    }
+    if (job.state == RUNNING)
+    {
+        job.cancel_requested = true;
+        _dnncam->cancel_lens_move();
+        return true;
+    }
+    return false;
+}
+
+void LensJobs::run()
+{
+    ScopedLock lock(_mtex);
+    while (_running)
+    {
+        if (_queue.empty())
+        {
+            _condition.wait(lock);
+            continue;
+        }
+
+        const int id = _queue.front();
+        _queue.pop_front();
+
+        // clear any earlier cancel before the job can be cancelled, see cancel()
+        _dnncam->clear_lens_cancel();
+
+        Job &job = _jobs[id];
+        job.state = RUNNING;
+        job.start_ms = monotonic_ms();
+        const Move move = job.relative ? Move(boost::bind(job.relative, job.steps)) : job.move;
+        _running_id = id;
+        lock.unlock();
+
+        bool ok = false;
+        try
+        {
+            ok = move();
+        }
+        catch (const std::exception &e)
+        {
+            std::cout << "Lens job " << id << " failed: " << e.what() << std::endl;
+        }
+
+        lock.lock();
+        _running_id = 0;
+        const bool cancelled = _jobs[id].cancel_requested;
+        lock.unlock();
+        finish(id, cancelled ? CANCELLED : (ok ? DONE : FAILED));
+        lock.lock();
+    }
+
+    // whatever is still queued will never run
+    while (!_queue.empty())
+    {
+        const int id = _queue.front();
+        _queue.pop_front();
+        lock.unlock();
+        finish(id, CANCELLED);
+        lock.lock();
+    }
+}
+
+void LensJobs::finish(const int id, const State state)
+{
+    DoneCallback callback;
+    {
+        ScopedLock lock(_mtex);
+        Job &job = _jobs[id];
+        job.state = state;
+        job.end_ms = monotonic_ms();
+        job.move = Move();
+        job.relative = RelativeMove();
+
+        // "focus_relative(500)" is counted as focus_relative
+        const std::string move = job.description.substr(0, job.description.find('('));
+        Metrics::registry().counter("dnncam_lens_moves_total", "Finished lens jobs, by move and outcome",
+                                    Metrics::label("move", move) + "," + Metrics::label("state", state_name(state)))->inc();
+        if (job.start_ms != 0)
+        {
+            static MetricHistogram *const duration = Metrics::registry().histogram(
+                "dnncam_lens_move_seconds", "Run time of lens jobs, not counting the time queued");
+            duration->observe_ns((job.end_ms - job.start_ms) * 1000000ULL);
+        }
+
+        _finished.push_back(id);
+        while (_finished.size() > MAX_FINISHED)
+        {
+            _jobs.erase(_finished.front());
+            _finished.pop_front();
+        }
+        callback = _done_callback;
+    }
+
+    if (callback)
+    {
+        callback();
+    }
+}
+
+const char *LensJobs::state_name(const State state)
+{
+    switch (state)
+    {
+        case QUEUED: return "queued";
+        case RUNNING: return "running";
+        case DONE: return "done";
+        case FAILED: return "failed";
+        case CANCELLED: return "cancelled";
+    }
+    return "unknown";
+}
+
+} // namespace BoulderAI
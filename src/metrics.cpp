@@ -0,0 +1,276 @@
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <boost/bind.hpp>
+
+#include "metrics.hpp"
+
+namespace BoulderAI
+{
+
+namespace
+{
+
+std::string format_value(const double value)
+{
+    std::ostringstream oss;
+    oss << std::setprecision(12) << value;
+    return oss.str();
+}
+
+// "{labels}", "{labels,extra}" or "" when both are empty
+std::string label_set(const std::string &labels, const std::string &extra = "")
+{
+    if (labels.empty() && extra.empty())
+    {
+        return "";
+    }
+    return "{" + labels + (labels.empty() || extra.empty() ? "" : ",") + extra + "}";
+}
+
+const char *type_name(const Metrics::Type type)
+{
+    switch (type)
+    {
+        case Metrics::COUNTER: return "counter";
+        case Metrics::GAUGE: return "gauge";
+        case Metrics::HISTOGRAM: return "histogram";
+    }
+    return "untyped";
+}
+
+} // anonymous namespace
+
+MetricHistogram::MetricHistogram(const std::vector < double > &bounds_s) :
+    _bounds_s(bounds_s),
+    _counts(new std::atomic < uint64_t >[bounds_s.size() + 1]),
+    _sum_ns(0)
+{
+    for (size_t i = 0; i < _bounds_s.size(); i++)
+    {
+        _bounds_ns.push_back((uint64_t)(_bounds_s[i] * 1e9));
+    }
+    for (size_t i = 0; i <= _bounds_s.size(); i++)
+    {
+        _counts[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+void MetricHistogram::observe_ns(const uint64_t ns)
+{
+    size_t bucket = 0;
+    while (bucket < _bounds_ns.size() && ns > _bounds_ns[bucket])
+    {
+        bucket++;
+    }
+    _counts[bucket].fetch_add(1, std::memory_order_relaxed);
+    _sum_ns.fetch_add(ns, std::memory_order_relaxed);
+}
+
+std::vector < uint64_t > MetricHistogram::get_counts() const
+{
+    std::vector < uint64_t > ret;
+    for (size_t i = 0; i <= _bounds_ns.size(); i++)
+    {
+        ret.push_back(_counts[i].load(std::memory_order_relaxed));
+    }
+    return ret;
+}
+
+Metrics::Metrics()
+{
+}
+
+Metrics &Metrics::registry()
+{
+    static Metrics metrics;
+    return metrics;
+}
+
+const std::vector < double > &Metrics::default_buckets()
+{
+    static const double bounds[] = {
+        0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10
+    };
+    static const std::vector < double > buckets(bounds, bounds + sizeof(bounds) / sizeof(bounds[0]));
+    return buckets;
+}
+
+std::string Metrics::label(const std::string &name, const std::string &value)
+{
+    std::string escaped;
+    for (size_t i = 0; i < value.size(); i++)
+    {
+        switch (value[i])
+        {
+            case '\\': escaped += "\\\\"; break;
+            case '"': escaped += "\\\""; break;
+            case '\n': escaped += "\\n"; break;
+            default: escaped += value[i]; break;
+        }
+    }
+    return name + "=\"" + escaped + "\"";
+}
+
+MetricCounter *Metrics::counter(const std::string &name, const std::string &help, const std::string &labels)
+{
+    ScopedLock lock(_mtex);
+    Series &series = get_series(get_family(name, help, COUNTER), labels);
+    if (!series.counter.get())
+    {
+        series.counter.reset(new MetricCounter());
+    }
+    return series.counter.get();
+}
+
+MetricGauge *Metrics::gauge(const std::string &name, const std::string &help, const std::string &labels)
+{
+    ScopedLock lock(_mtex);
+    Series &series = get_series(get_family(name, help, GAUGE), labels);
+    if (!series.gauge.get())
+    {
+        series.gauge.reset(new MetricGauge());
+    }
+    return series.gauge.get();
+}
+
+MetricHistogram *Metrics::histogram(const std::string &name, const std::string &help, const std::string &labels,
+                                    const std::vector < double > &bounds_s)
+{
+    ScopedLock lock(_mtex);
+    Series &series = get_series(get_family(name, help, HISTOGRAM), labels);
+    if (!series.histogram.get())
+    {
+        series.histogram.reset(new MetricHistogram(bounds_s));
+    }
+    return series.histogram.get();
+}
+
+void Metrics::add_collector(const std::string &name, const std::string &help, const Type type,
+                            const MetricCollector &collector)
+{
+    ScopedLock lock(_mtex);
+    get_family(name, help, type).collectors.push_back(collector);
+}
+
+Metrics::Family &Metrics::get_family(const std::string &name, const std::string &help, const Type type)
+{
+    for (std::list < Family >::iterator itr = _families.begin(); itr != _families.end(); ++itr)
+    {
+        if (itr->name == name)
+        {
+            if (itr->type != type)
+            {
+                throw std::runtime_error("Metric " + name + " registered with two types");
+            }
+            return *itr;
+        }
+    }
+
+    Family family;
+    family.name = name;
+    family.help = help;
+    family.type = type;
+    _families.push_back(family);
+    return _families.back();
+}
+
+Metrics::Series &Metrics::get_series(Family &family, const std::string &labels)
+{
+    for (std::list < Series >::iterator itr = family.series.begin(); itr != family.series.end(); ++itr)
+    {
+        if (itr->labels == labels)
+        {
+            return *itr;
+        }
+    }
+
+    Series series;
+    series.labels = labels;
+    family.series.push_back(series);
+    return family.series.back();
+}
+
+std::string Metrics::expose()
+{
+    // the registered metrics are formatted under the lock, the collectors may take locks of
+    // their own (and those holders may create metrics), so they run without it
+    std::vector < std::string > texts;
+    std::vector < std::string > names;
+    std::vector < std::vector < MetricCollector > > collectors;
+    {
+        ScopedLock lock(_mtex);
+        for (std::list < Family >::const_iterator family = _families.begin(); family != _families.end(); ++family)
+        {
+            std::ostringstream oss;
+            oss << "# HELP " << family->name << " " << family->help << "\n"
+                << "# TYPE " << family->name << " " << type_name(family->type) << "\n";
+            for (std::list < Series >::const_iterator series = family->series.begin(); series != family->series.end(); ++series)
+            {
+                if (series->counter.get())
+                {
+                    oss << family->name << label_set(series->labels) << " " << series->counter->get() << "\n";
+                }
+                else if (series->gauge.get())
+                {
+                    oss << family->name << label_set(series->labels) << " " << series->gauge->get() << "\n";
+                }
+                else if (series->histogram.get())
+                {
+                    // buckets are cumulative, and _count is taken from them so the two agree
+                    const std::vector < double > &bounds = series->histogram->get_bounds();
+                    const std::vector < uint64_t > counts = series->histogram->get_counts();
+                    const uint64_t sum_ns = series->histogram->get_sum_ns();
+                    uint64_t total = 0;
+                    for (size_t i = 0; i < counts.size(); i++)
+                    {
+                        total += counts[i];
+                        const std::string le = i < bounds.size() ? format_value(bounds[i]) : "+Inf";
+                        oss << family->name << "_bucket" << label_set(series->labels, label("le", le)) << " " << total << "\n";
+                    }
+                    oss << family->name << "_sum" << label_set(series->labels) << " " << format_value(sum_ns / 1e9) << "\n"
+                        << family->name << "_count" << label_set(series->labels) << " " << total << "\n";
+                }
+            }
+            texts.push_back(oss.str());
+            names.push_back(family->name);
+            collectors.push_back(family->collectors);
+        }
+    }
+
+    std::string ret;
+    for (size_t f = 0; f < texts.size(); f++)
+    {
+        ret += texts[f];
+        for (size_t c = 0; c < collectors[f].size(); c++)
+        {
+            std::vector < MetricSample > samples;
+            try
+            {
+                collectors[f][c](samples);
+            }
+            catch (const std::exception &e)
+            {
+                std::cout << "Metrics collector for " << names[f] << " failed: " << e.what() << std::endl;
+            }
+            for (size_t i = 0; i < samples.size(); i++)
+            {
+                ret += names[f] + label_set(samples[i].labels) + " " + format_value(samples[i].value) + "\n";
+            }
+        }
+    }
+    return ret;
+}
+
+void Metrics::register_handlers(HttpServer &server)
+{
+    server.add_handler("/metrics", boost::bind(&Metrics::serve_metrics, this, _1, _2));
+}
+
+bool Metrics::serve_metrics(const HttpRequest &, const int fd)
+{
+    return HttpServer::send_response(fd, 200, "text/plain; version=0.0.4; charset=utf-8", expose());
+}
+
+} // namespace BoulderAI
@@ -0,0 +1,560 @@
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <boost/bind.hpp>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "modbus_server.hpp"
+
+namespace BoulderAI
+{
+
+const char *ModbusServer::OPT_PORT = "modbus-port";
+
+const int ModbusServer::DEFAULT_PORT = 5020;
+
+int ModbusServer::_port = DEFAULT_PORT;
+
+// MBAP header: transaction id, protocol id (0), length of what follows, unit id
+static const size_t MBAP_SIZE = 7;
+static const size_t MAX_PDU_SIZE = 253;
+// a client that does not read its responses is dropped
+static const size_t MAX_OUT_BYTES = 64 * 1024;
+static const int MAX_EVENTS = 32;
+
+enum
+{
+    READ_HOLDING_REGISTERS = 0x03,
+    READ_INPUT_REGISTERS = 0x04,
+    WRITE_SINGLE_REGISTER = 0x06,
+    WRITE_MULTIPLE_REGISTERS = 0x10
+};
+
+enum
+{
+    ILLEGAL_FUNCTION = 0x01,
+    ILLEGAL_DATA_ADDRESS = 0x02,
+    ILLEGAL_DATA_VALUE = 0x03,
+    SERVER_DEVICE_FAILURE = 0x04,
+    SERVER_DEVICE_BUSY = 0x06
+};
+
+// the axis of each block of 10 registers, in the order of the old package/modbus.py
+static const char *const AXES[] = { "focus", "zoom", "iris" };
+static const int AXIS_BLOCKS = 3;
+static const int PRESET_BLOCK = 3;
+static const int CAMERA_BLOCK = 4;
+
+static uint16_t get_u16(const uint8_t *p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static void put_u16(std::string &s, const uint16_t value)
+{
+    s += (char)(value >> 8);
+    s += (char)(value & 0xff);
+}
+
+static uint16_t clamp_u16(const double value)
+{
+    return (uint16_t)std::min(std::max(value + 0.5, 0.0), 65535.0);
+}
+
+po::options_description ModbusServer::GetOptions()
+{
+    po::options_description desc( "Modbus Options" );
+    desc.add_options()
+        ( OPT_PORT, po::value<int>(&_port)->default_value(DEFAULT_PORT),
+          "Port of the Modbus TCP server for lens, preset and exposure registers. 0 disables it." )
+        ;
+    return desc;
+}
+
+ModbusServer::ModbusServer(DNNCamServerPtr server, DNNCamPtr camera, const int port) :
+    _server(server),
+    _camera(camera),
+    _jobs(server->get_lens_jobs()),
+    _listen_port(port),
+    _listen_fd(-1),
+    _epoll_fd(-1),
+    _running(false),
+    _pending_writes(0),
+    _write_worker(1, "Modbus Writes")
+{
+    _wake_pipe[0] = _wake_pipe[1] = -1;
+}
+
+ModbusServer::~ModbusServer()
+{
+    stop();
+}
+
+void ModbusServer::start()
+{
+    if (_thread_ptr.get() || _listen_port <= 0)
+    {
+        return;
+    }
+
+    _listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (_listen_fd < 0)
+    {
+        throw std::runtime_error("Unable to create the Modbus server socket.");
+    }
+    const int one = 1;
+    setsockopt(_listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(_listen_port);
+    if (bind(_listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(_listen_fd, 16) != 0)
+    {
+        close(_listen_fd);
+        _listen_fd = -1;
+        std::ostringstream oss;
+        oss << "Unable to listen on Modbus port " << _listen_port << ": " << strerror(errno);
+        throw std::runtime_error(oss.str());
+    }
+    if (pipe2(_wake_pipe, O_CLOEXEC | O_NONBLOCK) != 0)
+    {
+        throw std::runtime_error("Unable to create the Modbus server wake-up pipe.");
+    }
+    _epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (_epoll_fd < 0)
+    {
+        throw std::runtime_error("Unable to create the Modbus server epoll instance.");
+    }
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = _listen_fd;
+    epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _listen_fd, &ev);
+    ev.data.fd = _wake_pipe[0];
+    epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _wake_pipe[0], &ev);
+
+    std::cout << "Modbus server listening on port " << _listen_port << std::endl;
+    _write_worker.start();
+    _running = true;
+    _thread_ptr.reset(new boost::thread(boost::bind(&ModbusServer::run, this)));
+}
+
+void ModbusServer::stop()
+{
+    _running = false;
+    if (!_thread_ptr.get())
+    {
+        return;
+    }
+    const char c = 0;
+    if (write(_wake_pipe[1], &c, 1) < 0)
+    {
+        // the epoll timeout wakes the thread as well
+    }
+    _thread_ptr->join();
+    _thread_ptr.reset();
+    // writes that were answered are still made
+    _write_worker.wait();
+    _write_worker.stop();
+
+    close(_epoll_fd);
+    close(_listen_fd);
+    close(_wake_pipe[0]);
+    close(_wake_pipe[1]);
+    _epoll_fd = _listen_fd = -1;
+    _wake_pipe[0] = _wake_pipe[1] = -1;
+}
+
+void ModbusServer::run()
+{
+    struct epoll_event events[MAX_EVENTS];
+    while (_running)
+    {
+        const int count = epoll_wait(_epoll_fd, events, MAX_EVENTS, 500);
+        for (int i = 0; i < count; i++)
+        {
+            const int fd = events[i].data.fd;
+            if (fd == _wake_pipe[0])
+            {
+                char drain[64];
+                while (read(_wake_pipe[0], drain, sizeof(drain)) > 0)
+                {
+                }
+                continue;
+            }
+            if (fd == _listen_fd)
+            {
+                accept_connection();
+                continue;
+            }
+
+            std::map < int, Connection >::iterator itr = _connections.find(fd);
+            if (itr == _connections.end())
+            {
+                continue;
+            }
+            // a hang-up with data still to read is noticed by the read returning 0
+            bool ok = !(events[i].events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) || (events[i].events & EPOLLIN);
+            if (ok && (events[i].events & EPOLLIN))
+            {
+                ok = read_connection(fd, itr->second);
+            }
+            if (ok && (events[i].events & EPOLLOUT))
+            {
+                ok = flush_connection(fd, itr->second);
+            }
+            if (!ok)
+            {
+                close_connection(fd);
+            }
+        }
+    }
+
+    while (!_connections.empty())
+    {
+        close_connection(_connections.begin()->first);
+    }
+}
+
+void ModbusServer::accept_connection()
+{
+    while (true)
+    {
+        const int fd = accept4(_listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            return;
+        }
+        if (_connections.size() >= MAX_CONNECTIONS)
+        {
+            close(fd);
+            continue;
+        }
+        const int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.fd = fd;
+        if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0)
+        {
+            close(fd);
+            continue;
+        }
+        _connections[fd] = Connection();
+    }
+}
+
+bool ModbusServer::read_connection(const int fd, Connection &conn)
+{
+    char buffer[1024];
+    while (true)
+    {
+        const ssize_t got = recv(fd, buffer, sizeof(buffer), 0);
+        if (got == 0)
+        {
+            return false;
+        }
+        if (got < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                return false;
+            }
+            break;
+        }
+        conn.in.append(buffer, got);
+    }
+
+    // a PLC may pipeline requests, each is answered in order
+    size_t offset = 0;
+    while (conn.in.size() - offset >= MBAP_SIZE)
+    {
+        const uint8_t *mbap = (const uint8_t *)conn.in.data() + offset;
+        const size_t length = get_u16(mbap + 4);
+        if (get_u16(mbap + 2) != 0 || length < 2 || length > MAX_PDU_SIZE + 1)
+        {
+            return false;
+        }
+        if (conn.in.size() - offset < 6 + length)
+        {
+            break;
+        }
+
+        std::string response;
+        handle_request(mbap + MBAP_SIZE, length - 1, response);
+        conn.out.append((const char *)mbap, 4);
+        put_u16(conn.out, response.size() + 1);
+        conn.out += (char)mbap[6];
+        conn.out += response;
+        offset += 6 + length;
+    }
+    conn.in.erase(0, offset);
+
+    return flush_connection(fd, conn);
+}
+
+bool ModbusServer::flush_connection(const int fd, Connection &conn)
+{
+    while (!conn.out.empty())
+    {
+        const ssize_t sent = send(fd, conn.out.data(), conn.out.size(), MSG_NOSIGNAL);
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                return false;
+            }
+            break;
+        }
+        conn.out.erase(0, sent);
+    }
+    if (conn.out.size() > MAX_OUT_BYTES)
+    {
+        return false;
+    }
+
+    // only wait for the socket to drain while there is something left to send
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLRDHUP | (conn.out.empty() ? 0 : EPOLLOUT);
+    ev.data.fd = fd;
+    return epoll_ctl(_epoll_fd, EPOLL_CTL_MOD, fd, &ev) == 0;
+}
+
+void ModbusServer::close_connection(const int fd)
+{
+    epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    close(fd);
+    _connections.erase(fd);
+}
+
+void ModbusServer::handle_request(const uint8_t *pdu, const size_t size, std::string &response)
+{
+    const uint8_t function = pdu[0];
+    uint8_t exception = 0;
+    switch (function)
+    {
+    case READ_HOLDING_REGISTERS:
+    case READ_INPUT_REGISTERS:
+    {
+        const int start = size >= 5 ? get_u16(pdu + 1) : 0;
+        const int count = size >= 5 ? get_u16(pdu + 3) : 0;
+        if (size != 5 || count < 1 || count > 125)
+        {
+            exception = ILLEGAL_DATA_VALUE;
+            break;
+        }
+        if (start + count - 1 > MAX_ADDRESS)
+        {
+            exception = ILLEGAL_DATA_ADDRESS;
+            break;
+        }
+        response += (char)function;
+        response += (char)(count * 2);
+        for (int i = 0; i < count; i++)
+        {
+            put_u16(response, read_register(start + i));
+        }
+        return;
+    }
+    case WRITE_SINGLE_REGISTER:
+        if (size != 5)
+        {
+            exception = ILLEGAL_DATA_VALUE;
+            break;
+        }
+        exception = queue_writes(get_u16(pdu + 1), 1, pdu + 3);
+        if (!exception)
+        {
+            // the response echoes the request
+            response.assign((const char *)pdu, size);
+            return;
+        }
+        break;
+    case WRITE_MULTIPLE_REGISTERS:
+    {
+        const int start = size >= 6 ? get_u16(pdu + 1) : 0;
+        const int count = size >= 6 ? get_u16(pdu + 3) : 0;
+        if (size < 6 || count < 1 || count > 123 || pdu[5] != count * 2 || size != 6 + (size_t)count * 2)
+        {
+            exception = ILLEGAL_DATA_VALUE;
+            break;
+        }
+        exception = queue_writes(start, count, pdu + 6);
+        if (!exception)
+        {
+            response += (char)function;
+            put_u16(response, start);
+            put_u16(response, count);
+            return;
+        }
+        break;
+    }
+    default:
+        exception = ILLEGAL_FUNCTION;
+        break;
+    }
+
+    response.clear();
+    response += (char)(function | 0x80);
+    response += (char)exception;
+}
+
+uint16_t ModbusServer::read_register(const int address)
+{
+    const int block = address / 10;
+    const int reg = address % 10;
+    if (block < AXIS_BLOCKS && reg == 3)
+    {
+        // live positions, updated by the motor thread as it steps
+        const int location = block == 0 ? _camera->get_focus_location() :
+                             block == 1 ? _camera->get_zoom_location() : _camera->get_iris_location();
+        return (uint16_t)location;
+    }
+    if (block == PRESET_BLOCK && reg == 2)
+    {
+        // a write that will queue a lens job counts before the job exists
+        return (_pending_writes > 0 || _jobs->is_busy()) ? 1 : 0;
+    }
+    if (block == CAMERA_BLOCK && reg <= 2)
+    {
+        const ExposureStats stats = _camera->get_exposure_stats();
+        if (!stats.valid)
+        {
+            return 0;
+        }
+        switch (reg)
+        {
+        case 0:
+            return clamp_u16(stats.scene_lux);
+        case 1:
+            return clamp_u16(stats.analog_gain * stats.digital_gain * 100.0);
+        default:
+            return clamp_u16(stats.exposure_ns / 1000.0);
+        }
+    }
+    // write-only and unused registers
+    return 0;
+}
+
+bool ModbusServer::write_call(const int address, const uint16_t value, std::string &method, xmlrpc_c::paramList &params)
+{
+    const int block = address / 10;
+    const int reg = address % 10;
+    if (address > MAX_ADDRESS)
+    {
+        return false;
+    }
+    if (block < AXIS_BLOCKS && reg <= 2)
+    {
+        const std::string axis(AXES[block]);
+        switch (reg)
+        {
+        case 0:
+            method = axis + "_home";
+            break;
+        case 1:
+            method = axis + "_absolute";
+            params.add(xmlrpc_c::value_int(value));
+            break;
+        default:
+            // relative moves go either way
+            method = axis + "_relative";
+            params.add(xmlrpc_c::value_int((int16_t)value));
+            break;
+        }
+        return true;
+    }
+    if (block == PRESET_BLOCK && reg <= 1)
+    {
+        std::ostringstream name;
+        name << value;
+        params.add(xmlrpc_c::value_string(name.str()));
+        if (reg == 0)
+        {
+            method = "recall_preset";
+            return true;
+        }
+        method = "store_preset";
+        params.add(xmlrpc_c::value_boolean(true));
+        return true;
+    }
+    return false;
+}
+
+uint8_t ModbusServer::queue_writes(const int start, const int count, const uint8_t *values)
+{
+    std::vector < std::string > methods(count);
+    std::vector < xmlrpc_c::paramList > params(count);
+    for (int i = 0; i < count; i++)
+    {
+        if (!write_call(start + i, get_u16(values + i * 2), methods[i], params[i]))
+        {
+            return ILLEGAL_DATA_ADDRESS;
+        }
+    }
+    // only this thread adds writes, so the room cannot shrink before they are queued
+    if (_pending_writes + count > MAX_QUEUED_WRITES)
+    {
+        return SERVER_DEVICE_BUSY;
+    }
+
+    _pending_writes += count;
+    for (int i = 0; i < count; i++)
+    {
+        _write_worker.add_job(boost::bind(&ModbusServer::run_write, this, methods[i], params[i]));
+    }
+    return 0;
+}
+
+void ModbusServer::run_write(const std::string &method, xmlrpc_c::paramList const &params)
+{
+    call(method, params);
+    _pending_writes--;
+}
+
+bool ModbusServer::call(const std::string &method, xmlrpc_c::paramList const &params)
+{
+    try
+    {
+        xmlrpc_c::value result;
+        if (_server->call(method, params, &result))
+        {
+            return true;
+        }
+        std::cout << "Modbus " << method << " failed: no such method" << std::endl;
+    }
+    catch (const xmlrpc_c::fault &f)
+    {
+        // e.g. an unknown preset
+        std::cout << "Modbus " << method << " failed: " << f.getDescription() << std::endl;
+    }
+    catch (const std::exception &e)
+    {
+        std::cout << "Modbus " << method << " failed: " << e.what() << std::endl;
+    }
+    return false;
+}
+
+} // namespace BoulderAI
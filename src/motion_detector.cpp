@@ -0,0 +1,295 @@
+#include <algorithm>
+#include <cstdlib>
+
+#include "motion_detector.hpp"
+
+#if (defined(__ARM_NEON) || defined(__ARM_NEON__)) && defined(__aarch64__)
+#include <arm_neon.h>
+#define MOTION_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define MOTION_SSE2 1
+#endif
+
+namespace BoulderAI
+{
+
+const char *MotionDetector::OPT_CAPTURE_MODE = "capture-mode";
+const char *MotionDetector::OPT_SENSITIVITY = "motion-sensitivity";
+const char *MotionDetector::OPT_MIN_BLOCKS = "motion-min-blocks";
+const char *MotionDetector::OPT_TRIGGER_FRAMES = "motion-trigger-frames";
+const char *MotionDetector::OPT_MIN_EVENT_S = "motion-min-event-s";
+const char *MotionDetector::OPT_COOLDOWN_S = "motion-cooldown-s";
+
+const std::string MotionDetector::DEFAULT_CAPTURE_MODE = "off";
+const int MotionDetector::DEFAULT_SENSITIVITY = 50;
+const int MotionDetector::DEFAULT_MIN_BLOCKS = 2;
+const int MotionDetector::DEFAULT_TRIGGER_FRAMES = 3;
+const double MotionDetector::DEFAULT_MIN_EVENT_S = 5.0;
+const double MotionDetector::DEFAULT_COOLDOWN_S = 10.0;
+
+std::string MotionDetector::_capture_mode = DEFAULT_CAPTURE_MODE;
+int MotionDetector::_sensitivity = DEFAULT_SENSITIVITY;
+int MotionDetector::_min_blocks = DEFAULT_MIN_BLOCKS;
+int MotionDetector::_trigger_frames = DEFAULT_TRIGGER_FRAMES;
+double MotionDetector::_min_event_s = DEFAULT_MIN_EVENT_S;
+double MotionDetector::_cooldown_s = DEFAULT_COOLDOWN_S;
+
+// the reference follows the frames with this weight, as a shift: 1/16
+static const int REFERENCE_SHIFT = 4;
+// more of the image than this changing at once is a global change, not motion
+static const int GLOBAL_CHANGE_PERCENT = 75;
+
+po::options_description MotionDetector::GetOptions()
+{
+    po::options_description desc( "Motion Options" );
+    desc.add_options()
+        ( OPT_CAPTURE_MODE, po::value<std::string>(&_capture_mode)->default_value(DEFAULT_CAPTURE_MODE),
+          "Recording at startup: off, on, or auto to record while there is motion." )
+        ( OPT_SENSITIVITY, po::value<int>(&_sensitivity)->default_value(DEFAULT_SENSITIVITY),
+          "Motion sensitivity from 0 to 100; higher values count smaller changes as motion." )
+        ( OPT_MIN_BLOCKS, po::value<int>(&_min_blocks)->default_value(DEFAULT_MIN_BLOCKS),
+          "Changed blocks (of 128x128 pixels at 4K) that make a frame count as motion." )
+        ( OPT_TRIGGER_FRAMES, po::value<int>(&_trigger_frames)->default_value(DEFAULT_TRIGGER_FRAMES),
+          "Consecutive frames with motion that start an event." )
+        ( OPT_MIN_EVENT_S, po::value<double>(&_min_event_s)->default_value(DEFAULT_MIN_EVENT_S),
+          "Minimum length of a motion event in seconds." )
+        ( OPT_COOLDOWN_S, po::value<double>(&_cooldown_s)->default_value(DEFAULT_COOLDOWN_S),
+          "Seconds without motion that end a motion event." )
+        ;
+    return desc;
+}
+
+namespace
+{
+
+#if defined(MOTION_NEON)
+
+// 64 source bytes to 8 rounded means of 8
+int downscale_row_neon(const uint8_t *src, uint8_t *dst, const int dst_w)
+{
+    int x = 0;
+    for (; x + 8 <= dst_w; x += 8)
+    {
+        const uint8_t *p = src + x * 8;
+        const uint16x8_t s0 = vpaddq_u16(vpaddlq_u8(vld1q_u8(p)), vpaddlq_u8(vld1q_u8(p + 16)));
+        const uint16x8_t s1 = vpaddq_u16(vpaddlq_u8(vld1q_u8(p + 32)), vpaddlq_u8(vld1q_u8(p + 48)));
+        vst1_u8(dst + x, vrshrn_n_u16(vpaddq_u16(s0, s1), 3));
+    }
+    return x;
+}
+
+void block_sad_row_neon(const uint8_t *a, const uint8_t *b, uint32_t *sums, const int blocks)
+{
+    for (int i = 0; i < blocks; i++)
+    {
+        sums[i] += vaddlvq_u8(vabdq_u8(vld1q_u8(a + i * 16), vld1q_u8(b + i * 16)));
+    }
+}
+
+#elif defined(MOTION_SSE2)
+
+// 64 source bytes to 8 rounded means of 8
+int downscale_row_sse2(const uint8_t *src, uint8_t *dst, const int dst_w)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i round = _mm_set1_epi16(4);
+    int x = 0;
+    for (; x + 8 <= dst_w; x += 8)
+    {
+        const uint8_t *p = src + x * 8;
+        // each SAD against zero leaves the sums of both 8 byte halves in the low 16 bits of their 64 bit lane
+        const __m128i s0 = _mm_sad_epu8(_mm_loadu_si128((const __m128i *)p), zero);
+        const __m128i s1 = _mm_sad_epu8(_mm_loadu_si128((const __m128i *)(p + 16)), zero);
+        const __m128i s2 = _mm_sad_epu8(_mm_loadu_si128((const __m128i *)(p + 32)), zero);
+        const __m128i s3 = _mm_sad_epu8(_mm_loadu_si128((const __m128i *)(p + 48)), zero);
+        const __m128i sums = _mm_packs_epi32(_mm_packs_epi32(s0, s1), _mm_packs_epi32(s2, s3));
+        const __m128i means = _mm_srli_epi16(_mm_add_epi16(sums, round), 3);
+        _mm_storel_epi64((__m128i *)(dst + x), _mm_packus_epi16(means, zero));
+    }
+    return x;
+}
+
+void block_sad_row_sse2(const uint8_t *a, const uint8_t *b, uint32_t *sums, const int blocks)
+{
+    for (int i = 0; i < blocks; i++)
+    {
+        const __m128i sad = _mm_sad_epu8(_mm_loadu_si128((const __m128i *)(a + i * 16)),
+                                         _mm_loadu_si128((const __m128i *)(b + i * 16)));
+        sums[i] += _mm_cvtsi128_si32(sad) + _mm_extract_epi16(sad, 4);
+    }
+}
+
+#endif
+
+} // namespace
+
+void MotionDetector::downscale_row_c(const uint8_t *src, uint8_t *dst, const int dst_w)
+{
+    for (int x = 0; x < dst_w; x++)
+    {
+        int sum = 0;
+        for (int i = 0; i < DECIMATION; i++)
+        {
+            sum += src[x * DECIMATION + i];
+        }
+        dst[x] = (uint8_t)((sum + DECIMATION / 2) / DECIMATION);
+    }
+}
+
+void MotionDetector::downscale_row(const uint8_t *src, uint8_t *dst, const int dst_w)
+{
+#if defined(MOTION_NEON)
+    const int done = downscale_row_neon(src, dst, dst_w);
+#elif defined(MOTION_SSE2)
+    const int done = downscale_row_sse2(src, dst, dst_w);
+#else
+    const int done = 0;
+#endif
+    downscale_row_c(src + done * DECIMATION, dst + done, dst_w - done);
+}
+
+void MotionDetector::block_sad_row_c(const uint8_t *a, const uint8_t *b, uint32_t *sums, const int blocks)
+{
+    for (int i = 0; i < blocks; i++)
+    {
+        uint32_t sad = 0;
+        for (int j = 0; j < BLOCK; j++)
+        {
+            sad += abs(a[i * BLOCK + j] - b[i * BLOCK + j]);
+        }
+        sums[i] += sad;
+    }
+}
+
+void MotionDetector::block_sad_row(const uint8_t *a, const uint8_t *b, uint32_t *sums, const int blocks)
+{
+#if defined(MOTION_NEON)
+    block_sad_row_neon(a, b, sums, blocks);
+#elif defined(MOTION_SSE2)
+    block_sad_row_sse2(a, b, sums, blocks);
+#else
+    block_sad_row_c(a, b, sums, blocks);
+#endif
+}
+
+const char *MotionDetector::simd_name()
+{
+#if defined(MOTION_NEON)
+    return "NEON";
+#elif defined(MOTION_SSE2)
+    return "SSE2";
+#else
+    return "none";
+#endif
+}
+
+MotionDetector::MotionDetector() :
+    _threshold(0),
+    _motion_blocks(1),
+    _width(0),
+    _height(0),
+    _have_reference(false)
+{
+    set_sensitivity(_sensitivity);
+    set_min_blocks(_min_blocks);
+}
+
+void MotionDetector::set_sensitivity(const int sensitivity)
+{
+    // a mean difference of 27 levels at 0 down to 2 at 100
+    const int s = std::min(std::max(sensitivity, 0), 100);
+    _threshold = (2 * 4 + (100 - s)) * BLOCK * BLOCK / 4;
+}
+
+void MotionDetector::set_min_blocks(const int min_blocks)
+{
+    _motion_blocks = std::max(min_blocks, 1);
+}
+
+void MotionDetector::reset()
+{
+    _have_reference = false;
+}
+
+bool MotionDetector::process(const uint8_t *y, const int stride, const int width, const int height, MotionStatus &status)
+{
+    const int w = width / DECIMATION;
+    const int h = height / DECIMATION;
+    const int blocks_x = w / BLOCK;
+    const int blocks_y = h / BLOCK;
+    status.moving_blocks = 0;
+    status.blocks = blocks_x * blocks_y;
+    status.motion = false;
+    if (status.blocks == 0)
+    {
+        return false;
+    }
+    if (w != _width || h != _height)
+    {
+        _width = w;
+        _height = h;
+        _small.resize(w * h);
+        _reference.resize(w * h);
+        _reference8.resize(w * h);
+        _sums.resize(blocks_x);
+        _have_reference = false;
+    }
+
+    // the middle row of each band stands for the band
+    for (int row = 0; row < h; row++)
+    {
+        downscale_row(y + (size_t)(row * DECIMATION + DECIMATION / 2) * stride, &_small[row * w], w);
+    }
+
+    if (!_have_reference)
+    {
+        for (int i = 0; i < w * h; i++)
+        {
+            _reference[i] = _small[i] << 8;
+            _reference8[i] = _small[i];
+        }
+        _have_reference = true;
+        return false;
+    }
+
+    for (int by = 0; by < blocks_y; by++)
+    {
+        std::fill(_sums.begin(), _sums.end(), 0);
+        for (int row = by * BLOCK; row < (by + 1) * BLOCK; row++)
+        {
+            block_sad_row(&_small[row * w], &_reference8[row * w], _sums.data(), blocks_x);
+        }
+        for (int bx = 0; bx < blocks_x; bx++)
+        {
+            if (_sums[bx] > (uint32_t)_threshold)
+            {
+                status.moving_blocks++;
+            }
+        }
+    }
+
+    if (status.moving_blocks * 100 > status.blocks * GLOBAL_CHANGE_PERCENT)
+    {
+        // the scene itself changed; compare the next frames with the new one
+        status.moving_blocks = 0;
+        _have_reference = false;
+        return true;
+    }
+    status.motion = status.moving_blocks >= _motion_blocks;
+    update_reference();
+    return true;
+}
+
+void MotionDetector::update_reference()
+{
+    const int n = _width * _height;
+    for (int i = 0; i < n; i++)
+    {
+        const int ref = _reference[i];
+        _reference[i] = (uint16_t)(ref + (((_small[i] << 8) - ref) >> REFERENCE_SHIFT));
+        _reference8[i] = (uint8_t)((_reference[i] + 128) >> 8);
+    }
+}
+
+} // namespace BoulderAI
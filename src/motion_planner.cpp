@@ -0,0 +1,27 @@
+#include <algorithm>
+#include <cmath>
+
+#include "motion_planner.hpp"
+
+namespace BoulderAI
+{
+
+std::vector < uint32_t > plan_steps(const MotionProfile &profile, const int steps)
+{
+    // at least one step per second keeps every interval within 32 bits
+    const double start_speed = std::max(profile.start_speed, 1.0);
+    const double max_speed = std::max(profile.max_speed, start_speed);
+    const double accel = std::max(profile.acceleration, 0.0);
+
+    std::vector < uint32_t > intervals(std::max(steps, 0));
+    for (int i = 0; i < steps; i++)
+    {
+        // v^2 = v0^2 + 2as, counted from whichever end of the move is closer
+        const int from_end = std::min(i, steps - 1 - i);
+        const double speed = std::min(max_speed, std::sqrt(start_speed * start_speed + 2.0 * accel * from_end));
+        intervals[i] = (uint32_t)(1e9 / speed);
+    }
+    return intervals;
+}
+
+} // namespace BoulderAI
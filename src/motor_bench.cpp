@@ -0,0 +1,116 @@
+/**
+ * Runs MotorDriver against the simulated lens board and reports, for each move, the time it
+ * took, the I2C transfers and bus time it needed, and whether the simulated motors ended up
+ * where MotorDriver thinks they are.
+ *
+ * usage: motor_bench [bus clock in kHz]
+ */
+
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/function.hpp>
+
+#include "motordriver.hpp"
+#include "configuration.hpp"
+#include "i2c_sim.hpp"
+
+using namespace BoulderAI;
+
+namespace pt = boost::posix_time;
+
+static void quiet_log_handler(std::string)
+{
+}
+
+struct Positions
+{
+    int zoom;
+    int focus;
+    int iris;
+};
+
+static Positions motor_positions(SimulatedI2cBus &bus)
+{
+    const Positions positions = { bus.get_position("zoom"), bus.get_position("focus"), bus.get_position("iris") };
+    return positions;
+}
+
+static Positions driver_positions(MotorDriver &motor)
+{
+    const Positions positions = { motor.zoomAbsoluteLocation(), motor.focusAbsoluteLocation(), motor.irisAbsoluteLocation() };
+    return positions;
+}
+
+static bool report(const std::string &name, SimulatedI2cBus &bus, const boost::function < bool() > &move,
+                   const boost::function < bool() > &check)
+{
+    bus.reset_stats();
+    const pt::ptime start = pt::microsec_clock::universal_time();
+    const bool ok = move();
+    const double seconds = (pt::microsec_clock::universal_time() - start).total_microseconds() / 1e6;
+    const I2cSimStats stats = bus.get_stats();
+    const bool exact = ok && stats.missed_steps == 0 && check();
+
+    std::cout << std::left << std::setw(24) << name << std::right << std::fixed << std::setprecision(3)
+              << std::setw(8) << seconds << " s" << std::setw(8) << stats.transfers << " xfers"
+              << std::setw(9) << std::setprecision(1) << stats.bus_ns / 1e6 << " ms bus"
+              << std::setw(7) << 100.0 * stats.bus_ns / 1e9 / seconds << " %  "
+              << (exact ? "exact" : "MISMATCH") << std::endl;
+    return exact;
+}
+
+// a relative move: the motors moved by the given steps and MotorDriver followed them
+static bool relative(MotorDriver &motor, SimulatedI2cBus &bus, const std::string &name, const int zoom, const int focus, const int iris)
+{
+    const Positions before = motor_positions(bus);
+    const Positions before_driver = driver_positions(motor);
+    const LensSteps steps = { zoom, focus, iris };
+    return report(name, bus,
+                  [&] { return motor.move(steps); },
+                  [&] {
+                      const Positions after = motor_positions(bus);
+                      const Positions after_driver = driver_positions(motor);
+                      return after.zoom - before.zoom == zoom && after.focus - before.focus == focus && after.iris - before.iris == iris &&
+                          after_driver.zoom - before_driver.zoom == zoom && after_driver.focus - before_driver.focus == focus &&
+                          after_driver.iris - before_driver.iris == iris;
+                  });
+}
+
+int main(int argc, char **argv)
+{
+    const double clock_hz = argc > 1 ? atof(argv[1]) * 1000 : 400000;
+
+    SimulatedI2cBusPtr bus(new SimulatedI2cBus(clock_hz));
+    MotorDriver motor(true, quiet_log_handler, bus);
+    std::cout << "bus clock " << clock_hz / 1000 << " kHz" << std::endl;
+
+    bool exact = true;
+    // the motors start at 0 and stay well inside their travel
+    exact &= relative(motor, *bus, "zoom +7000", 7000, 0, 0);
+    exact &= relative(motor, *bus, "focus +7000", 0, 7000, 0);
+    exact &= relative(motor, *bus, "iris +100", 0, 0, 100);
+    exact &= relative(motor, *bus, "zoom/focus -4000/-3000", -4000, -3000, 0);
+    exact &= relative(motor, *bus, "all -3000/-4000/-100", -3000, -4000, -100);
+
+    // homing steps towards the limit switch, here 500 steps away, and stops within a step size
+    const int limit = bus->get_position("zoom") + 500;
+    bus->set_travel("zoom", -10000, 10000, limit);
+    exact &= report("zoom home", *bus,
+                    [&] { return motor.zoomHome(); },
+                    [&] {
+                        const int position = bus->get_position("zoom");
+                        return position >= limit && position < limit + Configuration::zoom_home_step_size() &&
+                            motor.zoomAbsoluteLocation() == 0;
+                    });
+    const int home = bus->get_position("zoom");
+    exact &= report("zoom absolute 2000", *bus,
+                    [&] { return motor.zoomAbsolute(2000); },
+                    [&] {
+                        return bus->get_position("zoom") == home + 2000 && motor.zoomAbsoluteLocation() == 2000;
+                    });
+
+    return exact ? 0 : 1;
+}
@@ -1,125 +1,48 @@
 // System includes
+#include <errno.h>
+#include <time.h>
 #include <unistd.h>
-#include <sys/ioctl.h>
-#include <sys/stat.h>
-#include <fcntl.h>
-#include <linux/i2c-dev.h>
-#include <chrono>
-#include <thread>
+#include <algorithm>
 #include <iostream>
 #include <iomanip>
+#include <limits>
+#include <vector>
 
 #include "motordriver.hpp"
 #include "configuration.hpp"
+#include "async_log.hpp"
+#include "lens_pins.hpp"
 
 using namespace std;
 
 namespace BoulderAI
 {
 
-// Addresses of the chips on the I2C bus
-int MotorDriver::addr1 = 0x20;  //U4 (Zoom, focus)
-int MotorDriver::addr2 = 0x21;  //U5 (Power on mainboard)
-int MotorDriver::addr0 = 0x22;  //U7 (Iris/Ircut)
-
-#define STEPPER_SLEEP_TIME_MS 1
-
-#define ZOOM_LIMIT      0x01 //pin U5.A.0
-#define ZOOM_DIR        0x02 //pin U5.A.1
-#define ZOOM_ENABLE     0x04 //pin U5.A.2
-#define ZOOM_STEP       0x08 //pin U5.A.3
-#define ZOOM_FAULT      0x10 //pin U5.A.4
-#define ZOOM_MS2        0X20 //pin U5.A.5
-#define ZOOM_MS1	0x40 //pin U5.A.6
-#define ZOOM_SLEEP	0x80 //pin U5.A.7
-#define ZOOM_AENBL 	ZOOM_ENABLE
-#define ZOOM_BENBL 	ZOOM_STEP
-#define ZOOM_APHASE 	ZOOM_MS1
-#define ZOOM_BPHASE	ZOOM_DIR
-#define ZOOM_EN1	ZOOM_MS2
-
-#define FOCUS_LIMIT     0x01 //pin U5.B.0
-#define FOCUS_DIR       0x02 //pin U5.B.1
-#define FOCUS_ENABLE    0x04 //pin U5.B.2
-#define FOCUS_STEP      0x08 //pin U5.B.3
-#define FOCUS_FAULT     0x10 //pin U5.B.4
-#define FOCUS_MS2       0X20 //pin U5.B.5
-#define FOCUS_MS1       0x40 //pin U5.B.6
-#define FOCUS_SLEEP     0x80 //pin U5.B.7
-#define FOCUS_AENBL      FOCUS_ENABLE
-#define FOCUS_BENBL      FOCUS_STEP
-#define FOCUS_APHASE     FOCUS_MS1
-#define FOCUS_BPHASE     FOCUS_DIR
-#define FOCUS_EN1        FOCUS_MS2
-
-#define PG		0x01 //pin U6.A.0
-#define IRIS_DIR        0x02 //pin U6.A.1
-#define IRIS_ENABLE     0x04 //pin U6.A.2
-#define IRIS_STEP       0x08 //pin U6.A.3
-#define IRIS_FAULT      0x10 //pin U6.A.4
-#define IRIS_MS2        0X20 //pin U6.A.5
-#define IRIS_MS1        0x40 //pin U6.A.6
-#define IRIS_SLEEP      0x80 //pin U6.A.7
-#define IRIS_AENBL      IRIS_ENABLE
-#define IRIS_BENBL      IRIS_STEP
-#define IRIS_APHASE     IRIS_MS1
-#define IRIS_BPHASE     IRIS_DIR
-#define IRIS_EN1        IRIS_MS2
-
-
-#define POWER_5V_EN_LDO    0x02 //pin U5.A.1
-#define PGOOD		   0x01 //pin U5.A.0
-#define POWER_4V_EN        0x80 //pin U5.B.7
-#define POWER_2_8V_EN      0x40 //pion U5.B.6
-#define POWER_1_8V_EN      0x20 //pin U5.B.5
-#define POWER_1_2V_EN      0x10 //pin U5.B.4
-#define POWER_5V_EN        0x08 //pin U5.B.3
-#define PG_4V		   0x04 //pin U5.B.2
-#define POWER_3_3V_EN      0x02 //pin U5.B.1
-#define PG_3_3V	           0x01 //pin U5.B.0
-
-
-#define IRCUT_A		   0x02 //pin U6.B.1
-#define IRCUT_B		   0x01 //pin U6.B.0
-
-#define REG_IOCON 0x0A
-#define REG_IODIRA 0x00
-#define REG_IODIRB 0x01
-#define REG_GPPUA 0x0C
-#define REG_GPPUB 0x0D
-#define REG_GPIOA 0x12
-#define REG_GPIOB 0x13
-
-#define REG_IOCON_VAL 0x00
-// Output direction is value 0
-#define REG_IODIRA_EXP1 0x11 //Fault, Pgood
-#define REG_IODIRB_EXP1 0x11 //Fault, Pgood
-#define REG_IODIRA_EXP0 0x00  
-#define REG_IODIRB_EXP0 0xE0 //Board ID
-#define REG_IODIRA_EXP2 0x01 //PGood, all others output
-#define REG_IODIRB_EXP2 (0x01 + 0x04) // U5.B.0,3 are input, all others output
-#define REG_GPPUA_VAL 0x00 // disable all pull-ups
-#define REG_GPPUB_VAL 0x00
-#define REG_GPIOA_EXP1 (ZOOM_SLEEP ) // wake up on init
-#define REG_GPIOB_EXP1 (FOCUS_SLEEP)
-#define REG_GPIOA_EXP2 0x00
-#define REG_GPIOB_EXP2 (POWER_1_8V_EN) //keep 1.8V on so level translator will work.
-#define REG_GPIOA_EXP0 (IRIS_SLEEP ) // wake up on init
-#define REG_GPIOB_EXP0 0x00
+int MotorDriver::addr1 = EXP1_ADDR;
+int MotorDriver::addr2 = EXP2_ADDR;
+int MotorDriver::addr0 = EXP0_ADDR;
 
+// bits of the axes in the position journal
+#define ZOOM_AXIS  0
+#define FOCUS_AXIS 1
+#define IRIS_AXIS  2
 
 #define DO_WRITE(addr,reg,data)   \
     {if (false == writeReg(addr,reg,data)) { ostringstream oss; oss << "Write failed for addr: " << hex << addr << " reg: " << hex << reg << dec; _log_callback(oss.str()); return false;}}
 
-    MotorDriver::MotorDriver(bool doInit, boost::function < void(std::string) > log_callback)
+    MotorDriver::MotorDriver(bool doInit, boost::function < void(std::string) > log_callback, I2cBusPtr bus)
         :
-        fd_(-1),
+        _bus(bus),
         zoom_init(false),
         zoom_abs_location(-1),
         focus_init(false),
         focus_abs_location(-1),
         iris_init(false),
         iris_abs_location(-1),
+        _cancel(false),
+        _journal_written(false),
+        _journal_synced(false),
+        _journal_known(0),
         _log_callback(log_callback)
 {
     if (true == doInit) {
@@ -146,64 +69,341 @@ int MotorDriver::addr0 = 0x22;  //U7 (Iris/Ircut)
 }
 
 MotorDriver::~MotorDriver()
-{}
+{
+    _journal.close();
+}
 
 bool MotorDriver::init()
 {
-    _log_callback("Initializing i2c device");
-    std::string devicename("/dev/i2c-6");
-    if ((fd_ = open(devicename.c_str(), O_RDWR)) < 0) {
-        ostringstream oss;
-        oss << "Unable to open device: " << devicename;
-        _log_callback(oss.str());
-        return false;
+    // only the lens on the real bus has its positions journaled, never a simulated one
+    const bool journal = !_bus;
+    if (!_bus) {
+        _log_callback("Initializing i2c device");
+        std::shared_ptr < LinuxI2cBus > bus(new LinuxI2cBus("/dev/i2c-6"));
+        std::string error;
+        if (!bus->open(error)) {
+            _log_callback(error);
+            return false;
+        }
+        _log_callback(bus->supports_rdwr() ? "Supports I2C_RDWR" : "Does not support I2C_RDWR");
+        _bus = bus;
     }
-    uint64_t funcs;
-    if (ioctl(fd_, I2C_FUNCS, &funcs) < 0) {
-        _log_callback("Unable to get I2C_FUNCS");
+    if (!initExpanders()) {
         return false;
     }
-    if (funcs & I2C_FUNC_I2C) {
-        _log_callback("Supports I2C_RDWR");
-    } else if (funcs & I2C_FUNC_SMBUS_WORD_DATA) {
-        _log_callback("Does not support I2C_RDWR");
-    } else {
-        _log_callback("Unable to get valid FUNC");
-        return false;
+    if (journal) {
+        restorePositions();
     }
-    return initExpanders();
+    return true;
 }
 
-bool MotorDriver::writeReg(uint8_t addr, uint8_t regaddr, uint8_t data)
+void MotorDriver::restorePositions()
 {
+    const std::string path = Configuration::position_journal();
+    if (path.empty() || !_journal.open(path)) {
+        return;
+    }
+    int positions[PositionJournal::AXES];
+    unsigned known = 0;
+    if (!_journal.restore(positions, known)) {
+        _log_callback("No lens positions journaled yet, the axes have to be homed");
+        return;
+    }
+
+    if (known & (1 << ZOOM_AXIS)) {
+        zoom_abs_location = positions[ZOOM_AXIS];
+        zoom_init = true;
+    }
+    if (known & (1 << FOCUS_AXIS)) {
+        focus_abs_location = positions[FOCUS_AXIS];
+        focus_init = true;
+    }
+    if (known & (1 << IRIS_AXIS)) {
+        iris_abs_location = positions[IRIS_AXIS];
+        iris_init = true;
+    }
+
+    // a limit switch that disagrees with the journal means the lens was moved behind our back
+    if (zoom_init && Configuration::zoom_has_limit()) {
+        const bool at_limit = zoomLimit();
+        if (at_limit != (zoom_abs_location <= Configuration::zoom_home_step_size())) {
+            _log_callback("Zoom limit switch does not match the journaled zoom position, zoom has to be homed");
+            zoom_init = false;
+            zoom_abs_location = -1;
+        }
+    }
+    if (focus_init && Configuration::focus_has_limit()) {
+        const bool at_limit = focusLimit();
+        if (at_limit != (focus_abs_location <= Configuration::focus_home_step_size())) {
+            _log_callback("Focus limit switch does not match the journaled focus position, focus has to be homed");
+            focus_init = false;
+            focus_abs_location = -1;
+        }
+    }
+
     ostringstream oss;
-    oss << ": 0x" << hex << std::setw(2) << std::setfill('0') << (unsigned)addr << " reg 0x" << std::setw(2) << std::setfill('0') << (unsigned)regaddr << " val 0x" << std::setw(2) << std::setfill('0') << (unsigned)data << dec;
+    oss << "Restored lens positions: zoom " << (zoom_init ? zoom_abs_location.load() : -1)
+        << " focus " << (focus_init ? focus_abs_location.load() : -1)
+        << " iris " << (iris_init ? iris_abs_location.load() : -1);
     _log_callback(oss.str());
-    if (ioctl(fd_, I2C_SLAVE, addr) < 0) {
-        ostringstream oss;
-        oss << "Unable to access slave: " << addr;
-        _log_callback(oss.str());
-        return false;
+    journalPositions(0, true);
+}
+
+void MotorDriver::journalPositions(const unsigned moving, const bool sync)
+{
+    if (!_journal.is_open()) {
+        return;
+    }
+    const int positions[PositionJournal::AXES] = { zoom_abs_location, focus_abs_location, iris_abs_location };
+    unsigned known = 0;
+    if (zoom_init) {
+        known |= 1 << ZOOM_AXIS;
+    }
+    if (focus_init) {
+        known |= 1 << FOCUS_AXIS;
+    }
+    if (iris_init) {
+        known |= 1 << IRIS_AXIS;
+    }
+    known &= ~moving;
+
+    // the positions of unknown axes are not part of the state
+    bool same = _journal_written && known == _journal_known;
+    for (int a = 0; same && a < PositionJournal::AXES; ++a) {
+        same = !(known & (1 << a)) || positions[a] == _journal_positions[a];
+    }
+    if (same) {
+        if (sync && !_journal_synced) {
+            _journal.sync();
+            _journal_synced = true;
+        }
+        return;
+    }
+
+    _journal.write(positions, known, sync);
+    _journal_written = true;
+    _journal_synced = sync;
+    _journal_known = known;
+    std::copy(positions, positions + PositionJournal::AXES, _journal_positions);
+}
+
+bool MotorDriver::writeMessages(const I2cWrite *writes, int count)
+{
+    // every step is a register write, so only format the trace when someone reads it
+    if (AsyncLog::enabled(AsyncLog::LOG_DEBUG)) {
+        for (int i = 0; i < count; ++i) {
+            ostringstream oss;
+            oss << ": 0x" << hex << std::setw(2) << std::setfill('0') << (unsigned)writes[i].addr;
+            for (int b = 0; b < writes[i].len; ++b) {
+                oss << (b == 0 ? " reg 0x" : " val 0x") << std::setw(2) << std::setfill('0') << (unsigned)writes[i].buf[b];
+            }
+            oss << dec;
+            AsyncLog::write(AsyncLog::LOG_DEBUG, "motor", oss.str());
+        }
     }
-    char buf[10];
-    buf[0] = regaddr;
-    buf[1] = data;
-    if (write(fd_, buf, 2) != 2) {
-        _log_callback("Unable to write data");
+    if (!_bus->write(writes, count)) {
+        _log_callback("I2C transfer failed");
         return false;
     }
     return true;
 }
 
+bool MotorDriver::writeReg(uint8_t addr, uint8_t regaddr, uint8_t data)
+{
+    const uint8_t buf[2] = { regaddr, data };
+    const I2cWrite write = { addr, buf, 2 };
+    return writeMessages(&write, 1);
+}
+
+static uint64_t monotonic_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sleep_until_ns(const uint64_t deadline_ns)
+{
+    struct timespec deadline;
+    deadline.tv_sec = deadline_ns / 1000000000ULL;
+    deadline.tv_nsec = deadline_ns % 1000000000ULL;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR) {
+    }
+}
+
+int MotorDriver::step(const StepChannel &channel, int steps)
+{
+    int taken = 0;
+    stepAxes(&channel, &steps, &taken, 1);
+    return taken;
+}
+
+bool MotorDriver::stepAxes(const StepChannel *channels, const int *steps, int *taken, const int count)
+{
+    // steps of different axes due this close together go out in the same transfer
+    static const uint64_t MERGE_NS = 50000;
+
+    struct Axis {
+        uint8_t cycle[4];       // the port value of each phase, the other pins as they are
+        int phase;              // where in the cycle the coils are now
+        bool backwards;
+        int total;
+        std::vector < uint32_t > intervals;
+        uint64_t next_ns;       // when the next step is due, from the start of the move
+    };
+    std::vector < Axis > axes(count);
+    for (int a = 0; a < count; ++a) {
+        const StepChannel &channel = channels[a];
+        const uint8_t others = *channel.gpio & ~(channel.aphase | channel.bphase);
+        axes[a].cycle[0] = others | channel.aphase;
+        axes[a].cycle[1] = others | channel.aphase | channel.bphase;
+        axes[a].cycle[2] = others | channel.bphase;
+        axes[a].cycle[3] = others;
+        // carry on from the phase the last move left the coils in, or the first step is lost
+        const bool a_on = *channel.gpio & channel.aphase;
+        const bool b_on = *channel.gpio & channel.bphase;
+        axes[a].phase = a_on ? (b_on ? 1 : 0) : (b_on ? 2 : 3);
+        axes[a].backwards = (steps[a] > 0) == channel.reverse;
+        axes[a].total = abs(steps[a]);
+        axes[a].intervals = plan_steps(channel.profile, axes[a].total);
+        axes[a].next_ns = 0;
+        taken[a] = 0;
+    }
+
+    // the moving axes are unknown until the move is over, should the process die half way
+    unsigned moving = 0;
+    for (int a = 0; a < count; ++a) {
+        if (steps[a] != 0) {
+            moving |= 1 << axisOf(channels[a]);
+        }
+    }
+    journalPositions(moving, true);
+
+    std::vector < uint8_t > values(count);
+    std::vector < bool > due(count);
+    std::vector < uint8_t > bufs(count * 3);
+    std::vector < I2cWrite > msgs(count);
+
+    bool ok = true;
+    const uint64_t start_ns = monotonic_ns();
+    // stopped by cancelMoves(), the steps actually taken are reported
+    while (ok && !_cancel) {
+        uint64_t tick_ns = std::numeric_limits < uint64_t >::max();
+        for (int a = 0; a < count; ++a) {
+            if (taken[a] < axes[a].total) {
+                tick_ns = std::min(tick_ns, axes[a].next_ns);
+            }
+        }
+        if (tick_ns == std::numeric_limits < uint64_t >::max()) {
+            break;
+        }
+        // sleep to an absolute deadline, so the time on the bus does not stretch the step period
+        sleep_until_ns(start_ns + tick_ns);
+
+        for (int a = 0; a < count; ++a) {
+            const int i = taken[a];
+            due[a] = i < axes[a].total && axes[a].next_ns <= tick_ns + MERGE_NS;
+            const int phase = (axes[a].phase + (axes[a].backwards ? 3 : 1) * (i + 1)) % 4;
+            values[a] = due[a] ? axes[a].cycle[phase] : *channels[a].gpio;
+        }
+
+        // one message per expander; GPIOA and GPIOB of the same one are a single sequential
+        // write, the MCP23017 advances the register address itself (IOCON.SEQOP is 0)
+        int n = 0;
+        std::vector < bool > sent(count, false);
+        for (int a = 0; a < count; ++a) {
+            if (!due[a] || sent[a]) {
+                continue;
+            }
+            uint8_t *buf = &bufs[n * 3];
+            buf[0] = channels[a].reg;
+            buf[1] = values[a];
+            int len = 2;
+            for (int b = a + 1; b < count; ++b) {
+                if (due[b] && !sent[b] && channels[b].addr == channels[a].addr && abs(channels[b].reg - channels[a].reg) == 1) {
+                    buf[0] = std::min(channels[a].reg, channels[b].reg);
+                    buf[1] = channels[a].reg < channels[b].reg ? values[a] : values[b];
+                    buf[2] = channels[a].reg < channels[b].reg ? values[b] : values[a];
+                    len = 3;
+                    sent[b] = true;
+                    break;
+                }
+            }
+            sent[a] = true;
+            msgs[n].addr = channels[a].addr;
+            msgs[n].buf = buf;
+            msgs[n].len = len;
+            ++n;
+        }
+        if (!writeMessages(&msgs[0], n)) {
+            ostringstream oss;
+            oss << "Write failed for addr: " << hex << (unsigned)msgs[0].addr << " reg: " << (unsigned)msgs[0].buf[0] << dec;
+            _log_callback(oss.str());
+            ok = false;
+            break;
+        }
+
+        for (int a = 0; a < count; ++a) {
+            if (due[a]) {
+                *channels[a].gpio = values[a];
+                // readers see the position of every step while the move is running
+                channels[a].location->fetch_add(steps[a] < 0 ? -1 : 1);
+                axes[a].next_ns += axes[a].intervals[taken[a]];
+                ++taken[a];
+            }
+        }
+    }
+
+    // hold the coils until the last step of every axis has settled
+    uint64_t end_ns = 0;
+    for (int a = 0; a < count; ++a) {
+        end_ns = std::max(end_ns, axes[a].next_ns);
+        if (steps[a] < 0) {
+            taken[a] = -taken[a];
+        }
+    }
+    sleep_until_ns(start_ns + end_ns);
+
+    if (!ok) {
+        // the coils may or may not have moved, so none of these axes knows where it is
+        for (int a = 0; a < count; ++a) {
+            forgetPosition(axisOf(channels[a]));
+        }
+    }
+    journalPositions(0, false);
+    return ok;
+}
+
+void MotorDriver::forgetPosition(const int axis)
+{
+    if (axis == ZOOM_AXIS) {
+        zoom_init = false;
+        zoom_abs_location = -1;
+    } else if (axis == FOCUS_AXIS) {
+        focus_init = false;
+        focus_abs_location = -1;
+    } else {
+        iris_init = false;
+        iris_abs_location = -1;
+    }
+}
+
+int MotorDriver::axisOf(const StepChannel &channel)
+{
+    if (channel.location == &zoom_abs_location) {
+        return ZOOM_AXIS;
+    }
+    return (channel.location == &focus_abs_location) ? FOCUS_AXIS : IRIS_AXIS;
+}
+
 bool MotorDriver::readReg(uint8_t addr, uint8_t regaddr, uint8_t& res)
 {
-    if (ioctl(fd_, I2C_SLAVE, addr) < 0) {
+    if (!_bus->read_reg(addr, regaddr, res)) {
         ostringstream oss;
-        oss << "Unable to access slave: " << addr;
+        oss << "Unable to read addr: " << hex << (unsigned)addr << " reg: " << (unsigned)regaddr << dec;
         _log_callback(oss.str());
         return false;
     }
-    res = i2c_smbus_read_byte_data(fd_, regaddr);
     return true;
 }
 
@@ -241,7 +441,7 @@ bool MotorDriver::initExpanders()
 {
     _log_callback("IN initExpanders");
     char buf[10] = {0};
-    if (-1 == fd_) {
+    if (!_bus) {
         _log_callback("i2c device not initialized");
         return false;
     }
@@ -305,6 +505,7 @@ bool MotorDriver::disableZoom()
 bool MotorDriver::enableZoom() {
     exp1_gpioa |= ZOOM_AENBL + ZOOM_BENBL;
     DO_WRITE(addr1, REG_GPIOA, exp1_gpioa);
+    return true;
 }
 
 bool MotorDriver::zoomDir(int dir, int steps)
@@ -321,19 +522,17 @@ bool MotorDriver::zoomDir(int dir, int steps)
 bool MotorDriver::zoomUp(int steps)
 {
     enableZoom();
-    zoom(steps);
-    zoom_abs_location += steps;
+    const int taken = zoom(steps);
     disableZoom();
-    return true;
+    return taken == steps;
 }
 
 bool MotorDriver::zoomDown(int steps)
 {
     enableZoom();
-    zoom(0-steps);
-    zoom_abs_location -= steps;
+    const int taken = zoom(0-steps);
     disableZoom();
-    return true;
+    return taken == 0-steps;
 }
 
 bool MotorDriver::zoomAbsolute(int loc)
@@ -355,10 +554,6 @@ bool MotorDriver::zoomAbsolute(int loc)
         ret = zoomUp(loc - zoom_abs_location);
     }
 
-    if (false == ret) {
-        zoom_init = false;
-        zoom_abs_location = -1;
-    }
     return ret;
 }
 
@@ -373,10 +568,6 @@ bool MotorDriver::zoomRelative(int steps)
         ret = zoomUp(steps);
     }
     
-    if (false == ret) {
-        zoom_init = false;
-        zoom_abs_location = -1;
-    }
     return ret;
 }
 
@@ -386,33 +577,35 @@ bool MotorDriver::zoomHome()
     //const int steps = Configuration::zoom_home_max_steps();
     const int steps = 20000;
     const int stepsize = Configuration::zoom_home_step_size();
-//    enableZoom();
+    // unknown until the limit is found, journaled once rather than before every step
+    zoom_init = false;
+    journalPositions(0, true);
+    enableZoom();
     int counter = 0;
     ostringstream oss;
     oss << "conf zoom limit: " << Configuration::zoom_has_limit() << " zoom limit pre while " << zoomLimit() << " stepsize " << stepsize;
     _log_callback(oss.str());
-    while ((!Configuration::zoom_has_limit() || !zoomLimit()) && (counter < steps)) {
-        oss.str("");
-        oss << "zoom limit during: " << zoomLimit();
-        _log_callback(oss.str());
+    while ((!Configuration::zoom_has_limit() || !zoomLimit()) && (counter < steps) && !_cancel) {
         zoom(stepsize);
         counter += stepsize;
     }
     oss.str("");
-    oss << "zoom limit after: " << zoomLimit();
+    const bool found = Configuration::zoom_has_limit() && zoomLimit();
+    oss << "zoom limit after: " << found;
     _log_callback(oss.str());
-    if (counter <= steps) {
+    if (!found) {
         oss.str("");
         oss << "Reached zoom homing step limit of " << steps;
         _log_callback(oss.str());
         zoom_abs_location = -1;
-        zoom_init = true;
     } else {
         _log_callback("Found zoom limit");
         zoom_abs_location = 0;
+        zoom_init = true;
         ret = true;
     }
     disableZoom();
+    journalPositions(0, true);
     return ret;
 }
 
@@ -420,53 +613,29 @@ bool MotorDriver::zoomLimit()
 {
     uint8_t res = 0x00;
     bool ret = readReg(addr1, REG_GPIOA, res);
-    ostringstream oss;
-    oss << "gpioa: 0x" << hex << (int)res << dec;
-    _log_callback(oss.str());
+    if (AsyncLog::enabled(AsyncLog::LOG_DEBUG)) {
+        ostringstream oss;
+        oss << "gpioa: 0x" << hex << (int)res << dec;
+        AsyncLog::write(AsyncLog::LOG_DEBUG, "motor", oss.str());
+    }
     return (res & ZOOM_LIMIT);
 }
 
-bool MotorDriver::zoom(int steps)
+int MotorDriver::zoom(int steps)
 {
-    char mask;
-    char phase;
-    char out;
-    for(int i = 0; i < abs(steps); ++i) {
-        phase = 0;
-        if (steps >0) {
-            phase = 3- (i%4);
-        }
-        else {
-            phase = i%4;
-        }
-        out = 0;
-        switch(phase){
-		case 0:
-			out = ZOOM_APHASE;
-            break;
-		case 1:
-            out = ZOOM_APHASE+ ZOOM_BPHASE;
-            break;
-		case 2:
-            out = ZOOM_BPHASE;
-            break;	
-		case 3:
-			out=0;
-            break;
-        }
-        mask = exp1_gpioa & (~(ZOOM_APHASE + ZOOM_BPHASE));  //set before to the mask of phase a and b and the current output register
-        exp1_gpioa = out + mask; 
-        DO_WRITE(addr1, REG_GPIOA, exp1_gpioa);
-        std::this_thread::sleep_for(std::chrono::milliseconds(STEPPER_SLEEP_TIME_MS));   
+    const int taken = step(zoomChannel(), steps);
+    // the limit switch after the move, only for the trace
+    if (AsyncLog::enabled(AsyncLog::LOG_DEBUG)) {
+        zoomLimit();
     }
-
-    zoomLimit();
+    return taken;
 }
 
 bool MotorDriver::enableFocus() {
 
     exp1_gpiob |= FOCUS_AENBL + FOCUS_BENBL;
     DO_WRITE(addr1, REG_GPIOB, exp1_gpiob);
+    return true;
 }
 
 bool MotorDriver::disableFocus()
@@ -489,19 +658,17 @@ bool MotorDriver::focusDir(int dir, int steps)
 bool MotorDriver::focusUp(int steps)
 {
     enableFocus();
-    focus(steps);
-    focus_abs_location += steps;
+    const int taken = focus(steps);
     disableFocus();
-    return true;
+    return taken == steps;
 }
 
 bool MotorDriver::focusDown(int steps)
 {
     enableFocus();
-    focus(0-steps);
-    focus_abs_location -= steps;
+    const int taken = focus(0-steps);
     disableFocus();
-    return true;
+    return taken == 0-steps;
 }
 
 bool MotorDriver::focusAbsolute(int loc)
@@ -523,10 +690,6 @@ bool MotorDriver::focusAbsolute(int loc)
         ret = focusUp(loc - focus_abs_location);
     }
 
-    if (false == ret) {
-        focus_init = false;
-        focus_abs_location = -1;
-    }
     return ret;
 }
 
@@ -541,10 +704,6 @@ bool MotorDriver::focusRelative(int steps)
         ret = focusUp(steps);
     }
 
-    if (false == ret) {
-        focus_init = false;
-        focus_abs_location = -1;
-    }
     return ret;
 }
 
@@ -553,30 +712,35 @@ bool MotorDriver::focusHome()
     bool ret = false;
     const int steps = Configuration::focus_home_max_steps();
     int stepsize;
-    //enableFocus();
     if (0 == Configuration::focus_home_direction()) {
   	stepsize = 0-Configuration::focus_home_step_size();
     }
     else {
         stepsize = Configuration::focus_home_step_size();
     }
+    // unknown until the limit is found, journaled once rather than before every step
+    focus_init = false;
+    journalPositions(0, true);
+    enableFocus();
     int counter = 0;
-    /*while ((!Configuration::focus_has_limit() || !focusLimit()) && (counter < steps)) {
+    while ((!Configuration::focus_has_limit() || !focusLimit()) && (counter < steps) && !_cancel) {
         focus(stepsize);
-	    counter += stepsize;
-    }*/
-    if (counter <= steps) {
+        counter += abs(stepsize);
+    }
+    const bool found = Configuration::focus_has_limit() && focusLimit();
+    if (!found) {
         ostringstream oss;
         oss << "Reached focus homing step limit of " << steps;
         _log_callback(oss.str());
         focus_abs_location = -1;
-        focus_init = true;
     } else {
         _log_callback("Found focus limit");
         focus_abs_location = 0;
+        focus_init = true;
         ret = true;
     }
     disableFocus();
+    journalPositions(0, true);
     return ret;
 }
 
@@ -584,54 +748,29 @@ bool MotorDriver::focusLimit()
 {
     uint8_t res = 0x00;
     bool ret = readReg(addr1, REG_GPIOB, res);
-    ostringstream oss;
-    oss << "gpiob: 0x" << hex << (int)res << dec;
-    _log_callback(oss.str());
+    if (AsyncLog::enabled(AsyncLog::LOG_DEBUG)) {
+        ostringstream oss;
+        oss << "gpiob: 0x" << hex << (int)res << dec;
+        AsyncLog::write(AsyncLog::LOG_DEBUG, "motor", oss.str());
+    }
     return (res & FOCUS_LIMIT);
 }
 
-bool MotorDriver::focus(int steps)
+int MotorDriver::focus(int steps)
 {
-   char mask;
-   char out;
-   char phase;
-   for(int i = 0; i < abs(steps); ++i) {
-        phase = 0;
-        if (steps <0) {
-                phase = 3- (i%4);
-        }
-        else {
-                 phase = i%4;
-        }
-        out = 0;
-        switch(phase){
-                case 0:
-                        out = FOCUS_APHASE;
-                break;
-                case 1:
-                         out = FOCUS_APHASE+ FOCUS_BPHASE;
-                break;
-                case 2:
-                         out = FOCUS_BPHASE;
-                break;
-                case 3:
-                        out=0;
-                break;
-        }
-   
-        mask = exp1_gpiob & (~(FOCUS_APHASE + FOCUS_BPHASE));  //set before to the mask of phase a and b and the current output register
-        exp1_gpiob = out + mask;
-        DO_WRITE(addr1, REG_GPIOB, exp1_gpiob);
-        std::this_thread::sleep_for(std::chrono::milliseconds(STEPPER_SLEEP_TIME_MS));
-   }
-
-   focusLimit();
+    const int taken = step(focusChannel(), steps);
+    // the limit switch after the move, only for the trace
+    if (AsyncLog::enabled(AsyncLog::LOG_DEBUG)) {
+        focusLimit();
+    }
+    return taken;
 }
 
 bool MotorDriver::enableIris() {
 
     exp0_gpioa |= IRIS_AENBL + IRIS_BENBL;
     DO_WRITE(addr0, REG_GPIOA, exp0_gpioa);
+    return true;
 }
 
 bool MotorDriver::disableIris()
@@ -654,19 +793,17 @@ bool MotorDriver::irisDir(int dir, int steps)
 bool MotorDriver::irisUp(int steps)
 {
     enableIris();
-    iris(steps);
-    iris_abs_location += steps;
+    const int taken = iris(steps);
     disableIris();
-    return true;
+    return taken == steps;
 }
 
 bool MotorDriver::irisDown(int steps)
 {
     enableIris();
-    iris(0-steps);
-    iris_abs_location -= steps;
+    const int taken = iris(0-steps);
     disableIris();
-    return true;
+    return taken == 0-steps;
 }
 
 bool MotorDriver::irisAbsolute(int loc)
@@ -688,10 +825,6 @@ bool MotorDriver::irisAbsolute(int loc)
         ret = irisUp(loc - iris_abs_location);
     }
 
-    if (false == ret) {
-        iris_init = false;
-        iris_abs_location = -1;
-    }
     return ret;
 }
 bool MotorDriver::irisRelative(int steps)
@@ -705,10 +838,6 @@ bool MotorDriver::irisRelative(int steps)
         ret = irisUp(steps);
     }
 
-    if (false == ret) {
-        iris_init = false;
-        iris_abs_location = -1;
-    }
     return ret;
 }
 
@@ -723,27 +852,39 @@ bool MotorDriver::irisHome()
     else {
         stepsize = Configuration::iris_home_step_size();
     }
+    // unknown until homed, journaled once rather than before every step
+    iris_init = false;
+    journalPositions(0, true);
+    enableIris();
     int counter = 0;
-    while (/*(!Configuration::iris_has_limit() || !irisLimit()) &&*/ (counter < steps))
+    while (/*(!Configuration::iris_has_limit() || !irisLimit()) &&*/ (counter < steps) && !_cancel)
     {
-        iris(stepsize);
-        ostringstream oss;
-        oss << "finding iris home " << counter << " " << stepsize;
-        _log_callback(oss.str());
-        counter += stepsize;
+        const int taken = iris(stepsize);
+        counter += abs(taken);
+        if (AsyncLog::enabled(AsyncLog::LOG_DEBUG)) {
+            ostringstream oss;
+            oss << "finding iris home " << counter << " " << stepsize;
+            AsyncLog::write(AsyncLog::LOG_DEBUG, "motor", oss.str());
+        }
+        if (taken != stepsize) {
+            // cancelled, or a write failed
+            break;
+        }
     }
-    if (counter <= steps) {
+    // without a limit switch the iris is home once it was driven its whole travel into the stop
+    if (_cancel || counter < steps) {
         ostringstream oss;
-        oss << "Reached iris homing step limit of " << steps;
+        oss << "Iris homing stopped after " << counter << " of " << steps << " steps";
         _log_callback(oss.str());
         iris_abs_location = -1;
-        iris_init = true;
     } else {
         _log_callback("Found iris limit");
         iris_abs_location = 0;
+        iris_init = true;
         ret = true;
     }
     disableIris();
+    journalPositions(0, true);
     return ret;
 }
 
@@ -753,41 +894,77 @@ bool MotorDriver::irisHome()
     bool ret = readReg(addr2, REG_GPIOA, res);
     return (res & IRIS_LIMIT);
 }*/
-bool MotorDriver::iris(int steps)
-{
-   char mask;
-   char out;
-   char phase;
-   for(int i = 0; i < abs(steps); ++i) {
-        phase = 0;
-        if (steps >0) {
-                phase = 3- (i%4);
-        }
-        else {
-                 phase = i%4;
-        }
-        out = 0;
-        switch(phase){
-                case 0:
-                        out = IRIS_APHASE;
-                break;
-                case 1:
-                         out = IRIS_APHASE+ IRIS_BPHASE;
-                break;
-                case 2:
-                         out = IRIS_BPHASE;
-                break;
-                case 3:
-                        out=0;
-                break;
-        }
+int MotorDriver::iris(int steps)
+{
+    return step(irisChannel(), steps);
+}
+
+MotorDriver::StepChannel MotorDriver::zoomChannel()
+{
+    const StepChannel channel = { (uint8_t)addr1, REG_GPIOA, &exp1_gpioa, ZOOM_APHASE, ZOOM_BPHASE, true, &zoom_abs_location,
+                                  { Configuration::zoom_start_speed(), Configuration::zoom_max_speed(), Configuration::zoom_acceleration() } };
+    return channel;
+}
+
+MotorDriver::StepChannel MotorDriver::focusChannel()
+{
+    const StepChannel channel = { (uint8_t)addr1, REG_GPIOB, &exp1_gpiob, FOCUS_APHASE, FOCUS_BPHASE, false, &focus_abs_location,
+                                  { Configuration::focus_start_speed(), Configuration::focus_max_speed(), Configuration::focus_acceleration() } };
+    return channel;
+}
+
+MotorDriver::StepChannel MotorDriver::irisChannel()
+{
+    const StepChannel channel = { (uint8_t)addr0, REG_GPIOA, &exp0_gpioa, IRIS_APHASE, IRIS_BPHASE, true, &iris_abs_location,
+                                  { Configuration::iris_start_speed(), Configuration::iris_max_speed(), Configuration::iris_acceleration() } };
+    return channel;
+}
+
+bool MotorDriver::move(const LensSteps &steps)
+{
+    StepChannel channels[3];
+    int counts[3];
+    int taken[3];
+    int n = 0;
+    if (steps.zoom != 0) {
+        enableZoom();
+        channels[n] = zoomChannel();
+        counts[n++] = steps.zoom;
+    }
+    if (steps.focus != 0) {
+        enableFocus();
+        channels[n] = focusChannel();
+        counts[n++] = steps.focus;
+    }
+    if (steps.iris != 0) {
+        enableIris();
+        channels[n] = irisChannel();
+        counts[n++] = steps.iris;
+    }
+
+    const bool ret = stepAxes(channels, counts, taken, n);
+
+    if (steps.zoom != 0) {
+        disableZoom();
+    }
+    if (steps.focus != 0) {
+        disableFocus();
+    }
+    if (steps.iris != 0) {
+        disableIris();
+    }
+    return ret;
+}
+void MotorDriver::cancelMoves()
+{
+    _cancel = true;
+}
 
-        mask = exp0_gpioa & (~(IRIS_APHASE + IRIS_BPHASE));  //set before to the mask of phase a and b and the current output register
-        exp0_gpioa = out + mask;
-        DO_WRITE(addr0, REG_GPIOA, exp0_gpioa);
-        std::this_thread::sleep_for(std::chrono::milliseconds(STEPPER_SLEEP_TIME_MS)*4);
-   }
+void MotorDriver::clearCancel()
+{
+    _cancel = false;
 }
+
 bool MotorDriver::ircutOn()
 {
 	exp0_gpiob |= IRCUT_A;
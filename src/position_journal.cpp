@@ -0,0 +1,207 @@
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include <fcntl.h>
+#include <libgen.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <boost/crc.hpp>
+
+#include "position_journal.hpp"
+
+namespace BoulderAI
+{
+
+const size_t PositionJournal::MAX_BYTES = 64 * 1024;
+
+static const uint32_t RECORD_MAGIC = 0x4c504f53;   // "LPOS"
+
+struct PositionJournal::Record
+{
+    uint32_t magic;
+    uint32_t seq;
+    uint32_t known_mask;
+    int32_t positions[AXES];
+    uint32_t crc;       // of everything before it
+};
+
+static uint32_t record_crc(const void *record, const size_t size)
+{
+    boost::crc_32_type crc;
+    crc.process_bytes(record, size);
+    return crc.checksum();
+}
+
+PositionJournal::PositionJournal() :
+    _fd(-1),
+    _seq(0),
+    _size(0),
+    _dirty(false),
+    _restored(false),
+    _known_mask(0)
+{
+    memset(_positions, 0, sizeof(_positions));
+}
+
+PositionJournal::~PositionJournal()
+{
+    close();
+}
+
+bool PositionJournal::open(const std::string &path)
+{
+    close();
+    _path = path;
+    _restored = false;
+
+    // the directory may not exist on a fresh install
+    std::vector < char > dir(path.begin(), path.end());
+    dir.push_back('\0');
+    mkdir(dirname(dir.data()), 0755);
+
+    _fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (_fd < 0)
+    {
+        std::cout << "Unable to open lens position journal " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    // the newest intact record wins; anything after a torn or corrupt record is not trusted
+    Record record;
+    uint64_t offset = 0;
+    while (pread(_fd, &record, sizeof(record), offset) == (ssize_t)sizeof(record) &&
+           record.magic == RECORD_MAGIC && record.crc == record_crc(&record, offsetof(Record, crc)))
+    {
+        _restored = true;
+        _seq = record.seq + 1;
+        _known_mask = record.known_mask;
+        for (int i = 0; i < AXES; i++)
+        {
+            _positions[i] = record.positions[i];
+        }
+        offset += sizeof(record);
+    }
+    _size = offset;
+    if (ftruncate(_fd, _size) != 0)
+    {
+        std::cout << "Unable to truncate lens position journal " << path << ": " << strerror(errno) << std::endl;
+    }
+    return true;
+}
+
+void PositionJournal::close()
+{
+    if (_fd < 0)
+    {
+        return;
+    }
+    sync();
+    ::close(_fd);
+    _fd = -1;
+}
+
+bool PositionJournal::restore(int positions[AXES], unsigned &known_mask) const
+{
+    if (!_restored)
+    {
+        return false;
+    }
+    for (int i = 0; i < AXES; i++)
+    {
+        positions[i] = _positions[i];
+    }
+    known_mask = _known_mask;
+    return true;
+}
+
+bool PositionJournal::write(const int positions[AXES], const unsigned known_mask, const bool sync)
+{
+    if (_fd < 0)
+    {
+        return false;
+    }
+
+    Record record;
+    memset(&record, 0, sizeof(record));
+    record.magic = RECORD_MAGIC;
+    record.seq = _seq++;
+    record.known_mask = known_mask;
+    for (int i = 0; i < AXES; i++)
+    {
+        record.positions[i] = positions[i];
+    }
+    record.crc = record_crc(&record, offsetof(Record, crc));
+
+    if (_size + sizeof(record) > MAX_BYTES && compact(record))
+    {
+        return true;
+    }
+    if (!append(record))
+    {
+        return false;
+    }
+    _dirty = true;
+    if (sync)
+    {
+        this->sync();
+    }
+    return true;
+}
+
+void PositionJournal::sync()
+{
+    if (_fd >= 0 && _dirty)
+    {
+        fdatasync(_fd);
+        _dirty = false;
+    }
+}
+
+bool PositionJournal::append(const Record &record)
+{
+    if (pwrite(_fd, &record, sizeof(record), _size) != (ssize_t)sizeof(record))
+    {
+        std::cout << "Unable to write lens position journal " << _path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    _size += sizeof(record);
+    return true;
+}
+
+// replaces the journal with a file holding only the given record; always synced
+bool PositionJournal::compact(const Record &record)
+{
+    const std::string tmp = _path + ".tmp";
+    const int fd = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        return false;
+    }
+    const bool ok = ::write(fd, &record, sizeof(record)) == (ssize_t)sizeof(record) && fdatasync(fd) == 0;
+    if (!ok || rename(tmp.c_str(), _path.c_str()) != 0)
+    {
+        ::close(fd);
+        unlink(tmp.c_str());
+        return false;
+    }
+
+    // the rename itself has to survive a crash as well
+    std::vector < char > dir(_path.begin(), _path.end());
+    dir.push_back('\0');
+    const int dir_fd = ::open(dirname(dir.data()), O_RDONLY | O_DIRECTORY);
+    if (dir_fd >= 0)
+    {
+        fsync(dir_fd);
+        ::close(dir_fd);
+    }
+
+    ::close(_fd);
+    _fd = fd;
+    _size = sizeof(record);
+    _dirty = false;
+    return true;
+}
+
+} // namespace BoulderAI
@@ -0,0 +1,137 @@
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include "presets.hpp"
+
+namespace BoulderAI
+{
+
+// reads a pair of values, or "- -" for a pair that is not stored
+template < typename T >
+static bool read_pair(std::istringstream &iss, bool &has, T &first, T &second)
+{
+    std::string a, b;
+    if (!(iss >> a >> b))
+    {
+        return false;
+    }
+    has = a != "-";
+    if (!has)
+    {
+        first = second = 0;
+        return b == "-";
+    }
+    std::istringstream values(a + " " + b);
+    return (bool)(values >> first >> second);
+}
+
+template < typename T >
+static void write_pair(std::ostream &os, const bool has, const T first, const T second)
+{
+    if (has)
+    {
+        os << " " << first << " " << second;
+    }
+    else
+    {
+        os << " - -";
+    }
+}
+
+bool PresetTable::load(const std::string &path)
+{
+    std::map < std::string, LensPreset > presets;
+    std::ifstream ifs(path.c_str());
+    const bool opened = ifs.is_open();
+    std::string line;
+    while (std::getline(ifs, line))
+    {
+        if (line.empty() || line[0] == '#')
+        {
+            continue;
+        }
+        std::istringstream iss(line);
+        LensPreset preset;
+        if (iss >> preset.name >> preset.zoom >> preset.focus >> preset.iris &&
+            read_pair(iss, preset.has_exposure, preset.exposure_min, preset.exposure_max) &&
+            read_pair(iss, preset.has_gain, preset.gain_min, preset.gain_max))
+        {
+            presets[preset.name] = preset;
+        }
+    }
+
+    ScopedLock lock(_mtex);
+    _presets.swap(presets);
+    return opened;
+}
+
+bool PresetTable::save(const std::string &path)
+{
+    // saves come from the lens job thread and from XMLRPC threads; one at a time, so each
+    // writes a newer snapshot than the last and none of them shares the tmp file
+    ScopedLock save_lock(_save_mtex);
+    const std::vector < LensPreset > presets = get_presets();
+
+    // written aside and renamed, so a crash never leaves half a table
+    const std::string tmp = path + ".tmp";
+    {
+        std::ofstream ofs(tmp.c_str());
+        ofs << "# name zoom focus iris exposure_min exposure_max gain_min gain_max" << std::endl;
+        for (size_t i = 0; i < presets.size(); i++)
+        {
+            const LensPreset &preset = presets[i];
+            ofs << preset.name << " " << preset.zoom << " " << preset.focus << " " << preset.iris;
+            write_pair(ofs, preset.has_exposure, preset.exposure_min, preset.exposure_max);
+            write_pair(ofs, preset.has_gain, preset.gain_min, preset.gain_max);
+            ofs << std::endl;
+        }
+        if (!ofs.good())
+        {
+            return false;
+        }
+    }
+    return rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+bool PresetTable::valid_name(const std::string &name)
+{
+    return !name.empty() && name[0] != '#' && name.find_first_of(" \t\r\n") == std::string::npos;
+}
+
+void PresetTable::set(const LensPreset &preset)
+{
+    ScopedLock lock(_mtex);
+    _presets[preset.name] = preset;
+}
+
+bool PresetTable::remove(const std::string &name)
+{
+    ScopedLock lock(_mtex);
+    return _presets.erase(name) > 0;
+}
+
+bool PresetTable::find(const std::string &name, LensPreset &preset)
+{
+    ScopedLock lock(_mtex);
+    std::map < std::string, LensPreset >::const_iterator itr = _presets.find(name);
+    if (itr == _presets.end())
+    {
+        return false;
+    }
+    preset = itr->second;
+    return true;
+}
+
+std::vector < LensPreset > PresetTable::get_presets()
+{
+    ScopedLock lock(_mtex);
+    std::vector < LensPreset > ret;
+    for (std::map < std::string, LensPreset >::const_iterator itr = _presets.begin(); itr != _presets.end(); ++itr)
+    {
+        ret.push_back(itr->second);
+    }
+    return ret;
+}
+
+} // namespace BoulderAI
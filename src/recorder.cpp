@@ -0,0 +1,593 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <time.h>
+#include <boost/bind.hpp>
+
+#include <sys/stat.h>
+
+#include "recorder.hpp"
+
+namespace BoulderAI
+{
+
+const char *Recorder::OPT_DIR = "record-dir";
+const char *Recorder::OPT_SEGMENT_SECONDS = "record-segment-seconds";
+const char *Recorder::OPT_CONTAINER = "record-container";
+const char *Recorder::OPT_BITRATE = "record-bitrate";
+const char *Recorder::OPT_KEYFRAME_INTERVAL = "record-keyframe-interval";
+const char *Recorder::OPT_WRITE_BATCH_KB = "record-write-batch-kb";
+const char *Recorder::OPT_IO_QUEUE_MB = "record-io-queue-mb";
+
+const std::string Recorder::DEFAULT_DIR = "/var/www/export";
+const uint32_t Recorder::DEFAULT_SEGMENT_SECONDS = 60;
+const std::string Recorder::DEFAULT_CONTAINER = "mkv";
+const uint32_t Recorder::DEFAULT_BITRATE = 8000000;
+const uint32_t Recorder::DEFAULT_KEYFRAME_INTERVAL = 30;
+const uint32_t Recorder::DEFAULT_WRITE_BATCH_KB = 1024;
+const uint32_t Recorder::DEFAULT_IO_QUEUE_MB = 32;
+
+std::string Recorder::_dir = DEFAULT_DIR;
+uint32_t Recorder::_segment_seconds = DEFAULT_SEGMENT_SECONDS;
+std::string Recorder::_container = DEFAULT_CONTAINER;
+uint32_t Recorder::_bitrate = DEFAULT_BITRATE;
+uint32_t Recorder::_keyframe_interval = DEFAULT_KEYFRAME_INTERVAL;
+uint32_t Recorder::_write_batch_kb = DEFAULT_WRITE_BATCH_KB;
+uint32_t Recorder::_io_queue_mb = DEFAULT_IO_QUEUE_MB;
+
+static const GstClockTime EOS_TIMEOUT = 5 * GST_SECOND;
+
+// share of --record-io-queue-mb above which frames are dropped before the encoder, leaving
+// the rest for what is already being encoded and muxed
+static const int SHED_IO_PERCENT = 75;
+
+po::options_description Recorder::GetOptions()
+{
+    po::options_description desc( "Recording Options" );
+    desc.add_options()
+        ( OPT_DIR, po::value<std::string>(&_dir)->default_value(DEFAULT_DIR),
+          "Directory the recorded segments and their index (segments.idx) are written to." )
+        ( OPT_SEGMENT_SECONDS, po::value<uint32_t>(&_segment_seconds)->default_value(DEFAULT_SEGMENT_SECONDS),
+          "Length of each recorded file. Files are cut at the first key frame after this." )
+        ( OPT_CONTAINER, po::value<std::string>(&_container)->default_value(DEFAULT_CONTAINER),
+          "Container of the recorded files, mkv or mp4 (fragmented)." )
+        ( OPT_BITRATE, po::value<uint32_t>(&_bitrate)->default_value(DEFAULT_BITRATE),
+          "H.265 bitrate of the recordings." )
+        ( OPT_KEYFRAME_INTERVAL, po::value<uint32_t>(&_keyframe_interval)->default_value(DEFAULT_KEYFRAME_INTERVAL),
+          "Frames between key frames in the recordings, which bounds how far a segment can run over." )
+        ( OPT_WRITE_BATCH_KB, po::value<uint32_t>(&_write_batch_kb)->default_value(DEFAULT_WRITE_BATCH_KB),
+          "Recorded data is written to disk in blocks of this size." )
+        ( OPT_IO_QUEUE_MB, po::value<uint32_t>(&_io_queue_mb)->default_value(DEFAULT_IO_QUEUE_MB),
+          "Recorded data that may wait for the disk; as it fills, frames are dropped rather than stalling capture." )
+        ;
+    return desc;
+}
+
+namespace
+{
+
+uint64_t clock_ns(const clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// waits for the pipeline to drain after an end-of-stream, false on error or timeout
+bool wait_for_eos(GstElement *pipeline)
+{
+    GstBus *bus = gst_element_get_bus(pipeline);
+    GstMessage *msg = gst_bus_timed_pop_filtered(bus, EOS_TIMEOUT,
+                                                 (GstMessageType)(GST_MESSAGE_EOS | GST_MESSAGE_ERROR));
+    const bool ok = msg && GST_MESSAGE_TYPE(msg) == GST_MESSAGE_EOS;
+    if (msg)
+    {
+        gst_message_unref(msg);
+    }
+    gst_object_unref(bus);
+    return ok;
+}
+
+void end_stream(GstElement *appsrc)
+{
+    GstFlowReturn ret;
+    g_signal_emit_by_name(appsrc, "end-of-stream", &ret);
+}
+
+} // namespace
+
+Recorder::Recorder(const int width, const int height, const size_t max_queued_frames) :
+    _width(width),
+    _height(height),
+    _max_queued_frames(max_queued_frames),
+    _shed_io_bytes((size_t)_io_queue_mb * 1024 * 1024 / 100 * SHED_IO_PERCENT),
+    _writer(_write_batch_kb * 1024, _io_queue_mb * 1024 * 1024),
+    _running(false),
+    _in_event(false),
+    _encoder(NULL),
+    _encoder_src(NULL),
+    _event_id(0),
+    _event_base_ns(0),
+    _event_unix_offset_ns(0),
+    _last_pts(GST_CLOCK_TIME_NONE),
+    _muxer(NULL),
+    _muxer_src(NULL),
+    _segment_file(-1),
+    _segment_start(0),
+    _segment_end(0),
+    _segment_failed(false)
+{
+    _stats.recording = false;
+    _stats.event_id = 0;
+    _stats.segments = 0;
+    _stats.frames = 0;
+    _stats.dropped_frames = 0;
+    _stats.written_bytes = 0;
+    _stats.dropped_bytes = 0;
+    _stats.io_queue_bytes = 0;
+}
+
+Recorder::~Recorder()
+{
+    stop();
+}
+
+void Recorder::set_segment_callback(SegmentCallback callback)
+{
+    _segment_callback = callback;
+}
+
+void Recorder::start()
+{
+    if (_thread_ptr.get())
+    {
+        return;
+    }
+
+    mkdir(_dir.c_str(), 0755);
+    _writer.start();
+
+    ScopedLock lock(_mtex);
+    _running = true;
+    _thread_ptr.reset(new boost::thread(boost::bind(&Recorder::run, this)));
+}
+
+void Recorder::stop()
+{
+    {
+        ScopedLock lock(_mtex);
+        _running = false;
+        _condition.notify_all();
+    }
+
+    if (!_thread_ptr.get())
+    {
+        return;
+    }
+    _thread_ptr->join();
+    _thread_ptr.reset();
+    _writer.stop();
+}
+
+void Recorder::push_frame(const FrameCollection &frame_col)
+{
+    const size_t io_queue_bytes = _writer.get_queue_bytes();
+    ScopedLock lock(_mtex);
+    if (!_running)
+    {
+        return;
+    }
+    if (!_in_event)
+    {
+        // events are named by their start time, which keeps the ids unique across restarts
+        _in_event = true;
+        _stats.event_id = std::max < uint64_t > (_stats.event_id + 1, clock_ns(CLOCK_REALTIME) / 1000000ULL);
+    }
+
+    /* the queue holds capture buffers, so it is kept short and overflow is dropped; while
+     * the disk is behind, frames are dropped here too, so the encoded stream only ever
+     * loses whole frames */
+    if (_queue.size() >= _max_queued_frames || io_queue_bytes > _shed_io_bytes)
+    {
+        _stats.dropped_frames++;
+        return;
+    }
+    QueueEntry entry;
+    entry.end_event = false;
+    entry.event_id = _stats.event_id;
+    entry.frame_col = frame_col;
+    _queue.push_back(entry);
+    _condition.notify_one();
+}
+
+void Recorder::end_event()
+{
+    ScopedLock lock(_mtex);
+    if (!_in_event)
+    {
+        return;
+    }
+    _in_event = false;
+
+    QueueEntry entry;
+    entry.end_event = true;
+    entry.event_id = _stats.event_id;
+    _queue.push_back(entry);
+    _condition.notify_one();
+}
+
+RecorderStats Recorder::get_stats()
+{
+    RecorderStats stats;
+    {
+        ScopedLock lock(_mtex);
+        stats = _stats;
+        stats.recording = _in_event || !_queue.empty();
+    }
+    stats.written_bytes = _writer.get_written_bytes();
+    stats.dropped_bytes = _writer.get_dropped_bytes();
+    stats.io_queue_bytes = _writer.get_queue_bytes();
+    return stats;
+}
+
+void Recorder::run()
+{
+    while (true)
+    {
+        QueueEntry entry;
+        {
+            ScopedLock lock(_mtex);
+            while (_queue.empty() && _running)
+            {
+                _condition.wait(lock);
+            }
+            if (_queue.empty())
+            {
+                break;
+            }
+            entry = _queue.front();
+            _queue.pop_front();
+        }
+
+        if (entry.end_event)
+        {
+            stop_encoder();
+            continue;
+        }
+
+        if (_encoder && entry.event_id != _event_id)
+        {
+            // a new event started before the end of the previous one was seen
+            stop_encoder();
+        }
+        if (!_encoder)
+        {
+            _event_id = entry.event_id;
+            if (!start_encoder())
+            {
+                ScopedLock lock(_mtex);
+                _stats.dropped_frames++;
+                continue;
+            }
+        }
+        encode_frame(entry.frame_col);
+    }
+
+    // the queue is drained at shutdown, finish the open segment
+    stop_encoder();
+}
+
+bool Recorder::start_encoder()
+{
+    std::ostringstream launch;
+    launch << "appsrc name=src ! omxh265enc bitrate=" << _bitrate << " iframeinterval=" << _keyframe_interval
+           << " ! h265parse config-interval=-1 ! video/x-h265,stream-format=byte-stream,alignment=au"
+           << " ! appsink name=sink emit-signals=true sync=false";
+
+    GError *error = NULL;
+    _encoder = gst_parse_launch(launch.str().c_str(), &error);
+    if (!_encoder)
+    {
+        std::cout << "Unable to create the recording encoder: " << (error ? error->message : "unknown error") << std::endl;
+        if (error)
+        {
+            g_error_free(error);
+        }
+        return false;
+    }
+
+    _encoder_src = gst_bin_get_by_name(GST_BIN(_encoder), "src");
+    g_object_set(G_OBJECT(_encoder_src),
+            "caps", gst_caps_new_simple ("video/x-raw",
+                "format", G_TYPE_STRING, "I420",
+                "width", G_TYPE_INT, _width,
+                "height", G_TYPE_INT, _height,
+                "framerate", GST_TYPE_FRACTION, 0, 1,
+                NULL),
+            "stream-type", 0,
+            "is-live", FALSE,
+            "block", FALSE,
+            "format", GST_FORMAT_TIME, NULL);
+
+    GstElement *sink = gst_bin_get_by_name(GST_BIN(_encoder), "sink");
+    g_signal_connect(sink, "new-sample", G_CALLBACK(on_encoded_sample), this);
+    gst_object_unref(sink);
+
+    _event_base_ns = 0;
+    _event_unix_offset_ns = (int64_t)clock_ns(CLOCK_REALTIME) - (int64_t)clock_ns(CLOCK_MONOTONIC);
+    _last_pts = GST_CLOCK_TIME_NONE;
+
+    if (gst_element_set_state(_encoder, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE)
+    {
+        std::cout << "Unable to start the recording encoder." << std::endl;
+        gst_object_unref(_encoder_src);
+        gst_object_unref(_encoder);
+        _encoder_src = NULL;
+        _encoder = NULL;
+        return false;
+    }
+    std::cout << "Recording event " << _event_id << std::endl;
+    return true;
+}
+
+void Recorder::stop_encoder()
+{
+    if (!_encoder)
+    {
+        return;
+    }
+
+    // let the encoder drain, the last frames still go into the open segment
+    end_stream(_encoder_src);
+    if (!wait_for_eos(_encoder))
+    {
+        std::cout << "The recording encoder did not drain, the end of event " << _event_id << " may be lost." << std::endl;
+    }
+    {
+        ScopedLock lock(_segment_mtex);
+        close_segment();
+    }
+
+    gst_element_set_state(_encoder, GST_STATE_NULL);
+    gst_object_unref(_encoder_src);
+    gst_object_unref(_encoder);
+    _encoder_src = NULL;
+    _encoder = NULL;
+    std::cout << "Recording of event " << _event_id << " finished" << std::endl;
+}
+
+void Recorder::encode_frame(const FrameCollection &frame_col)
+{
+    const uint64_t ts = frame_col.sensor_timestamp ? frame_col.sensor_timestamp : clock_ns(CLOCK_MONOTONIC);
+    if (_event_base_ns == 0)
+    {
+        _event_base_ns = ts;
+    }
+    if (ts < _event_base_ns)
+    {
+        return;
+    }
+    const GstClockTime pts = ts - _event_base_ns;
+    if (GST_CLOCK_TIME_IS_VALID(_last_pts) && pts <= _last_pts)
+    {
+        return;
+    }
+
+    const guint size = _width * _height * 3 / 2;
+    GstBuffer *buffer = gst_buffer_new_allocate(NULL, size, NULL);
+    GstMapInfo map;
+    if (!gst_buffer_map(buffer, &map, GST_MAP_WRITE))
+    {
+        gst_buffer_unref(buffer);
+        return;
+    }
+
+    // the capture planes have stride != width, copy by row
+    const cv::Mat planes[3] = { frame_col.frame_y->to_mat(), frame_col.frame_u->to_mat(), frame_col.frame_v->to_mat() };
+    unsigned char *dst = map.data;
+    for (int p = 0; p < 3; p++)
+    {
+        for (int j = 0; j < planes[p].rows; j++)
+        {
+            memcpy(dst, planes[p].ptr(j), planes[p].cols);
+            dst += planes[p].cols;
+        }
+    }
+    gst_buffer_unmap(buffer, &map);
+
+    GST_BUFFER_PTS(buffer) = pts;
+    if (GST_CLOCK_TIME_IS_VALID(_last_pts))
+    {
+        GST_BUFFER_DURATION(buffer) = pts - _last_pts;
+    }
+    _last_pts = pts;
+
+    GstFlowReturn ret;
+    g_signal_emit_by_name(_encoder_src, "push-buffer", buffer, &ret);
+    gst_buffer_unref(buffer);
+
+    ScopedLock lock(_mtex);
+    _stats.frames++;
+}
+
+GstFlowReturn Recorder::on_encoded_sample(GstElement *sink, gpointer user_data)
+{
+    Recorder *self = (Recorder *)user_data;
+    GstSample *sample = NULL;
+    g_signal_emit_by_name(sink, "pull-sample", &sample);
+    if (!sample)
+    {
+        return GST_FLOW_ERROR;
+    }
+
+    GstBuffer *buffer = gst_sample_get_buffer(sample);
+    const GstClockTime pts = GST_BUFFER_PTS(buffer);
+    const bool key_frame = !GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+
+    ScopedLock lock(self->_segment_mtex);
+    /* Segments only start on key frames, so every file plays on its own. A segment that lost
+     * data is cut at the next one, the writer discards it. */
+    if (self->_muxer && key_frame &&
+        (self->_segment_failed || pts >= self->_segment_start + (GstClockTime)_segment_seconds * GST_SECOND))
+    {
+        self->close_segment();
+    }
+    if (!self->_muxer && (!key_frame || !self->open_segment(sample, pts)))
+    {
+        gst_sample_unref(sample);
+        return GST_FLOW_OK;
+    }
+
+    // the encoded data is shared, only the timestamps change to start each file at 0
+    GstBuffer *out = gst_buffer_copy(buffer);
+    GST_BUFFER_PTS(out) = pts - self->_segment_start;
+    if (GST_BUFFER_DTS_IS_VALID(out))
+    {
+        GST_BUFFER_DTS(out) = GST_BUFFER_DTS(out) >= self->_segment_start ? GST_BUFFER_DTS(out) - self->_segment_start : 0;
+    }
+    self->_segment_end = pts + (GST_BUFFER_DURATION_IS_VALID(buffer) ? GST_BUFFER_DURATION(buffer) : 0);
+
+    GstFlowReturn ret;
+    g_signal_emit_by_name(self->_muxer_src, "push-buffer", out, &ret);
+    gst_buffer_unref(out);
+    gst_sample_unref(sample);
+    return GST_FLOW_OK;
+}
+
+GstFlowReturn Recorder::on_muxed_sample(GstElement *sink, gpointer user_data)
+{
+    /* Runs on the muxer's streaming thread. _segment_file is only changed while no muxer
+     * exists, so it is read without the segment lock, which close_segment() holds while it
+     * waits for this thread to drain. */
+    Recorder *self = (Recorder *)user_data;
+    GstSample *sample = NULL;
+    g_signal_emit_by_name(sink, "pull-sample", &sample);
+    if (!sample)
+    {
+        return GST_FLOW_ERROR;
+    }
+
+    GstBuffer *buffer = gst_sample_get_buffer(sample);
+    GstMapInfo map;
+    if (gst_buffer_map(buffer, &map, GST_MAP_READ))
+    {
+        if (!self->_writer.write(self->_segment_file, map.data, map.size))
+        {
+            self->_segment_failed = true;
+        }
+        gst_buffer_unmap(buffer, &map);
+    }
+    gst_sample_unref(sample);
+    return GST_FLOW_OK;
+}
+
+bool Recorder::open_segment(GstSample *sample, const GstClockTime pts)
+{
+    const bool mp4 = (_container == "mp4");
+    std::ostringstream launch;
+    launch << "appsrc name=src ! h265parse ! "
+           << (mp4 ? "mp4mux fragment-duration=1000 streamable=true" : "matroskamux streamable=true")
+           << " ! appsink name=sink emit-signals=true sync=false";
+
+    GError *error = NULL;
+    GstElement *muxer = gst_parse_launch(launch.str().c_str(), &error);
+    if (!muxer)
+    {
+        std::cout << "Unable to create the recording muxer: " << (error ? error->message : "unknown error") << std::endl;
+        if (error)
+        {
+            g_error_free(error);
+        }
+        return false;
+    }
+
+    const int64_t start_unix_ns = (int64_t)(_event_base_ns + pts) + _event_unix_offset_ns;
+    const time_t start_s = start_unix_ns / 1000000000LL;
+    struct tm tm;
+    localtime_r(&start_s, &tm);
+    char name[64];
+    snprintf(name, sizeof(name), "dnncam_%04d%02d%02d_%02d%02d%02d_%03d.%s",
+             tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec,
+             (int)((start_unix_ns / 1000000LL) % 1000), mp4 ? "mp4" : "mkv");
+    _segment_path = _dir + "/" + name;
+
+    // preallocate what the bitrate says the segment will take, plus some headroom
+    const uint64_t expected_bytes = (uint64_t)_bitrate / 8 * _segment_seconds * 11 / 10;
+    _segment_file = _writer.open(_segment_path, expected_bytes);
+    _segment_failed = false;
+    _segment_start = pts;
+    _segment_end = pts;
+
+    _muxer = muxer;
+    _muxer_src = gst_bin_get_by_name(GST_BIN(_muxer), "src");
+    g_object_set(G_OBJECT(_muxer_src),
+            "caps", gst_sample_get_caps(sample),
+            "stream-type", 0,
+            "is-live", FALSE,
+            "format", GST_FORMAT_TIME, NULL);
+    GstElement *sink = gst_bin_get_by_name(GST_BIN(_muxer), "sink");
+    g_signal_connect(sink, "new-sample", G_CALLBACK(on_muxed_sample), this);
+    gst_object_unref(sink);
+    gst_element_set_state(_muxer, GST_STATE_PLAYING);
+
+    ScopedLock lock(_mtex);
+    _stats.segment = name;
+    return true;
+}
+
+void Recorder::close_segment()
+{
+    if (!_muxer)
+    {
+        return;
+    }
+
+    end_stream(_muxer_src);
+    if (!wait_for_eos(_muxer))
+    {
+        std::cout << "The recording muxer did not drain, " << _segment_path << " may be truncated." << std::endl;
+    }
+    gst_element_set_state(_muxer, GST_STATE_NULL);
+    gst_object_unref(_muxer_src);
+    gst_object_unref(_muxer);
+    _muxer_src = NULL;
+    _muxer = NULL;
+
+    if (_segment_failed)
+    {
+        std::cout << "The disk fell behind, " << _segment_path << " is discarded." << std::endl;
+    }
+    const int64_t start_unix_ms = ((int64_t)(_event_base_ns + _segment_start) + _event_unix_offset_ns) / 1000000LL;
+    const int64_t duration_ms = (_segment_end - _segment_start) / GST_MSECOND;
+    _writer.close(_segment_file, boost::bind(&Recorder::segment_closed, this, _1, _2, _event_id, start_unix_ms, duration_ms));
+    _segment_file = -1;
+
+    ScopedLock lock(_mtex);
+    _stats.segment = "";
+}
+
+void Recorder::segment_closed(const std::string &path, const uint64_t bytes, const uint64_t event_id,
+                              const int64_t start_unix_ms, const int64_t duration_ms)
+{
+    // runs on the writer's I/O thread, after the segment has its final name
+    {
+        ScopedLock lock(_mtex);
+        _stats.segments++;
+    }
+    if (!_segment_callback)
+    {
+        return;
+    }
+
+    RecordedSegment segment;
+    segment.name = path.substr(path.rfind('/') + 1);
+    segment.start_unix_ms = start_unix_ms;
+    segment.duration_ms = duration_ms;
+    segment.bytes = bytes;
+    segment.event_id = event_id;
+    _segment_callback(segment);
+}
+
+} // namespace BoulderAI
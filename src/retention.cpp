@@ -0,0 +1,567 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <unordered_set>
+#include <time.h>
+#include <boost/bind.hpp>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "retention.hpp"
+
+namespace BoulderAI
+{
+
+const char *RetentionManager::OPT_QUOTA_MB = "retention-quota-mb";
+const char *RetentionManager::OPT_MAX_AGE_HOURS = "retention-max-age-hours";
+const char *RetentionManager::OPT_INTERVAL_S = "retention-interval-s";
+
+const uint32_t RetentionManager::DEFAULT_QUOTA_MB = 0;
+const uint32_t RetentionManager::DEFAULT_MAX_AGE_HOURS = 24 * 30;
+const uint32_t RetentionManager::DEFAULT_INTERVAL_S = 10;
+
+uint32_t RetentionManager::_quota_mb = DEFAULT_QUOTA_MB;
+uint32_t RetentionManager::_max_age_hours = DEFAULT_MAX_AGE_HOURS;
+uint32_t RetentionManager::_interval_s = DEFAULT_INTERVAL_S;
+
+const char *RetentionManager::INDEX_FILE = "segments.idx";
+const char *RetentionManager::PROTECTED_FILE = "protected.idx";
+
+// without a quota, recordings may use everything but this share of the file system
+static const int FREE_PERCENT = 10;
+// segments unlinked per pass, so the index lock is never held for long
+static const size_t EVICT_BATCH = 64;
+
+// <linux/ioprio.h> is not exported by every toolchain
+static const int IOPRIO_WHO_PROCESS = 1;
+static const int IOPRIO_CLASS_IDLE = 3;
+static const int IOPRIO_CLASS_SHIFT = 13;
+
+po::options_description RetentionManager::GetOptions()
+{
+    po::options_description desc( "Retention Options" );
+    desc.add_options()
+        ( OPT_QUOTA_MB, po::value<uint32_t>(&_quota_mb)->default_value(DEFAULT_QUOTA_MB),
+          "Space the recordings may use. 0 uses all but 10% of the file system." )
+        ( OPT_MAX_AGE_HOURS, po::value<uint32_t>(&_max_age_hours)->default_value(DEFAULT_MAX_AGE_HOURS),
+          "Recordings older than this are deleted. 0 keeps them until the quota is reached." )
+        ( OPT_INTERVAL_S, po::value<uint32_t>(&_interval_s)->default_value(DEFAULT_INTERVAL_S),
+          "How often the quota and age limits are checked." )
+        ;
+    return desc;
+}
+
+namespace
+{
+
+int64_t unix_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+bool ends_with(const std::string &s, const std::string &suffix)
+{
+    return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+} // namespace
+
+RetentionManager::RetentionManager(const std::string &dir) :
+    _dir(dir),
+    _start_time(time(NULL)),
+    _dir_fd(-1),
+    _running(false),
+    _loaded(false),
+    _index_dirty(false),
+    _bytes(0),
+    _evicted_segments(0),
+    _evicted_bytes(0)
+{
+}
+
+RetentionManager::~RetentionManager()
+{
+    stop();
+}
+
+void RetentionManager::start()
+{
+    if (_thread_ptr.get())
+    {
+        return;
+    }
+
+    mkdir(_dir.c_str(), 0755);
+    _dir_fd = open(_dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (_dir_fd < 0)
+    {
+        std::cout << "Unable to open " << _dir << ", recordings will not be managed: " << strerror(errno) << std::endl;
+        return;
+    }
+    load_protected();
+
+    ScopedLock lock(_mtex);
+    _running = true;
+    _thread_ptr.reset(new boost::thread(boost::bind(&RetentionManager::run, this)));
+}
+
+void RetentionManager::stop()
+{
+    {
+        ScopedLock lock(_mtex);
+        _running = false;
+        _condition.notify_all();
+    }
+
+    if (!_thread_ptr.get())
+    {
+        return;
+    }
+    _thread_ptr->join();
+    _thread_ptr.reset();
+    close(_dir_fd);
+    _dir_fd = -1;
+}
+
+void RetentionManager::add_segment(const RecordedSegment &segment)
+{
+    ScopedLock index_lock(_index_mtex);
+    const std::string index_path = _dir + "/" + INDEX_FILE;
+    FILE *index = fopen(index_path.c_str(), "a");
+    if (index)
+    {
+        fputs(format_segment(segment).c_str(), index);
+        fclose(index);
+    }
+    else
+    {
+        std::cout << "Unable to update " << index_path << std::endl;
+    }
+
+    ScopedLock lock(_mtex);
+    insert_segment(segment);
+    _condition.notify_one();
+}
+
+bool RetentionManager::set_protected(const uint64_t event_id, const bool is_protected)
+{
+    {
+        ScopedLock lock(_mtex);
+        bool found = false;
+        for (SegmentMap::const_iterator itr = _segments.begin(); itr != _segments.end() && !found; ++itr)
+        {
+            found = (itr->second.event_id == event_id);
+        }
+        if (!found)
+        {
+            return false;
+        }
+
+        if (is_protected)
+        {
+            _protected.insert(event_id);
+        }
+        else
+        {
+            _protected.erase(event_id);
+            _condition.notify_one();
+        }
+    }
+    write_protected();
+    return true;
+}
+
+std::vector < RecordedEvent > RetentionManager::get_events()
+{
+    ScopedLock lock(_mtex);
+    std::map < uint64_t, RecordedEvent > events;
+    for (SegmentMap::const_iterator itr = _segments.begin(); itr != _segments.end(); ++itr)
+    {
+        const RecordedSegment &segment = itr->second;
+        RecordedEvent &event = events[segment.event_id];
+        if (event.segments == 0)
+        {
+            event.event_id = segment.event_id;
+            event.start_unix_ms = segment.start_unix_ms;
+            event.is_protected = _protected.count(segment.event_id) > 0;
+        }
+        // segments are visited in start order
+        event.end_unix_ms = segment.start_unix_ms + segment.duration_ms;
+        event.bytes += segment.bytes;
+        event.segments++;
+    }
+
+    std::vector < RecordedEvent > ret;
+    for (std::map < uint64_t, RecordedEvent >::const_iterator itr = events.begin(); itr != events.end(); ++itr)
+    {
+        ret.push_back(itr->second);
+    }
+    return ret;
+}
+
+RetentionStats RetentionManager::get_stats()
+{
+    const uint64_t quota = quota_bytes();
+
+    ScopedLock lock(_mtex);
+    std::set < uint64_t > events;
+    for (SegmentMap::const_iterator itr = _segments.begin(); itr != _segments.end(); ++itr)
+    {
+        events.insert(itr->second.event_id);
+    }
+
+    RetentionStats stats;
+    stats.segments = _segments.size();
+    stats.events = events.size();
+    stats.bytes = _bytes;
+    stats.quota_bytes = quota;
+    stats.oldest_unix_ms = _segments.empty() ? 0 : _segments.begin()->first.first;
+    stats.evicted_segments = _evicted_segments;
+    stats.evicted_bytes = _evicted_bytes;
+    return stats;
+}
+
+void RetentionManager::run()
+{
+    // deleting old recordings must never compete with the recorder for the SD card
+    syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+
+    SegmentMap loaded;
+    load_index(loaded);
+    scan_directory(loaded);
+    {
+        ScopedLock index_lock(_index_mtex);
+        ScopedLock lock(_mtex);
+        // segments added while loading are already in _segments
+        for (SegmentMap::const_iterator itr = loaded.begin(); itr != loaded.end(); ++itr)
+        {
+            insert_segment(itr->second);
+        }
+        _loaded = true;
+        _index_dirty = true;
+        std::cout << "Recordings: " << _segments.size() << " segments, " << _bytes / (1024 * 1024) << " MB in " << _dir << std::endl;
+    }
+
+    while (true)
+    {
+        while (evict())
+        {
+        }
+        if (_index_dirty)
+        {
+            write_index();
+        }
+
+        ScopedLock lock(_mtex);
+        if (!_running)
+        {
+            break;
+        }
+        _condition.timed_wait(lock, boost::posix_time::seconds(_interval_s));
+        if (!_running)
+        {
+            break;
+        }
+    }
+}
+
+void RetentionManager::load_protected()
+{
+    std::ifstream in((_dir + "/" + PROTECTED_FILE).c_str());
+    uint64_t event_id;
+    ScopedLock lock(_mtex);
+    while (in >> event_id)
+    {
+        _protected.insert(event_id);
+    }
+}
+
+void RetentionManager::load_index(SegmentMap &segments)
+{
+    std::ifstream in((_dir + "/" + INDEX_FILE).c_str());
+    std::string line;
+    while (std::getline(in, line))
+    {
+        RecordedSegment segment;
+        if (parse_segment(line, segment))
+        {
+            segments[SegmentKey(segment.start_unix_ms, segment.name)] = segment;
+        }
+    }
+}
+
+void RetentionManager::scan_directory(SegmentMap &segments)
+{
+    /* One pass over the directory entries. Indexed files only need their name, files the
+     * index does not know (e.g. after a power cut) are stat()ed and timed by their name. */
+    std::unordered_set < std::string > indexed;
+    for (SegmentMap::const_iterator itr = segments.begin(); itr != segments.end(); ++itr)
+    {
+        indexed.insert(itr->second.name);
+    }
+
+    DIR *dir = fdopendir(dup(_dir_fd));
+    if (!dir)
+    {
+        return;
+    }
+    rewinddir(dir);
+
+    std::unordered_set < std::string > present;
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL)
+    {
+        std::string name = ent->d_name;
+        if (name.compare(0, 7, "dnncam_") != 0)
+        {
+            continue;
+        }
+
+        struct stat st;
+        if (ends_with(name, ".part"))
+        {
+            // left behind by a crash; the containers are written streamable, so keep what made it
+            if (fstatat(_dir_fd, name.c_str(), &st, 0) != 0 || st.st_mtime >= _start_time)
+            {
+                continue;
+            }
+            const std::string final_name = name.substr(0, name.size() - 5);
+            if (renameat(_dir_fd, name.c_str(), _dir_fd, final_name.c_str()) != 0)
+            {
+                continue;
+            }
+            name = final_name;
+        }
+        else if (!ends_with(name, ".mkv") && !ends_with(name, ".mp4"))
+        {
+            continue;
+        }
+
+        present.insert(name);
+        if (indexed.count(name))
+        {
+            continue;
+        }
+
+        RecordedSegment segment;
+        if (!parse_segment_name(name, segment.start_unix_ms) || fstatat(_dir_fd, name.c_str(), &st, 0) != 0)
+        {
+            continue;
+        }
+        segment.name = name;
+        segment.duration_ms = 0;
+        segment.bytes = st.st_size;
+        segment.event_id = 0;
+        segments[SegmentKey(segment.start_unix_ms, segment.name)] = segment;
+    }
+    closedir(dir);
+
+    // files deleted behind our back, e.g. through cgi-bin/delete
+    for (SegmentMap::iterator itr = segments.begin(); itr != segments.end(); )
+    {
+        if (present.count(itr->second.name))
+        {
+            ++itr;
+        }
+        else
+        {
+            segments.erase(itr++);
+        }
+    }
+}
+
+bool RetentionManager::evict()
+{
+    const uint64_t quota = quota_bytes();
+    const int64_t now = unix_ms();
+    const int64_t max_age_ms = (int64_t)_max_age_hours * 3600 * 1000;
+
+    std::vector < SegmentKey > victims;
+    {
+        ScopedLock lock(_mtex);
+        if (!_loaded)
+        {
+            return false;
+        }
+
+        // oldest first; stop at the first segment that is young enough once under quota
+        uint64_t total = _bytes;
+        for (SegmentMap::const_iterator itr = _segments.begin(); itr != _segments.end() && victims.size() < EVICT_BATCH; ++itr)
+        {
+            const RecordedSegment &segment = itr->second;
+            const bool too_old = max_age_ms > 0 && segment.start_unix_ms + segment.duration_ms < now - max_age_ms;
+            if (total <= quota && !too_old)
+            {
+                break;
+            }
+            if (_protected.count(segment.event_id))
+            {
+                continue;
+            }
+            victims.push_back(itr->first);
+            total -= segment.bytes;
+        }
+    }
+    if (victims.empty())
+    {
+        return false;
+    }
+
+    std::vector < SegmentKey > removed;
+    for (size_t i = 0; i < victims.size(); i++)
+    {
+        if (unlinkat(_dir_fd, victims[i].second.c_str(), 0) == 0 || errno == ENOENT)
+        {
+            removed.push_back(victims[i]);
+        }
+        else
+        {
+            std::cout << "Unable to delete recording " << victims[i].second << ": " << strerror(errno) << std::endl;
+        }
+    }
+
+    ScopedLock lock(_mtex);
+    for (size_t i = 0; i < removed.size(); i++)
+    {
+        SegmentMap::iterator itr = _segments.find(removed[i]);
+        if (itr == _segments.end())
+        {
+            continue;
+        }
+        _bytes -= itr->second.bytes;
+        _evicted_bytes += itr->second.bytes;
+        _evicted_segments++;
+        _segments.erase(itr);
+    }
+    _index_dirty = true;
+    return removed.size() == EVICT_BATCH;
+}
+
+void RetentionManager::write_index()
+{
+    // rewrite through a temporary file, so a power cut leaves either index intact
+    ScopedLock index_lock(_index_mtex);
+    std::ostringstream oss;
+    {
+        ScopedLock lock(_mtex);
+        for (SegmentMap::const_iterator itr = _segments.begin(); itr != _segments.end(); ++itr)
+        {
+            oss << format_segment(itr->second);
+        }
+        _index_dirty = false;
+    }
+
+    const std::string tmp_name = std::string(INDEX_FILE) + ".tmp";
+    const int fd = openat(_dir_fd, tmp_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        return;
+    }
+    const std::string data = oss.str();
+    const bool ok = write(fd, data.data(), data.size()) == (ssize_t)data.size() && fdatasync(fd) == 0;
+    close(fd);
+    if (!ok || renameat(_dir_fd, tmp_name.c_str(), _dir_fd, INDEX_FILE) != 0)
+    {
+        std::cout << "Unable to rewrite " << _dir << "/" << INDEX_FILE << std::endl;
+        unlinkat(_dir_fd, tmp_name.c_str(), 0);
+    }
+}
+
+void RetentionManager::write_protected()
+{
+    std::ostringstream oss;
+    {
+        ScopedLock lock(_mtex);
+        for (std::set < uint64_t >::const_iterator itr = _protected.begin(); itr != _protected.end(); ++itr)
+        {
+            oss << *itr << "\n";
+        }
+    }
+
+    const std::string path = _dir + "/" + PROTECTED_FILE;
+    std::ofstream out((path + ".tmp").c_str());
+    out << oss.str();
+    out.close();
+    if (!out || rename((path + ".tmp").c_str(), path.c_str()) != 0)
+    {
+        std::cout << "Unable to update " << path << std::endl;
+    }
+}
+
+void RetentionManager::insert_segment(const RecordedSegment &segment)
+{
+    const SegmentKey key(segment.start_unix_ms, segment.name);
+    SegmentMap::iterator itr = _segments.find(key);
+    if (itr != _segments.end())
+    {
+        _bytes -= itr->second.bytes;
+    }
+    _segments[key] = segment;
+    _bytes += segment.bytes;
+}
+
+uint64_t RetentionManager::quota_bytes()
+{
+    if (_quota_mb > 0)
+    {
+        return (uint64_t)_quota_mb * 1024 * 1024;
+    }
+
+    // what the recordings use now plus what is free, less the reserve
+    struct statvfs fs;
+    if (fstatvfs(_dir_fd, &fs) != 0)
+    {
+        return UINT64_MAX;
+    }
+    const uint64_t size = (uint64_t)fs.f_blocks * fs.f_frsize;
+    const uint64_t available = (uint64_t)fs.f_bavail * fs.f_frsize;
+    const uint64_t reserve = size * FREE_PERCENT / 100;
+
+    ScopedLock lock(_mtex);
+    return _bytes + available > reserve ? _bytes + available - reserve : 0;
+}
+
+std::string RetentionManager::format_segment(const RecordedSegment &segment)
+{
+    std::ostringstream oss;
+    oss << segment.name << "\t" << segment.start_unix_ms << "\t" << segment.duration_ms << "\t"
+        << segment.bytes << "\t" << segment.event_id << "\n";
+    return oss.str();
+}
+
+bool RetentionManager::parse_segment(const std::string &line, RecordedSegment &segment)
+{
+    std::istringstream iss(line);
+    iss >> segment.name >> segment.start_unix_ms >> segment.duration_ms >> segment.bytes >> segment.event_id;
+    return !iss.fail();
+}
+
+bool RetentionManager::parse_segment_name(const std::string &name, int64_t &start_unix_ms)
+{
+    // dnncam_YYYYmmdd_HHMMSS_mmm.ext, local time
+    struct tm tm;
+    int ms;
+    memset(&tm, 0, sizeof(tm));
+    if (sscanf(name.c_str(), "dnncam_%4d%2d%2d_%2d%2d%2d_%3d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+               &tm.tm_hour, &tm.tm_min, &tm.tm_sec, &ms) != 7)
+    {
+        return false;
+    }
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    tm.tm_isdst = -1;
+    start_unix_ms = (int64_t)mktime(&tm) * 1000 + ms;
+    return true;
+}
+
+} // namespace BoulderAI
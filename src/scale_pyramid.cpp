@@ -0,0 +1,149 @@
+#include <cstring>
+#include <iostream>
+
+#include "nvbuf_utils.h"
+
+#include "scale_pyramid.hpp"
+
+namespace BoulderAI
+{
+
+ScalePyramid::ScalePyramid(const int width, const int height) :
+    _width(width),
+    _height(height),
+    _use_hw(true),
+    _levels(MAX_LEVELS + 1),
+    _hw_fds(MAX_LEVELS + 1, -1)
+{
+    for (int n = 1; n <= MAX_LEVELS; n++)
+    {
+        _levels[n].resize(level_width(width, n), level_height(height, n));
+    }
+    std::cout << "Scale pyramid CPU fallback uses " << Scaler::simd_name() << std::endl;
+}
+
+ScalePyramid::~ScalePyramid()
+{
+    destroy_hw_buffers();
+}
+
+int ScalePyramid::level_width(const int width, const int n)
+{
+    int w = width;
+    for (int i = 0; i < n; i++)
+    {
+        w = Scaler::half_dim(w);
+    }
+    return w;
+}
+
+int ScalePyramid::level_height(const int height, const int n)
+{
+    return level_width(height, n);
+}
+
+void ScalePyramid::build(const FrameCollection &frame_col, const unsigned level_mask)
+{
+    int max_level = 0;
+    for (int n = 1; n <= MAX_LEVELS; n++)
+    {
+        if (level_mask & (1u << n))
+        {
+            max_level = n;
+        }
+    }
+    if (max_level == 0)
+    {
+        return;
+    }
+
+    if (_use_hw && frame_col.yuv_fd >= 0)
+    {
+        bool ok = true;
+        for (int n = 1; n <= max_level && ok; n++)
+        {
+            if (level_mask & (1u << n))
+            {
+                ok = hw_scale(frame_col.yuv_fd, n);
+            }
+        }
+        if (ok)
+        {
+            return;
+        }
+        std::cout << "Hardware scaling failed, falling back to CPU scaling." << std::endl;
+        _use_hw = false;
+        destroy_hw_buffers();
+    }
+
+    // CPU path: halve the strided capture planes once, then keep halving the previous level
+    cv::Mat frame_y = frame_col.frame_y->to_mat();
+    cv::Mat frame_u = frame_col.frame_u->to_mat();
+    cv::Mat frame_v = frame_col.frame_v->to_mat();
+    I420Image &first = _levels[1];
+    Scaler::half_plane(frame_y.data, frame_y.step, first.y(), first.width, first.width, first.height);
+    Scaler::half_plane(frame_u.data, frame_u.step, first.u(), first.width / 2, first.width / 2, first.height / 2);
+    Scaler::half_plane(frame_v.data, frame_v.step, first.v(), first.width / 2, first.width / 2, first.height / 2);
+
+    for (int n = 2; n <= max_level; n++)
+    {
+        Scaler::half_i420(_levels[n - 1], _levels[n]);
+    }
+}
+
+bool ScalePyramid::hw_scale(const int src_fd, const int n)
+{
+    I420Image &dst = _levels[n];
+    if (_hw_fds[n] < 0)
+    {
+        if (NvBufferCreate(&_hw_fds[n], dst.width, dst.height, NvBufferLayout_Pitch, NvBufferColorFormat_YUV420) != 0)
+        {
+            _hw_fds[n] = -1;
+            return false;
+        }
+    }
+
+    NvBufferTransformParams transform_params;
+    memset(&transform_params, 0, sizeof(transform_params));
+    transform_params.transform_flag = NVBUFFER_TRANSFORM_FILTER;
+    transform_params.transform_filter = NvBufferTransform_Filter_Smart;
+    if (NvBufferTransform(src_fd, _hw_fds[n], &transform_params) != 0)
+    {
+        return false;
+    }
+
+    NvBufferParams params;
+    NvBufferGetParams(_hw_fds[n], &params);
+    uint8_t *dst_planes[3] = { dst.y(), dst.u(), dst.v() };
+    const int widths[3] = { dst.width, dst.width / 2, dst.width / 2 };
+    const int heights[3] = { dst.height, dst.height / 2, dst.height / 2 };
+    for (int p = 0; p < 3; p++)
+    {
+        void *plane;
+        if (NvBufferMemMap(_hw_fds[n], p, NvBufferMem_Read, &plane) != 0)
+        {
+            return false;
+        }
+        NvBufferMemSyncForCpu(_hw_fds[n], p, &plane);
+        for (int j = 0; j < heights[p]; j++)
+        {
+            memcpy(dst_planes[p] + j * widths[p], (uint8_t *)plane + j * params.pitch[p], widths[p]);
+        }
+        NvBufferMemUnMap(_hw_fds[n], p, &plane);
+    }
+    return true;
+}
+
+void ScalePyramid::destroy_hw_buffers()
+{
+    for (size_t n = 0; n < _hw_fds.size(); n++)
+    {
+        if (_hw_fds[n] >= 0)
+        {
+            NvBufferDestroy(_hw_fds[n]);
+            _hw_fds[n] = -1;
+        }
+    }
+}
+
+} // namespace BoulderAI
@@ -0,0 +1,105 @@
+#include "scaler.hpp"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define SCALER_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define SCALER_SSE2 1
+#endif
+
+namespace BoulderAI
+{
+
+void Scaler::half_plane_c(const uint8_t *src, const int src_stride,
+                          uint8_t *dst, const int dst_stride, const int dst_w, const int dst_h)
+{
+    for (int j = 0; j < dst_h; j++)
+    {
+        const uint8_t *row0 = src + (2 * j) * src_stride;
+        const uint8_t *row1 = row0 + src_stride;
+        uint8_t *out = dst + j * dst_stride;
+        for (int i = 0; i < dst_w; i++)
+        {
+            out[i] = (row0[2 * i] + row0[2 * i + 1] + row1[2 * i] + row1[2 * i + 1] + 2) >> 2;
+        }
+    }
+}
+
+void Scaler::half_plane(const uint8_t *src, const int src_stride,
+                        uint8_t *dst, const int dst_stride, const int dst_w, const int dst_h)
+{
+#if defined(SCALER_NEON)
+    for (int j = 0; j < dst_h; j++)
+    {
+        const uint8_t *row0 = src + (2 * j) * src_stride;
+        const uint8_t *row1 = row0 + src_stride;
+        uint8_t *out = dst + j * dst_stride;
+        int i = 0;
+        for (; i + 16 <= dst_w; i += 16)
+        {
+            // pairwise add the horizontal neighbours of both rows, then round-shift by 2
+            uint16x8_t lo = vpaddlq_u8(vld1q_u8(row0 + 2 * i));
+            uint16x8_t hi = vpaddlq_u8(vld1q_u8(row0 + 2 * i + 16));
+            lo = vpadalq_u8(lo, vld1q_u8(row1 + 2 * i));
+            hi = vpadalq_u8(hi, vld1q_u8(row1 + 2 * i + 16));
+            vst1q_u8(out + i, vcombine_u8(vrshrn_n_u16(lo, 2), vrshrn_n_u16(hi, 2)));
+        }
+        for (; i < dst_w; i++)
+        {
+            out[i] = (row0[2 * i] + row0[2 * i + 1] + row1[2 * i] + row1[2 * i + 1] + 2) >> 2;
+        }
+    }
+#elif defined(SCALER_SSE2)
+    const __m128i low_bytes = _mm_set1_epi16(0x00ff);
+    const __m128i two = _mm_set1_epi16(2);
+    for (int j = 0; j < dst_h; j++)
+    {
+        const uint8_t *row0 = src + (2 * j) * src_stride;
+        const uint8_t *row1 = row0 + src_stride;
+        uint8_t *out = dst + j * dst_stride;
+        int i = 0;
+        for (; i + 16 <= dst_w; i += 16)
+        {
+            __m128i sums[2];
+            for (int k = 0; k < 2; k++)
+            {
+                const __m128i a = _mm_loadu_si128((const __m128i *)(row0 + 2 * i + 16 * k));
+                const __m128i b = _mm_loadu_si128((const __m128i *)(row1 + 2 * i + 16 * k));
+                // even bytes + odd bytes of both rows, in 16 bits
+                __m128i s = _mm_add_epi16(_mm_and_si128(a, low_bytes), _mm_srli_epi16(a, 8));
+                s = _mm_add_epi16(s, _mm_add_epi16(_mm_and_si128(b, low_bytes), _mm_srli_epi16(b, 8)));
+                sums[k] = _mm_srli_epi16(_mm_add_epi16(s, two), 2);
+            }
+            _mm_storeu_si128((__m128i *)(out + i), _mm_packus_epi16(sums[0], sums[1]));
+        }
+        for (; i < dst_w; i++)
+        {
+            out[i] = (row0[2 * i] + row0[2 * i + 1] + row1[2 * i] + row1[2 * i + 1] + 2) >> 2;
+        }
+    }
+#else
+    half_plane_c(src, src_stride, dst, dst_stride, dst_w, dst_h);
+#endif
+}
+
+void Scaler::half_i420(const I420Image &src, I420Image &dst)
+{
+    dst.resize(half_dim(src.width), half_dim(src.height));
+    half_plane(src.y(), src.width, dst.y(), dst.width, dst.width, dst.height);
+    half_plane(src.u(), src.width / 2, dst.u(), dst.width / 2, dst.width / 2, dst.height / 2);
+    half_plane(src.v(), src.width / 2, dst.v(), dst.width / 2, dst.width / 2, dst.height / 2);
+}
+
+const char *Scaler::simd_name()
+{
+#if defined(SCALER_NEON)
+    return "NEON";
+#elif defined(SCALER_SSE2)
+    return "SSE2";
+#else
+    return "none";
+#endif
+}
+
+} // namespace BoulderAI
@@ -7,35 +7,131 @@
 #define NOMINMAX
 #endif
 
+#include <algorithm>
+#include <cstring>
 #include <sstream>
 #include <stdexcept>
+#include <time.h>
 
 #include <opencv/highgui.h>
 
 #include "stream.hpp"
+#include "colorconv.hpp"
+#include "trace.hpp"
+#include "async_log.hpp"
 
 namespace BoulderAI
 {
 
+const char *Stream::OPT_CLIENT_QUEUE_FRAMES = "stream-client-queue-frames";
+const char *Stream::OPT_CLIENT_MAX_BYTES = "stream-client-max-bytes";
+const char *Stream::OPT_BITRATE = "stream-bitrate";
+const char *Stream::OPT_MOUNTS = "stream-mount";
+const char *Stream::OPT_LATENCY_MS = "stream-latency-ms";
+
+const uint32_t Stream::DEFAULT_CLIENT_QUEUE_FRAMES = 4;
+const uint64_t Stream::DEFAULT_CLIENT_MAX_BYTES = 0;
+const uint32_t Stream::DEFAULT_BITRATE = 0;
+const std::vector < std::string > Stream::DEFAULT_MOUNTS = {"/stream/1080,2,1,4000000",
+                                                            "/stream/540,4,2,1000000",
+                                                            "/stream/gray,4,1,500000,gray"};
+const uint32_t Stream::DEFAULT_LATENCY_MS = 100;
+
+uint32_t Stream::_client_queue_frames = DEFAULT_CLIENT_QUEUE_FRAMES;
+uint64_t Stream::_client_max_bytes = DEFAULT_CLIENT_MAX_BYTES;
+uint32_t Stream::_bitrate = DEFAULT_BITRATE;
+std::vector < std::string > Stream::_mounts = DEFAULT_MOUNTS;
+uint32_t Stream::_latency_ms = DEFAULT_LATENCY_MS;
+
 std::mutex Stream::_context_mutex;
 
+po::options_description Stream::GetOptions()
+{
+    po::options_description desc( "Stream Options" );
+    desc.add_options()
+        ( OPT_CLIENT_QUEUE_FRAMES, po::value<uint32_t>(&_client_queue_frames)->default_value(DEFAULT_CLIENT_QUEUE_FRAMES),
+          "Maximum number of frames queued for each RTSP client. The oldest frame is dropped when a client falls behind." )
+        ( OPT_CLIENT_MAX_BYTES, po::value<uint64_t>(&_client_max_bytes)->default_value(DEFAULT_CLIENT_MAX_BYTES),
+          "Maximum number of bytes queued for each RTSP client, also used as the appsrc max-bytes. "
+          "If 0, two full frames are allowed." )
+        ( OPT_BITRATE, po::value<uint32_t>(&_bitrate)->default_value(DEFAULT_BITRATE),
+          "Encoder bitrate of the full resolution /stream mount. If 0, the encoder default is used." )
+        ( OPT_MOUNTS, po::value<std::vector < std::string > >(&_mounts)->composing()->default_value(
+              DEFAULT_MOUNTS, "/stream/1080,2,1,4000000 /stream/540,4,2,1000000 /stream/gray,4,1,500000,gray"),
+          "Additional RTSP mount, given as path,scale,decimation,bitrate[,gray]. The frame is downscaled by "
+          "scale (1, 2, 4, 8 or 16), only every decimation-th frame is sent, and a bitrate of 0 uses the encoder "
+          "default. May be given more than once." )
+        ( OPT_LATENCY_MS, po::value<uint32_t>(&_latency_ms)->default_value(DEFAULT_LATENCY_MS),
+          "Latency reported by the RTSP sources, in milliseconds. Frames are timestamped with their capture "
+          "time, so this must cover the time from exposure until the frame is pushed to the stream." )
+        ;
+    return desc;
+}
+
+bool Stream::parse_mount(const std::string &spec, MountConfig &mount)
+{
+    std::vector < std::string > fields;
+    std::istringstream iss(spec);
+    std::string field;
+    while (std::getline(iss, field, ','))
+    {
+        fields.push_back(field);
+    }
+    if (fields.size() < 4 || fields.size() > 5 || fields[0].empty() || fields[0][0] != '/')
+    {
+        return false;
+    }
+
+    try
+    {
+        const int scale = std::stoi(fields[1]);
+        mount.path = fields[0];
+        mount.level = -1;
+        for (int n = 0; n <= ScalePyramid::MAX_LEVELS; n++)
+        {
+            if (scale == (1 << n))
+            {
+                mount.level = n;
+            }
+        }
+        mount.decimation = std::stoi(fields[2]);
+        mount.bitrate = std::stoul(fields[3]);
+        mount.gray = (fields.size() == 5 && fields[4] == "gray");
+    }
+    catch (const std::exception &e)
+    {
+        return false;
+    }
+
+    return mount.level >= 0 && mount.decimation >= 1 && (fields.size() == 4 || mount.gray);
+}
+
 Stream::Stream(const int width, const int height, const std::string host, const int port) :
     _send_frames(false),
     _timestamp(0),
     _host(host), 
-    _port(port)
+    _port(port),
+    _width(width),
+    _height(height),
+    _pyramid(width, height),
+    _frame_count(0),
+    _clock(NULL),
+    _clock_mapped(false),
+    _clock_offset(0)
 {
-    _streamContext.width = width;
-    _streamContext.height = height;
     GstRTSPServer *server;
     GstRTSPMountPoints *mounts;
-    GstRTSPMediaFactory *factory;
     /* init GStreamer */
     int argc=0;
     gst_init(&argc, NULL);
 
     _loop = g_main_loop_new (NULL, FALSE); 
 
+    memset(&_clock_info, 0, sizeof(_clock_info));
+    /* Every media runs on the (monotonic) system clock, so the capture times map the same way for
+     * all clients and steps of the wall clock never reach the timestamps. */
+    _clock = gst_system_clock_obtain();
+
 
     /* create a server instance */
     server = gst_rtsp_server_new ();
@@ -44,24 +140,27 @@ Stream::Stream(const int width, const int height, const std::string host, const
     * that be used to map uri mount points to media factories */
     mounts = gst_rtsp_server_get_mount_points (server);
 
-    factory = gst_rtsp_media_factory_new ();
-
-    std::cout << "Stream image size: " << _streamContext.width << "x" << _streamContext.height << std::endl; 
-    /*g_object_set(G_OBJECT (clockoverlay), 
-            "halignment", 2, 
-            "valignment", 1, 
-            "color", 4278255359,
-            NULL);
-*/
-    gst_rtsp_media_factory_set_launch (factory,
-        "( appsrc name=mysrc ! clockoverlay halignment=2 valignment=1 ! omxh265enc ! rtph265pay name=pay0 config-interval=3 pt=96 )");
-    g_signal_connect(factory, "media-configure", (GCallback) media_configure, (gpointer)(&_streamContext));
-//gst_rtsp_media_factory_set_launch (factory,
-//            "( videotestsrc horizontal-speed=5 is-live=1 ! clockoverlay halignment=0 valignment=2 ! omxh264enc ! rtph264pay name=pay0 pt=96 )");
-//gst_rtsp_media_factory_set_shared (factory, TRUE);
-
-    /* attach the factory to the /stream url */
-    gst_rtsp_mount_points_add_factory (mounts, "/stream", factory);
+    std::cout << "Stream image size: " << _width << "x" << _height << std::endl; 
+
+    /* attach the full resolution stream to the /stream url */
+    MountConfig main_mount;
+    main_mount.path = "/stream";
+    main_mount.level = 0;
+    main_mount.decimation = 1;
+    main_mount.bitrate = _bitrate;
+    main_mount.gray = false;
+    add_mount(mounts, main_mount);
+
+    for (size_t i = 0; i < _mounts.size(); i++)
+    {
+        MountConfig mount;
+        if (!parse_mount(_mounts[i], mount))
+        {
+            std::cout << "Ignoring invalid stream mount: " << _mounts[i] << std::endl;
+            continue;
+        }
+        add_mount(mounts, mount);
+    }
 
     /* don't need the ref to the mapper anymore */
     g_object_unref (mounts);
@@ -70,6 +169,44 @@ Stream::Stream(const int width, const int height, const std::string host, const
     gst_rtsp_server_attach (server, NULL);
 }
 
+void Stream::add_mount(GstRTSPMountPoints *mounts, const MountConfig &mount)
+{
+    StreamContextPtr sc(new streamContext());
+    sc->mount = mount;
+    sc->width = ScalePyramid::level_width(_width, mount.level);
+    sc->height = ScalePyramid::level_height(_height, mount.level);
+    sc->max_frames = std::max < uint32_t > (_client_queue_frames, 1);
+    sc->max_bytes = _client_max_bytes;
+    if (sc->max_bytes == 0)
+    {
+        sc->max_bytes = 2 * (sc->width * sc->height * 3 / 2);
+    }
+    sc->next_client_id = 0;
+    sc->last_frame_number = 0;
+    sc->last_capture_time = GST_CLOCK_TIME_NONE;
+    _contexts.push_back(sc);
+
+    std::ostringstream encoder;
+    encoder << "omxh265enc";
+    if (mount.bitrate > 0)
+    {
+        encoder << " bitrate=" << mount.bitrate;
+    }
+    std::ostringstream launch;
+    launch << "( appsrc name=mysrc ! clockoverlay halignment=2 valignment=1 ! " << encoder.str()
+           << " ! rtph265pay name=pay0 config-interval=3 pt=96 )";
+
+    std::cout << "Stream mount " << mount.path << ": " << sc->width << "x" << sc->height
+              << ", every " << mount.decimation << " frame(s)"
+              << (mount.gray ? ", gray" : "") << std::endl;
+
+    GstRTSPMediaFactory *factory = gst_rtsp_media_factory_new ();
+    gst_rtsp_media_factory_set_launch (factory, launch.str().c_str());
+    gst_rtsp_media_factory_set_clock (factory, _clock);
+    g_signal_connect(factory, "media-configure", (GCallback) media_configure, (gpointer)(sc.get()));
+    gst_rtsp_mount_points_add_factory (mounts, mount.path.c_str(), factory);
+}
+
 void Stream::media_configure(GstRTSPMediaFactory * factory, GstRTSPMedia * media, gpointer user_data)
 {
     std::lock_guard<std::mutex> lg(_context_mutex);
@@ -85,10 +222,36 @@ void Stream::media_configure(GstRTSPMediaFactory * factory, GstRTSPMedia * media
                 "framerate", GST_TYPE_FRACTION, 0, 1,
                 NULL),
             "stream-type", 0,
-            "min-latency", gst_util_uint64_scale_int (1, GST_SECOND, 30),
+            "min-latency", (gint64)(_latency_ms * GST_MSECOND),
             "is-live", TRUE,
             "format", GST_FORMAT_TIME, NULL);
-    sc->elementMap.insert(std::make_pair(appsrc, element));
+
+    StreamClientPtr client(new StreamClient(appsrc, element, sc->next_client_id++, sc->max_frames, sc->max_bytes));
+    client->start();
+    sc->clients.insert(std::make_pair(appsrc, client));
+
+    /* The rtpbin is only added to the media pipeline once the media is prepared */
+    GstElement *pipeline = GST_ELEMENT(gst_element_get_parent(element));
+    if (pipeline)
+    {
+        g_signal_connect(pipeline, "element-added", (GCallback) element_added, NULL);
+        gst_object_unref(pipeline);
+    }
+}
+
+void Stream::element_added(GstBin * bin, GstElement * element, gpointer user_data)
+{
+    GstElementFactory *factory = gst_element_get_factory(element);
+    if (!factory || strcmp(GST_OBJECT_NAME(factory), "rtpbin") != 0)
+    {
+        return;
+    }
+    /* Sender reports take the wall clock from the realtime clock when they are sent and pair it
+     * with the RTP time of that running time, the capture time, rather than the send time, so an
+     * RTP timestamp maps to the wall clock time of its exposure. A step of the wall clock only
+     * moves the reports that follow it. */
+    gst_util_set_object_arg(G_OBJECT(element), "ntp-time-source", "ntp");
+    g_object_set(G_OBJECT(element), "rtcp-sync-send-time", FALSE, NULL);
 }
 
 void Stream::start()
@@ -113,34 +276,35 @@ void Stream::stop()
     _thread_ptr.reset();
 }
 
-void Stream::push_frame(const FrameCollection frame_col)
+GstBuffer *Stream::make_buffer(const FrameCollection &frame_col, const streamContext &sc)
 {
-    std::lock_guard<std::mutex> lg(_context_mutex);
-    if(_streamContext.elementMap.empty()) return;
-
-    cv::Mat frame_y = frame_col.frame_y->to_mat();
-    cv::Mat frame_u = frame_col.frame_u->to_mat();
-    cv::Mat frame_v = frame_col.frame_v->to_mat();
-    const guint size = frame_y.rows * frame_y.cols * 3/2;
-    
-    auto itr = _streamContext.elementMap.begin();
-    while (_streamContext.elementMap.end() != itr) {
-        GstBuffer *buffer;
-        GstFlowReturn ret;
-        buffer = gst_buffer_new_allocate (NULL, size, NULL);
-        //gst_buffer_memset (buffer, 0, 0xff, size);
- 
-        //memcpy(GST_BUFFER_DATA(buffer), frame.data, GST_BUFFER_SIZE(buffer));
-        /* I420 => Y frame followed by 2x2 subsampled U/V frame
-        * set the U/V to 128 for black & white */
-        GstMapInfo map;
-        if (gst_buffer_map (buffer, &map, GST_MAP_READ))
+    const guint size = sc.width * sc.height * 3/2;
+    const guint y_size = sc.width * sc.height;
+    GstBuffer *buffer = gst_buffer_new_allocate (NULL, size, NULL);
+
+    /* I420 => Y frame followed by 2x2 subsampled U/V frame
+     * set the U/V to 128 for black & white */
+    GstMapInfo map;
+    if (!gst_buffer_map (buffer, &map, GST_MAP_WRITE))
+    {
+        AsyncLog::write(AsyncLog::LOG_ERROR, "stream", "gst_buffer_map error");
+        gst_buffer_unref(buffer);
+        return NULL;
+    }
+
+    if (sc.mount.level == 0)
+    {
+        cv::Mat frame_y = frame_col.frame_y->to_mat();
+        cv::Mat frame_u = frame_col.frame_u->to_mat();
+        cv::Mat frame_v = frame_col.frame_v->to_mat();
+
+        // the data produced by libargus has stride != width, so we must copy by row...
+        for(int j = 0; j < frame_y.rows; j++)
+        {
+            memcpy(map.data + j * frame_y.cols, frame_y.row(j).data, frame_y.cols);
+        }
+        if (!sc.mount.gray)
         {
-            // the data produced by libargus has stride != width, so we must copy by row...
-            for(int j = 0; j < frame_y.rows; j++)
-            {
-                memcpy(map.data + j * frame_y.cols, frame_y.row(j).data, frame_y.cols);
-            }
             for(int j = 0; j < frame_u.rows; j++)
             {
                 memcpy(map.data + frame_y.rows * frame_y.cols + j * frame_u.cols, frame_u.row(j).data, frame_u.cols);
@@ -149,45 +313,179 @@ void Stream::push_frame(const FrameCollection frame_col)
             {
                 memcpy(map.data + frame_y.rows * frame_y.cols + frame_u.rows * frame_u.cols + j * frame_v.cols, frame_v.row(j).data, frame_v.cols);
             }
-            
-            gst_buffer_unmap (buffer, &map);
         }
-        else {
-            std::cout << "gst_buffer_map error" << std::endl;
+    }
+    else
+    {
+        // pyramid levels are already packed I420
+        const I420Image &level = _pyramid.level(sc.mount.level);
+        memcpy(map.data, level.data.data(), sc.mount.gray ? y_size : size);
+    }
+
+    if (sc.mount.gray)
+    {
+        memset(map.data + y_size, 128, size - y_size);
+    }
+
+    gst_buffer_unmap (buffer, &map);
+    return buffer;
+}
+
+void Stream::push_frame(const FrameCollection frame_col)
+{
+    const uint64_t frame_count = _frame_count++;
+
+    /* Only mounts with clients, on the frames their decimation lets through, cost anything */
+    std::vector < StreamContextPtr > active;
+    unsigned level_mask = 0;
+    {
+        std::lock_guard<std::mutex> lg(_context_mutex);
+        for (size_t i = 0; i < _contexts.size(); i++) {
+            if (!_contexts[i]->clients.empty() && frame_count % _contexts[i]->mount.decimation == 0) {
+                active.push_back(_contexts[i]);
+                level_mask |= 1u << _contexts[i]->mount.level;
+            }
         }
-        
-        GST_ELEMENT_CLOCK(itr->first);
-        const GstClockTime now = gst_clock_get_time(GST_ELEMENT_CLOCK(itr->first)) - gst_element_get_base_time(itr->first);
-        GST_BUFFER_PTS(buffer) = now;
+    }
+    if (active.empty()) return;
+
+    /* each pyramid level is computed once per frame, however many mounts and clients use it */
+    {
+        TraceSpan span("scale", frame_col.frame_number);
+        _pyramid.build(frame_col, level_mask);
+    }
+
+    const GstClockTime pts = capture_time(frame_col);
 
-        g_signal_emit_by_name (itr->first, "push-buffer", buffer, &ret);
+    std::vector < StreamClientPtr > disconnected;
+    for (size_t i = 0; i < active.size(); i++) {
+        /* The frame is copied once per mount and the buffer is shared by every client of
+         * the mount; each client stamps and pushes it from its own thread. */
+        TraceSpan copy_span("copy", frame_col.frame_number);
+        GstBuffer *buffer = make_buffer(frame_col, *active[i]);
+        copy_span.end();
+        if (!buffer) continue;
+
+        {
+            std::lock_guard<std::mutex> lg(_context_mutex);
+            /* The shared buffer carries the absolute clock time of the capture, each client turns it
+             * into running time of its own pipeline. A gap in the frame numbers beyond the mount's
+             * decimation means frames were lost upstream. */
+            streamContext &sc = *active[i];
+            GST_BUFFER_PTS(buffer) = pts;
+            GST_BUFFER_OFFSET(buffer) = frame_col.frame_number;
+            if (GST_CLOCK_TIME_IS_VALID(sc.last_capture_time) && pts > sc.last_capture_time) {
+                GST_BUFFER_DURATION(buffer) = pts - sc.last_capture_time;
+            }
+            if (sc.last_frame_number != 0 && frame_col.frame_number != 0 &&
+                frame_col.frame_number - sc.last_frame_number > (uint64_t)sc.mount.decimation) {
+                GST_BUFFER_FLAG_SET(buffer, GST_BUFFER_FLAG_DISCONT);
+            }
+            sc.last_capture_time = pts;
+            sc.last_frame_number = frame_col.frame_number;
+
+            ClientMap &clients = sc.clients;
+            auto itr = clients.begin();
+            while (clients.end() != itr) {
+                if (!itr->second->is_alive()) {
+                    disconnected.push_back(itr->second);
+                    itr = clients.erase(itr);
+                } else {
+                    itr->second->enqueue(buffer);
+                    ++itr;
+                }
+            }
+        }
         gst_buffer_unref(buffer);
+    }
+
+    // joining the client threads happens outside of the lock
+    disconnected.clear();
+}
+
+void Stream::rgb_to_i420(unsigned char *rgb, unsigned char *yuv420, int width, int height)
+{
+    // OpenCV order, packed BGR
+    unsigned char *u = yuv420 + width * height;
+    unsigned char *v = u + (width / 2) * (height / 2);
+    ColorConv::bgr_to_i420(rgb, width * 3, yuv420, width, u, width / 2, v, width / 2, width, height);
+}
 
-        if (ret != GST_FLOW_OK) {
-            std::cout << "Something went wrong while streaming(most likely client disconnected): " << ret << std::endl;
-            gst_object_unref(itr->first);
-            gst_object_unref(itr->second);
-            auto erase = itr;
-            ++itr;
-            _streamContext.elementMap.erase(erase);
-        } else {
-            ++itr;
+void Stream::rgba_to_i420(unsigned char *rgb, unsigned char *yuv420, int width, int height)
+{
+    unsigned char *u = yuv420 + width * height;
+    unsigned char *v = u + (width / 2) * (height / 2);
+    ColorConv::rgba_to_i420(rgb, width * 4, yuv420, width, u, width / 2, v, width / 2, width, height);
+}
+
+inline void Stream::rgb_to_yuv(unsigned char b, unsigned char g, unsigned char r, unsigned char & y, unsigned char & u, unsigned char & v)
+{
+    y = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+    u = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+    v = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+}
+
+GstClockTime Stream::capture_time(const FrameCollection &frame_col)
+{
+    const GstClockTime now = gst_clock_get_time(_clock);
+    if (frame_col.sensor_timestamp == 0)
+    {
+        // no capture metadata, the best we can do is the push time
+        return now;
+    }
+
+    /* The sensor timestamps are CLOCK_MONOTONIC, which the system clock normally is as well.
+     * Measure the offset between the two once, rather than per frame, so worker jitter
+     * never ends up in the timestamps. */
+    if (!_clock_mapped)
+    {
+        struct timespec mono;
+        clock_gettime(CLOCK_MONOTONIC, &mono);
+        _clock_offset = GST_CLOCK_DIFF(GST_TIMESPEC_TO_TIME(mono), gst_clock_get_time(_clock));
+        _clock_mapped = true;
+        std::cout << "Stream clock offset to sensor timestamps: " << _clock_offset << " ns" << std::endl;
+    }
+    const GstClockTime pts = frame_col.sensor_timestamp + _clock_offset;
+
+    struct timespec real;
+    clock_gettime(CLOCK_REALTIME, &real);
+    std::lock_guard<std::mutex> lg(_context_mutex);
+    _clock_info.frame_number = frame_col.frame_number;
+    _clock_info.sensor_timestamp = frame_col.sensor_timestamp;
+    _clock_info.clock_time = pts;
+    _clock_info.unix_time = (int64_t)GST_TIMESPEC_TO_TIME(real) - GST_CLOCK_DIFF(pts, now);
+
+    return pts;
+}
+
+StreamClockInfo Stream::get_clock_info()
+{
+    std::lock_guard<std::mutex> lg(_context_mutex);
+    return _clock_info;
+}
+
+std::vector < StreamClientStats > Stream::get_client_stats()
+{
+    std::vector < StreamClientStats > ret;
+    std::lock_guard<std::mutex> lg(_context_mutex);
+    for (size_t i = 0; i < _contexts.size(); i++) {
+        for (auto itr = _contexts[i]->clients.begin(); itr != _contexts[i]->clients.end(); ++itr) {
+            StreamClientStats stats = itr->second->get_stats();
+            stats.mount = _contexts[i]->mount.path;
+            ret.push_back(stats);
         }
     }
+    return ret;
 }
 
 Stream::~Stream() 
 {
     stop(); 
-    auto itr = _streamContext.elementMap.begin();
-    while (_streamContext.elementMap.end() != itr) {
-        auto erase = itr;
-        ++itr;
-        gst_object_unref(erase->first);
-        gst_object_unref(erase->second);
-        _streamContext.elementMap.erase(erase);
+    for (size_t i = 0; i < _contexts.size(); i++) {
+        _contexts[i]->clients.clear();
     }
     g_main_loop_unref(_loop);
+    gst_object_unref(_clock);
 }
 
 } // namespace BoulderAI
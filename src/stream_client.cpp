@@ -0,0 +1,207 @@
+#include <iostream>
+#include <boost/bind.hpp>
+
+#include "stream_client.hpp"
+#include "trace.hpp"
+
+namespace BoulderAI
+{
+
+StreamClient::StreamClient(GstElement *appsrc, GstElement *media_element, const int id,
+                           const size_t max_frames, const size_t max_bytes) :
+    _appsrc(appsrc),
+    _media_element(media_element),
+    _id(id),
+    _max_frames(max_frames),
+    _max_bytes(max_bytes),
+    _need_data_handler(0),
+    _enough_data_handler(0),
+    _queue_bytes(0),
+    _pushed_frames(0),
+    _pushed_bytes(0),
+    _dropped_frames(0),
+    _need_data(true),
+    _discont(true),
+    _alive(true),
+    _running(false)
+{
+    // let the appsrc tell us when its own queue is full, rather than letting it grow without bound
+    g_object_set(G_OBJECT(_appsrc), "max-bytes", (guint64)_max_bytes, "block", FALSE, NULL);
+    _need_data_handler = g_signal_connect(_appsrc, "need-data", G_CALLBACK(need_data), this);
+    _enough_data_handler = g_signal_connect(_appsrc, "enough-data", G_CALLBACK(enough_data), this);
+}
+
+StreamClient::~StreamClient()
+{
+    stop();
+    g_signal_handler_disconnect(_appsrc, _need_data_handler);
+    g_signal_handler_disconnect(_appsrc, _enough_data_handler);
+    clear_queue();
+    gst_object_unref(_appsrc);
+    gst_object_unref(_media_element);
+}
+
+void StreamClient::start()
+{
+    ScopedLock lock(_mtex);
+    if (_thread_ptr.get())
+    {
+        return;
+    }
+
+    _running = true;
+    _thread_ptr.reset(new boost::thread(boost::bind(&StreamClient::run, this)));
+}
+
+void StreamClient::stop()
+{
+    {
+        ScopedLock lock(_mtex);
+        _running = false;
+        _condition.notify_all();
+    }
+
+    if (!_thread_ptr.get())
+    {
+        return;
+    }
+    _thread_ptr->join();
+    _thread_ptr.reset();
+}
+
+void StreamClient::enqueue(GstBuffer *buffer)
+{
+    const size_t size = gst_buffer_get_size(buffer);
+
+    ScopedLock lock(_mtex);
+    if (!_alive)
+    {
+        return;
+    }
+
+    // leaky queue: make room by dropping the oldest frames
+    while (!_queue.empty() && (_queue.size() >= _max_frames || _queue_bytes + size > _max_bytes))
+    {
+        GstBuffer *oldest = _queue.front();
+        _queue.pop_front();
+        _queue_bytes -= gst_buffer_get_size(oldest);
+        gst_buffer_unref(oldest);
+        _dropped_frames++;
+        _discont = true;
+    }
+
+    _queue.push_back(gst_buffer_ref(buffer));
+    _queue_bytes += size;
+    _condition.notify_one();
+}
+
+bool StreamClient::is_alive()
+{
+    ScopedLock lock(_mtex);
+    return _alive;
+}
+
+StreamClientStats StreamClient::get_stats()
+{
+    ScopedLock lock(_mtex);
+    StreamClientStats stats;
+    stats.id = _id;
+    stats.queue_depth = _queue.size();
+    stats.queue_bytes = _queue_bytes;
+    stats.pushed_frames = _pushed_frames;
+    stats.pushed_bytes = _pushed_bytes;
+    stats.dropped_frames = _dropped_frames;
+    stats.need_data = _need_data;
+    return stats;
+}
+
+void StreamClient::run()
+{
+    ScopedLock lock(_mtex);
+    while (_running)
+    {
+        if (_queue.empty() || !_need_data)
+        {
+            _condition.wait(lock);
+            continue;
+        }
+
+        GstBuffer *buffer = _queue.front();
+        _queue.pop_front();
+        _queue_bytes -= gst_buffer_get_size(buffer);
+        lock.unlock();
+
+        /* The frame buffer is shared by every client, so stamp a shallow copy. Its PTS is the
+         * capture time on the pipeline clock; frames captured before this client's pipeline
+         * started have no running time and are dropped. */
+        const GstClockTime base_time = gst_element_get_base_time(_appsrc);
+        if (GST_BUFFER_PTS(buffer) < base_time)
+        {
+            gst_buffer_unref(buffer);
+            lock.lock();
+            _dropped_frames++;
+            _discont = true;
+            continue;
+        }
+
+        GstBuffer *out = gst_buffer_copy(buffer);
+        gst_buffer_unref(buffer);
+        const size_t size = gst_buffer_get_size(out);
+        GST_BUFFER_PTS(out) -= base_time;
+
+        lock.lock();
+        if (_discont)
+        {
+            GST_BUFFER_FLAG_SET(out, GST_BUFFER_FLAG_DISCONT);
+            _discont = false;
+        }
+        lock.unlock();
+
+        GstFlowReturn ret;
+        {
+            // the buffer offset is the sensor frame number, see Stream::push_frame()
+            TraceSpan span("push", GST_BUFFER_OFFSET(out));
+            g_signal_emit_by_name(_appsrc, "push-buffer", out, &ret);
+        }
+        gst_buffer_unref(out);
+
+        lock.lock();
+        if (ret != GST_FLOW_OK)
+        {
+            std::cout << "Something went wrong while streaming to client " << _id
+                      << " (most likely client disconnected): " << ret << std::endl;
+            _alive = false;
+            break;
+        }
+        _pushed_frames++;
+        _pushed_bytes += size;
+    }
+}
+
+void StreamClient::clear_queue()
+{
+    ScopedLock lock(_mtex);
+    while (!_queue.empty())
+    {
+        gst_buffer_unref(_queue.front());
+        _queue.pop_front();
+    }
+    _queue_bytes = 0;
+}
+
+void StreamClient::need_data(GstElement *appsrc, guint length, gpointer user_data)
+{
+    StreamClient *client = (StreamClient *)user_data;
+    ScopedLock lock(client->_mtex);
+    client->_need_data = true;
+    client->_condition.notify_one();
+}
+
+void StreamClient::enough_data(GstElement *appsrc, gpointer user_data)
+{
+    StreamClient *client = (StreamClient *)user_data;
+    ScopedLock lock(client->_mtex);
+    client->_need_data = false;
+}
+
+} // namespace BoulderAI
@@ -0,0 +1,329 @@
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <time.h>
+#include <boost/bind.hpp>
+
+#include "telemetry.hpp"
+
+namespace BoulderAI
+{
+
+const char *Telemetry::OPT_MAX_RATE = "telemetry-max-rate";
+const char *Telemetry::OPT_INTERVAL_MS = "telemetry-interval-ms";
+
+const double Telemetry::DEFAULT_MAX_RATE = 4.0;
+const int Telemetry::DEFAULT_INTERVAL_MS = 1000;
+
+double Telemetry::_max_rate = DEFAULT_MAX_RATE;
+int Telemetry::_interval_ms = DEFAULT_INTERVAL_MS;
+
+// a comment is sent after this long without changes, to notice clients that went away
+static const int KEEPALIVE_S = 15;
+
+po::options_description Telemetry::GetOptions()
+{
+    po::options_description desc( "Telemetry Options" );
+    desc.add_options()
+        ( OPT_MAX_RATE, po::value<double>(&_max_rate)->default_value(DEFAULT_MAX_RATE),
+          "Maximum rate of telemetry events on /events, in events per second." )
+        ( OPT_INTERVAL_MS, po::value<int>(&_interval_ms)->default_value(DEFAULT_INTERVAL_MS),
+          "Interval in ms at which telemetry is sampled while clients are connected; settings changes are sent sooner." )
+        ;
+    return desc;
+}
+
+namespace
+{
+
+uint64_t monotonic_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+} // anonymous namespace
+
+Telemetry::Telemetry(const double max_rate, const int interval_ms) :
+    _rate(max_rate),
+    _interval(interval_ms > 0 ? interval_ms : DEFAULT_INTERVAL_MS),
+    _running(false),
+    _notified(false),
+    _clients(0),
+    _version(0)
+{
+}
+
+Telemetry::~Telemetry()
+{
+    stop();
+}
+
+void Telemetry::add_source(const TelemetrySource &source)
+{
+    ScopedLock lock(_mtex);
+    _sources.push_back(source);
+}
+
+void Telemetry::start()
+{
+    ScopedLock lock(_mtex);
+    if (_thread_ptr.get())
+    {
+        return;
+    }
+
+    _running = true;
+    _thread_ptr.reset(new boost::thread(boost::bind(&Telemetry::run, this)));
+}
+
+void Telemetry::stop()
+{
+    {
+        ScopedLock lock(_mtex);
+        _running = false;
+        _condition.notify_all();
+        _changed.notify_all();
+    }
+
+    if (!_thread_ptr.get())
+    {
+        return;
+    }
+    _thread_ptr->join();
+    _thread_ptr.reset();
+}
+
+void Telemetry::notify()
+{
+    ScopedLock lock(_mtex);
+    if (!_notified && _clients > 0)
+    {
+        _notified = true;
+        _condition.notify_all();
+    }
+}
+
+void Telemetry::register_handlers(HttpServer &server)
+{
+    server.add_handler("/events", boost::bind(&Telemetry::serve_events, this, _1, _2), true);
+}
+
+int Telemetry::get_client_count()
+{
+    ScopedLock lock(_mtex);
+    return _clients;
+}
+
+void Telemetry::run()
+{
+    const uint64_t min_gap_ms = _rate > 0 ? (uint64_t)(1000.0 / _rate) : 0;
+    uint64_t last_ms = 0;
+
+    ScopedLock lock(_mtex);
+    while (_running)
+    {
+        if (_clients == 0)
+        {
+            // nobody is listening, nothing to sample
+            _condition.wait(lock);
+            continue;
+        }
+
+        const uint64_t now_ms = monotonic_ms();
+        const uint64_t due_ms = last_ms + (_notified ? min_gap_ms : _interval);
+        if (last_ms != 0 && now_ms < due_ms)
+        {
+            _condition.timed_wait(lock, boost::posix_time::milliseconds(due_ms - now_ms));
+            continue;
+        }
+
+        _notified = false;
+        last_ms = now_ms;
+        lock.unlock();
+        sample();
+        lock.lock();
+    }
+}
+
+void Telemetry::sample()
+{
+    // the sources may take locks of their own, so they run without ours
+    std::vector < TelemetrySource > sources;
+    {
+        ScopedLock lock(_mtex);
+        sources = _sources;
+    }
+
+    TelemetryValues values;
+    for (size_t i = 0; i < sources.size(); i++)
+    {
+        try
+        {
+            sources[i](values);
+        }
+        catch (const std::exception &e)
+        {
+            std::cout << "Telemetry source failed: " << e.what() << std::endl;
+        }
+    }
+
+    ScopedLock lock(_mtex);
+    std::ostringstream clients;
+    clients << _clients;
+    values["clients.events"] = clients.str();
+
+    const uint64_t version = _version + 1;
+    bool changed = false;
+    for (TelemetryValues::const_iterator itr = values.begin(); itr != values.end(); ++itr)
+    {
+        std::map < std::string, Entry >::iterator entry = _values.find(itr->first);
+        if (entry == _values.end())
+        {
+            Entry e = { itr->second, version };
+            _values.insert(std::make_pair(itr->first, e));
+            changed = true;
+        }
+        else if (entry->second.value != itr->second)
+        {
+            entry->second.value = itr->second;
+            entry->second.version = version;
+            changed = true;
+        }
+    }
+
+    if (changed)
+    {
+        _version = version;
+        _changed.notify_all();
+    }
+}
+
+std::string Telemetry::get_changes(const uint64_t since)
+{
+    std::ostringstream oss;
+    oss << "{";
+    bool first = true;
+    for (std::map < std::string, Entry >::const_iterator itr = _values.begin(); itr != _values.end(); ++itr)
+    {
+        if (itr->second.version > since)
+        {
+            oss << (first ? "" : ",") << HttpServer::json_string(itr->first) << ":" << itr->second.value;
+            first = false;
+        }
+    }
+    oss << "}";
+    return oss.str();
+}
+
+bool Telemetry::serve_events(const HttpRequest &request, const int fd)
+{
+    uint64_t sent = 0;
+    std::map < std::string, std::string >::const_iterator last_id = request.headers.find("last-event-id");
+    if (last_id != request.headers.end())
+    {
+        sent = strtoull(last_id->second.c_str(), NULL, 10);
+    }
+
+    bool ok = HttpServer::send_headers(fd, 200, "text/event-stream", -1,
+                                       "Cache-Control: no-cache\r\nConnection: close\r\n");
+    if (ok)
+    {
+        // how long EventSource waits before reconnecting
+        static const char retry[] = "retry: 2000\n\n";
+        ok = HttpServer::send_all(fd, retry, sizeof(retry) - 1);
+    }
+
+    {
+        ScopedLock lock(_mtex);
+        _clients++;
+        if (sent > _version)
+        {
+            // an id from before a restart
+            sent = 0;
+        }
+        _notified = true;
+        _condition.notify_all();
+    }
+
+    while (ok)
+    {
+        std::string data;
+        uint64_t version;
+        {
+            ScopedLock lock(_mtex);
+            if (_running && _version == sent)
+            {
+                _changed.timed_wait(lock, boost::posix_time::seconds(KEEPALIVE_S));
+            }
+            if (!_running)
+            {
+                break;
+            }
+            version = _version;
+            if (version != sent)
+            {
+                data = get_changes(sent);
+            }
+        }
+
+        if (data.empty())
+        {
+            static const char keepalive[] = ": keepalive\n\n";
+            ok = HttpServer::is_connected(fd) && HttpServer::send_all(fd, keepalive, sizeof(keepalive) - 1);
+            continue;
+        }
+
+        std::ostringstream event;
+        event << "id: " << version << "\ndata: " << data << "\n\n";
+        const std::string text = event.str();
+        ok = HttpServer::send_all(fd, text.data(), text.size());
+        sent = version;
+    }
+
+    {
+        ScopedLock lock(_mtex);
+        _clients--;
+    }
+    return false;
+}
+
+std::vector < std::pair < std::string, double > > read_temperatures()
+{
+    // the TX2 thermal zones (BCPU, MCPU, GPU, PLL, Tboard, Tdiode, PMIC, thermal-fan-est)
+    std::vector < std::pair < std::string, double > > ret;
+    for (int zone = 0; ; zone++)
+    {
+        std::ostringstream base;
+        base << "/sys/class/thermal/thermal_zone" << zone << "/";
+        std::ifstream type_file((base.str() + "type").c_str());
+        std::ifstream temp_file((base.str() + "temp").c_str());
+        std::string type;
+        long millideg;
+        if (!(type_file >> type))
+        {
+            break;
+        }
+        if (temp_file >> millideg)
+        {
+            ret.push_back(std::make_pair(type, millideg / 1000.0));
+        }
+    }
+    return ret;
+}
+
+void sample_temperatures(TelemetryValues &values)
+{
+    const std::vector < std::pair < std::string, double > > temps = read_temperatures();
+    for (size_t i = 0; i < temps.size(); i++)
+    {
+        std::ostringstream oss;
+        oss << std::fixed << std::setprecision(1) << temps[i].second;
+        values["temps." + temps[i].first] = oss.str();
+    }
+}
+
+} // namespace BoulderAI
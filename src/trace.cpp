@@ -0,0 +1,266 @@
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <boost/scoped_array.hpp>
+#include <boost/thread/tss.hpp>
+
+#include "trace.hpp"
+#include "http_server.hpp"
+
+namespace BoulderAI
+{
+
+const char *Trace::OPT_ENABLE = "trace";
+const char *Trace::OPT_BUFFER_EVENTS = "trace-buffer-events";
+
+const bool Trace::DEFAULT_ENABLE = false;
+const int Trace::DEFAULT_BUFFER_EVENTS = 16384;
+
+bool Trace::_enable = DEFAULT_ENABLE;
+int Trace::_buffer_events = DEFAULT_BUFFER_EVENTS;
+
+std::atomic < bool > Trace::_enabled(false);
+boost::mutex Trace::_rings_mtex;
+std::vector < Trace::RingPtr > Trace::_rings;
+
+struct Trace::Ring
+{
+    int tid;
+    bool in_use;
+    size_t capacity;
+    boost::scoped_array < TraceEvent > events;
+    // number of events ever written; event i lives in events[i % capacity]
+    std::atomic < uint64_t > head;
+};
+
+po::options_description Trace::GetOptions()
+{
+    po::options_description desc( "Trace Options" );
+    desc.add_options()
+        ( OPT_ENABLE, po::value<bool>(&_enable)->default_value(DEFAULT_ENABLE),
+          "Record per frame timing spans from the start; see set_trace and get_trace." )
+        ( OPT_BUFFER_EVENTS, po::value<int>(&_buffer_events)->default_value(DEFAULT_BUFFER_EVENTS),
+          "Number of spans kept per thread." )
+        ;
+    return desc;
+}
+
+void Trace::set_enabled(const bool enabled)
+{
+    _enabled.store(enabled, std::memory_order_relaxed);
+}
+
+uint64_t Trace::now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void Trace::record(const char *name, const uint64_t start_ns, const uint64_t end_ns, const uint64_t frame)
+{
+    Ring *ring = get_ring();
+    const uint64_t head = ring->head.load(std::memory_order_relaxed);
+    TraceEvent &event = ring->events[head % ring->capacity];
+    event.name = name;
+    event.start_ns = start_ns;
+    event.duration_ns = end_ns - start_ns;
+    event.frame = frame;
+    // publishes the event to collect()
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+Trace::Ring *Trace::get_ring()
+{
+    // plain thread_local for the fast path; the thread_specific_ptr only hands the ring
+    // back to the pool when its thread exits
+    static thread_local Ring *cached_ring = NULL;
+    static boost::thread_specific_ptr < Ring > thread_ring(&Trace::release_ring);
+
+    if (cached_ring)
+    {
+        return cached_ring;
+    }
+
+    Ring *ring = NULL;
+    ScopedLock lock(_rings_mtex);
+    for (size_t i = 0; i < _rings.size() && !ring; i++)
+    {
+        if (!_rings[i]->in_use)
+        {
+            ring = _rings[i].get();
+        }
+    }
+    if (!ring)
+    {
+        RingPtr new_ring(new Ring());
+        new_ring->capacity = std::max(_buffer_events, 16);
+        new_ring->events.reset(new TraceEvent[new_ring->capacity]);
+        _rings.push_back(new_ring);
+        ring = new_ring.get();
+    }
+    ring->tid = syscall(SYS_gettid);
+    ring->in_use = true;
+    ring->head.store(0, std::memory_order_relaxed);
+    thread_ring.reset(ring);
+    cached_ring = ring;
+    return ring;
+}
+
+void Trace::release_ring(Ring *ring)
+{
+    ScopedLock lock(_rings_mtex);
+    ring->in_use = false;
+}
+
+std::vector < Trace::ThreadEvents > Trace::collect(const double seconds)
+{
+    const uint64_t now = now_ns();
+    const uint64_t span_ns = (uint64_t)(seconds * 1e9);
+    const uint64_t since_ns = now > span_ns ? now - span_ns : 0;
+
+    std::vector < ThreadEvents > ret;
+    ScopedLock lock(_rings_mtex);
+    for (size_t r = 0; r < _rings.size(); r++)
+    {
+        Ring &ring = *_rings[r];
+        const uint64_t head = ring.head.load(std::memory_order_acquire);
+        const uint64_t first = head > ring.capacity ? head - ring.capacity : 0;
+
+        ThreadEvents thread;
+        thread.tid = ring.tid;
+        for (uint64_t i = first; i < head; i++)
+        {
+            thread.events.push_back(ring.events[i % ring.capacity]);
+        }
+
+        // the owner kept writing meanwhile; drop whatever it may have overwritten
+        const uint64_t end = ring.head.load(std::memory_order_acquire);
+        const uint64_t valid = end > ring.capacity ? end - ring.capacity + 1 : 0;
+        if (valid > first)
+        {
+            thread.events.erase(thread.events.begin(),
+                                thread.events.begin() + std::min < uint64_t >(valid - first, thread.events.size()));
+        }
+
+        std::vector < TraceEvent > recent;
+        for (size_t i = 0; i < thread.events.size(); i++)
+        {
+            if (thread.events[i].start_ns >= since_ns)
+            {
+                recent.push_back(thread.events[i]);
+            }
+        }
+        thread.events.swap(recent);
+        if (!thread.events.empty())
+        {
+            ret.push_back(thread);
+        }
+    }
+    return ret;
+}
+
+std::string Trace::get_chrome_json(const double seconds)
+{
+    const std::vector < ThreadEvents > threads = collect(seconds);
+    const int pid = getpid();
+
+    std::ostringstream oss;
+    oss << std::fixed << std::setprecision(3);
+    oss << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    for (size_t t = 0; t < threads.size(); t++)
+    {
+        std::ostringstream comm_path;
+        comm_path << "/proc/self/task/" << threads[t].tid << "/comm";
+        std::ifstream comm_file(comm_path.str().c_str());
+        std::string comm;
+        if (!std::getline(comm_file, comm))
+        {
+            comm = "exited";
+        }
+        std::ostringstream thread_name;
+        thread_name << comm << " " << threads[t].tid;
+
+        oss << (first ? "" : ",")
+            << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":" << threads[t].tid
+            << ",\"args\":{\"name\":" << HttpServer::json_string(thread_name.str()) << "}}";
+        first = false;
+
+        for (size_t i = 0; i < threads[t].events.size(); i++)
+        {
+            const TraceEvent &event = threads[t].events[i];
+            oss << ",{\"name\":" << HttpServer::json_string(event.name) << ",\"ph\":\"X\""
+                << ",\"ts\":" << event.start_ns / 1e3 << ",\"dur\":" << event.duration_ns / 1e3
+                << ",\"pid\":" << pid << ",\"tid\":" << threads[t].tid
+                << ",\"args\":{\"frame\":" << event.frame << "}}";
+        }
+    }
+    oss << "]}";
+    return oss.str();
+}
+
+std::string Trace::get_summary(const double seconds)
+{
+    struct Stats
+    {
+        uint64_t count;
+        uint64_t total_ns;
+        uint64_t max_ns;
+    };
+    std::map < std::string, Stats > stats;
+
+    const std::vector < ThreadEvents > threads = collect(seconds);
+    for (size_t t = 0; t < threads.size(); t++)
+    {
+        for (size_t i = 0; i < threads[t].events.size(); i++)
+        {
+            const TraceEvent &event = threads[t].events[i];
+            std::map < std::string, Stats >::iterator itr = stats.find(event.name);
+            if (itr == stats.end())
+            {
+                Stats s = { 0, 0, 0 };
+                itr = stats.insert(std::make_pair(std::string(event.name), s)).first;
+            }
+            itr->second.count++;
+            itr->second.total_ns += event.duration_ns;
+            itr->second.max_ns = std::max(itr->second.max_ns, event.duration_ns);
+        }
+    }
+
+    std::ostringstream oss;
+    oss << std::fixed << std::setprecision(3);
+    for (std::map < std::string, Stats >::const_iterator itr = stats.begin(); itr != stats.end(); ++itr)
+    {
+        oss << itr->first << ": " << itr->second.count << " spans, mean "
+            << itr->second.total_ns / 1e6 / itr->second.count << " ms, max "
+            << itr->second.max_ns / 1e6 << " ms" << std::endl;
+    }
+    return oss.str();
+}
+
+uint64_t Trace::get_mean_ns(const std::string &name, const double seconds)
+{
+    uint64_t count = 0;
+    uint64_t total_ns = 0;
+    const std::vector < ThreadEvents > threads = collect(seconds);
+    for (size_t t = 0; t < threads.size(); t++)
+    {
+        for (size_t i = 0; i < threads[t].events.size(); i++)
+        {
+            if (name == threads[t].events[i].name)
+            {
+                count++;
+                total_ns += threads[t].events[i].duration_ns;
+            }
+        }
+    }
+    return count ? total_ns / count : 0;
+}
+
+} // namespace BoulderAI
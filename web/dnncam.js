@@ -310,6 +310,12 @@ var set_denoise_strength = function()
     get_config();
 }
 
+var capture = function()
+{
+    /* served by camerastreamer next to this page, on whatever --http-port it uses */
+    window.open('/snapshot.jpg', '_blank');
+}
+
 var refresh = function()
 {
     get_config();
@@ -317,6 +323,50 @@ var refresh = function()
     setTimeout("refresh();",3000);
 }
 
+/* live status pushed by camerastreamer on /events, one JSON object of changed values per event */
+var telemetry = {};
+
+var show_telemetry = function()
+{
+    var html = "<table>";
+    var names = Object.keys(telemetry).sort();
+    for (var i = 0; i < names.length; i++)
+    {
+        if (names[i].indexOf("settings.") == 0)
+            continue;
+        html += "<tr><td>" + names[i] + "</td><td>" + JSON.stringify(telemetry[names[i]]) + "</td></tr>";
+    }
+    document.getElementById("telemetry").innerHTML = html + "</table>";
+}
+
+var start = function()
+{
+    if (!window.EventSource)
+    {
+        refresh();
+        return;
+    }
+
+    get_config();
+    /* camerastreamer serves /events next to this page */
+    var events = new EventSource('/events');
+    events.onmessage = function(e)
+    {
+        var changes = JSON.parse(e.data);
+        var settings_changed = false;
+        for (var name in changes)
+        {
+            telemetry[name] = changes[name];
+            if (name.indexOf("settings.") == 0)
+                settings_changed = true;
+        }
+        /* the configuration table is only fetched again when a setting actually changed */
+        if (settings_changed)
+            get_config();
+        show_telemetry();
+    }
+}
+
 if (document.addEventListener) {
-  document.addEventListener("DOMContentLoaded", refresh, false);
+  document.addEventListener("DOMContentLoaded", start, false);
 }